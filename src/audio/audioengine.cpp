@@ -0,0 +1,643 @@
+#include "audio/audioengine.h"
+#include "audio/audiosink.h"
+#include "audio/dspchain.h"
+#include "audio/dspkernels.h"
+#include "audio/trackdecoder.h"
+#include "services/tagreader.h"
+#include <QDebug>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+
+using namespace MS;
+
+namespace {
+
+// Used when the file does not say; the decoder converts to it.
+constexpr int kDefaultRate = 44100;
+// Decoded frames queued for the sink, in floats (about 0.75 s at 44.1 kHz).
+// Each TrackDecoder buffers more behind it on the decoder thread.
+constexpr int kRingSamples = 1 << 16;
+// The next track is opened this long before the current one ends.
+constexpr qint64 kOpenNextMs = 10000;
+// Longest crossfade; the next track has to be open by the time it starts.
+constexpr int kMaxCrossfadeMs = 8000;
+// Frames of the fading track read ahead of the mix.
+constexpr int kFadeChunk = 4096;
+// The fade curves are exact every this many frames and linear in between.
+constexpr int kFadeSegment = 256;
+constexpr double kHalfPi = 1.57079632679489661923;
+// The feeder tops the ring up at least this often.
+constexpr int kFeedMs = 20;
+constexpr int kPollMs = 50;
+
+}
+
+// Lives on the decoder thread and owns the decoders; the only writer of the ring.
+class AudioEngine::Feeder : public QObject
+{
+public:
+    explicit Feeder(AudioEngine *engine)
+        : m_engine(engine), m_timer(new QTimer(this)), m_fadeBuffer(2 * kFadeChunk)
+    {
+        m_timer->setInterval(kFeedMs);
+        connect(m_timer, &QTimer::timeout, this, [this]() { fill(); });
+    }
+
+    // Replaces the current track with url from startFrame; play() drops the
+    // queued track too, a seek keeps it.
+    void start(quint64 serial, const QUrl &url, float gain, int rate, qint64 startFrame, bool keepNext)
+    {
+        endFade();
+        delete m_current;
+        m_current = nullptr;
+        if (!keepNext) {
+            delete m_next;
+            m_next = nullptr;
+            m_nextUrl.clear();
+        }
+        m_serial = serial;
+        m_rate = rate;
+        m_ended = false;
+        flush();
+        begin(url, gain, startFrame, false);
+        m_timer->start();
+        fill();
+    }
+
+    void setNext(const QUrl &url, float gain)
+    {
+        m_nextGain = gain;
+        if (url == m_nextUrl) return;
+        m_nextUrl = url;
+        delete m_next;
+        m_next = nullptr;
+        if (m_ended && !url.isEmpty()) {
+            // The queue ran out before this arrived; carry on where it ended
+            m_ended = false;
+            advance();
+            m_timer->start();
+        }
+        fill();
+    }
+
+    void stop()
+    {
+        m_timer->stop();
+        endFade();
+        delete m_current;
+        m_current = nullptr;
+        delete m_next;
+        m_next = nullptr;
+        m_nextUrl.clear();
+        m_ended = false;
+        m_engine->m_feeding.store(false);
+        flush();
+    }
+
+private:
+    void flush()
+    {
+        // Only the sink may move the read position: tell it where to skip to
+        m_engine->m_flushTo.store(m_engine->m_ring.writePosition() / 2, std::memory_order_release);
+        m_engine->m_transitionAt.store(-1, std::memory_order_release);
+    }
+
+    TrackDecoder *open(const QUrl &url, qint64 startFrame = 0)
+    {
+        GaplessInfo gapless;
+        TagReader::readGapless(url.toLocalFile(), gapless);
+        auto *decoder = new TrackDecoder(url, gapless, m_rate, startFrame, this);
+        // Queued: read() pulls, and a pull must not re-enter fill()
+        connect(decoder, &TrackDecoder::ready, this, [this]() { fill(); }, Qt::QueuedConnection);
+        return decoder;
+    }
+
+    void begin(const QUrl &url, float gain, qint64 startFrame, bool automatic)
+    {
+        m_current = m_next && automatic ? m_next : open(url, startFrame);
+        if (m_current == m_next) m_next = nullptr;
+        m_gain = gain;
+        m_engine->m_feeding.store(true);
+        Mark mark;
+        mark.written = m_engine->m_ring.writePosition() / 2;
+        mark.trackFrame = startFrame;
+        mark.lengthFrames = m_current->lengthFrames();
+        mark.url = url;
+        mark.gain = gain;
+        mark.automatic = automatic;
+        m_markAt = mark.written;
+        m_postedLength = mark.lengthFrames;
+        post([serial = m_serial, mark](AudioEngine *e) { e->onMark(serial, mark); });
+    }
+
+    bool advance()
+    {
+        // Only a fade longer than the track it led into is still running
+        endFade();
+        delete m_current;
+        m_current = nullptr;
+        const qint64 at = m_engine->m_ring.writePosition() / 2;
+        if (m_nextUrl.isEmpty()) {
+            m_ended = true;
+            m_timer->stop();
+            m_engine->m_feeding.store(false);
+            post([serial = m_serial, at](AudioEngine *e) { e->onEnded(serial, at); });
+            return false;
+        }
+        // Normally opened long ago; a short track may end before that
+        const QUrl url = m_nextUrl;
+        m_nextUrl.clear();
+        begin(url, m_nextGain, 0, true);
+        m_engine->m_transitionAt.store(at, std::memory_order_release);
+        return true;
+    }
+
+    void fill()
+    {
+        SpscRing<float> &ring = m_engine->m_ring;
+        while (m_current) {
+            if (m_current->atEnd()) {
+                if (!advance()) break;
+                continue;
+            }
+            int n = 0;
+            float *span = ring.writeSpan(n);
+            qint64 want = n / 2;
+            if (m_fading) {
+                want = qMin(want, fadeReady());
+            } else {
+                const qint64 toFade = framesToFade();
+                if (toFade == 0) {
+                    startFade();
+                    continue;
+                }
+                // Stop short of the fade, so that it starts on its frame
+                if (toFade > 0) want = qMin(want, toFade);
+            }
+            const int got = want > 0 ? m_current->read(span, int(want)) : 0;
+            if (got == 0) break;
+            // Levelled here, once per track, so that the join needs no ramp
+            if (m_fading) mixFade(span, got);
+            else if (m_gain != 1.0f) DspKernels::scale(span, got, m_gain);
+            ring.commitWrite(got * 2);
+        }
+        if (!m_current) return;
+        const qint64 length = m_current->lengthFrames();
+        if (length != m_postedLength) {
+            m_postedLength = length;
+            post([serial = m_serial, at = m_markAt, length](AudioEngine *e) { e->onLength(serial, at, length); });
+        }
+        const bool nearEnd = length >= 0 && length - m_current->position() <= kOpenNextMs * m_rate / 1000;
+        if (!m_next && !m_nextUrl.isEmpty() && (nearEnd || m_current->decodeFinished()))
+            m_next = open(m_nextUrl);
+    }
+
+    // Frames of the current track left before it starts to fade into the
+    // next one, or -1 if it will not.
+    qint64 framesToFade() const
+    {
+        const int ms = m_engine->m_crossfadeMs.load(std::memory_order_relaxed);
+        if (ms <= 0 || !m_next || m_nextUrl.isEmpty()) return -1;
+        const qint64 length = m_current->lengthFrames();
+        if (length < 0) return -1;
+        const qint64 frames = qint64(ms) * m_rate / 1000;
+        // A track this short would end before it had faded in
+        const qint64 nextLength = m_next->lengthFrames();
+        if (nextLength >= 0 && nextLength <= 2 * frames) return -1;
+        return qMax<qint64>(0, length - m_current->position() - frames);
+    }
+
+    void startFade()
+    {
+        const qint64 at = m_engine->m_ring.writePosition() / 2;
+        m_fading = m_current;
+        m_current = nullptr;
+        m_fadeGain = m_gain;
+        m_fadeFrames = qMax<qint64>(1, m_fading->lengthFrames() - m_fading->position());
+        m_fadeDone = 0;
+        m_fadeStart = m_fadeEnd = 0;
+        // The next track is heard from here on, under the end of this one
+        const QUrl url = m_nextUrl;
+        m_nextUrl.clear();
+        begin(url, m_nextGain, 0, true);
+        m_engine->m_transitionAt.store(at, std::memory_order_release);
+    }
+
+    void endFade()
+    {
+        delete m_fading;
+        m_fading = nullptr;
+    }
+
+    // Frames of the fading track ready to mix; its end, should it come
+    // early, is mixed as silence.
+    qint64 fadeReady()
+    {
+        if (m_fadeStart == m_fadeEnd) {
+            m_fadeStart = m_fadeEnd = 0;
+            float *buffer = m_fadeBuffer.data();
+            if (!m_fading->atEnd()) {
+                m_fadeEnd = m_fading->read(buffer, kFadeChunk);
+            } else {
+                std::fill(buffer, buffer + 2 * kFadeChunk, 0.0f);
+                m_fadeEnd = kFadeChunk;
+            }
+        }
+        return qMin<qint64>(m_fadeEnd - m_fadeStart, m_fadeFrames - m_fadeDone);
+    }
+
+    // Mixes the next count frames of the fading track under span, which
+    // fades in: sine and cosine, so that the power stays level.
+    void mixFade(float *span, int count)
+    {
+        const float *fading = m_fadeBuffer.constData() + 2 * m_fadeStart;
+        for (int done = 0; done < count;) {
+            const qint64 at = m_fadeDone + done;
+            const qint64 from = at / kFadeSegment * kFadeSegment;
+            const qint64 to = qMin(from + kFadeSegment, m_fadeFrames);
+            const int run = int(qMin<qint64>(count - done, to - at));
+            const double p0 = kHalfPi * from / m_fadeFrames;
+            const double p1 = kHalfPi * to / m_fadeFrames;
+            const double inStep = (std::sin(p1) - std::sin(p0)) / (to - from);
+            const double outStep = (std::cos(p1) - std::cos(p0)) / (to - from);
+            const double in = std::sin(p0) + inStep * (at - from);
+            const double out = std::cos(p0) + outStep * (at - from);
+            DspKernels::crossfade(span + 2 * done, fading + 2 * done, run, float(m_gain * in),
+                                  float(m_gain * inStep), float(m_fadeGain * out), float(m_fadeGain * outStep));
+            done += run;
+        }
+        m_fadeStart += count;
+        m_fadeDone += count;
+        if (m_fadeDone >= m_fadeFrames) endFade();
+    }
+
+    template<typename F>
+    void post(F f)
+    {
+        AudioEngine *engine = m_engine;
+        QMetaObject::invokeMethod(engine, [engine, f]() { f(engine); }, Qt::QueuedConnection);
+    }
+
+    AudioEngine *m_engine;
+    QTimer *m_timer;
+    TrackDecoder *m_current = nullptr;
+    TrackDecoder *m_next = nullptr;
+    TrackDecoder *m_fading = nullptr; // the previous track, under the start of the current one
+    QUrl m_nextUrl;
+    float m_gain = 1.0f;        // of the current track
+    float m_nextGain = 1.0f;
+    int m_rate = 0;
+    quint64 m_serial = 0;
+    bool m_ended = false;       // the queue ran out; setNext() may still extend it
+    qint64 m_markAt = 0;        // ring frame where the current track began
+    qint64 m_postedLength = -1;
+    float m_fadeGain = 1.0f;    // of the fading track
+    qint64 m_fadeFrames = 0;    // length of the fade in progress
+    qint64 m_fadeDone = 0;
+    QVector<float> m_fadeBuffer; // read from m_fading; m_fadeStart to m_fadeEnd not mixed yet
+    int m_fadeStart = 0;
+    int m_fadeEnd = 0;
+};
+
+AudioEngine::AudioEngine(QObject *parent)
+    : AudioEngine(new QtAudioSink, parent)
+{
+}
+
+AudioEngine::AudioEngine(AudioSink *sink, QObject *parent)
+    : QObject(parent)
+    , m_ring(kRingSamples)
+    , m_sink(sink)
+    , m_feeder(new Feeder(this))
+    , m_poll(new QTimer(this))
+{
+    qRegisterMetaType<MS::AudioEngine::State>();
+    for (auto &tap : m_taps) tap.store(nullptr);
+    for (auto &stage : m_stages) stage.store(nullptr);
+    m_decodeThread.setObjectName(QStringLiteral("AudioDecoder"));
+    m_feeder->moveToThread(&m_decodeThread);
+    m_decodeThread.start();
+    m_poll->setInterval(kPollMs);
+    connect(m_poll, &QTimer::timeout, this, &AudioEngine::poll);
+}
+
+AudioEngine::~AudioEngine()
+{
+    m_sink->close();
+    QMetaObject::invokeMethod(m_feeder, [this]() { m_feeder->stop(); }, Qt::BlockingQueuedConnection);
+    m_decodeThread.quit();
+    m_decodeThread.wait();
+    delete m_feeder;
+}
+
+QUrl AudioEngine::currentUrl() const
+{
+    return m_marks.isEmpty() ? QUrl() : m_marks.first().url;
+}
+
+qint64 AudioEngine::duration() const
+{
+    const int rate = sampleRate();
+    if (m_marks.isEmpty() || rate <= 0 || m_marks.first().lengthFrames < 0) return 0;
+    return m_marks.first().lengthFrames * 1000 / rate;
+}
+
+qint64 AudioEngine::heardFrame() const
+{
+    // What the sink took, less what still sits in the stages and the device ahead of it
+    const qint64 pending = m_sink->latencyFrames() + m_stageLatency.load(std::memory_order_relaxed)
+        - m_silentTail.load(std::memory_order_relaxed);
+    return m_readFrame.load(std::memory_order_acquire) - qMax<qint64>(0, pending);
+}
+
+qint64 AudioEngine::position() const
+{
+    const int rate = sampleRate();
+    if (m_marks.isEmpty() || rate <= 0) return 0;
+    const Mark &m = m_marks.first();
+    return (m.trackFrame + qMax<qint64>(0, heardFrame() - m.written)) * 1000 / rate;
+}
+
+void AudioEngine::play(const QUrl &url, float gain)
+{
+    if (!url.isLocalFile()) {
+        qWarning() << "AudioEngine: not a local file:" << url;
+        return;
+    }
+    // The sink runs at the first track's rate when the device takes it
+    GaplessInfo gapless;
+    TagReader::readGapless(url.toLocalFile(), gapless);
+    const int rate = m_sink->supportedRate(gapless.sampleRate > 0 ? gapless.sampleRate : kDefaultRate);
+    if (!m_sinkOpen || rate != sampleRate()) {
+        m_sink->close();
+        m_rate.store(rate);
+        prepareStages(rate);
+        m_sinkOpen = m_sink->open(rate, [this](float *out, int frames) { return render(out, frames); });
+        if (!m_sinkOpen) {
+            stop();
+            return;
+        }
+    }
+    m_sink->setPaused(false);
+
+    const quint64 serial = ++m_serial;
+    m_marks.clear();
+    m_endAt = -1;
+    m_nextUrl.clear();
+    m_nextGain = 1.0f;
+    QMetaObject::invokeMethod(m_feeder, [this, serial, url, gain, rate]() {
+        m_feeder->start(serial, url, gain, rate, 0, false);
+    }, Qt::QueuedConnection);
+    setState(PlayingState);
+    m_poll->start();
+    emit positionChanged(0);
+}
+
+void AudioEngine::setNext(const QUrl &url, float gain)
+{
+    if (url == m_nextUrl && gain == m_nextGain) return;
+    m_nextUrl = url;
+    m_nextGain = gain;
+    QMetaObject::invokeMethod(m_feeder, [this, url, gain]() { m_feeder->setNext(url, gain); }, Qt::QueuedConnection);
+}
+
+void AudioEngine::pause()
+{
+    if (m_state != PlayingState) return;
+    m_sink->setPaused(true);
+    setState(PausedState);
+}
+
+void AudioEngine::resume()
+{
+    if (m_state != PausedState) return;
+    m_sink->setPaused(false);
+    setState(PlayingState);
+}
+
+void AudioEngine::stop()
+{
+    ++m_serial;
+    QMetaObject::invokeMethod(m_feeder, [this]() { m_feeder->stop(); }, Qt::QueuedConnection);
+    m_sink->close();
+    m_sinkOpen = false;
+    m_poll->stop();
+    m_marks.clear();
+    m_nextUrl.clear();
+    m_nextGain = 1.0f;
+    m_endAt = -1;
+    setState(StoppedState);
+}
+
+void AudioEngine::seek(qint64 ms)
+{
+    if (m_marks.isEmpty()) return;
+    // QAudioDecoder cannot seek: decode again and drop up to the target
+    const int rate = sampleRate();
+    const qint64 frame = qMax<qint64>(0, ms) * rate / 1000;
+    const QUrl url = m_marks.first().url;
+    const float gain = m_marks.first().gain;
+    const quint64 serial = ++m_serial;
+    m_marks.clear();
+    m_endAt = -1;
+    QMetaObject::invokeMethod(m_feeder, [this, serial, url, gain, rate, frame]() {
+        m_feeder->start(serial, url, gain, rate, frame, true);
+    }, Qt::QueuedConnection);
+    emit positionChanged(ms);
+}
+
+void AudioEngine::setVolume(float linear)
+{
+    m_volume.store(qBound(0.0f, linear, 1.0f), std::memory_order_relaxed);
+}
+
+void AudioEngine::setCrossfade(int ms)
+{
+    m_crossfadeMs.store(qBound(0, ms, kMaxCrossfadeMs), std::memory_order_relaxed);
+}
+
+bool AudioEngine::addTap(PcmTap *tap)
+{
+    for (auto &slot : m_taps) {
+        PcmTap *empty = nullptr;
+        if (slot.compare_exchange_strong(empty, tap)) return true;
+    }
+    qWarning() << "AudioEngine: no room for another PCM tap";
+    return false;
+}
+
+void AudioEngine::removeTap(PcmTap *tap)
+{
+    for (auto &slot : m_taps) {
+        PcmTap *expected = tap;
+        slot.compare_exchange_strong(expected, nullptr);
+    }
+    // A render that already loaded the tap may still be inside it
+    while (m_rendering.load(std::memory_order_acquire)) QThread::yieldCurrentThread();
+}
+
+bool AudioEngine::addStage(DspStage *stage)
+{
+    // Not called before it is in a slot, so it can be prepared here
+    const int rate = sampleRate();
+    stage->prepare(rate > 0 ? rate : kDefaultRate);
+    for (auto &slot : m_stages) {
+        DspStage *empty = nullptr;
+        if (slot.compare_exchange_strong(empty, stage)) {
+            m_stageLatency.fetch_add(stage->latencyFrames());
+            return true;
+        }
+    }
+    qWarning() << "AudioEngine: no room for another DSP stage";
+    return false;
+}
+
+void AudioEngine::removeStage(DspStage *stage)
+{
+    for (auto &slot : m_stages) {
+        DspStage *expected = stage;
+        if (slot.compare_exchange_strong(expected, nullptr)) m_stageLatency.fetch_sub(stage->latencyFrames());
+    }
+    while (m_rendering.load(std::memory_order_acquire)) QThread::yieldCurrentThread();
+}
+
+void AudioEngine::prepareStages(int rate)
+{
+    // The sink is closed: nothing calls the stages now
+    int latency = 0;
+    for (auto &slot : m_stages) {
+        if (DspStage *stage = slot.load(std::memory_order_acquire)) {
+            stage->prepare(rate);
+            latency += stage->latencyFrames();
+        }
+    }
+    m_stageLatency.store(latency);
+}
+
+int AudioEngine::render(float *out, int frames)
+{
+    m_rendering.fetch_add(1, std::memory_order_acq_rel);
+    const qint64 flushTo = m_flushTo.load(std::memory_order_acquire) * 2;
+    if (m_ring.readPosition() < flushTo) {
+        m_ring.skipTo(flushTo);
+        // What the stages still hold belongs to what was flushed
+        for (auto &slot : m_stages)
+            if (DspStage *stage = slot.load(std::memory_order_acquire)) stage->reset();
+        m_stageHeld = 0;
+    }
+
+    const float volume = m_volume.load(std::memory_order_relaxed);
+    const int rate = m_rate.load(std::memory_order_relaxed);
+    int done = 0;
+    while (done < frames) {
+        int n = 0;
+        const float *span = m_ring.readSpan(n);
+        const int take = qMin(n / 2, frames - done);
+        if (take == 0) break;
+        for (auto &slot : m_taps)
+            if (PcmTap *tap = slot.load(std::memory_order_acquire)) tap->process(span, take, rate);
+        float *dst = out + 2 * done;
+        for (int i = 0; i < take * 2; ++i) dst[i] = span[i] * volume;
+        m_ring.commitRead(take * 2);
+        done += take;
+    }
+    // Silence goes through the stages for as long as they still hold audio,
+    // so what they delay comes out now: at the end of the queue it would be
+    // lost, and after an underrun it would only come out ahead of the next
+    // audio, late.
+    int processed = done;
+    if (done < frames && (done > 0 || m_stageHeld > 0)) {
+        std::fill(out + 2 * done, out + 2 * frames, 0.0f);
+        processed = frames;
+    }
+    int latency = 0;
+    for (auto &slot : m_stages) {
+        if (DspStage *stage = slot.load(std::memory_order_acquire)) {
+            if (processed > 0) stage->process(out, processed);
+            latency += stage->latencyFrames();
+        }
+    }
+    // A stage may change its latency as it goes (the limiter when bypassed)
+    m_stageLatency.store(latency, std::memory_order_relaxed);
+    if (done > 0) m_stageHeld = latency;
+    m_stageHeld = qMax(0, m_stageHeld - (processed - done));
+    const qint64 pos = m_ring.readPosition() / 2;
+    const int silent = frames - done;
+    m_silentTail.store(done > 0 ? silent : m_silentTail.load(std::memory_order_relaxed) + silent,
+                       std::memory_order_relaxed);
+    m_readFrame.store(pos, std::memory_order_release);
+
+    qint64 at = m_transitionAt.load(std::memory_order_acquire);
+    if (at >= 0 && pos > at) {
+        // The next track started: whatever silence came before it was the gap
+        m_gapResult.store(m_gapFrames, std::memory_order_release);
+        m_gapFrames = 0;
+        m_transitionAt.compare_exchange_strong(at, -1);
+    } else if (at >= 0 && pos == at) {
+        m_gapFrames += silent;
+    } else if (silent > 0 && m_feeding.load(std::memory_order_relaxed)) {
+        m_underruns.fetch_add(silent, std::memory_order_relaxed);
+    }
+    m_rendering.fetch_sub(1, std::memory_order_release);
+    return processed;
+}
+
+void AudioEngine::onMark(quint64 serial, const Mark &mark)
+{
+    if (serial != m_serial) return;
+    m_marks << mark;
+    if (mark.automatic) m_endAt = -1;
+    if (m_marks.size() == 1) {
+        // play() or seek(): heard as soon as the sink gets to it
+        emit durationChanged(duration());
+    } else if (mark.automatic && mark.url == m_nextUrl) {
+        // The feeder took it; a repeat of the same url has to be queued again
+        m_nextUrl.clear();
+    }
+}
+
+void AudioEngine::onLength(quint64 serial, qint64 written, qint64 lengthFrames)
+{
+    if (serial != m_serial) return;
+    for (Mark &m : m_marks)
+        if (m.written == written) m.lengthFrames = lengthFrames;
+    if (!m_marks.isEmpty() && m_marks.first().written == written) emit durationChanged(duration());
+}
+
+void AudioEngine::onEnded(quint64 serial, qint64 written)
+{
+    if (serial == m_serial) m_endAt = written;
+}
+
+void AudioEngine::poll()
+{
+    if (m_marks.isEmpty()) return;
+    const qint64 heard = heardFrame();
+    while (m_marks.size() > 1 && m_marks.at(1).written <= heard) {
+        m_marks.removeFirst();
+        if (m_marks.first().automatic) {
+            emit currentChanged(m_marks.first().url);
+            emit durationChanged(duration());
+        }
+    }
+    const qint64 gap = m_gapResult.exchange(-1, std::memory_order_acquire);
+    if (gap >= 0) {
+        m_lastGap = gap;
+        qInfo() << "AudioEngine: transition gap" << gap << "frames";
+        emit transitionMeasured(gap);
+    }
+    if (m_endAt >= 0 && m_marks.size() == 1 && heard >= m_endAt) {
+        stop();
+        emit endOfQueue();
+        return;
+    }
+    emit positionChanged(position());
+}
+
+void AudioEngine::setState(State state)
+{
+    if (state == m_state) return;
+    m_state = state;
+    emit stateChanged(state);
+}
@@ -0,0 +1,180 @@
+/*
+ * AudioEngine - gapless playback of a sequence of local files
+ *
+ * QMediaPlayer rebuilds its pipeline for every track, which leaves an
+ * audible gap between the tracks of a live album. The engine owns the whole
+ * pipeline instead:
+ *
+ *   decoder thread --> SpscRing --> AudioSink thread --> DspStages --> device
+ *                                        `--> PcmTaps
+ *
+ * On the decoder thread a Feeder takes frames from the current TrackDecoder
+ * and writes them straight into a lock-free ring; while a track plays, the
+ * next one (setNext) is opened and decodes ahead, so its first frame follows
+ * the last frame of the previous one in the ring. Every decoder converts to
+ * the rate the sink was opened with, so a change of rate between tracks
+ * does not reopen it. The sink runs its own clock and takes from the ring;
+ * nothing on that path locks or allocates, and a busy GUI thread cannot
+ * starve it.
+ *
+ * With a crossfade set, the next track starts that long before the current
+ * one ends and the feeder mixes the two, equal power, on their way into the
+ * ring. The stages (DspChain) run on the sink's thread on what it takes.
+ *
+ * Each automatic transition is measured: the frames the sink had to play
+ * silence for between the two tracks because the next one was not ready.
+ * Zero means the join was sample continuous.
+ */
+#ifndef MEDIASONIC_AUDIO_AUDIOENGINE_H
+#define MEDIASONIC_AUDIO_AUDIOENGINE_H
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QThread>
+#include <QUrl>
+#include <QVector>
+#include <atomic>
+#include "audio/spscring.h"
+
+class QTimer;
+
+namespace MS {
+
+class AudioSink;
+class DspStage;
+
+// Sees the engine's PCM on the sink's thread: interleaved stereo float as it
+// sits in the ring, after each track's gain and any crossfade and before
+// volume and the DspStages, with no copy in between. Must not block or
+// allocate; whatever it keeps it copies itself.
+class PcmTap
+{
+public:
+    virtual ~PcmTap() = default;
+    virtual void process(const float *frames, int count, int sampleRate) = 0;
+};
+
+class AudioEngine : public QObject
+{
+    Q_OBJECT
+public:
+    enum State { StoppedState, PlayingState, PausedState };
+
+    static constexpr int kMaxTaps = 4;
+    static constexpr int kMaxStages = 4;
+
+    // Plays through a QtAudioSink.
+    explicit AudioEngine(QObject *parent = nullptr);
+    // Plays through sink, which the engine takes over (a NullSink for tests).
+    explicit AudioEngine(AudioSink *sink, QObject *parent = nullptr);
+    ~AudioEngine() override;
+
+    // Plays url from its start, replacing whatever played before. gain is a
+    // linear factor for this track alone (its ReplayGain).
+    void play(const QUrl &url, float gain = 1.0f);
+    // The track to continue with once the current one ends, and its gain; an
+    // empty url ends playback there. Opened ahead of time, when the current
+    // track is close to its end.
+    void setNext(const QUrl &url, float gain = 1.0f);
+    void pause();
+    void resume();
+    void stop();
+    void seek(qint64 ms);
+    void setVolume(float linear);
+    // Overlap of consecutive tracks, 0 for none; up to 8 s. Applies from the
+    // next transition on, and never to a track shorter than two overlaps.
+    void setCrossfade(int ms);
+    int crossfade() const { return m_crossfadeMs.load(std::memory_order_relaxed); }
+
+    State state() const { return m_state; }
+    QUrl currentUrl() const;
+    qint64 position() const; // ms into the track being heard
+    qint64 duration() const;
+    int sampleRate() const { return m_rate.load(std::memory_order_relaxed); }
+    // Silent frames at the last automatic transition, -1 before the first.
+    qint64 lastTransitionGap() const { return m_lastGap; }
+    // Silent frames the sink played because decoding fell behind.
+    qint64 underrunFrames() const { return m_underruns.load(std::memory_order_relaxed); }
+    AudioSink *sink() const { return m_sink.data(); }
+
+    // At most kMaxTaps at a time. removeTap() returns once the tap is no
+    // longer called, so it may be destroyed right after.
+    bool addTap(PcmTap *tap);
+    void removeTap(PcmTap *tap);
+    // At most kMaxStages, run in the order they were added. addStage()
+    // prepares the stage for the sink's rate; removeStage() returns once it
+    // is no longer called.
+    bool addStage(DspStage *stage);
+    void removeStage(DspStage *stage);
+
+signals:
+    // The track being heard changed on its own, to the url given to setNext().
+    void currentChanged(const QUrl &url);
+    void positionChanged(qint64 ms);
+    void durationChanged(qint64 ms);
+    void stateChanged(MS::AudioEngine::State state);
+    void transitionMeasured(qint64 gapFrames);
+    // The last track ended and nothing was queued after it.
+    void endOfQueue();
+
+private:
+    class Feeder;
+
+    // Where in the ring a track (or a seek into one) begins.
+    struct Mark
+    {
+        qint64 written = 0;    // ring frame of its first frame
+        qint64 trackFrame = 0; // frame of the track there
+        qint64 lengthFrames = -1;
+        QUrl url;
+        float gain = 1.0f;
+        bool automatic = false; // reached by a transition
+    };
+
+    int render(float *out, int frames);
+    qint64 heardFrame() const;
+    void onMark(quint64 serial, const Mark &mark);
+    void onLength(quint64 serial, qint64 written, qint64 lengthFrames);
+    void onEnded(quint64 serial, qint64 written);
+    void poll();
+    void setState(State state);
+    void prepareStages(int rate);
+
+    // Shared with the decoder and sink threads
+    SpscRing<float> m_ring;
+    std::atomic<qint64> m_flushTo{0};      // ring frame the sink skips ahead to
+    std::atomic<qint64> m_readFrame{0};    // ring frame the sink took up to
+    std::atomic<qint64> m_silentTail{0};   // silence the sink played since then
+    std::atomic<qint64> m_transitionAt{-1};// ring frame of a pending automatic transition
+    std::atomic<qint64> m_gapResult{-1};   // measured by the sink, picked up by poll()
+    std::atomic<qint64> m_underruns{0};
+    std::atomic<bool> m_feeding{false};    // a track is decoding
+    std::atomic<float> m_volume{1.0f};
+    std::atomic<int> m_rate{0};
+    std::atomic<PcmTap *> m_taps[kMaxTaps];
+    std::atomic<DspStage *> m_stages[kMaxStages];
+    std::atomic<int> m_stageLatency{0};    // frames, all stages together
+    std::atomic<int> m_crossfadeMs{0};
+    std::atomic<int> m_rendering{0};
+    qint64 m_gapFrames = 0;                // sink thread only
+    int m_stageHeld = 0;                   // sink thread only: frames of audio inside the stages
+
+    QScopedPointer<AudioSink> m_sink;
+    QThread m_decodeThread;
+    Feeder *m_feeder;
+    QTimer *m_poll;
+    bool m_sinkOpen = false;
+    State m_state = StoppedState;
+    quint64 m_serial = 0;      // bumped by play() and seek(); older marks are stale
+    QUrl m_nextUrl;
+    float m_nextGain = 1.0f;
+    QVector<Mark> m_marks;     // first is the track being heard
+    qint64 m_endAt = -1;       // ring frame where the queue ended
+    qint64 m_lastGap = -1;
+};
+
+}
+
+Q_DECLARE_METATYPE(MS::AudioEngine::State)
+
+#endif // MEDIASONIC_AUDIO_AUDIOENGINE_H
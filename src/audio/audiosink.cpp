@@ -0,0 +1,190 @@
+#include "audio/audiosink.h"
+#include <QAudioDeviceInfo>
+#include <QAudioOutput>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QIODevice>
+
+using namespace MS;
+
+namespace {
+
+constexpr int kBytesPerFrame = 2 * int(sizeof(qint16));
+// Device buffer: what plays on while the engine is descheduled.
+constexpr int kSinkBufferMs = 100;
+// How often the null sink's clock ticks in real time.
+constexpr int kNullTickMs = 10;
+
+QAudioFormat pcmFormat(int sampleRate)
+{
+    QAudioFormat format;
+    format.setCodec(QStringLiteral("audio/pcm"));
+    format.setSampleRate(sampleRate);
+    format.setChannelCount(2);
+    format.setSampleSize(16);
+    format.setSampleType(QAudioFormat::SignedInt);
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    return format;
+}
+
+}
+
+// QAudioOutput pulls from it on the sink's thread.
+class QtAudioSink::Device : public QIODevice
+{
+public:
+    Device(const Render &render, int maxFrames, QAudioOutput *output, std::atomic<int> &latency)
+        : m_render(render), m_scratch(maxFrames * 2), m_output(output), m_latency(latency) {}
+    bool isSequential() const override { return true; }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override
+    {
+        // The scratch buffer was sized for the device buffer; never grow it here
+        const int frames = int(qMin<qint64>(maxlen / kBytesPerFrame, m_scratch.size() / 2));
+        float *mix = m_scratch.data();
+        const int got = m_render(mix, frames);
+        std::fill(mix + 2 * got, mix + 2 * frames, 0.0f);
+        qint16 *out = reinterpret_cast<qint16 *>(data);
+        for (int i = 0; i < frames * 2; ++i)
+            out[i] = qint16(qBound(-1.0f, mix[i], 32767.0f / 32768.0f) * 32768.0f);
+        const int queued = m_output->bufferSize() - m_output->bytesFree();
+        m_latency.store(qMax(0, queued) / kBytesPerFrame + frames, std::memory_order_relaxed);
+        return qint64(frames) * kBytesPerFrame;
+    }
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    Render m_render;
+    QVector<float> m_scratch;
+    QAudioOutput *m_output;
+    std::atomic<int> &m_latency;
+};
+
+QtAudioSink::QtAudioSink()
+{
+    m_thread.setObjectName(QStringLiteral("AudioSink"));
+    m_context.moveToThread(&m_thread);
+    m_thread.start(QThread::TimeCriticalPriority);
+}
+
+QtAudioSink::~QtAudioSink()
+{
+    close();
+    m_thread.quit();
+    m_thread.wait();
+}
+
+int QtAudioSink::supportedRate(int sampleRate) const
+{
+    const QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+    return device.isFormatSupported(pcmFormat(sampleRate)) ? sampleRate : device.preferredFormat().sampleRate();
+}
+
+bool QtAudioSink::open(int sampleRate, const Render &render)
+{
+    close();
+    bool ok = false;
+    QMetaObject::invokeMethod(&m_context, [&]() {
+        const QAudioFormat format = pcmFormat(sampleRate);
+        const int bufferBytes = sampleRate * kBytesPerFrame * kSinkBufferMs / 1000;
+        m_output = new QAudioOutput(QAudioDeviceInfo::defaultOutputDevice(), format);
+        m_output->setBufferSize(bufferBytes);
+        m_device = new Device(render, bufferBytes / kBytesPerFrame, m_output, m_latency);
+        m_device->open(QIODevice::ReadOnly);
+        m_output->start(m_device);
+        ok = m_output->error() == QAudio::NoError;
+        if (!ok) qWarning() << "AudioSink: could not open output:" << m_output->error();
+    }, Qt::BlockingQueuedConnection);
+    if (!ok) close();
+    return ok;
+}
+
+void QtAudioSink::close()
+{
+    if (!m_output) return;
+    QMetaObject::invokeMethod(&m_context, [this]() {
+        m_output->stop();
+        delete m_output;
+        m_output = nullptr;
+        delete m_device;
+        m_device = nullptr;
+    }, Qt::BlockingQueuedConnection);
+    m_latency.store(0);
+}
+
+void QtAudioSink::setPaused(bool paused)
+{
+    if (!m_output) return;
+    QMetaObject::invokeMethod(&m_context, [this, paused]() {
+        if (paused) m_output->suspend();
+        else m_output->resume();
+    }, Qt::BlockingQueuedConnection);
+}
+
+NullSink::NullSink(bool realTime)
+    : m_realTime(realTime)
+{
+}
+
+NullSink::~NullSink()
+{
+    close();
+}
+
+bool NullSink::open(int sampleRate, const Render &render)
+{
+    close();
+    m_render = render;
+    m_rate = sampleRate;
+    m_scratch.resize(qMax(1, sampleRate * kNullTickMs / 1000) * 2 * 4);
+    if (!m_realTime) return true;
+
+    m_running.store(true);
+    m_thread = QThread::create([this]() {
+        QElapsedTimer clock;
+        clock.start();
+        qint64 due = 0;
+        while (m_running.load()) {
+            QThread::msleep(kNullTickMs);
+            const qint64 now = clock.nsecsElapsed() * m_rate / 1000000000;
+            if (m_paused.load()) {
+                due = now;
+                continue;
+            }
+            // Catch up in scratch-sized steps after an oversleep
+            while (due < now && m_running.load()) {
+                const int frames = int(qMin<qint64>(now - due, m_scratch.size() / 2));
+                pull(frames);
+                due += frames;
+            }
+        }
+    });
+    m_thread->setObjectName(QStringLiteral("NullSink"));
+    m_thread->start(QThread::TimeCriticalPriority);
+    return true;
+}
+
+void NullSink::close()
+{
+    if (m_thread) {
+        m_running.store(false);
+        m_thread->wait();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+    m_render = nullptr;
+}
+
+int NullSink::pull(int frames)
+{
+    if (!m_render) return 0;
+    int filled = 0;
+    while (frames > 0) {
+        const int n = qMin(frames, m_scratch.size() / 2);
+        filled += m_render(m_scratch.data(), n);
+        m_rendered.fetch_add(n);
+        frames -= n;
+    }
+    return filled;
+}
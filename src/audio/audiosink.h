@@ -0,0 +1,97 @@
+/*
+ * AudioSink - the end of the engine's pipeline
+ *
+ * A sink keeps its own clock on its own thread and asks the engine for every
+ * block of interleaved stereo float frames through the render callback.
+ * QtAudioSink plays through QAudioOutput; NullSink discards the audio,
+ * either in real time or only when pull() is called, so that the whole
+ * pipeline runs without a sound device.
+ */
+#ifndef MEDIASONIC_AUDIO_AUDIOSINK_H
+#define MEDIASONIC_AUDIO_AUDIOSINK_H
+
+#include <QObject>
+#include <QThread>
+#include <QVector>
+#include <atomic>
+#include <functional>
+
+class QAudioOutput;
+
+namespace MS {
+
+class AudioSink
+{
+public:
+    // Fills out with up to frames frames and returns how many; the sink
+    // plays silence for the rest. Called on the sink's thread; must not
+    // block or allocate.
+    using Render = std::function<int(float *out, int frames)>;
+
+    virtual ~AudioSink() = default;
+
+    // The rate the sink would open at when asked for sampleRate.
+    virtual int supportedRate(int sampleRate) const = 0;
+    virtual bool open(int sampleRate, const Render &render) = 0;
+    // Returns once render is no longer called.
+    virtual void close() = 0;
+    virtual void setPaused(bool paused) = 0;
+    // Frames rendered that have not been heard yet.
+    virtual int latencyFrames() const = 0;
+};
+
+class QtAudioSink : public AudioSink
+{
+public:
+    QtAudioSink();
+    ~QtAudioSink() override;
+
+    int supportedRate(int sampleRate) const override;
+    bool open(int sampleRate, const Render &render) override;
+    void close() override;
+    void setPaused(bool paused) override;
+    int latencyFrames() const override { return m_latency.load(std::memory_order_relaxed); }
+
+private:
+    class Device;
+
+    QThread m_thread;
+    QObject m_context; // lives on m_thread; the output is created and driven there
+    QAudioOutput *m_output = nullptr;
+    Device *m_device = nullptr;
+    std::atomic<int> m_latency{0};
+};
+
+class NullSink : public AudioSink
+{
+public:
+    // realTime: a thread pulls as fast as a sound card would. Otherwise
+    // nothing plays until pull() is called.
+    explicit NullSink(bool realTime = false);
+    ~NullSink() override;
+
+    int supportedRate(int sampleRate) const override { return sampleRate; }
+    bool open(int sampleRate, const Render &render) override;
+    void close() override;
+    void setPaused(bool paused) override { m_paused.store(paused); }
+    int latencyFrames() const override { return 0; }
+
+    // Renders frames and throws them away; returns how many were not
+    // silence. Only for a sink that is not real time.
+    int pull(int frames);
+    qint64 renderedFrames() const { return m_rendered.load(); }
+
+private:
+    const bool m_realTime;
+    Render m_render;
+    int m_rate = 0;
+    QVector<float> m_scratch;
+    QThread *m_thread = nullptr;
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_paused{false};
+    std::atomic<qint64> m_rendered{0};
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_AUDIOSINK_H
@@ -0,0 +1,298 @@
+#include "audio/dspchain.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace MS;
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// Bands closer to Nyquist than this fraction of the rate are pulled in.
+constexpr double kMaxFrequency = 0.45;
+// A band this close to 0 dB is left out of the chain.
+constexpr float kFlatDb = 0.01f;
+constexpr float kGraphicFrequencies[ParametricEq::kMaxBands] = { 32.0f, 64.0f, 125.0f, 250.0f, 500.0f,
+                                                                1000.0f, 2000.0f, 4000.0f, 8000.0f, 16000.0f };
+// An octave wide.
+constexpr float kGraphicQ = 1.41f;
+constexpr float kShelfQ = 0.707f;
+
+// How far the limiter looks ahead, and how fast it lets go again.
+constexpr int kLookaheadMs = 5;
+constexpr int kReleaseMs = 80;
+// The limiter works through a block in chunks of at most this many frames.
+constexpr int kChunkFrames = 1024;
+
+}
+
+ParametricEq::Settings ParametricEq::graphic(const float gainsDb[kMaxBands], float preampDb)
+{
+    Settings s;
+    s.bandCount = kMaxBands;
+    s.preampDb = preampDb;
+    for (int i = 0; i < kMaxBands; ++i) {
+        Band &band = s.bands[i];
+        band.type = i == 0 ? LowShelf : i == kMaxBands - 1 ? HighShelf : Peak;
+        band.frequency = kGraphicFrequencies[i];
+        band.gainDb = gainsDb[i];
+        band.q = band.type == Peak ? kGraphicQ : kShelfQ;
+    }
+    return s;
+}
+
+void ParametricEq::setSettings(const Settings &settings)
+{
+    m_requested = settings;
+    m_requested.bandCount = qBound(0, settings.bandCount, int(kMaxBands));
+    m_incoming.write(m_requested);
+}
+
+bool ParametricEq::isFlat() const
+{
+    if (std::fabs(m_requested.preampDb) >= kFlatDb) return false;
+    for (int i = 0; i < m_requested.bandCount; ++i)
+        if (std::fabs(m_requested.bands[i].gainDb) >= kFlatDb) return false;
+    return true;
+}
+
+void ParametricEq::prepare(int sampleRate)
+{
+    m_rate = sampleRate;
+    m_stale = true;
+    std::fill(m_states, m_states + kMaxBands, DspKernels::BiquadState());
+}
+
+void ParametricEq::reset()
+{
+    std::fill(m_states, m_states + kMaxBands, DspKernels::BiquadState());
+}
+
+void ParametricEq::process(float *frames, int count)
+{
+    if (m_incoming.update()) m_stale = true;
+    if (m_stale) design();
+    if (m_preamp != 1.0f) DspKernels::scale(frames, count, m_preamp);
+    if (m_sectionCount > 0) DspKernels::biquads(frames, count, m_sections, m_states, m_sectionCount);
+}
+
+void ParametricEq::design()
+{
+    // RBJ's cookbook filters; no allocation, so this runs on the sink's thread
+    m_stale = false;
+    const Settings &s = m_incoming.current();
+    const int before = m_sectionCount;
+    m_sectionCount = 0;
+    m_preamp = std::fabs(s.preampDb) < kFlatDb ? 1.0f : float(std::pow(10.0, s.preampDb / 20.0));
+    if (m_rate <= 0) return;
+    for (int i = 0; i < s.bandCount; ++i) {
+        const Band &band = s.bands[i];
+        if (std::fabs(band.gainDb) < kFlatDb) continue;
+        const double f = qBound(1.0, double(band.frequency), kMaxFrequency * m_rate);
+        const double a = std::pow(10.0, band.gainDb / 40.0);
+        const double w = 2.0 * kPi * f / m_rate;
+        const double cosw = std::cos(w);
+        const double alpha = std::sin(w) / (2.0 * qMax(0.05, double(band.q)));
+        const double root = 2.0 * std::sqrt(a) * alpha;
+        double b0, b1, b2, a0, a1, a2;
+        switch (band.type) {
+        case LowShelf:
+            b0 = a * ((a + 1.0) - (a - 1.0) * cosw + root);
+            b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosw);
+            b2 = a * ((a + 1.0) - (a - 1.0) * cosw - root);
+            a0 = (a + 1.0) + (a - 1.0) * cosw + root;
+            a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosw);
+            a2 = (a + 1.0) + (a - 1.0) * cosw - root;
+            break;
+        case HighShelf:
+            b0 = a * ((a + 1.0) + (a - 1.0) * cosw + root);
+            b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosw);
+            b2 = a * ((a + 1.0) + (a - 1.0) * cosw - root);
+            a0 = (a + 1.0) - (a - 1.0) * cosw + root;
+            a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosw);
+            a2 = (a + 1.0) - (a - 1.0) * cosw - root;
+            break;
+        case Peak:
+        default:
+            b0 = 1.0 + alpha * a;
+            b1 = -2.0 * cosw;
+            b2 = 1.0 - alpha * a;
+            a0 = 1.0 + alpha / a;
+            a1 = -2.0 * cosw;
+            a2 = 1.0 - alpha / a;
+            break;
+        }
+        DspKernels::Biquad &section = m_sections[m_sectionCount];
+        section.b0 = float(b0 / a0);
+        section.b1 = float(b1 / a0);
+        section.b2 = float(b2 / a0);
+        section.a1 = float(a1 / a0);
+        section.a2 = float(a2 / a0);
+        // Sections that keep their place keep their state, so a change of
+        // gain does not click; new ones start from rest.
+        if (m_sectionCount >= before) m_states[m_sectionCount] = DspKernels::BiquadState();
+        ++m_sectionCount;
+    }
+}
+
+void Limiter::setCeilingDb(float db)
+{
+    m_ceilingDb.store(qMin(0.0f, db), std::memory_order_relaxed);
+}
+
+void Limiter::prepare(int sampleRate)
+{
+    m_window = qMax(1, sampleRate * kLookaheadMs / 1000);
+    m_release = float(1.0 - std::exp(-1000.0 / (double(qMax(1, sampleRate)) * kReleaseMs)));
+    m_minGain.resize(m_window);
+    m_minFrame.resize(m_window);
+    m_boxRing.resize(m_window);
+    m_work.resize(2 * (m_window - 1 + kChunkFrames));
+    m_gains.resize(2 * kChunkFrames);
+    m_kept.resize(2 * (m_window - 1));
+    reset();
+}
+
+void Limiter::reset()
+{
+    // Nothing is delayed after a flush, so either way can be taken up now
+    m_limiting.store(!m_bypass.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_silentRun = 0;
+    resetGain();
+    std::fill(m_work.data(), m_work.data() + 2 * (m_window - 1), 0.0f);
+    std::fill(m_kept.begin(), m_kept.end(), 0.0f);
+}
+
+void Limiter::resetGain()
+{
+    m_minHead = 0;
+    m_minCount = 0;
+    m_frame = 0;
+    m_envelope = 1.0f;
+    std::fill(m_boxRing.data(), m_boxRing.data() + m_window, 1.0f);
+    m_boxPos = 0;
+    m_boxSum = m_window;
+}
+
+void Limiter::process(float *frames, int count)
+{
+    const bool bypass = m_bypass.load(std::memory_order_relaxed);
+    int fade = 0;
+    if (!m_limiting.load(std::memory_order_relaxed)) {
+        if (bypass) {
+            keep(frames, count);
+            return;
+        }
+        // The latest input refills the delay, its gains worked out on the
+        // way in; the output steps back by the delay, which latencyFrames()
+        // reports, and crossfades from the dry input to hide the seam.
+        resetGain();
+        std::fill(m_work.data(), m_work.data() + 2 * (m_window - 1), 0.0f);
+        for (int done = 0; done < m_window - 1; done += kChunkFrames)
+            processChunk(m_kept.data() + 2 * done, qMin(kChunkFrames, m_window - 1 - done));
+        fade = qMin(count, m_window - 1);
+        std::memcpy(m_kept.data(), frames, sizeof(float) * 2 * fade);
+        m_limiting.store(true, std::memory_order_relaxed);
+    }
+    // Silence at the end of the input, counted while waiting to step aside
+    int i = count;
+    while (bypass && i > 0 && frames[2 * i - 2] == 0.0f && frames[2 * i - 1] == 0.0f) --i;
+    m_silentRun = !bypass ? 0 : i == 0 ? m_silentRun + count : count - i;
+    for (int done = 0; done < count; done += kChunkFrames)
+        processChunk(frames + 2 * done, qMin(kChunkFrames, count - done));
+    if (fade) {
+        // The dry side was never limited, so it is clipped to the ceiling.
+        const float ceiling = float(std::pow(10.0, ceilingDb() / 20.0));
+        const float *dry = m_kept.data();
+        for (int j = 0; j < 2 * fade; ++j) {
+            const float from = qBound(-ceiling, dry[j], ceiling);
+            frames[j] = from + (frames[j] - from) * (float(j / 2) + 0.5f) / float(fade);
+        }
+    }
+    if (bypass && m_silentRun >= m_window - 1) {
+        // Only silence is left in the delay; skipping it loses nothing
+        resetGain();
+        m_silentRun = 0;
+        m_limiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+void Limiter::keep(const float *frames, int count)
+{
+    const int delay = m_window - 1;
+    float *work = m_kept.data();
+    if (count >= delay) {
+        std::memcpy(work, frames + 2 * (count - delay), sizeof(float) * 2 * delay);
+    } else {
+        std::memmove(work, work + 2 * count, sizeof(float) * 2 * (delay - count));
+        std::memcpy(work + 2 * (delay - count), frames, sizeof(float) * 2 * count);
+    }
+}
+
+void Limiter::processChunk(float *frames, int count)
+{
+    const int window = m_window;
+    const int delay = window - 1;
+    float *work = m_work.data();
+    float *gains = m_gains.data();
+    float *minGain = m_minGain.data();
+    qint64 *minFrame = m_minFrame.data();
+    float *box = m_boxRing.data();
+
+    // The gain each frame needs on its own, then for every frame the lowest
+    // of those over the window ahead of it, eased back up after a peak and
+    // averaged over the window, so that the gain is down by the time the
+    // peak comes out of the delay.
+    const float ceiling = float(std::pow(10.0, ceilingDb() / 20.0));
+    DspKernels::limitGains(frames, count, ceiling, gains);
+    // Kept in locals: the stores to the buffers could otherwise alias them
+    int head = m_minHead;
+    int held = m_minCount;
+    qint64 frame = m_frame;
+    float envelope = m_envelope;
+    int boxPos = m_boxPos;
+    double boxSum = m_boxSum;
+    const float release = m_release;
+    const double scale = 1.0 / window;
+    for (int i = 0; i < count; ++i, ++frame) {
+        const float want = gains[2 * i];
+        if (held && minFrame[head] <= frame - window) {
+            head = head + 1 == window ? 0 : head + 1;
+            --held;
+        }
+        int tail = head + held;
+        if (tail >= window) tail -= window;
+        while (held) {
+            const int last = tail == 0 ? window - 1 : tail - 1;
+            if (minGain[last] < want) break;
+            tail = last;
+            --held;
+        }
+        minGain[tail] = want;
+        minFrame[tail] = frame;
+        ++held;
+
+        const float lowest = minGain[head];
+        envelope = lowest < envelope ? lowest : envelope + (lowest - envelope) * release;
+        boxSum += envelope - box[boxPos];
+        box[boxPos] = envelope;
+        if (++boxPos == window) {
+            // Start the running sum afresh, before rounding can build up in it
+            boxPos = 0;
+            boxSum = 0.0;
+            for (int j = 0; j < window; ++j) boxSum += box[j];
+        }
+        gains[2 * i] = gains[2 * i + 1] = float(boxSum * scale);
+    }
+    m_minHead = head;
+    m_minCount = held;
+    m_frame = frame;
+    m_envelope = envelope;
+    m_boxPos = boxPos;
+    m_boxSum = boxSum;
+
+    std::memcpy(work + 2 * delay, frames, sizeof(float) * 2 * count);
+    std::memcpy(frames, work, sizeof(float) * 2 * count);
+    DspKernels::applyGains(frames, gains, count);
+    std::memmove(work, work + 2 * count, sizeof(float) * 2 * delay);
+}
@@ -0,0 +1,145 @@
+/*
+ * DspChain - processing stages between the ring and the device
+ *
+ * The engine runs its stages in order on every block the sink takes, in
+ * place, after volume. Stages are prepared for the sink's rate before they
+ * are first called, and again whenever it changes; that is the only place
+ * they may allocate. Their settings come from the GUI thread through a
+ * TripleBuffer and are taken up at the start of the next block.
+ *
+ *   ParametricEq  up to kMaxBands peaking and shelving biquads and a preamp
+ *   Limiter       lookahead peak limiter, so that a boost cannot clip; the
+ *                 player bypasses it while nothing boosts
+ *
+ * The crossfade between queue entries is not a stage: it needs two tracks
+ * at once and is mixed by the engine's feeder, before the ring.
+ */
+#ifndef MEDIASONIC_AUDIO_DSPCHAIN_H
+#define MEDIASONIC_AUDIO_DSPCHAIN_H
+
+#include <QVector>
+#include <atomic>
+#include "audio/dspkernels.h"
+#include "audio/triplebuffer.h"
+
+namespace MS {
+
+class DspStage
+{
+public:
+    virtual ~DspStage() = default;
+    virtual const char *name() const = 0;
+    // Off the sink's thread, while the stage is not being called.
+    virtual void prepare(int sampleRate) = 0;
+    // On the sink's thread: interleaved stereo float, in place. Must not
+    // block or allocate.
+    virtual void process(float *frames, int count) = 0;
+    // On the sink's thread: forget the audio before a flush (play, seek).
+    virtual void reset() {}
+    // How far behind its input the stage's output runs; it may change from
+    // one block to the next.
+    virtual int latencyFrames() const { return 0; }
+};
+
+class ParametricEq : public DspStage
+{
+public:
+    static constexpr int kMaxBands = 10;
+
+    enum BandType { Peak, LowShelf, HighShelf };
+    struct Band
+    {
+        BandType type = Peak;
+        float frequency = 1000.0f; // Hz; centre, or corner of a shelf
+        float gainDb = 0.0f;
+        float q = 1.0f;
+    };
+    struct Settings
+    {
+        Band bands[kMaxBands];
+        int bandCount = 0;
+        float preampDb = 0.0f;
+    };
+
+    // The ten bands of a graphic equalizer, 32 Hz to 16 kHz an octave apart,
+    // the outer two as shelves.
+    static Settings graphic(const float gainsDb[kMaxBands], float preampDb = 0.0f);
+
+    const char *name() const override { return "equalizer"; }
+    // GUI thread; bands beyond kMaxBands are dropped.
+    void setSettings(const Settings &settings);
+    const Settings &settings() const { return m_requested; }
+    // Passes audio through untouched while every band and the preamp are at 0 dB.
+    bool isFlat() const;
+
+    void prepare(int sampleRate) override;
+    void process(float *frames, int count) override;
+    void reset() override;
+
+private:
+    void design();
+
+    Settings m_requested;               // GUI thread
+    TripleBuffer<Settings> m_incoming;
+    int m_rate = 0;
+    bool m_stale = true;                // the sections do not match current()
+    DspKernels::Biquad m_sections[kMaxBands];
+    DspKernels::BiquadState m_states[kMaxBands];
+    int m_sectionCount = 0;
+    float m_preamp = 1.0f;
+};
+
+class Limiter : public DspStage
+{
+public:
+    const char *name() const override { return "limiter"; }
+    // Any thread; the level no sample leaves above, in dBFS.
+    void setCeilingDb(float db);
+    float ceilingDb() const { return m_ceilingDb.load(std::memory_order_relaxed); }
+    // Any thread: pass audio through untouched and undelayed. Going back to
+    // limiting happens at the next block, since a boost may be on its way,
+    // and crossfades into the delayed output;
+    // going to bypass waits for a flush or for the delayed audio to be
+    // silence, so that nothing in the delay is dropped.
+    void setBypassed(bool bypassed) { m_bypass.store(bypassed, std::memory_order_relaxed); }
+
+    void prepare(int sampleRate) override;
+    void process(float *frames, int count) override;
+    void reset() override;
+    int latencyFrames() const override { return m_limiting.load(std::memory_order_relaxed) ? m_window - 1 : 0; }
+
+private:
+    void processChunk(float *frames, int count);
+    void resetGain();
+    // While bypassed: keeps the latest input, for going back.
+    void keep(const float *frames, int count);
+
+    std::atomic<float> m_ceilingDb{-1.0f};
+    std::atomic<bool> m_bypass{false};    // as asked for
+    std::atomic<bool> m_limiting{true};   // as the sink's thread runs it
+    int m_silentRun = 0;      // input frames of silence up to the end of the last block
+    int m_window = 1;         // lookahead, in frames, of the gain ahead of the audio
+    float m_release = 1.0f;   // per-frame step of the recovery towards unity
+    // Sliding minimum of the wanted gains over the window, as a ring of
+    // ascending candidates: the gain and the frame it belongs to.
+    QVector<float> m_minGain;
+    QVector<qint64> m_minFrame;
+    int m_minHead = 0;
+    int m_minCount = 0;
+    qint64 m_frame = 0;
+    float m_envelope = 1.0f;
+    // Box average of the envelope over the window
+    QVector<float> m_boxRing;
+    int m_boxPos = 0;
+    double m_boxSum = 0.0;
+    // Delayed audio: the last m_window - 1 frames, then the chunk at hand
+    QVector<float> m_work;
+    QVector<float> m_gains;
+    // While bypassed, the last m_window - 1 frames of input; on going back,
+    // the dry start of the block to crossfade from
+    QVector<float> m_kept;
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_DSPCHAIN_H
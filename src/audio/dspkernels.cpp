@@ -0,0 +1,243 @@
+#include "audio/dspkernels.h"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace MS;
+
+namespace {
+
+#if defined(__SSE2__)
+// Sections in a pipeline, two to a register: section k has its left and
+// right in one half of register k / 2 and runs k frames behind the first,
+// on what section k - 1 produced the frame before. The sections of one
+// frame are then independent of each other and overlap in the CPU instead
+// of waiting on one another. While the pipeline fills and drains, the
+// sections that have no frame leave their state alone, so nothing is left
+// in flight between calls.
+template<int Pairs>
+void biquadPipeline(float *frames, int count, const DspKernels::Biquad *sections, DspKernels::BiquadState *states)
+{
+    constexpr int kSections = 2 * Pairs;
+    __m128 b0[Pairs], b1[Pairs], b2[Pairs], a1[Pairs], a2[Pairs], z1[Pairs], z2[Pairs], y[Pairs];
+    for (int j = 0; j < Pairs; ++j) {
+        const DspKernels::Biquad &p = sections[2 * j];
+        const DspKernels::Biquad &q = sections[2 * j + 1];
+        b0[j] = _mm_setr_ps(p.b0, p.b0, q.b0, q.b0);
+        b1[j] = _mm_setr_ps(p.b1, p.b1, q.b1, q.b1);
+        b2[j] = _mm_setr_ps(p.b2, p.b2, q.b2, q.b2);
+        a1[j] = _mm_setr_ps(p.a1, p.a1, q.a1, q.a1);
+        a2[j] = _mm_setr_ps(p.a2, p.a2, q.a2, q.a2);
+        const DspKernels::BiquadState &ps = states[2 * j];
+        const DspKernels::BiquadState &qs = states[2 * j + 1];
+        z1[j] = _mm_setr_ps(ps.z1[0], ps.z1[1], qs.z1[0], qs.z1[1]);
+        z2[j] = _mm_setr_ps(ps.z2[0], ps.z2[1], qs.z2[0], qs.z2[1]);
+        y[j] = _mm_setzero_ps();
+    }
+    const __m128 zero = _mm_setzero_ps();
+
+    // Inlined into each loop below, so that the pipeline stays in registers
+    auto step = [&](int t, auto edge) __attribute__((always_inline)) {
+        const __m128 x = t < count ? _mm_loadl_pi(zero, reinterpret_cast<const __m64 *>(frames + 2 * t)) : zero;
+        __m128 in[Pairs];
+        in[0] = _mm_movelh_ps(x, y[0]);
+#pragma GCC unroll 6
+        for (int j = 1; j < Pairs; ++j) in[j] = _mm_shuffle_ps(y[j - 1], y[j], _MM_SHUFFLE(1, 0, 3, 2));
+#pragma GCC unroll 6
+        for (int j = 0; j < Pairs; ++j) {
+            y[j] = _mm_add_ps(_mm_mul_ps(b0[j], in[j]), z1[j]);
+            __m128 n1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[j], in[j]), _mm_mul_ps(a1[j], y[j])), z2[j]);
+            __m128 n2 = _mm_sub_ps(_mm_mul_ps(b2[j], in[j]), _mm_mul_ps(a2[j], y[j]));
+            if (decltype(edge)::value) {
+                // Section k has frame t - k, if there is such a frame
+                const int k = 2 * j;
+                const bool lo = t - k >= 0 && t - k < count;
+                const bool hi = t - k - 1 >= 0 && t - k - 1 < count;
+                const __m128 keep = _mm_castsi128_ps(_mm_setr_epi32(-int(lo), -int(lo), -int(hi), -int(hi)));
+                n1 = _mm_or_ps(_mm_and_ps(keep, n1), _mm_andnot_ps(keep, z1[j]));
+                n2 = _mm_or_ps(_mm_and_ps(keep, n2), _mm_andnot_ps(keep, z2[j]));
+            }
+            z1[j] = n1;
+            z2[j] = n2;
+        }
+        if (t >= kSections - 1) _mm_storeh_pi(reinterpret_cast<__m64 *>(frames + 2 * (t - kSections + 1)), y[Pairs - 1]);
+    };
+
+    const int steps = count + kSections - 1;
+    int t = 0;
+    for (; t < std::min(kSections - 1, steps); ++t) step(t, std::true_type());
+    for (; t < count; ++t) step(t, std::false_type());
+    for (; t < steps; ++t) step(t, std::true_type());
+
+    for (int j = 0; j < Pairs; ++j) {
+        alignas(16) float v1[4], v2[4];
+        _mm_store_ps(v1, z1[j]);
+        _mm_store_ps(v2, z2[j]);
+        DspKernels::BiquadState &ps = states[2 * j];
+        DspKernels::BiquadState &qs = states[2 * j + 1];
+        ps.z1[0] = v1[0]; ps.z1[1] = v1[1]; qs.z1[0] = v1[2]; qs.z1[1] = v1[3];
+        ps.z2[0] = v2[0]; ps.z2[1] = v2[1]; qs.z2[0] = v2[2]; qs.z2[1] = v2[3];
+    }
+}
+#else
+void biquadScalar(float *frames, int count, const DspKernels::Biquad &c, DspKernels::BiquadState &state)
+{
+    for (int ch = 0; ch < 2; ++ch) {
+        float z1 = state.z1[ch];
+        float z2 = state.z2[ch];
+        for (int i = 0; i < count; ++i) {
+            const float x = frames[2 * i + ch];
+            const float y = c.b0 * x + z1;
+            z1 = c.b1 * x - c.a1 * y + z2;
+            z2 = c.b2 * x - c.a2 * y;
+            frames[2 * i + ch] = y;
+        }
+        state.z1[ch] = z1;
+        state.z2[ch] = z2;
+    }
+}
+#endif
+
+}
+
+const char *DspKernels::instructionSet()
+{
+#if defined(__AVX__)
+    return "AVX";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+void DspKernels::biquads(float *frames, int count, const Biquad *sections, BiquadState *states, int sectionCount)
+{
+    if (count <= 0) return;
+    int s = 0;
+#if defined(__SSE2__)
+    // The filters decay into denormals on silence; flush them to zero here.
+    const unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+    // The recursion runs frame by frame, so AVX has nothing wider to offer
+    // here. Up to kMaxPipeline sections go through in one pass; an odd one
+    // out is paired with a section that passes its input through.
+    constexpr int kMaxPipeline = 12;
+    for (; s < sectionCount;) {
+        const int n = std::min(kMaxPipeline, sectionCount - s);
+        Biquad group[kMaxPipeline];
+        BiquadState groupStates[kMaxPipeline];
+        std::copy(sections + s, sections + s + n, group);
+        std::copy(states + s, states + s + n, groupStates);
+        switch ((n + 1) / 2) {
+        case 1: biquadPipeline<1>(frames, count, group, groupStates); break;
+        case 2: biquadPipeline<2>(frames, count, group, groupStates); break;
+        case 3: biquadPipeline<3>(frames, count, group, groupStates); break;
+        case 4: biquadPipeline<4>(frames, count, group, groupStates); break;
+        case 5: biquadPipeline<5>(frames, count, group, groupStates); break;
+        default: biquadPipeline<6>(frames, count, group, groupStates); break;
+        }
+        std::copy(groupStates, groupStates + n, states + s);
+        s += n;
+    }
+    _mm_setcsr(csr);
+#else
+    for (; s < sectionCount; ++s) biquadScalar(frames, count, sections[s], states[s]);
+#endif
+}
+
+void DspKernels::crossfade(float *dst, const float *src, int count, float inGain, float inStep, float outGain,
+                           float outStep)
+{
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 lane = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+    const __m256 in0 = _mm256_set1_ps(inGain), inD = _mm256_set1_ps(inStep);
+    const __m256 out0 = _mm256_set1_ps(outGain), outD = _mm256_set1_ps(outStep);
+    for (; i + 4 <= count; i += 4) {
+        const __m256 t = _mm256_add_ps(_mm256_set1_ps(float(i)), lane);
+        const __m256 gin = _mm256_add_ps(in0, _mm256_mul_ps(inD, t));
+        const __m256 gout = _mm256_add_ps(out0, _mm256_mul_ps(outD, t));
+        const __m256 d = _mm256_loadu_ps(dst + 2 * i);
+        const __m256 s = _mm256_loadu_ps(src + 2 * i);
+        _mm256_storeu_ps(dst + 2 * i, _mm256_add_ps(_mm256_mul_ps(d, gin), _mm256_mul_ps(s, gout)));
+    }
+#elif defined(__SSE2__)
+    const __m128 lane = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    const __m128 in0 = _mm_set1_ps(inGain), inD = _mm_set1_ps(inStep);
+    const __m128 out0 = _mm_set1_ps(outGain), outD = _mm_set1_ps(outStep);
+    for (; i + 2 <= count; i += 2) {
+        const __m128 t = _mm_add_ps(_mm_set1_ps(float(i)), lane);
+        const __m128 gin = _mm_add_ps(in0, _mm_mul_ps(inD, t));
+        const __m128 gout = _mm_add_ps(out0, _mm_mul_ps(outD, t));
+        const __m128 d = _mm_loadu_ps(dst + 2 * i);
+        const __m128 s = _mm_loadu_ps(src + 2 * i);
+        _mm_storeu_ps(dst + 2 * i, _mm_add_ps(_mm_mul_ps(d, gin), _mm_mul_ps(s, gout)));
+    }
+#endif
+    for (; i < count; ++i) {
+        const float gin = inGain + inStep * i;
+        const float gout = outGain + outStep * i;
+        dst[2 * i] = dst[2 * i] * gin + src[2 * i] * gout;
+        dst[2 * i + 1] = dst[2 * i + 1] * gin + src[2 * i + 1] * gout;
+    }
+}
+
+void DspKernels::limitGains(const float *frames, int count, float ceiling, float *gains)
+{
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 c = _mm256_set1_ps(ceiling);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+    for (; i + 4 <= count; i += 4) {
+        const __m256 v = _mm256_and_ps(absMask, _mm256_loadu_ps(frames + 2 * i));
+        const __m256 peak = _mm256_max_ps(v, _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm256_storeu_ps(gains + 2 * i, _mm256_div_ps(c, _mm256_max_ps(peak, c)));
+    }
+#elif defined(__SSE2__)
+    const __m128 c = _mm_set1_ps(ceiling);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    for (; i + 2 <= count; i += 2) {
+        const __m128 v = _mm_and_ps(absMask, _mm_loadu_ps(frames + 2 * i));
+        const __m128 peak = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(gains + 2 * i, _mm_div_ps(c, _mm_max_ps(peak, c)));
+    }
+#endif
+    for (; i < count; ++i) {
+        const float peak = std::max(std::fabs(frames[2 * i]), std::fabs(frames[2 * i + 1]));
+        gains[2 * i] = gains[2 * i + 1] = ceiling / std::max(peak, ceiling);
+    }
+}
+
+void DspKernels::applyGains(float *frames, const float *gains, int count)
+{
+    const int samples = 2 * count;
+    int i = 0;
+#if defined(__AVX__)
+    for (; i + 8 <= samples; i += 8)
+        _mm256_storeu_ps(frames + i, _mm256_mul_ps(_mm256_loadu_ps(frames + i), _mm256_loadu_ps(gains + i)));
+#elif defined(__SSE2__)
+    for (; i + 4 <= samples; i += 4)
+        _mm_storeu_ps(frames + i, _mm_mul_ps(_mm_loadu_ps(frames + i), _mm_loadu_ps(gains + i)));
+#endif
+    for (; i < samples; ++i) frames[i] *= gains[i];
+}
+
+void DspKernels::scale(float *frames, int count, float gain)
+{
+    const int samples = 2 * count;
+    int i = 0;
+#if defined(__AVX__)
+    const __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= samples; i += 8) _mm256_storeu_ps(frames + i, _mm256_mul_ps(_mm256_loadu_ps(frames + i), g));
+#elif defined(__SSE2__)
+    const __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= samples; i += 4) _mm_storeu_ps(frames + i, _mm_mul_ps(_mm_loadu_ps(frames + i), g));
+#endif
+    for (; i < samples; ++i) frames[i] *= gain;
+}
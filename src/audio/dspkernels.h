@@ -0,0 +1,53 @@
+/*
+ * DspKernels - the inner loops of the engine's processing
+ *
+ * Every kernel works in place on interleaved stereo float frames and has an
+ * SSE2 and a plain C++ body, and all but the biquads an AVX one as well; the
+ * widest the target allows is compiled in (MS_NATIVE_SIMD builds for the
+ * host CPU, AVX included where it has it). None of them allocates, locks or
+ * calls into the system, so they may run on the sink's thread.
+ */
+#ifndef MEDIASONIC_AUDIO_DSPKERNELS_H
+#define MEDIASONIC_AUDIO_DSPKERNELS_H
+
+namespace MS {
+
+class DspKernels
+{
+public:
+    // One second-order section, a0 normalised to 1.
+    struct Biquad
+    {
+        float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    };
+
+    // Transposed direct form II state of one section, left and right.
+    struct BiquadState
+    {
+        float z1[2] = { 0.0f, 0.0f };
+        float z2[2] = { 0.0f, 0.0f };
+    };
+
+    // "AVX", "SSE2" or "scalar".
+    static const char *instructionSet();
+
+    // Runs frames through sectionCount sections in series. With SSE they
+    // run as a pipeline, two sections to a register, each a frame behind
+    // the one before.
+    static void biquads(float *frames, int count, const Biquad *sections, BiquadState *states, int sectionCount);
+    // dst = dst * in + src * out, where the two gains start at inGain and
+    // outGain and move by inStep and outStep every frame.
+    static void crossfade(float *dst, const float *src, int count, float inGain, float inStep, float outGain,
+                          float outStep);
+    // For every frame the gain that brings its larger channel down to
+    // ceiling, or 1; written to both samples of the frame in gains.
+    static void limitGains(const float *frames, int count, float ceiling, float *gains);
+    // Multiplies every sample by its entry in gains.
+    static void applyGains(float *frames, const float *gains, int count);
+    // Multiplies every sample by gain.
+    static void scale(float *frames, int count, float gain);
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_DSPKERNELS_H
@@ -0,0 +1,204 @@
+#include "audio/loudness.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace MS;
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+// BS.1770: block loudness is -0.691 + 10 log10(mean square).
+constexpr double kLoudnessOffset = -0.691;
+constexpr double kAbsoluteGateLufs = -70.0;
+constexpr double kRelativeGateLu = -10.0;
+
+double energyOf(double lufs)
+{
+    return std::pow(10.0, (lufs - kLoudnessOffset) / 10.0);
+}
+
+}
+
+LoudnessMeter::LoudnessMeter(int sampleRate)
+    : m_rate(qMax(1, sampleRate))
+    , m_subBlockFrames(qMax(1, (m_rate + 5) / 10))
+{
+    // Pre-filter and RLB weighting of BS.1770, recomputed for the rate at
+    // hand from their analogue prototypes.
+    double k = std::tan(kPi * 1681.974450955533 / m_rate);
+    double q = 0.7071752369554196;
+    const double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    m_shelf = { (vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+    k = std::tan(kPi * 38.13547087602444 / m_rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    m_highPass = { 1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0 };
+
+    // Blackman-windowed sinc cut off at the input's Nyquist frequency; every
+    // phase is normalised to unity gain at DC, so full scale stays 1.0.
+    const int phases = m_rate < 96000 ? 4 : m_rate < 192000 ? 2 : 1;
+    if (phases == 1) {
+        m_taps[kTapsPerPhase - 1][0] = 1.0f;
+        return;
+    }
+    const int length = kTapsPerPhase * phases;
+    for (int p = 0; p < phases; ++p) {
+        double h[kTapsPerPhase];
+        double sum = 0.0;
+        for (int i = 0; i < kTapsPerPhase; ++i) {
+            const int n = p + i * phases;
+            const double t = (n - (length - 1) / 2.0) / phases;
+            const double sinc = t == 0.0 ? 1.0 : std::sin(kPi * t) / (kPi * t);
+            const double w = 0.42 - 0.5 * std::cos(2.0 * kPi * n / (length - 1))
+                + 0.08 * std::cos(4.0 * kPi * n / (length - 1));
+            h[i] = sinc * w;
+            sum += h[i];
+        }
+        // Tap i applies to the input i frames back; the history runs oldest first.
+        for (int i = 0; i < kTapsPerPhase; ++i) m_taps[kTapsPerPhase - 1 - i][p] = float(h[i] / sum);
+    }
+}
+
+void LoudnessMeter::process(const float *frames, int count)
+{
+    int pos = m_historyPos;
+    float *left = m_history[0];
+    float *right = m_history[1];
+#if defined(__SSE2__)
+    // The filters decay into denormals on silence; flush them to zero here.
+    const unsigned int csr = _mm_getcsr();
+    _mm_setcsr(csr | 0x8040);
+
+    const __m128d sb0 = _mm_set1_pd(m_shelf.b0), sb1 = _mm_set1_pd(m_shelf.b1), sb2 = _mm_set1_pd(m_shelf.b2);
+    const __m128d sa1 = _mm_set1_pd(m_shelf.a1), sa2 = _mm_set1_pd(m_shelf.a2);
+    const __m128d hb1 = _mm_set1_pd(m_highPass.b1);
+    const __m128d ha1 = _mm_set1_pd(m_highPass.a1), ha2 = _mm_set1_pd(m_highPass.a2);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128d s1 = _mm_loadu_pd(m_state[0]), s2 = _mm_loadu_pd(m_state[1]);
+    __m128d h1 = _mm_loadu_pd(m_state[2]), h2 = _mm_loadu_pd(m_state[3]);
+    __m128d squares = _mm_setzero_pd();
+    __m128 peak = _mm_set1_ps(float(m_peak));
+
+    for (int i = 0; i < count; ++i) {
+        const float *f = frames + 2 * i;
+        // Lanes 0 and 1 hold left and right; the upper two are zero.
+        const __m128 xf = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(f)));
+        const __m128d x = _mm_cvtps_pd(xf);
+        const __m128d y = _mm_add_pd(_mm_mul_pd(sb0, x), s1);
+        s1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(sb1, x), _mm_mul_pd(sa1, y)), s2);
+        s2 = _mm_sub_pd(_mm_mul_pd(sb2, x), _mm_mul_pd(sa2, y));
+        const __m128d z = _mm_add_pd(y, h1);
+        h1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(hb1, y), _mm_mul_pd(ha1, z)), h2);
+        h2 = _mm_sub_pd(y, _mm_mul_pd(ha2, z));
+        squares = _mm_add_pd(squares, _mm_mul_pd(z, z));
+
+        left[pos] = left[pos + kTapsPerPhase] = f[0];
+        right[pos] = right[pos + kTapsPerPhase] = f[1];
+        pos = pos + 1 == kTapsPerPhase ? 0 : pos + 1;
+        __m128 outLeft = _mm_setzero_ps();
+        __m128 outRight = _mm_setzero_ps();
+        for (int j = 0; j < kTapsPerPhase; ++j) {
+            const __m128 taps = _mm_load_ps(m_taps[j]);
+            outLeft = _mm_add_ps(outLeft, _mm_mul_ps(_mm_set1_ps(left[pos + j]), taps));
+            outRight = _mm_add_ps(outRight, _mm_mul_ps(_mm_set1_ps(right[pos + j]), taps));
+        }
+        peak = _mm_max_ps(peak, _mm_and_ps(absMask, xf));
+        peak = _mm_max_ps(peak, _mm_max_ps(_mm_and_ps(absMask, outLeft), _mm_and_ps(absMask, outRight)));
+
+        if (++m_subFrames == m_subBlockFrames) {
+            m_subSum += _mm_cvtsd_f64(_mm_add_sd(squares, _mm_unpackhi_pd(squares, squares)));
+            squares = _mm_setzero_pd();
+            endSubBlock();
+        }
+    }
+    m_subSum += _mm_cvtsd_f64(_mm_add_sd(squares, _mm_unpackhi_pd(squares, squares)));
+    _mm_storeu_pd(m_state[0], s1);
+    _mm_storeu_pd(m_state[1], s2);
+    _mm_storeu_pd(m_state[2], h1);
+    _mm_storeu_pd(m_state[3], h2);
+    peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+    peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(2, 3, 0, 1)));
+    m_peak = _mm_cvtss_f32(peak);
+    _mm_setcsr(csr);
+#else
+    const Biquad &s = m_shelf;
+    const Biquad &h = m_highPass;
+    float peak = float(m_peak);
+    for (int i = 0; i < count; ++i) {
+        const float *f = frames + 2 * i;
+        for (int c = 0; c < 2; ++c) {
+            const double x = f[c];
+            const double y = s.b0 * x + m_state[0][c];
+            m_state[0][c] = s.b1 * x - s.a1 * y + m_state[1][c];
+            m_state[1][c] = s.b2 * x - s.a2 * y;
+            const double z = y + m_state[2][c];
+            m_state[2][c] = h.b1 * y - h.a1 * z + m_state[3][c];
+            m_state[3][c] = y - h.a2 * z;
+            m_subSum += z * z;
+            peak = std::max(peak, std::fabs(f[c]));
+        }
+
+        left[pos] = left[pos + kTapsPerPhase] = f[0];
+        right[pos] = right[pos + kTapsPerPhase] = f[1];
+        pos = pos + 1 == kTapsPerPhase ? 0 : pos + 1;
+        for (int p = 0; p < kMaxPhases; ++p) {
+            float outLeft = 0.0f;
+            float outRight = 0.0f;
+            for (int j = 0; j < kTapsPerPhase; ++j) {
+                outLeft += left[pos + j] * m_taps[j][p];
+                outRight += right[pos + j] * m_taps[j][p];
+            }
+            peak = std::max(peak, std::max(std::fabs(outLeft), std::fabs(outRight)));
+        }
+
+        if (++m_subFrames == m_subBlockFrames) endSubBlock();
+    }
+    m_peak = peak;
+#endif
+    m_historyPos = pos;
+}
+
+void LoudnessMeter::endSubBlock()
+{
+    m_recent[m_subBlocks % 4] = m_subSum;
+    ++m_subBlocks;
+    m_subSum = 0.0;
+    m_subFrames = 0;
+    if (m_subBlocks >= 4)
+        m_blocks.append(float((m_recent[0] + m_recent[1] + m_recent[2] + m_recent[3]) / (4.0 * m_subBlockFrames)));
+}
+
+double LoudnessMeter::integratedLoudness(const QVector<float> &blocks)
+{
+    const double absoluteGate = energyOf(kAbsoluteGateLufs);
+    double sum = 0.0;
+    int counted = 0;
+    for (const float z : blocks) {
+        if (z <= absoluteGate) continue;
+        sum += z;
+        ++counted;
+    }
+    if (!counted) return kSilence;
+
+    const double relativeGate = qMax(absoluteGate, sum / counted * std::pow(10.0, kRelativeGateLu / 10.0));
+    sum = 0.0;
+    counted = 0;
+    for (const float z : blocks) {
+        if (z <= relativeGate) continue;
+        sum += z;
+        ++counted;
+    }
+    if (!counted) return kSilence;
+    return kLoudnessOffset + 10.0 * std::log10(sum / counted);
+}
+
+double LoudnessMeter::gainDb(double lufs)
+{
+    return std::isinf(lufs) ? 0.0 : kReferenceLufs - lufs;
+}
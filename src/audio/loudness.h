@@ -0,0 +1,80 @@
+/*
+ * LoudnessMeter - integrated loudness and true peak after ITU-R BS.1770-4
+ *
+ * Frames pass the K-weighting filter (a high shelf followed by a high pass,
+ * both biquads run in double precision with the two channels side by side
+ * in one SSE2 register) and are summed into 100 ms sub-blocks; every 400 ms
+ * block that ends on a sub-block boundary is one gating block. Integrated
+ * loudness gates those blocks at -70 LUFS and then 10 LU below their mean.
+ * An album is measured the same way over the blocks of all of its tracks,
+ * which is why blocks() is kept.
+ *
+ * The true peak comes from 4x oversampling below 96 kHz (2x below 192 kHz)
+ * through a polyphase FIR, all phases of one input frame in one register.
+ */
+#ifndef MEDIASONIC_AUDIO_LOUDNESS_H
+#define MEDIASONIC_AUDIO_LOUDNESS_H
+
+#include <QVector>
+#include <limits>
+
+namespace MS {
+
+class LoudnessMeter
+{
+public:
+    // ReplayGain 2.0 plays everything at -18 LUFS.
+    static constexpr double kReferenceLufs = -18.0;
+    static constexpr double kSilence = -std::numeric_limits<double>::infinity();
+
+    explicit LoudnessMeter(int sampleRate);
+
+    int sampleRate() const { return m_rate; }
+    // Interleaved stereo frames.
+    void process(const float *frames, int count);
+
+    // LUFS over everything processed; kSilence if no block passed the gates.
+    double integratedLoudness() const { return integratedLoudness(m_blocks); }
+    // Largest true peak, as a linear sample value.
+    double truePeak() const { return m_peak; }
+    // Mean square of each gating block, channels summed.
+    const QVector<float> &blocks() const { return m_blocks; }
+
+    static double integratedLoudness(const QVector<float> &blocks);
+    // Adjustment that brings lufs to the reference; 0 for silence.
+    static double gainDb(double lufs);
+
+private:
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    static constexpr int kTapsPerPhase = 12;
+    static constexpr int kMaxPhases = 4;
+
+    void endSubBlock();
+
+    int m_rate;
+    int m_subBlockFrames;
+    Biquad m_shelf;
+    Biquad m_highPass;
+    double m_state[4][2] = {}; // z1 and z2 of both filters, per channel
+
+    double m_subSum = 0.0; // squares of the current sub-block, channels summed
+    int m_subFrames = 0;
+    double m_recent[4] = {}; // the last four sub-blocks
+    int m_subBlocks = 0;
+    QVector<float> m_blocks;
+
+    // Oversampling: taps by phase, oldest input first; history written twice
+    // so that the newest kTapsPerPhase frames are always contiguous.
+    alignas(16) float m_taps[kTapsPerPhase][kMaxPhases] = {};
+    alignas(16) float m_history[2][2 * kTapsPerPhase] = {};
+    int m_historyPos = 0;
+    double m_peak = 0.0;
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_LOUDNESS_H
@@ -0,0 +1,75 @@
+/*
+ * SpscRing - lock-free ring buffer between one producer and one consumer
+ *
+ * Positions are 64-bit counters that never wrap, so a full ring needs no
+ * spare slot and either side can tell how far the other one got. Both sides
+ * work on the ring's own memory through contiguous spans: the decoder
+ * writes into it directly and the sink's taps look at it without a copy.
+ * The capacity is rounded up to a power of two.
+ */
+#ifndef MEDIASONIC_AUDIO_SPSCRING_H
+#define MEDIASONIC_AUDIO_SPSCRING_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+
+namespace MS {
+
+template<typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(int capacity)
+    {
+        int n = 1;
+        while (n < capacity) n <<= 1;
+        m_buffer.reset(new T[size_t(n)]());
+        m_capacity = n;
+    }
+
+    int capacity() const { return m_capacity; }
+
+    // ---- producer ----
+    qint64 writePosition() const { return m_head.load(std::memory_order_relaxed); }
+    int writable() const { return m_capacity - int(writePosition() - m_tail.load(std::memory_order_acquire)); }
+    // Free space at the write position that is contiguous in memory; n gets its length.
+    T *writeSpan(int &n)
+    {
+        const qint64 head = writePosition();
+        const int start = int(head & (m_capacity - 1));
+        n = qMin(writable(), m_capacity - start);
+        return m_buffer.get() + start;
+    }
+    void commitWrite(int n) { m_head.store(writePosition() + n, std::memory_order_release); }
+
+    // ---- consumer ----
+    qint64 readPosition() const { return m_tail.load(std::memory_order_relaxed); }
+    int readable() const { return int(m_head.load(std::memory_order_acquire) - readPosition()); }
+    // Data at the read position that is contiguous in memory; n gets its length.
+    const T *readSpan(int &n) const
+    {
+        const qint64 tail = readPosition();
+        const int start = int(tail & (m_capacity - 1));
+        n = qMin(readable(), m_capacity - start);
+        return m_buffer.get() + start;
+    }
+    void commitRead(int n) { m_tail.store(readPosition() + n, std::memory_order_release); }
+    // Drops everything before position, which the producer has to have reached.
+    void skipTo(qint64 position)
+    {
+        const qint64 head = m_head.load(std::memory_order_acquire);
+        if (position > readPosition()) m_tail.store(qMin(position, head), std::memory_order_release);
+    }
+
+private:
+    std::unique_ptr<T[]> m_buffer;
+    int m_capacity = 0;
+    // Each side writes one counter; keep them on separate cache lines.
+    alignas(64) std::atomic<qint64> m_head{0};
+    alignas(64) std::atomic<qint64> m_tail{0};
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_SPSCRING_H
@@ -0,0 +1,158 @@
+#include "audio/trackdecoder.h"
+#include <QAudioBuffer>
+#include <QAudioDecoder>
+#include <QDebug>
+#include <cstring>
+
+using namespace MS;
+
+namespace {
+
+// How far decoding runs ahead of playback.
+constexpr qint64 kDecodeAheadMs = 2000;
+
+qint64 scaled(qint64 frames, int to, int from)
+{
+    return from > 0 && from != to ? qint64(double(frames) * to / from + 0.5) : frames;
+}
+
+template<typename T>
+inline float toFloat(T v);
+template<>
+inline float toFloat<qint16>(qint16 v) { return float(v) / 32768.0f; }
+template<>
+inline float toFloat<qint32>(qint32 v) { return float(v) / 2147483648.0f; }
+template<>
+inline float toFloat<float>(float v) { return v; }
+
+// Interleaved stereo from any channel count: mono is doubled, channels past
+// the first two are dropped.
+template<typename T>
+void toStereo(const T *in, int channels, int frames, float *out)
+{
+    for (int i = 0; i < frames; ++i, in += channels) {
+        out[2 * i] = toFloat(in[0]);
+        out[2 * i + 1] = toFloat(in[channels > 1 ? 1 : 0]);
+    }
+}
+
+}
+
+TrackDecoder::TrackDecoder(const QUrl &url, const GaplessInfo &gapless, int sampleRate, qint64 startFrame,
+                           QObject *parent)
+    : QObject(parent)
+    , m_url(url)
+    , m_gapless(gapless)
+    , m_rate(sampleRate)
+    , m_startFrame(qMax<qint64>(0, startFrame))
+    , m_decoder(new QAudioDecoder(this))
+{
+    m_skip = scaled(gapless.delayFrames, m_rate, gapless.sampleRate) + m_startFrame;
+    if (gapless.validFrames >= 0)
+        m_left = qMax<qint64>(0, scaled(gapless.validFrames, m_rate, gapless.sampleRate) - m_startFrame);
+
+    QAudioFormat format;
+    format.setCodec(QStringLiteral("audio/pcm"));
+    format.setSampleRate(m_rate);
+    format.setChannelCount(2);
+    format.setSampleSize(32);
+    format.setSampleType(QAudioFormat::Float);
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    m_decoder->setAudioFormat(format);
+    m_decoder->setSourceFilename(url.toLocalFile());
+
+    connect(m_decoder, &QAudioDecoder::bufferReady, this, &TrackDecoder::pull);
+    connect(m_decoder, &QAudioDecoder::finished, this, [this]() { m_finished = true; });
+    connect(m_decoder, &QAudioDecoder::durationChanged, this, [this](qint64 ms) { m_durationMs = ms; });
+    connect(m_decoder, QOverload<QAudioDecoder::Error>::of(&QAudioDecoder::error), this, [this]() {
+        qWarning() << "TrackDecoder:" << m_url.toLocalFile() << m_decoder->errorString();
+        m_failed = true;
+    });
+    m_decoder->start();
+}
+
+TrackDecoder::~TrackDecoder()
+{
+    m_decoder->stop();
+}
+
+qint64 TrackDecoder::lengthFrames() const
+{
+    if (m_gapless.validFrames >= 0) return scaled(m_gapless.validFrames, m_rate, m_gapless.sampleRate);
+    return m_durationMs >= 0 ? m_durationMs * m_rate / 1000 : -1;
+}
+
+bool TrackDecoder::decodeFinished() const
+{
+    return m_left == 0 || (m_finished && !m_decoder->bufferAvailable());
+}
+
+int TrackDecoder::read(float *out, int frames)
+{
+    int done = 0;
+    while (done < frames && !m_chunks.isEmpty()) {
+        const QVector<float> &chunk = m_chunks.first();
+        const int chunkFrames = chunk.size() / 2;
+        const int take = qMin(frames - done, chunkFrames - m_chunkPos);
+        std::memcpy(out + 2 * done, chunk.constData() + 2 * m_chunkPos, size_t(take) * 2 * sizeof(float));
+        done += take;
+        m_chunkPos += take;
+        if (m_chunkPos == chunkFrames) {
+            m_chunks.removeFirst();
+            m_chunkPos = 0;
+        }
+    }
+    m_buffered -= done;
+    m_handedOut += done;
+    pull();
+    return done;
+}
+
+void TrackDecoder::pull()
+{
+    const qint64 ahead = kDecodeAheadMs * m_rate / 1000;
+    const qint64 before = m_buffered;
+    while (!m_failed && m_left != 0 && m_buffered < ahead && m_decoder->bufferAvailable())
+        append(m_decoder->read());
+    if (m_left == 0 && !m_finished) {
+        // The music ended before the file did (padding, trailing junk)
+        m_decoder->stop();
+        m_finished = true;
+    }
+    if (m_buffered > before) emit ready();
+}
+
+void TrackDecoder::append(const QAudioBuffer &buffer)
+{
+    if (!buffer.isValid()) return;
+    const QAudioFormat format = buffer.format();
+    if (format.sampleRate() != m_rate) {
+        qWarning() << "TrackDecoder:" << m_url.toLocalFile() << "decoded at" << format.sampleRate()
+                   << "Hz instead of" << m_rate;
+        m_failed = true;
+        return;
+    }
+    const int frames = buffer.frameCount();
+    const int drop = int(qMin<qint64>(m_skip, frames));
+    m_skip -= drop;
+    int keep = frames - drop;
+    if (m_left >= 0) keep = int(qMin<qint64>(keep, m_left));
+    if (keep <= 0) return;
+
+    QVector<float> chunk(keep * 2);
+    const int channels = format.channelCount();
+    if (format.sampleType() == QAudioFormat::Float && format.sampleSize() == 32)
+        toStereo(buffer.constData<float>() + drop * channels, channels, keep, chunk.data());
+    else if (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 16)
+        toStereo(buffer.constData<qint16>() + drop * channels, channels, keep, chunk.data());
+    else if (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 32)
+        toStereo(buffer.constData<qint32>() + drop * channels, channels, keep, chunk.data());
+    else {
+        qWarning() << "TrackDecoder:" << m_url.toLocalFile() << "unsupported sample format";
+        m_failed = true;
+        return;
+    }
+    m_chunks << chunk;
+    m_buffered += keep;
+    if (m_left > 0) m_left -= keep;
+}
@@ -0,0 +1,79 @@
+/*
+ * TrackDecoder - one track decoded to interleaved stereo float
+ *
+ * Wraps QAudioDecoder, which also converts to the engine's sample rate, and
+ * drops the encoder delay and padding TagReader::readGapless finds, so the
+ * frames handed out are exactly the music. Decoding runs ahead of playback
+ * by a bounded amount: buffers are taken from the decoder only while less
+ * than kDecodeAheadMs is queued, and the decoder's own small queue stalls
+ * it until then.
+ */
+#ifndef MEDIASONIC_AUDIO_TRACKDECODER_H
+#define MEDIASONIC_AUDIO_TRACKDECODER_H
+
+#include <QList>
+#include <QObject>
+#include <QUrl>
+#include <QVector>
+#include "services/tagreader.h"
+
+class QAudioBuffer;
+class QAudioDecoder;
+
+namespace MS {
+
+class TrackDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    // Starts decoding at once. startFrame > 0 begins that many frames into
+    // the music, for a seek; the frames before it are decoded and dropped.
+    TrackDecoder(const QUrl &url, const GaplessInfo &gapless, int sampleRate, qint64 startFrame = 0,
+                 QObject *parent = nullptr);
+    ~TrackDecoder() override;
+
+    QUrl url() const { return m_url; }
+    const GaplessInfo &gapless() const { return m_gapless; }
+    int sampleRate() const { return m_rate; }
+    // Length of the music in frames, -1 while unknown.
+    qint64 lengthFrames() const;
+    // Frame of the music the next read() starts at.
+    qint64 position() const { return m_startFrame + m_handedOut; }
+    qint64 bufferedFrames() const { return m_buffered; }
+    // Everything was decoded; only the buffered frames are left.
+    bool decodeFinished() const;
+    // Every frame was handed out, or the file could not be decoded.
+    bool atEnd() const { return (decodeFinished() || m_failed) && m_buffered == 0; }
+    bool failed() const { return m_failed; }
+
+    // Copies up to frames interleaved stereo frames into out and returns how
+    // many; fewer than asked only if decoding is behind or the track ended.
+    int read(float *out, int frames);
+
+signals:
+    // More frames were buffered.
+    void ready();
+
+private:
+    void pull();
+    void append(const QAudioBuffer &buffer);
+
+    QUrl m_url;
+    GaplessInfo m_gapless;
+    int m_rate;
+    qint64 m_startFrame;
+    QAudioDecoder *m_decoder;
+    qint64 m_skip = 0;        // decoded frames still to drop
+    qint64 m_left = -1;       // frames still to keep; -1 keeps all
+    qint64 m_durationMs = -1; // as the decoder reports it
+    qint64 m_buffered = 0;
+    qint64 m_handedOut = 0;
+    bool m_finished = false;  // the decoder reached the end of the file
+    bool m_failed = false;
+    QList<QVector<float>> m_chunks;
+    int m_chunkPos = 0;       // frames of the first chunk already read
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_TRACKDECODER_H
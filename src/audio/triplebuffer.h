@@ -0,0 +1,50 @@
+/*
+ * TripleBuffer - latest-value handoff from one writer to one reader
+ *
+ * The writer fills a slot of its own and swaps it with the middle one; the
+ * reader swaps its slot with the middle one when that holds something newer.
+ * Neither side ever waits for the other or allocates, so settings made on
+ * the GUI thread reach the sink's thread without a lock. Values the reader
+ * did not get to in time are simply overwritten.
+ */
+#ifndef MEDIASONIC_AUDIO_TRIPLEBUFFER_H
+#define MEDIASONIC_AUDIO_TRIPLEBUFFER_H
+
+#include <atomic>
+
+namespace MS {
+
+template<typename T>
+class TripleBuffer
+{
+public:
+    // ---- writer ----
+    void write(const T &value)
+    {
+        m_slots[m_back] = value;
+        m_back = m_middle.exchange(m_back | kFresh, std::memory_order_acq_rel) & kIndex;
+    }
+
+    // ---- reader ----
+    // Takes the latest value written, if there is one it has not seen yet.
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & kFresh)) return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & kIndex;
+        return true;
+    }
+    const T &current() const { return m_slots[m_front]; }
+
+private:
+    static constexpr int kIndex = 3;
+    static constexpr int kFresh = 4;
+
+    T m_slots[3] = {};
+    int m_back = 0;
+    std::atomic<int> m_middle{1};
+    int m_front = 2;
+};
+
+}
+
+#endif // MEDIASONIC_AUDIO_TRIPLEBUFFER_H
@@ -0,0 +1,161 @@
+/*
+ * TM & (C) 2025 Syndromatic Ltd. All rights reserved.
+ * Designed by Kavish Krishnakumar in Manchester.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "trackInfo.h"
+#include "services/coldtagcache.h"
+#include <QDateTime>
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QLabel>
+#include <QLocale>
+#include <QPlainTextEdit>
+#include <QTabWidget>
+#include <QTime>
+#include <QVBoxLayout>
+
+namespace {
+
+QLabel *valueLabel(const QString &text, QWidget *parent)
+{
+    QLabel *label = new QLabel(text, parent);
+    label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    label->setWordWrap(true);
+    return label;
+}
+
+QString gainText(double gainDb, double peak)
+{
+    QString text = QStringLiteral("%1 dB").arg(gainDb, 0, 'f', 2);
+    if (peak > 0) text += QStringLiteral(", peak %1").arg(peak, 0, 'f', 6);
+    return text;
+}
+
+}
+
+TrackInfo::TrackInfo(const MS::Track &track, MS::ColdTagCache *cache, QWidget *parent) :
+    QDialog(parent),
+    m_track(track),
+    m_cache(cache)
+{
+    setupUi();
+    if (m_cache) {
+        connect(m_cache, &MS::ColdTagCache::loaded, this, [this](const QString &path) {
+            if (path == m_track.localPath) showColdTags();
+        });
+    }
+    showColdTags();
+}
+
+TrackInfo::~TrackInfo()
+{
+}
+
+void TrackInfo::setupUi()
+{
+    setWindowTitle(m_track.title.isEmpty() ? tr("Get Info") : m_track.title);
+    resize(440, 460);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    QTabWidget *tabs = new QTabWidget(this);
+    layout->addWidget(tabs);
+
+    // Summary: everything the library already has, no file access
+    QWidget *summary = new QWidget(tabs);
+    QFormLayout *form = new QFormLayout(summary);
+    const QLocale locale;
+    auto row = [&](const QString &name, const QString &value) {
+        if (!value.isEmpty()) form->addRow(name, valueLabel(value, summary));
+    };
+    auto number = [](int n) { return n > 0 ? QString::number(n) : QString(); };
+    row(tr("Name:"), m_track.title);
+    row(tr("Artist:"), m_track.artist);
+    row(tr("Album:"), m_track.album);
+    row(tr("Composer:"), m_track.composer);
+    row(tr("Genre:"), m_track.genre);
+    row(tr("Year:"), number(m_track.year));
+    row(tr("Track:"), number(m_track.trackNumber));
+    row(tr("Disc:"), number(m_track.discNumber));
+    if (m_track.durationMs > 0)
+        row(tr("Time:"), QTime(0, 0).addMSecs(int(m_track.durationMs))
+                             .toString(m_track.durationMs >= 3600000 ? QStringLiteral("h:mm:ss") : QStringLiteral("m:ss")));
+    if (m_track.bitrateKbps > 0) row(tr("Bit rate:"), tr("%1 kbps").arg(m_track.bitrateKbps));
+    if (m_track.sampleRate > 0) row(tr("Sample rate:"), tr("%1 Hz").arg(locale.toString(m_track.sampleRate)));
+    if (m_track.fileSize > 0) row(tr("Size:"), locale.formattedDataSize(m_track.fileSize));
+    row(tr("Plays:"), QString::number(m_track.playCount));
+    if (m_track.lastPlayed > 0)
+        row(tr("Last played:"), locale.toString(QDateTime::fromSecsSinceEpoch(m_track.lastPlayed), QLocale::ShortFormat));
+    row(tr("Where:"), m_track.localPath);
+    tabs->addTab(summary, tr("Summary"));
+
+    // Details: read from the file on demand
+    QWidget *details = new QWidget(tabs);
+    m_coldForm = new QFormLayout(details);
+    m_coldStatus = new QLabel(tr("Reading tags..."), details);
+    m_coldForm->addRow(m_coldStatus);
+    tabs->addTab(details, tr("Details"));
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok, this);
+    connect(buttons, &QDialogButtonBox::accepted, this, &QDialog::accept);
+    layout->addWidget(buttons);
+
+    setLayout(layout);
+}
+
+void TrackInfo::showColdTags()
+{
+    const MS::ColdTags *tags = m_cache ? m_cache->tags(m_track.localPath) : nullptr;
+    if (!tags || !m_coldStatus) return;
+    // Copy first: the cache may evict the entry while the widgets are built
+    const MS::ColdTags cold = *tags;
+    QWidget *details = m_coldStatus->parentWidget();
+    m_coldForm->removeRow(m_coldStatus);
+    m_coldStatus = nullptr;
+
+    auto row = [&](const QString &name, const QString &value) {
+        if (!value.isEmpty()) m_coldForm->addRow(name, valueLabel(value, details));
+    };
+    auto text = [&](const QString &name, const QString &value) {
+        if (value.isEmpty()) return;
+        QPlainTextEdit *edit = new QPlainTextEdit(value, details);
+        edit->setReadOnly(true);
+        edit->setMaximumHeight(96);
+        m_coldForm->addRow(name, edit);
+    };
+    text(tr("Comments:"), cold.comment);
+    text(tr("Lyrics:"), cold.lyrics);
+    if (cold.hasTrackGain) row(tr("Track gain:"), gainText(cold.trackGainDb, cold.trackPeak));
+    if (cold.hasAlbumGain) row(tr("Album gain:"), gainText(cold.albumGainDb, cold.albumPeak));
+    row(tr("MusicBrainz track:"), cold.musicBrainzTrackId);
+    row(tr("MusicBrainz album:"), cold.musicBrainzAlbumId);
+    row(tr("MusicBrainz artist:"), cold.musicBrainzArtistId);
+    const QLocale locale;
+    for (const MS::ColdTags::Picture &p : cold.pictures) {
+        QStringList parts;
+        parts << p.mimeType;
+        if (p.width > 0 && p.height > 0) parts << QStringLiteral("%1 x %2").arg(p.width).arg(p.height);
+        if (p.bytes > 0) parts << locale.formattedDataSize(p.bytes);
+        parts.removeAll(QString());
+        row(p.type.isEmpty() ? tr("Artwork:") : p.type + QLatin1Char(':'), parts.join(QStringLiteral(", ")));
+    }
+    for (auto it = cold.other.cbegin(); it != cold.other.cend(); ++it)
+        row(it.key() + QLatin1Char(':'), it.value().join(QStringLiteral("; ")));
+    if (m_coldForm->rowCount() == 0) m_coldForm->addRow(new QLabel(tr("No further tags."), details));
+}
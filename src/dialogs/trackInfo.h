@@ -0,0 +1,52 @@
+/*
+ * TM & (C) 2025 Syndromatic Ltd. All rights reserved.
+ * Designed by Kavish Krishnakumar in Manchester.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef TRACKINFO_H
+#define TRACKINFO_H
+
+#include <QDialog>
+#include "models/track.h"
+
+class QFormLayout;
+class QLabel;
+namespace MS { class ColdTagCache; }
+
+// Get Info: the library's fields of a track, then the tags that are read
+// from the file only when asked for (MS::ColdTags).
+class TrackInfo : public QDialog
+{
+    Q_OBJECT
+
+public:
+    TrackInfo(const MS::Track &track, MS::ColdTagCache *cache, QWidget *parent = nullptr);
+    ~TrackInfo();
+
+private:
+    void setupUi();
+    void showColdTags();
+
+    MS::Track m_track;
+    MS::ColdTagCache *m_cache;
+    QFormLayout *m_coldForm = nullptr;
+    QLabel *m_coldStatus = nullptr;
+};
+
+#endif // TRACKINFO_H
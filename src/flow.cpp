@@ -275,7 +275,7 @@ public:
     Flow * const q;
     QColor bg;
     GraphicsScene *scene;
-    QStandardItemModel *model;
+    QAbstractItemModel *model;
     QModelIndex centerIndex, prevCenter, savedCenter;
     QPersistentModelIndex rootIndex;
     int row, nextRow, newRow, savedRow, sortColumn;
@@ -495,7 +495,7 @@ void Flow::enterEvent(QEvent *e)
         QApplication::restoreOverrideCursor();
 }
 
-void Flow::setModel(QStandardItemModel *model)
+void Flow::setModel(QAbstractItemModel *model)
 {
     d->model = model;
     d->sortColumn = 0;
@@ -32,7 +32,7 @@
 #include <QTimeLine>
 #include <QGraphicsItemAnimation>
 #include <QScrollBar>
-#include <QStandardItemModel>
+#include <QAbstractItemModel>
 #include <QModelIndex>
 #include <QItemSelectionModel>
 #include <QMouseEvent>
@@ -93,7 +93,7 @@ public:
     explicit Flow(QWidget *parent = nullptr);
     ~Flow();
 
-    void setModel(QStandardItemModel *model);
+    void setModel(QAbstractItemModel *model);
     void setSelectionModel(QItemSelectionModel *model);
     void setCenterIndex(const QModelIndex &index);
     void showCenterIndex(const QModelIndex &index);
@@ -28,6 +28,7 @@
 #include <QDir>
 #include <KLocalizedString>
 #include "models/track.h"
+#include "services/scanstats.h"
 #include <QDateTime>
 #include <QTextStream>
 #include <QFile>
@@ -57,6 +58,8 @@ int main(int argc, char *argv[])
 {
     qInstallMessageHandler(msMessageHandler);
     qRegisterMetaType<MS::Track>("MS::Track");
+    qRegisterMetaType<QVector<MS::Track>>("QVector<MS::Track>");
+    qRegisterMetaType<MS::ScanStats>("MS::ScanStats");
     qRegisterMetaType<QVector<float>>("QVector<float>");
     Application app(argc, argv);
     KLocalizedString::setApplicationDomain("mediasonic");
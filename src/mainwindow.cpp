@@ -21,6 +21,7 @@
 
 #include "mainwindow.h"
 #include "dialogs/aboutInfo.h"
+#include "dialogs/trackInfo.h"
 #include <QApplication>
 #include <QMainWindow>
 #include <QMenuBar>
@@ -52,22 +53,79 @@
 #include "lcddisplay.h"
 #include <QMessageBox>
 #include <QMediaPlayer>
-#include <QMediaPlaylist>
 #include <QStyledItemDelegate>
 #include <QPainter>
 #include <QImageReader>
 #include <QSortFilterProxyModel>
 #include <QRegularExpression>
 #include "models/trackmodel.h"
+#include "models/libraryproxymodel.h"
+#include "models/browsemodel.h"
+#include "models/playqueue.h"
 #include "services/scanner.h"
+#include "services/librarysnapshot.h"
+#include "services/folderwatcher.h"
+#include "services/coldtagcache.h"
+#include "services/loudnessanalyzer.h"
+#include "audio/dspchain.h"
 #include "visualizer/visualizerbridge.h"
 #include <KLocalizedString>
+#include <KFormat>
 #include <KFileWidget>
 #include <KFile>
 #include <QDialog>
 #include <QDialogButtonBox>
 #include <QStandardPaths>
+#include <QTimer>
+#include <QSettings>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <QActionGroup>
+#include <QSet>
 #include "ui/nse_uno.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace {
+
+// A play is counted once half the track, or this much of a long one, was heard.
+constexpr qint64 kPlayCountMs = 4 * 60 * 1000;
+// A restored library's loudness analysis starts this long after startup.
+constexpr int kLoudnessStartMs = 30 * 1000;
+
+// Gains of the ten graphic equalizer bands, 32 Hz to 16 kHz.
+struct EqPreset
+{
+    const char *name;
+    float gainsDb[MS::ParametricEq::kMaxBands];
+};
+const EqPreset kEqPresets[] = {
+    { QT_TRANSLATE_NOOP("MainWindow", "Flat"), { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Acoustic"), { 5, 5, 4, 1, 2, 2, 3.5f, 4, 3.5f, 2 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Bass Booster"), { 5.5f, 4.5f, 3.5f, 2.5f, 1, 0, 0, 0, 0, 0 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Bass Reducer"), { -5.5f, -4.5f, -3.5f, -2.5f, -1, 0, 0, 0, 0, 0 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Classical"), { 4.5f, 4, 3, 2.5f, -1.5f, -1.5f, 0, 2, 3, 3.5f } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Dance"), { 3.5f, 6.5f, 5, 0, 2, 3.5f, 5, 4.5f, 3.5f, 0 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Electronic"), { 4, 3.5f, 1, 0, -2, 2, 1, 1, 4, 5 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Hip-Hop"), { 5, 4, 1.5f, 3, -1, -1, 1.5f, -0.5f, 2, 3 } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Jazz"), { 4, 3, 1.5f, 2, -1.5f, -1.5f, 0, 1.5f, 3, 3.5f } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Rock"), { 5, 4, 3, 1.5f, -0.5f, -1, 0.5f, 2.5f, 3.5f, 4.5f } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Treble Booster"), { 0, 0, 0, 0, 0, 1, 2.5f, 3.5f, 4.5f, 5.5f } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Treble Reducer"), { 0, 0, 0, 0, 0, -1, -2.5f, -3.5f, -4.5f, -5.5f } },
+    { QT_TRANSLATE_NOOP("MainWindow", "Vocal Booster"), { -1.5f, -3, -3, 1.5f, 3.5f, 3.5f, 3, 1.5f, 0, -1.5f } },
+};
+
+// Half the largest boost comes off the preamp; the limiter catches the rest.
+MS::ParametricEq::Settings eqSettings(const EqPreset &preset)
+{
+    const float *gains = preset.gainsDb;
+    const float boost = *std::max_element(gains, gains + MS::ParametricEq::kMaxBands);
+    return MS::ParametricEq::graphic(gains, -qMax(0.0f, boost) / 2.0f);
+}
+
+}
 
 // StarRatingDelegate for the Rating column
 class StarRatingDelegate : public QStyledItemDelegate {
@@ -169,20 +227,57 @@ MainWindow::MainWindow(QWidget *parent)
 
     // Search integration once models exist
     connect(topBar, &TopBar::searchTextChanged, this, [this](const QString &text){
-        if (trackProxyModel) {
-            trackProxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
-            trackProxyModel->setFilterKeyColumn(-1);
-            trackProxyModel->setFilterRegularExpression(QRegularExpression(QRegularExpression::escape(text), QRegularExpression::CaseInsensitiveOption));
-        }
+        // Answered from the track model's trigram index, not a regex per cell
+        if (trackProxyModel) trackProxyModel->setSearchText(text);
     });
 
     // Connect media player to update status bar (mediaPlayer is valid here)
-    connect(mediaPlayer, &MediaPlayer::currentMediaChanged, this, &MainWindow::updateStatusSummary);
-    connect(mediaPlayer, &MediaPlayer::durationChanged, this, &MainWindow::updateStatusSummary);
+    connect(mediaPlayer, &MediaPlayer::currentMediaChanged, this, &MainWindow::scheduleStatusSummary);
+    connect(mediaPlayer, &MediaPlayer::durationChanged, this, &MainWindow::scheduleStatusSummary);
+    // Play counts and last plays feed the smart playlists
+    connect(mediaPlayer, &MediaPlayer::currentMediaChanged, this, [this]() { playCounted = false; });
+    connect(mediaPlayer, &MediaPlayer::positionChanged, this, [this](qint64 position) {
+        const qint64 duration = mediaPlayer->duration();
+        if (playCounted || duration <= 0 || position < qMin(duration / 2, kPlayCountMs)) return;
+        playCounted = true;
+        const quint32 id = mediaPlayer->playQueue()->currentId();
+        const int row = id == MS::PlayQueue::kNoTrack ? -1 : trackListModel->store().rowOfId(id);
+        if (row >= 0) trackListModel->recordPlay(row);
+    });
+
+    // Restore the library from the last snapshot, then keep the snapshot fresh
+    loadLibrarySnapshot();
+    folderWatcher = new MS::FolderWatcher(this);
+    connect(folderWatcher, &MS::FolderWatcher::changesReady, this, &MainWindow::onFolderChanges);
+    connect(folderWatcher, &MS::FolderWatcher::sweepRequested, this, [this](const QStringList &roots) {
+        ensureScanner();
+        scanner->scanPaths(roots, MS::Scanner::Background);
+    });
+    restoreLibraryRoots();
+    // Loudness of what was never measured, measured in the background
+    loudnessAnalyzer = new MS::LoudnessAnalyzer(this);
+    connect(loudnessAnalyzer, &MS::LoudnessAnalyzer::analyzed, this,
+            [this](const QVector<MS::LoudnessAnalyzer::Result> &results) {
+        for (const MS::LoudnessAnalyzer::Result &r : results) {
+            const int row = trackListModel->rowOf(r.localPath);
+            if (row >= 0) trackListModel->setLoudness(row, r.trackGainDb, r.trackPeak, r.albumGainDb, r.albumPeak);
+        }
+        libraryDirty = true;
+    });
+    QTimer::singleShot(kLoudnessStartMs, this, &MainWindow::queueLoudnessAnalysis);
+    auto markDirty = [this]() { libraryDirty = true; };
+    connect(trackListModel, &QAbstractItemModel::rowsInserted, this, markDirty);
+    connect(trackListModel, &QAbstractItemModel::rowsRemoved, this, markDirty);
+    connect(trackListModel, &QAbstractItemModel::dataChanged, this, markDirty);
+    snapshotTimer = new QTimer(this);
+    snapshotTimer->setInterval(5 * 60 * 1000);
+    connect(snapshotTimer, &QTimer::timeout, this, [this]() { saveLibrarySnapshot(false); });
+    snapshotTimer->start();
 }
 
 MainWindow::~MainWindow()
 {
+    saveLibrarySnapshot(true);
 }
 
 void MainWindow::setupUi()
@@ -234,31 +329,11 @@ void MainWindow::setupUi()
     viewHeaderLayout->addWidget(composersButton);
     viewHeaderLayout->addStretch();
     
-    // Connect button signals
-    connect(albumsButton, &QPushButton::clicked, this, [this]() {
-        albumsButton->setChecked(true);
-        artistsButton->setChecked(false);
-        genresButton->setChecked(false);
-        composersButton->setChecked(false);
-    });
-    connect(artistsButton, &QPushButton::clicked, this, [this]() {
-        albumsButton->setChecked(false);
-        artistsButton->setChecked(true);
-        genresButton->setChecked(false);
-        composersButton->setChecked(false);
-    });
-    connect(genresButton, &QPushButton::clicked, this, [this]() {
-        albumsButton->setChecked(false);
-        artistsButton->setChecked(false);
-        genresButton->setChecked(true);
-        composersButton->setChecked(false);
-    });
-    connect(composersButton, &QPushButton::clicked, this, [this]() {
-        albumsButton->setChecked(false);
-        artistsButton->setChecked(false);
-        genresButton->setChecked(false);
-        composersButton->setChecked(true);
-    });
+    // Connect button signals: each picks what the column browser lists
+    connect(albumsButton, &QPushButton::clicked, this, [this]() { setBrowseCategory(MS::BrowseIndex::Albums); });
+    connect(artistsButton, &QPushButton::clicked, this, [this]() { setBrowseCategory(MS::BrowseIndex::Artists); });
+    connect(genresButton, &QPushButton::clicked, this, [this]() { setBrowseCategory(MS::BrowseIndex::Genres); });
+    connect(composersButton, &QPushButton::clicked, this, [this]() { setBrowseCategory(MS::BrowseIndex::Composers); });
     
     mainLayout->addWidget(viewHeader);
 
@@ -270,7 +345,14 @@ void MainWindow::setupUi()
     sidebar = new Sidebar(mainSplitter);
     sidebar->setFixedWidth(220);
     connect(static_cast<Sidebar*>(sidebar), &Sidebar::itemSelected, this, [this](const QString &category, const QString &item) {
-        // TODO: Handle sidebar item selection
+        // Smart playlists narrow the track list; the library shows all of it
+        if (!trackProxyModel) return;
+        if (category == QLatin1String("library")) {
+            trackProxyModel->setSmartPlaylist(-1);
+        } else if (category == QLatin1String("playlist")) {
+            const int playlist = trackListModel->smartPlaylists().indexOf(item);
+            if (playlist >= 0) trackProxyModel->setSmartPlaylist(playlist);
+        }
     });
 
     // Main view stack (List, Album, Cover Flow)
@@ -279,12 +361,21 @@ void MainWindow::setupUi()
     // --- List View ---
     QWidget *listView = new QWidget();
     QVBoxLayout *listLayout = new QVBoxLayout(listView);
+    QSplitter *listSplitter = new QSplitter(Qt::Vertical, listView);
+    listSplitter->setChildrenCollapsible(false);
+    // Column browser: picking a group narrows the track list to it
+    columnBrowser = new QListView();
+    columnBrowser->setSelectionMode(QAbstractItemView::SingleSelection);
+    columnBrowser->setUniformItemSizes(true);
+    listSplitter->addWidget(columnBrowser);
     trackListView = new QTableView();
     trackListView->setSelectionBehavior(QAbstractItemView::SelectRows);
     trackListView->horizontalHeader()->setStretchLastSection(true);
     trackListView->verticalHeader()->setVisible(false);
     trackListView->setShowGrid(false);
-    listLayout->addWidget(trackListView);
+    listSplitter->addWidget(trackListView);
+    listSplitter->setSizes(QList<int>() << 150 << 450);
+    listLayout->addWidget(listSplitter);
     mainViewStack->addWidget(listView);
 
     // --- Album View (QListView in IconMode) ---
@@ -359,15 +450,10 @@ void MainWindow::setupUi()
     });
     
     connect(trackListView, &QTableView::doubleClicked, this, [this](const QModelIndex &index) {
-        if (!index.isValid()) return;
-        QModelIndex srcIdx = index;
-        if (trackProxyModel) srcIdx = trackProxyModel->mapToSource(index);
-        int row = srcIdx.row();
-        QMediaPlaylist* playlist = mediaPlayer->getPlaylist();
-        if (playlist && row >= 0 && row < playlist->mediaCount()) {
-            playlist->setCurrentIndex(row);
-            mediaPlayer->play();
-        }
+        // The list as shown becomes the queue, starting from the clicked track
+        if (!index.isValid() || !trackProxyModel) return;
+        const QModelIndex source = trackProxyModel->mapToSource(index);
+        if (source.isValid()) playRows(trackProxyModel->sourceRows(), source.row());
     });
 }
 
@@ -394,7 +480,20 @@ void MainWindow::setupMenuBar()
     connect(exitAction, &QAction::triggered, qApp, &QApplication::quit);
 
     // Edit Menu
-    menuBar->addMenu(tr("&Edit"));
+    QMenu *editMenu = menuBar->addMenu(tr("&Edit"));
+    QAction *getInfoAction = editMenu->addAction(tr("Get &Info"));
+    getInfoAction->setShortcut(QKeySequence(tr("Ctrl+I")));
+    connect(getInfoAction, &QAction::triggered, this, &MainWindow::showTrackInfo);
+    QAction *playNextAction = editMenu->addAction(tr("Play &Next"));
+    connect(playNextAction, &QAction::triggered, this, &MainWindow::playSelectionNext);
+    trackListView->addAction(getInfoAction);
+    trackListView->addAction(playNextAction);
+    trackListView->setContextMenuPolicy(Qt::ActionsContextMenu);
+    if (coverFlowTrackList) {
+        coverFlowTrackList->addAction(getInfoAction);
+        coverFlowTrackList->addAction(playNextAction);
+        coverFlowTrackList->setContextMenuPolicy(Qt::ActionsContextMenu);
+    }
 
     // View Menu
     menuBar->addMenu(tr("&View"));
@@ -407,6 +506,77 @@ void MainWindow::setupMenuBar()
     connect(pauseAction, &QAction::triggered, mediaPlayer, &MediaPlayer::pause);
     QAction *stopAction = controlsMenu->addAction(tr("Stop"));
     connect(stopAction, &QAction::triggered, mediaPlayer, &MediaPlayer::stop);
+    controlsMenu->addSeparator();
+    // Gapless: consecutive tracks join without the pipeline restart between them
+    QAction *gaplessAction = controlsMenu->addAction(tr("Gapless Playback"));
+    gaplessAction->setCheckable(true);
+    QSettings settings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic"));
+    gaplessAction->setChecked(settings.value(QStringLiteral("playback/gapless"), true).toBool());
+    mediaPlayer->setGapless(gaplessAction->isChecked());
+    connect(gaplessAction, &QAction::toggled, this, [this](bool on) {
+        mediaPlayer->setGapless(on);
+        QSettings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic")).setValue(QStringLiteral("playback/gapless"), on);
+    });
+    // Sound Check: every track at the same loudness, or every album
+    QMenu *soundCheckMenu = controlsMenu->addMenu(tr("Sound Check"));
+    QActionGroup *soundCheckGroup = new QActionGroup(soundCheckMenu);
+    const int savedGainMode = qBound(int(MediaPlayer::NoGain),
+                                     settings.value(QStringLiteral("playback/replayGain"), int(MediaPlayer::TrackGain)).toInt(),
+                                     int(MediaPlayer::AlbumGain));
+    const QPair<QString, MediaPlayer::GainMode> gainModes[] = {
+        { tr("Off"), MediaPlayer::NoGain },
+        { tr("By Track"), MediaPlayer::TrackGain },
+        { tr("By Album"), MediaPlayer::AlbumGain },
+    };
+    for (const auto &gainMode : gainModes) {
+        QAction *action = soundCheckMenu->addAction(gainMode.first);
+        action->setCheckable(true);
+        action->setChecked(gainMode.second == savedGainMode);
+        soundCheckGroup->addAction(action);
+        const MediaPlayer::GainMode mode = gainMode.second;
+        connect(action, &QAction::triggered, this, [this, mode]() {
+            mediaPlayer->setGainMode(mode);
+            QSettings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic")).setValue(QStringLiteral("playback/replayGain"), int(mode));
+        });
+    }
+    mediaPlayer->setGainMode(MediaPlayer::GainMode(savedGainMode));
+    // Crossfade: the next track starts under the end of the current one
+    QMenu *crossfadeMenu = controlsMenu->addMenu(tr("Crossfade"));
+    QActionGroup *crossfadeGroup = new QActionGroup(crossfadeMenu);
+    const int savedCrossfade = settings.value(QStringLiteral("playback/crossfadeMs"), 0).toInt();
+    for (const int ms : { 0, 2000, 4000, 6000 }) {
+        QAction *action = crossfadeMenu->addAction(ms ? tr("%1 Seconds").arg(ms / 1000) : tr("Off"));
+        action->setCheckable(true);
+        action->setChecked(ms == savedCrossfade);
+        crossfadeGroup->addAction(action);
+        connect(action, &QAction::triggered, this, [this, ms]() {
+            mediaPlayer->setCrossfade(ms);
+            QSettings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic")).setValue(QStringLiteral("playback/crossfadeMs"), ms);
+        });
+    }
+    mediaPlayer->setCrossfade(savedCrossfade);
+    // Equalizer presets, kept by their untranslated name
+    QMenu *equalizerMenu = controlsMenu->addMenu(tr("Equalizer"));
+    QActionGroup *equalizerGroup = new QActionGroup(equalizerMenu);
+    const QString savedPreset = settings.value(QStringLiteral("playback/equalizer"), QStringLiteral("Flat")).toString();
+    for (const EqPreset &preset : kEqPresets) {
+        QAction *action = equalizerMenu->addAction(tr(preset.name));
+        action->setCheckable(true);
+        equalizerGroup->addAction(action);
+        const QString key = QString::fromLatin1(preset.name);
+        const MS::ParametricEq::Settings eq = eqSettings(preset);
+        connect(action, &QAction::triggered, this, [this, key, eq]() {
+            mediaPlayer->setEqualizer(eq);
+            QSettings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic")).setValue(QStringLiteral("playback/equalizer"), key);
+        });
+        if (key == savedPreset) {
+            action->setChecked(true);
+            mediaPlayer->setEqualizer(eq);
+        }
+    }
+    QAction *shuffleAction = controlsMenu->addAction(tr("Shuffle"));
+    shuffleAction->setCheckable(true);
+    connect(shuffleAction, &QAction::toggled, mediaPlayer->playQueue(), &MS::PlayQueue::setShuffle);
 
 
     // Share Menu
@@ -432,10 +602,43 @@ void MainWindow::createModels()
     // Sidebar Model handled by Sidebar widget itself
     // Track List Model (typed)
     trackListModel = new MS::TrackModel(this);
-    trackProxyModel = new QSortFilterProxyModel(this);
+    trackProxyModel = new MS::LibraryProxyModel(this);
     trackProxyModel->setSourceModel(trackListModel);
-    trackProxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
-    trackProxyModel->setDynamicSortFilter(true);
+    coldTags = new MS::ColdTagCache(this);
+    // The play queue keeps ids; a URL is made only when an entry is about to play
+    mediaPlayer->playQueue()->setResolver([this](quint32 id) {
+        const int row = trackListModel->store().rowOfId(id);
+        return row < 0 ? QUrl() : QUrl::fromLocalFile(trackListModel->store().localPath(row));
+    });
+    // ReplayGain as measured, but never so loud that the true peak clips
+    mediaPlayer->setGainResolver([this](quint32 id, MediaPlayer::GainMode mode) {
+        const MS::TrackStore &store = trackListModel->store();
+        const int row = store.rowOfId(id);
+        if (row < 0 || !store.hasLoudness(row)) return 1.0f;
+        const bool album = mode == MediaPlayer::AlbumGain;
+        const float peak = album ? store.albumPeak(row) : store.trackPeak(row);
+        float gain = std::pow(10.0f, (album ? store.albumGainDb(row) : store.trackGainDb(row)) / 20.0f);
+        if (peak > 0.0f) gain = qMin(gain, 1.0f / peak);
+        return gain;
+    });
+    // The audio engine reads no tags; the library already has them
+    mediaPlayer->setMetaDataResolver([this](quint32 id, const QString &key) -> QVariant {
+        const MS::TrackStore &store = trackListModel->store();
+        const int row = store.rowOfId(id);
+        if (row < 0) return QVariant();
+        // The library keeps no album artist apart from the artist
+        if (key == QMediaMetaData::Title) return store.title(row);
+        if (key == QMediaMetaData::AlbumArtist || key == QMediaMetaData::ContributingArtist) return store.artist(row);
+        if (key == QMediaMetaData::AlbumTitle) return store.album(row);
+        if (key == QMediaMetaData::Genre) return store.genre(row);
+        if (key == QMediaMetaData::Composer) return store.composer(row);
+        if (key == QMediaMetaData::Year) return store.year(row) > 0 ? QVariant(store.year(row)) : QVariant();
+        if (key == QMediaMetaData::TrackNumber) return store.trackNumber(row) > 0 ? QVariant(store.trackNumber(row)) : QVariant();
+        if (key == QMediaMetaData::Duration) return store.durationMs(row);
+        if (key == QMediaMetaData::AudioBitRate) return store.bitrateKbps(row) * 1000;
+        if (key == QMediaMetaData::SampleRate) return store.sampleRate(row);
+        return QVariant();
+    });
     trackListView->setModel(trackProxyModel);
     if (coverFlowTrackList) coverFlowTrackList->setModel(trackProxyModel);
     trackListView->setAlternatingRowColors(true);
@@ -452,33 +655,80 @@ void MainWindow::createModels()
     if (coverFlowTrackList)
         coverFlowTrackList->setItemDelegateForColumn(MS::TrackModel::ColRating, new StarRatingDelegate(coverFlowTrackList));
 
-    // Album View Model (simple: album name, artist, cover art)
-    albumViewModel = new QStandardItemModel(this);
-    if (albumListView) albumListView->setModel(albumViewModel);
-
-    // Cover Flow Model
-    coverFlowModel = new QStandardItemModel(this);
-    coverFlowModel->setHorizontalHeaderLabels({"Album", "Artist", "Year"});
-    coverFlow->setModel(coverFlowModel);
-    // Opened album -> play first track matching album
-    connect(coverFlow, &Flow::opened, this, [this](const QModelIndex &idx){
-        if (!idx.isValid()) return;
-        QString album = coverFlowModel->index(idx.row(), 0).data().toString();
-        // Find first matching track
-        int srcRow = -1;
-        for (int r = 0; r < trackListModel->rowCount(); ++r) {
-            QModelIndex aIdx = trackListModel->index(r, MS::TrackModel::ColAlbum);
-            if (aIdx.data().toString() == album) { srcRow = r; break; }
-        }
-        if (srcRow >= 0) {
-            QMediaPlaylist *pl = mediaPlayer->getPlaylist();
-            if (pl && srcRow < pl->mediaCount()) {
-                pl->setCurrentIndex(srcRow);
-                mediaPlayer->play();
-            }
-        }
+    // Album view and Cover Flow list the library's albums, one item each
+    albumBrowseModel = new MS::BrowseModel(trackListModel, MS::BrowseIndex::Albums, this);
+    if (albumListView) albumListView->setModel(albumBrowseModel);
+    coverFlow->setModel(albumBrowseModel);
+    // Opened album -> play its first track
+    connect(coverFlow, &Flow::opened, this, [this](const QModelIndex &idx){
+        if (idx.isValid()) playAlbum(albumBrowseModel->groupAt(idx.row()));
+    });
+    connect(albumListView, &QListView::activated, this, [this](const QModelIndex &idx){
+        if (idx.isValid()) playAlbum(albumBrowseModel->groupAt(idx.row()));
+    });
+
+    // Smart playlists, named as in the sidebar
+    MS::SmartPlaylists::Rule topRated;
+    topRated.minRating = 4;
+    trackListModel->addSmartPlaylist(QStringLiteral("My Top Rated"), topRated);
+    MS::SmartPlaylists::Rule nineties;
+    nineties.minYear = 1990;
+    nineties.maxYear = 1999;
+    trackListModel->addSmartPlaylist(QStringLiteral("90's Music"), nineties);
+    MS::SmartPlaylists::Rule classical;
+    classical.genre = QStringLiteral("Classical");
+    trackListModel->addSmartPlaylist(QStringLiteral("Classical Music"), classical);
+    MS::SmartPlaylists::Rule recentlyAdded;
+    recentlyAdded.order = MS::SmartPlaylists::Rule::RecentlyAdded;
+    recentlyAdded.limit = 25;
+    trackListModel->addSmartPlaylist(QStringLiteral("Recently Added"), recentlyAdded);
+    MS::SmartPlaylists::Rule recentlyPlayed;
+    recentlyPlayed.order = MS::SmartPlaylists::Rule::RecentlyPlayed;
+    recentlyPlayed.limit = 25;
+    trackListModel->addSmartPlaylist(QStringLiteral("Recently Played"), recentlyPlayed);
+    MS::SmartPlaylists::Rule mostPlayed;
+    mostPlayed.order = MS::SmartPlaylists::Rule::MostPlayed;
+    mostPlayed.limit = 25;
+    trackListModel->addSmartPlaylist(QStringLiteral("Top 25 Most Played"), mostPlayed);
+
+    columnBrowseModel = new MS::BrowseModel(trackListModel, MS::BrowseIndex::Albums, this);
+    columnBrowseModel->setShowAll(true);
+    columnBrowser->setModel(columnBrowseModel);
+    connect(columnBrowser->selectionModel(), &QItemSelectionModel::currentChanged, this, [this](const QModelIndex &idx){
+        trackProxyModel->setBrowseFilter(columnBrowseModel->category(), columnBrowseModel->groupAt(idx.row()));
+    });
+    // The filtered group can vanish under the selection (last track removed)
+    connect(columnBrowseModel, &QAbstractItemModel::modelReset, this, [this]() {
+        trackProxyModel->setBrowseFilter(columnBrowseModel->category(), -1);
     });
 }
+
+void MainWindow::setBrowseCategory(MS::BrowseIndex::Category category)
+{
+    albumsButton->setChecked(category == MS::BrowseIndex::Albums);
+    artistsButton->setChecked(category == MS::BrowseIndex::Artists);
+    genresButton->setChecked(category == MS::BrowseIndex::Genres);
+    composersButton->setChecked(category == MS::BrowseIndex::Composers);
+    columnBrowseModel->setCategory(category);
+    trackProxyModel->setBrowseFilter(category, -1);
+}
+
+void MainWindow::playAlbum(qint64 group)
+{
+    if (group < 0) return;
+    const QVector<int> rows = trackListModel->browseIndex().rows(trackListModel->store(), MS::BrowseIndex::Albums, quint32(group));
+    if (!rows.isEmpty()) playRows(rows, rows.first());
+}
+
+void MainWindow::playRows(const QVector<int> &rows, int startRow)
+{
+    const MS::TrackStore &store = trackListModel->store();
+    QVector<quint32> ids;
+    ids.reserve(rows.size());
+    for (const int row : rows) ids << store.id(row);
+    mediaPlayer->playQueue()->replace(ids, store.id(startRow));
+    mediaPlayer->play();
+}
 
 void MainWindow::addFiles()
 {
@@ -488,33 +738,8 @@ void MainWindow::addFiles()
         QDir::homePath(),
         tr("Audio Files (*.mp3 *.flac *.m4a *.wav *.ogg *.aac *.opus *.aiff *.wma);;All Files (*)"));
     if (!files.isEmpty()) {
-        if (!scanner) {
-            scanner = new MS::Scanner(this);
-            connect(scanner, &MS::Scanner::trackDiscovered, this, [this](const MS::Track &t){
-                mediaPlayer->addToPlaylist(t.url);
-                trackListModel->addTrack(t);
-                // Basic album & Cover Flow population
-                QString album = t.album;
-                QString artist = t.artist;
-                QString year = t.year ? QString::number(t.year) : QString();
-                if (!album.isEmpty()) {
-                    bool found=false; for (int r=0;r<albumViewModel->rowCount();++r) if (albumViewModel->item(r)->text()==album) {found=true;break;}
-                    if (!found) {
-                        QStandardItem *albumItem = new QStandardItem(album);
-                        albumItem->setData(artist, Qt::UserRole + 1);
-                        albumItem->setIcon(QPixmap(":/gfx/icons/music.png").scaled(64,64));
-                        albumViewModel->appendRow(albumItem);
-                    }
-                }
-                QList<QStandardItem*> coverRow;
-                coverRow << new QStandardItem(album);
-                coverRow << new QStandardItem(artist);
-                coverRow << new QStandardItem(year);
-                coverFlowModel->appendRow(coverRow);
-                updateStatusSummary();
-            });
-        }
-        scanner->scanPaths(files);
+        ensureScanner();
+        scanner->scanPaths(files, MS::Scanner::Interactive);
     }
 }
 
@@ -522,6 +747,7 @@ void MainWindow::addFolder()
 {
     QString dir = QFileDialog::getExistingDirectory(this, tr("Add Folder"), QDir::homePath(), QFileDialog::ShowDirsOnly | QFileDialog::DontResolveSymlinks);
     if (!dir.isEmpty()) {
+        addLibraryRoots(QStringList() << dir);
         scanDirectory(dir);
     }
 }
@@ -566,69 +792,210 @@ void MainWindow::addToLibrary()
     }
     if (paths.isEmpty()) return;
 
-    if (!scanner) {
-        scanner = new MS::Scanner(this);
-        connect(scanner, &MS::Scanner::trackDiscovered, this, [this](const MS::Track &t){
-            mediaPlayer->addToPlaylist(t.url);
-            trackListModel->addTrack(t);
-            QString album = t.album;
-            QString artist = t.artist;
-            QString year = t.year ? QString::number(t.year) : QString();
-            if (!album.isEmpty()) {
-                bool found=false; for (int r=0;r<albumViewModel->rowCount();++r) if (albumViewModel->item(r)->text()==album) {found=true;break;}
-                if (!found) {
-                    QStandardItem *albumItem = new QStandardItem(album);
-                    albumItem->setData(artist, Qt::UserRole + 1);
-                    albumItem->setIcon(QPixmap(":/gfx/icons/music.png").scaled(128,128, Qt::KeepAspectRatio, Qt::SmoothTransformation));
-                    albumViewModel->appendRow(albumItem);
-                }
-            }
-            QList<QStandardItem*> coverRow;
-            QStandardItem *albumCell = new QStandardItem(album);
-            albumCell->setData(QIcon(":/gfx/icons/music.png"), Qt::DecorationRole);
-            coverRow << albumCell;
-            coverRow << new QStandardItem(artist);
-            coverRow << new QStandardItem(year);
-            coverFlowModel->appendRow(coverRow);
-            updateStatusSummary();
-        });
-    }
-    scanner->scanPaths(paths);
+    addLibraryRoots(paths);
+    ensureScanner();
+    scanner->scanPaths(paths, MS::Scanner::Interactive);
+}
+
+void MainWindow::ensureScanner()
+{
+    if (scanner) return;
+    scanner = new MS::Scanner(this);
+    connect(scanner, &MS::Scanner::tracksDiscovered, this, &MainWindow::onTracksDiscovered);
+    connect(scanner, &MS::Scanner::tracksModified, this, &MainWindow::onTracksModified);
+    connect(scanner, &MS::Scanner::tracksRemoved, this, &MainWindow::onTracksRemoved);
+    connect(scanner, &MS::Scanner::finished, this, [this]() {
+        qInfo().noquote() << "Library:" << trackListModel->store().memoryUsage().toString() << "+"
+                          << trackListModel->searchIndex().memoryBytes() / (1024 * 1024) << "MB search index";
+        queueLoudnessAnalysis();
+    });
 }
 
 void MainWindow::scanDirectory(const QString &path)
 {
-    if (!scanner) {
-        scanner = new MS::Scanner(this);
-        connect(scanner, &MS::Scanner::trackDiscovered, this, [this](const MS::Track &t){
-            // Add to playlist in same order
-            mediaPlayer->addToPlaylist(t.url);
-            trackListModel->addTrack(t);
-            // Album/CoverFlow population (simple for now)
-            QString album = t.album;
-            QString artist = t.artist;
-            QString year = t.year ? QString::number(t.year) : QString();
-            if (!album.isEmpty()) {
-                bool found=false; for (int r=0;r<albumViewModel->rowCount();++r) if (albumViewModel->item(r)->text()==album) {found=true;break;}
-                if (!found) {
-                    QStandardItem *albumItem = new QStandardItem(album);
-                    albumItem->setData(artist, Qt::UserRole + 1);
-                    albumItem->setIcon(QPixmap(":/gfx/icons/music.png").scaled(64,64));
-                    albumViewModel->appendRow(albumItem);
-                }
-            }
-            QList<QStandardItem*> coverRow;
-            QStandardItem *albumCell = new QStandardItem(album);
-            albumCell->setData(QIcon(":/gfx/icons/music.png"), Qt::DecorationRole);
-            coverRow << albumCell;
-            coverRow << new QStandardItem(artist);
-            coverRow << new QStandardItem(year);
-            coverFlowModel->appendRow(coverRow);
-            updateStatusSummary();
-        });
-    }
-    scanner->scanDirectory(path);
+    ensureScanner();
+    scanner->scanDirectory(path, MS::Scanner::Interactive);
 }
+
+void MainWindow::onTracksDiscovered(const QVector<MS::Track> &discovered)
+{
+    // Files the library already holds (e.g. restored without a fingerprint) are refreshed in place
+    QVector<MS::Track> tracks;
+    QVector<MS::Track> known;
+    tracks.reserve(discovered.size());
+    for (const MS::Track &t : discovered)
+        (trackListModel->rowOf(t.localPath) >= 0 ? known : tracks) << t;
+    if (!known.isEmpty()) onTracksModified(known);
+    if (tracks.isEmpty()) return;
+
+    // The album and browser models follow the track model on their own
+    const int first = trackListModel->rowCount();
+    trackListModel->addTracks(tracks);
+    // New tracks join the end of the queue, by id; URLs are made when they play
+    QVector<quint32> ids;
+    ids.reserve(tracks.size());
+    for (int row = first; row < trackListModel->rowCount(); ++row) ids << trackListModel->store().id(row);
+    mediaPlayer->playQueue()->append(ids);
+    scheduleStatusSummary();
+}
+
+void MainWindow::onTracksModified(const QVector<MS::Track> &tracks)
+{
+    for (const MS::Track &t : tracks) coldTags->invalidate(t.localPath);
+    trackListModel->updateTracks(tracks);
+    scheduleStatusSummary();
+}
+
+void MainWindow::onTracksRemoved(const QStringList &paths)
+{
+    QList<int> rows;
+    QVector<quint32> ids;
+    for (const QString &p : paths) {
+        coldTags->invalidate(p);
+        const int row = trackListModel->rowOf(p);
+        if (row < 0) continue;
+        rows << row;
+        ids << trackListModel->store().id(row);
+    }
+    mediaPlayer->playQueue()->remove(ids);
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    // Remove contiguous runs bottom-up so earlier rows keep their numbers
+    for (int i = 0; i < rows.size();) {
+        int j = i + 1;
+        while (j < rows.size() && rows.at(j) == rows.at(j - 1) - 1) ++j;
+        const int first = rows.at(j - 1);
+        const int count = j - i;
+        trackListModel->removeRows(first, count);
+        i = j;
+    }
+    scheduleStatusSummary();
+}
+
+void MainWindow::onFolderChanges(const MS::FolderChanges &changes)
+{
+    ensureScanner();
+    QStringList rescan = changes.changed;
+    for (const auto &move : changes.renamed) {
+        // Renames keep rating and play count; only the location changes
+        const QVector<QPair<QString, QString>> files = scanner->fingerprints().rename(move.first, move.second);
+        if (files.isEmpty()) {
+            rescan << move.second; // the source was never part of the library
+            continue;
+        }
+        // A whole directory moves as one path trie node; files go one by one.
+        // The play queue holds ids, so it follows without being touched.
+        const bool movedDirectory = trackListModel->moveDirectory(move.first, move.second);
+        if (movedDirectory) libraryDirty = true;
+        for (const auto &f : files) {
+            coldTags->invalidate(f.first);
+            if (!movedDirectory) trackListModel->renameTrack(f.first, f.second);
+        }
+    }
+    if (!rescan.isEmpty()) scanner->scanPaths(rescan);
+}
+
+void MainWindow::loadLibrarySnapshot()
+{
+    QElapsedTimer timer;
+    timer.start();
+    MS::LibrarySnapshot::Contents contents;
+    QString error;
+    if (!MS::LibrarySnapshot::read(MS::LibrarySnapshot::defaultPath(), contents, &error)) {
+        if (!error.isEmpty()) qWarning() << "Library snapshot: ignored:" << error;
+        return;
+    }
+    const qint64 readMs = timer.elapsed();
+    ensureScanner();
+    scanner->fingerprints().insert(contents.fingerprints);
+    onTracksDiscovered(contents.tracks);
+    qInfo() << "Library snapshot: restored" << contents.tracks.size() << "tracks in" << timer.elapsed()
+            << "ms (" << readMs << "ms reading)";
+    qInfo().noquote() << "Library:" << trackListModel->store().memoryUsage().toString();
+}
+
+void MainWindow::saveLibrarySnapshot(bool wait)
+{
+    if (snapshotWrite.isRunning()) {
+        if (!wait) return; // the next tick picks the changes up
+        snapshotWrite.waitForFinished();
+    }
+    if (!libraryDirty || !trackListModel) return;
+    libraryDirty = false;
+    // Both copies share their data by chunk, so a later change copies only what it touches
+    const MS::TrackStore tracks = trackListModel->store().snapshot();
+    const QHash<QString, MS::FileFingerprint> fingerprints =
+        scanner ? scanner->fingerprints().entries() : QHash<QString, MS::FileFingerprint>();
+    const QString path = MS::LibrarySnapshot::defaultPath();
+    auto job = [tracks, fingerprints, path]() {
+        QString error;
+        if (!MS::LibrarySnapshot::write(path, tracks, fingerprints, &error))
+            qWarning() << "Library snapshot: write failed:" << error;
+    };
+    if (wait) job();
+    else snapshotWrite = QtConcurrent::run(job);
+}
+
+void MainWindow::addLibraryRoots(const QStringList &paths)
+{
+    QSettings settings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic"));
+    QStringList roots = settings.value(QStringLiteral("library/roots")).toStringList();
+    for (const QString &p : paths) {
+        const QFileInfo fi(p);
+        if (!fi.isDir()) continue;
+        const QString root = QDir::cleanPath(fi.absoluteFilePath());
+        if (!roots.contains(root)) roots << root;
+        folderWatcher->addRoot(root);
+    }
+    settings.setValue(QStringLiteral("library/roots"), roots);
+}
+
+void MainWindow::queueLoudnessAnalysis()
+{
+    if (!loudnessAnalyzer || !trackListModel) return;
+    // Whole albums, so that an album's gain always covers all of its tracks.
+    // An album is its name in one directory: by name alone, every artist's
+    // "Greatest Hits" would be measured as one.
+    const MS::TrackStore &store = trackListModel->store();
+    QVector<MS::LoudnessAnalyzer::Job> jobs;
+    QSet<QPair<quint32, quint32>> albums; // directory, album
+    for (const quint32 id : trackListModel->unmeasuredIds()) {
+        const int row = store.rowOfId(id);
+        if (row < 0) continue;
+        const QString path = store.localPath(row);
+        if (loudnessAnalyzer->isQueued(path)) continue;
+        const quint32 album = store.albumId(row);
+        if (album != 0) {
+            albums.insert(qMakePair(store.directoryId(row), album));
+            continue;
+        }
+        MS::LoudnessAnalyzer::Job single;
+        single.paths << path;
+        single.sampleRates << store.sampleRate(row);
+        jobs << single;
+    }
+    for (const QPair<quint32, quint32> &album : albums) {
+        MS::LoudnessAnalyzer::Job job;
+        for (const int row : trackListModel->browseIndex().rows(store, MS::BrowseIndex::Albums, album.second)) {
+            if (store.directoryId(row) != album.first) continue;
+            job.paths << store.localPath(row);
+            job.sampleRates << store.sampleRate(row);
+        }
+        jobs << job;
+    }
+    loudnessAnalyzer->enqueue(jobs);
+}
+
+void MainWindow::restoreLibraryRoots()
+{
+    QSettings settings(QStringLiteral("Syndromatic"), QStringLiteral("MediaSonic"));
+    const QStringList roots = settings.value(QStringLiteral("library/roots")).toStringList();
+    for (const QString &root : roots) folderWatcher->addRoot(root);
+    // Catch up with whatever changed while we were not running; unchanged files cost one stat each
+    if (!roots.isEmpty() && trackListModel->rowCount() > 0) {
+        ensureScanner();
+        scanner->scanPaths(roots, MS::Scanner::Background);
+    }
+}
 
 void MainWindow::about()
 {
@@ -636,6 +1003,44 @@ void MainWindow::about()
     aboutDialog.exec();
 }
 
+void MainWindow::playSelectionNext()
+{
+    QTableView *view = coverFlowTrackList && coverFlowTrackList->isVisible() ? coverFlowTrackList : trackListView;
+    QModelIndexList selected = view->selectionModel()->selectedRows();
+    std::sort(selected.begin(), selected.end(), [](const QModelIndex &a, const QModelIndex &b) { return a.row() < b.row(); });
+    QVector<quint32> ids;
+    ids.reserve(selected.size());
+    for (const QModelIndex &index : qAsConst(selected)) {
+        const QModelIndex source = trackProxyModel->mapToSource(index);
+        if (source.isValid()) ids << trackListModel->store().id(source.row());
+    }
+    mediaPlayer->playQueue()->insertNext(ids);
+}
+
+void MainWindow::showTrackInfo()
+{
+    QTableView *view = coverFlowTrackList && coverFlowTrackList->isVisible() ? coverFlowTrackList : trackListView;
+    const QModelIndex current = view->currentIndex();
+    if (!current.isValid()) return;
+    const QModelIndex source = trackProxyModel->mapToSource(current);
+    if (!source.isValid()) return;
+    TrackInfo dialog(trackListModel->trackAt(source.row()), coldTags, this);
+    dialog.exec();
+}
+
+void MainWindow::scheduleStatusSummary()
+{
+    // Imports deliver a batch every few milliseconds; repaint the summary at
+    // most once per frame
+    if (!statusSummaryTimer) {
+        statusSummaryTimer = new QTimer(this);
+        statusSummaryTimer->setSingleShot(true);
+        statusSummaryTimer->setInterval(16);
+        connect(statusSummaryTimer, &QTimer::timeout, this, &MainWindow::updateStatusSummary);
+    }
+    if (!statusSummaryTimer->isActive()) statusSummaryTimer->start();
+}
+
 void MainWindow::updateStatusSummary()
 {
     if (!statusSummaryLabel) return;
@@ -646,22 +1051,22 @@ void MainWindow::updateStatusSummary()
         return;
     }
     
-    // Calculate total duration from model
+    // Running totals kept by the model, O(1) to read
     qint64 totalDuration = trackListModel->totalDurationMs();
     
     int totalMinutes = totalDuration / 60000;
     int totalSeconds = (totalDuration % 60000) / 1000;
     
-    // Calculate total size (placeholder until file sizes are stored)
     qint64 totalSize = trackListModel->totalSizeBytes();
-    double totalSizeMB = totalSize / (1024.0 * 1024.0);
     
-    QString summary = QString("%1 %2, %3:%4, %5 MB")
+    QString summary = QString("%1 %2, %3:%4, %5")
                      .arg(trackCount)
                      .arg(trackCount == 1 ? i18n("track") : i18n("tracks"))
                      .arg(totalMinutes)
                      .arg(totalSeconds, 2, 10, QChar('0'))
-                     .arg(QString::number(totalSizeMB, 'f', 1));
+                     .arg(KFormat().formatByteSize(double(totalSize), 1));
     
     statusSummaryLabel->setText(summary);
+    statusSummaryLabel->setToolTip(i18n("%1 albums, %2 artists, %3 genres", trackListModel->albumCount(),
+                                        trackListModel->artistCount(), trackListModel->genreCount()));
 }
@@ -27,11 +27,14 @@
 #include "flow.h"
 #include "mediaplayer.h"
 #include "topbar.h"
+#include "models/browseindex.h"
 #include <QStackedWidget>
 #include <QSortFilterProxyModel>
+#include <QVector>
+#include <QFuture>
 
 // Forward declarations for MS namespace types used as pointers
-namespace MS { class TrackModel; class VisualizerBridge; class Scanner; }
+namespace MS { class TrackModel; class LibraryProxyModel; class BrowseModel; class VisualizerBridge; class Scanner; class FolderWatcher; class ColdTagCache; class LoudnessAnalyzer; struct Track; struct FolderChanges; }
 
 class QTableView;
 class QSplitter;
@@ -39,6 +42,7 @@ class QTreeView;
 class QLabel;
 class QSlider;
 class QListView;
+class QTimer;
 
 class MainWindow : public QMainWindow
 {
@@ -53,13 +57,31 @@ private slots:
     void addFolder();
     void addToLibrary();
     void about();
+    void showTrackInfo();
+    void playSelectionNext();
+    void onTracksDiscovered(const QVector<MS::Track> &tracks);
+    void onTracksModified(const QVector<MS::Track> &tracks);
+    void onTracksRemoved(const QStringList &paths);
+    void onFolderChanges(const MS::FolderChanges &changes);
 
 private:
     void setupUi();
     void setupMenuBar();
     void createModels();
+    void ensureScanner();
     void scanDirectory(const QString &path);
+    void scheduleStatusSummary();
     void updateStatusSummary();
+    void loadLibrarySnapshot();
+    void saveLibrarySnapshot(bool wait);
+    void addLibraryRoots(const QStringList &paths);
+    void restoreLibraryRoots();
+    // Queues every album with a track whose loudness was not measured yet.
+    void queueLoudnessAnalysis();
+    void setBrowseCategory(MS::BrowseIndex::Category category);
+    void playAlbum(qint64 group);
+    // Makes rows the play queue and starts playing at startRow.
+    void playRows(const QVector<int> &rows, int startRow);
 
     // Main UI components
     TopBar *topBar;
@@ -73,6 +95,7 @@ private:
     QTreeView *sidebar;
     QStackedWidget *mainViewStack;
     QTableView *trackListView;
+    QListView *columnBrowser;
     QListView *albumListView;
     QTableView *coverFlowTrackList;
     Flow *coverFlow;
@@ -81,20 +104,32 @@ private:
     // Models
     QStandardItemModel *sidebarModel;
     MS::TrackModel *trackListModel;
-    QSortFilterProxyModel *trackProxyModel;
-    QStandardItemModel *coverFlowModel;
-    QStandardItemModel *albumViewModel;
+    MS::LibraryProxyModel *trackProxyModel;
+    MS::BrowseModel *albumBrowseModel;  // album view and Cover Flow
+    MS::BrowseModel *columnBrowseModel; // column browser above the track list
 
     // Media Player & services
     MediaPlayer *mediaPlayer;
     MS::VisualizerBridge *visualizer;
     MS::Scanner *scanner;
+    MS::FolderWatcher *folderWatcher = nullptr;
+    MS::ColdTagCache *coldTags = nullptr; // Get Info details, read on demand
+    MS::LoudnessAnalyzer *loudnessAnalyzer = nullptr; // ReplayGain, in the background
+
+    // Library persistence
+    QTimer *snapshotTimer = nullptr;
+    bool libraryDirty = false;
+    QFuture<void> snapshotWrite;
+
+    // Whether the current track's play was counted yet
+    bool playCounted = false;
 
     // Status bar widgets
     QLabel *trackInfoLabel;
     QLabel *timeLabel;
     QSlider *timeSlider;
     QLabel *statusSummaryLabel;
+    QTimer *statusSummaryTimer = nullptr;
 };
 
 #endif // MAINWINDOW_H
@@ -20,76 +20,232 @@
  */
 
 #include "mediaplayer.h"
+#include "audio/audioengine.h"
+#include "audio/dspchain.h"
+#include "models/playqueue.h"
 
 MediaPlayer::MediaPlayer(QObject *parent) : QObject(parent)
 {
     player = new QMediaPlayer(this);
-    playlist = new QMediaPlaylist(this);
-    player->setPlaylist(playlist);
+    queue = new MS::PlayQueue(this);
+    nextId = MS::PlayQueue::kNoTrack;
     player->setObjectName(QStringLiteral("MediaPlayerCoreObject"));
 
     connect(player, &QMediaPlayer::currentMediaChanged, this, &MediaPlayer::currentMediaChanged);
     connect(player, &QMediaPlayer::durationChanged, this, &MediaPlayer::durationChanged);
     connect(player, &QMediaPlayer::positionChanged, this, &MediaPlayer::positionChanged);
     connect(player, &QMediaPlayer::stateChanged, this, &MediaPlayer::stateChanged);
+    connect(player, &QMediaPlayer::mediaStatusChanged, this, [this](QMediaPlayer::MediaStatus status) {
+        // QMediaPlayer holds one entry; moving on to the next is ours to do
+        if (gapless || status != QMediaPlayer::EndOfMedia) return;
+        advancing = true;
+        queue->next();
+        advancing = false;
+    });
+
+    engine = new MS::AudioEngine(this);
+    connect(engine, &MS::AudioEngine::positionChanged, this, [this](qint64 ms) {
+        if (gapless) emit positionChanged(ms);
+    });
+    connect(engine, &MS::AudioEngine::durationChanged, this, [this](qint64 ms) {
+        if (gapless) emit durationChanged(ms);
+    });
+    connect(engine, &MS::AudioEngine::stateChanged, this, [this](MS::AudioEngine::State st) {
+        if (!gapless) return;
+        emit stateChanged(st == MS::AudioEngine::PlayingState ? QMediaPlayer::PlayingState
+                          : st == MS::AudioEngine::PausedState ? QMediaPlayer::PausedState
+                                                               : QMediaPlayer::StoppedState);
+    });
+    connect(engine, &MS::AudioEngine::currentChanged, this, [this]() {
+        advancing = true;
+        queue->setCurrent(nextId);
+        advancing = false;
+        emit currentMediaChanged(QMediaContent(queue->currentUrl()));
+        updateNext();
+    });
+    connect(engine, &MS::AudioEngine::transitionMeasured, this, &MediaPlayer::transitionGapMeasured);
+    // The limiter last, so that nothing the equalizer boosts can clip
+    eq = new MS::ParametricEq;
+    limiter = new MS::Limiter;
+    engine->addStage(eq);
+    engine->addStage(limiter);
+    updateLimiter();
+
+    connect(queue, &MS::PlayQueue::currentChanged, this, &MediaPlayer::onCurrentChanged);
+    connect(queue, &MS::PlayQueue::changed, this, &MediaPlayer::updateNext);
 }
-
-void MediaPlayer::addToPlaylist(const QUrl &url)
-{
-    playlist->addMedia(url);
+
+MediaPlayer::~MediaPlayer()
+{
+    // The engine outlives this destructor; it must stop calling the stages first
+    engine->removeStage(limiter);
+    engine->removeStage(eq);
+    delete limiter;
+    delete eq;
+}
+
+void MediaPlayer::setGapless(bool on)
+{
+    if (on == gapless) return;
+    if (on) {
+        player->stop();
+        player->setMedia(QMediaContent());
+    } else {
+        engine->stop();
+        gain = gainOf(queue->currentId());
+        applyVolume();
+        player->setMedia(QMediaContent(queue->currentUrl()));
+    }
+    gapless = on;
+    updateNext();
+}
+
+void MediaPlayer::setGainMode(GainMode mode)
+{
+    if (mode == gainMode) return;
+    gainMode = mode;
+    gain = gainOf(queue->currentId());
+    applyVolume();
+    updateNext();
+}
+
+float MediaPlayer::gainOf(quint32 id) const
+{
+    if (gainMode == NoGain || !gainResolver || id == MS::PlayQueue::kNoTrack) return 1.0f;
+    return gainResolver(id, gainMode);
+}
+
+void MediaPlayer::applyVolume()
+{
+    // QMediaPlayer cannot amplify; tracks that need a boost stay at volume there
+    player->setVolume(qRound(volume * qMin(1.0f, gain)));
+    engine->setVolume(volume / 100.0f);
+}
+
+qint64 MediaPlayer::lastTransitionGap() const
+{
+    return engine->lastTransitionGap();
+}
+
+void MediaPlayer::setEqualizer(const MS::ParametricEq::Settings &settings)
+{
+    eq->setSettings(settings);
+    updateLimiter();
+}
+
+void MediaPlayer::setCrossfade(int ms)
+{
+    engine->setCrossfade(ms);
+}
+
+void MediaPlayer::updateLimiter()
+{
+    // Without a boost nothing can go over full scale, and the limiter would only delay and squash
+    const bool boost = !eq->isFlat() || gainOf(queue->currentId()) > 1.0f || gainOf(nextId) > 1.0f;
+    limiter->setBypassed(!boost);
+}
+
+void MediaPlayer::onCurrentChanged()
+{
+    if (advancing && gapless) return; // the engine is already playing it
+    const QUrl url = queue->currentUrl();
+    if (!gapless) {
+        // Like QMediaPlaylist: a new entry starts at once if something was playing
+        const bool resume = advancing || player->state() == QMediaPlayer::PlayingState;
+        gain = gainOf(queue->currentId());
+        applyVolume();
+        player->setMedia(url.isEmpty() ? QMediaContent() : QMediaContent(url));
+        if (resume && !url.isEmpty()) player->play();
+        return;
+    }
+    emit currentMediaChanged(QMediaContent(url));
+    if (engine->state() != MS::AudioEngine::StoppedState) {
+        if (url.isEmpty()) engine->stop();
+        else engine->play(url, gainOf(queue->currentId()));
+    }
+    updateNext();
+}
+
+void MediaPlayer::updateNext()
+{
+    if (gapless && engine->state() != MS::AudioEngine::StoppedState) {
+        const int next = queue->nextPosition();
+        nextId = queue->idAt(next);
+        engine->setNext(queue->urlAt(next), gainOf(nextId));
+    }
+    updateLimiter();
 }
 
 void MediaPlayer::play()
 {
-    player->play();
+    if (queue->currentPosition() < 0) queue->setCurrentPosition(0);
+    if (queue->currentPosition() < 0) return; // empty
+    if (!gapless) {
+        if (player->media().isNull()) {
+            gain = gainOf(queue->currentId());
+            applyVolume();
+            player->setMedia(QMediaContent(queue->currentUrl()));
+        }
+        player->play();
+        return;
+    }
+    if (engine->state() == MS::AudioEngine::PausedState) {
+        engine->resume();
+    } else if (engine->state() == MS::AudioEngine::StoppedState) {
+        engine->play(queue->currentUrl(), gainOf(queue->currentId()));
+        updateNext();
+    }
 }
 
 void MediaPlayer::pause()
 {
-    player->pause();
+    if (gapless) engine->pause();
+    else player->pause();
 }
 
 void MediaPlayer::stop()
 {
-    player->stop();
+    if (gapless) engine->stop();
+    else player->stop();
 }
 
 QVariant MediaPlayer::metaData(const QString &key) const
 {
-    return player->metaData(key);
+    if (!gapless) return player->metaData(key);
+    // QMediaPlayer sits idle in gapless mode; the queue knows what the engine plays
+    const quint32 id = queue->currentId();
+    if (!metaDataResolver || id == MS::PlayQueue::kNoTrack) return QVariant();
+    return metaDataResolver(id, key);
 }
 
 qint64 MediaPlayer::duration() const
 {
-    return player->duration();
+    return gapless ? engine->duration() : player->duration();
 }
 
 qint64 MediaPlayer::position() const
 {
-    return player->position();
+    return gapless ? engine->position() : player->position();
 }
 
 void MediaPlayer::setPosition(qint64 position)
 {
-    player->setPosition(position);
-}
-
-QMediaPlaylist* MediaPlayer::getPlaylist()
-{
-    return playlist;
+    if (gapless) engine->seek(position);
+    else player->setPosition(position);
 }
 
 void MediaPlayer::setVolume(int volume)
 {
-    player->setVolume(qBound(0, volume, 100));
+    this->volume = qBound(0, volume, 100);
+    applyVolume();
 }
 
 void MediaPlayer::next()
 {
-    if (playlist) playlist->next();
+    queue->next();
 }
 
 void MediaPlayer::previous()
 {
-    if (playlist) playlist->previous();
+    queue->previous();
 }
@@ -24,21 +24,56 @@
 
 #include <QObject>
 #include <QMediaPlayer>
-#include <QMediaPlaylist>
 #include <QMediaMetaData>
+#include <functional>
+#include "audio/dspchain.h"
+
+namespace MS { class AudioEngine; class PlayQueue; }
 
 class MediaPlayer : public QObject
 {
     Q_OBJECT
 public:
     explicit MediaPlayer(QObject *parent = nullptr);
+    ~MediaPlayer() override;
 
-    void addToPlaylist(const QUrl &url);
+    // Tags of the entry playing, by QMediaMetaData key. The engine reads no
+    // tags, so in gapless mode they come from the metadata resolver.
     QVariant metaData(const QString &key) const;
     qint64 duration() const;
     qint64 position() const;
-    QMediaPlaylist* getPlaylist();
+    // What plays, in order, by stable track id. QMediaPlayer is handed one
+    // entry at a time, so reordering or shuffling the queue never rebuilds
+    // anything on the playback side.
+    MS::PlayQueue* playQueue() { return queue; }
     QMediaPlayer* backend() { return player; }
+    MS::AudioEngine* audioEngine() { return engine; }
+
+    // ReplayGain: each track is levelled by its own gain or by its album's.
+    enum GainMode { NoGain, TrackGain, AlbumGain };
+    // Linear gain of a queue entry under a mode; 1.0 for unmeasured tracks.
+    using GainResolver = std::function<float(quint32 id, GainMode mode)>;
+    void setGainResolver(const GainResolver &resolver) { gainResolver = resolver; }
+    // Tags of a queue entry by QMediaMetaData key; a null QVariant if unknown.
+    using MetaDataResolver = std::function<QVariant(quint32 id, const QString &key)>;
+    void setMetaDataResolver(const MetaDataResolver &resolver) { metaDataResolver = resolver; }
+    // Applies from the next track on in gapless mode, at once otherwise.
+    void setGainMode(GainMode mode);
+    GainMode getGainMode() const { return gainMode; }
+
+    // Gapless mode plays through MS::AudioEngine instead of QMediaPlayer,
+    // which joins consecutive queue entries without a gap. The queue is the
+    // same either way.
+    void setGapless(bool on);
+    bool isGapless() const { return gapless; }
+    // Silent frames at the last gapless transition; -1 before the first.
+    qint64 lastTransitionGap() const;
+    // Gapless mode only: the equalizer ahead of the engine's limiter, and
+    // the overlap between consecutive queue entries (0 ms for none). The
+    // limiter is bypassed unless something boosts: an equalizer that is not
+    // flat, or a ReplayGain factor above 1.
+    void setEqualizer(const MS::ParametricEq::Settings &settings);
+    void setCrossfade(int ms);
 
 public slots:
     void play();
@@ -54,11 +89,29 @@ signals:
     void durationChanged(qint64 duration);
     void positionChanged(qint64 position);
     void stateChanged(QMediaPlayer::State state);
+    void transitionGapMeasured(qint64 frames);
 
 
 private:
+    void onCurrentChanged();
+    void updateNext();
+    float gainOf(quint32 id) const;
+    void applyVolume();
+    void updateLimiter();
+
     QMediaPlayer *player;
-    QMediaPlaylist *playlist;
+    MS::PlayQueue *queue;
+    MS::AudioEngine *engine;
+    MS::ParametricEq *eq;
+    MS::Limiter *limiter;
+    bool gapless = false;
+    bool advancing = false; // playback moved on by itself; the queue follows
+    quint32 nextId;         // queue entry the engine continues with
+    GainResolver gainResolver;
+    MetaDataResolver metaDataResolver;
+    GainMode gainMode = NoGain;
+    int volume = 100;
+    float gain = 1.0f;      // of the entry QMediaPlayer holds
 };
 
 #endif // MEDIAPLAYER_H
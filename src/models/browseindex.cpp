@@ -0,0 +1,101 @@
+#include "models/browseindex.h"
+#include <algorithm>
+
+using namespace MS;
+
+void BrowseIndex::add(const TrackStore &store, int row)
+{
+    const quint32 id = store.id(row);
+    for (int c = 0; c < CategoryCount; ++c) {
+        const quint32 group = groupOf(store, Category(c), row);
+        QVector<QVector<quint32>> &groups = m_groups[c];
+        QVector<qint32> &positions = m_positions[c];
+        if (int(group) >= groups.size()) groups.resize(int(group) + 1);
+        if (int(id) >= positions.size()) positions.resize(int(id) + 1);
+        positions[int(id)] = groups.at(int(group)).size();
+        groups[int(group)] << id;
+    }
+}
+
+void BrowseIndex::remove(const TrackStore &store, int row)
+{
+    const quint32 id = store.id(row);
+    for (int c = 0; c < CategoryCount; ++c) {
+        const quint32 group = groupOf(store, Category(c), row);
+        QVector<qint32> &positions = m_positions[c];
+        if (int(group) >= m_groups[c].size() || int(id) >= positions.size()) continue;
+        QVector<quint32> &list = m_groups[c][int(group)];
+        const int slot = positions.at(int(id));
+        if (slot < 0 || slot >= list.size() || list.at(slot) != id) continue;
+        const quint32 moved = list.last();
+        list[slot] = moved;
+        positions[int(moved)] = slot;
+        list.removeLast();
+        positions[int(id)] = -1;
+        if (list.isEmpty()) list.squeeze();
+    }
+}
+
+void BrowseIndex::clear()
+{
+    *this = BrowseIndex();
+}
+
+quint32 BrowseIndex::groupOf(const TrackStore &store, Category category, int row)
+{
+    switch (category) {
+    case Albums: return store.albumId(row);
+    case Artists: return store.artistId(row);
+    case Genres: return store.genreId(row);
+    case Composers: return store.composerId(row);
+    default: return 0;
+    }
+}
+
+const StringDictionary &BrowseIndex::values(const TrackStore &store, Category category)
+{
+    switch (category) {
+    case Artists: return store.artists();
+    case Genres: return store.genres();
+    case Composers: return store.composers();
+    default: return store.albums();
+    }
+}
+
+const QVector<quint32> &BrowseIndex::tracks(Category category, quint32 group) const
+{
+    static const QVector<quint32> none;
+    const QVector<QVector<quint32>> &groups = m_groups[category];
+    return int(group) < groups.size() ? groups.at(int(group)) : none;
+}
+
+QVector<int> BrowseIndex::rows(const TrackStore &store, Category category, quint32 group) const
+{
+    QVector<int> out;
+    const QVector<quint32> &ids = tracks(category, group);
+    out.reserve(ids.size());
+    for (const quint32 id : ids) {
+        const int row = store.rowOfId(id);
+        if (row >= 0) out << row;
+    }
+    std::sort(out.begin(), out.end(), [&store](int a, int b) {
+        if (store.discNumber(a) != store.discNumber(b)) return store.discNumber(a) < store.discNumber(b);
+        if (store.trackNumber(a) != store.trackNumber(b)) return store.trackNumber(a) < store.trackNumber(b);
+        return a < b;
+    });
+    return out;
+}
+
+qint64 BrowseIndex::memoryBytes() const
+{
+    // Rough heap cost of one group's QVector header.
+    constexpr qint64 kGroupBytes = 24;
+    qint64 bytes = 0;
+    for (int c = 0; c < CategoryCount; ++c) {
+        bytes += qint64(m_positions[c].capacity()) * qint64(sizeof(qint32));
+        bytes += qint64(m_groups[c].capacity()) * qint64(sizeof(QVector<quint32>));
+        for (const QVector<quint32> &list : m_groups[c])
+            if (list.capacity()) bytes += kGroupBytes + qint64(list.capacity()) * qint64(sizeof(quint32));
+    }
+    return bytes;
+}
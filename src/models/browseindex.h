@@ -0,0 +1,61 @@
+/*
+ * BrowseIndex - the library's tracks grouped by album, artist, genre and
+ * composer
+ *
+ * A group is keyed by the store's dictionary id of its value, so going from
+ * a name to its group is the dictionary's hash lookup and going from a group
+ * to its tracks is an array access. Each group lists the stable ids of its
+ * tracks and is updated one track at a time as rows are added, retagged and
+ * removed, so nothing that browses the library ("play this album", the
+ * album view, the column browser) has to scan it.
+ */
+#ifndef MEDIASONIC_MODELS_BROWSEINDEX_H
+#define MEDIASONIC_MODELS_BROWSEINDEX_H
+
+#include <QVector>
+#include "models/trackstore.h"
+
+namespace MS {
+
+class BrowseIndex
+{
+public:
+    enum Category {
+        Albums = 0,
+        Artists,
+        Genres,
+        Composers,
+        CategoryCount
+    };
+
+    // Keep the index in step with the store: add() once a row was appended or
+    // retagged, remove() before a row is retagged or removed.
+    void add(const TrackStore &store, int row);
+    void remove(const TrackStore &store, int row);
+    void clear();
+
+    // The group of a row in a category (its value's dictionary id); group 0
+    // holds the tracks without a value.
+    static quint32 groupOf(const TrackStore &store, Category category, int row);
+    static const StringDictionary &values(const TrackStore &store, Category category);
+
+    // Stable ids of the group's tracks, in no particular order.
+    const QVector<quint32> &tracks(Category category, quint32 group) const;
+    int trackCount(Category category, quint32 group) const { return tracks(category, group).size(); }
+    // One past the largest group that ever held a track.
+    int groupLimit(Category category) const { return m_groups[category].size(); }
+    // Store rows of the group in album order: disc, track, then row.
+    QVector<int> rows(const TrackStore &store, Category category, quint32 group) const;
+
+    qint64 memoryBytes() const;
+
+private:
+    QVector<QVector<quint32>> m_groups[CategoryCount];
+    // Position of each track (by stable id) in its group's list, so removal
+    // is a swap with the last entry instead of a search.
+    QVector<qint32> m_positions[CategoryCount];
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_BROWSEINDEX_H
@@ -0,0 +1,261 @@
+#include "models/browsemodel.h"
+#include "models/trackmodel.h"
+#include <KLocalizedString>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+using namespace MS;
+
+namespace {
+
+// An update inserting or removing more groups than this resets the model
+// instead: every insertion and removal is a signal each view handles alone.
+constexpr int kMaxRowSignals = 64;
+
+}
+
+BrowseModel::BrowseModel(TrackModel *tracks, BrowseIndex::Category category, QObject *parent)
+    : QAbstractTableModel(parent)
+    , m_tracks(tracks)
+    , m_category(category)
+    , m_albumIcon(QStringLiteral(":/gfx/icons/music.png"))
+{
+    m_collator.setCaseSensitivity(Qt::CaseInsensitive);
+    m_collator.setNumericMode(true);
+    connect(m_tracks, &QAbstractItemModel::rowsInserted, this, &BrowseModel::sync);
+    connect(m_tracks, &QAbstractItemModel::rowsRemoved, this, &BrowseModel::sync);
+    // A retag can change an album's artist or year without changing its size;
+    // rating edits touch neither and leave the albums alone.
+    connect(m_tracks, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex &topLeft) {
+        sync();
+        if (m_category == BrowseIndex::Albums && topLeft.column() <= TrackModel::ColAlbum) refreshAll();
+    });
+    connect(m_tracks, &QAbstractItemModel::modelReset, this, [this]() {
+        beginResetModel();
+        rebuild();
+        endResetModel();
+    });
+    rebuild();
+}
+
+void BrowseModel::setCategory(BrowseIndex::Category category)
+{
+    if (category == m_category) return;
+    beginResetModel();
+    m_category = category;
+    rebuild();
+    endResetModel();
+}
+
+void BrowseModel::setShowAll(bool show)
+{
+    if (show == m_showAll) return;
+    beginResetModel();
+    m_showAll = show;
+    endResetModel();
+}
+
+qint64 BrowseModel::groupAt(int row) const
+{
+    const int i = row - firstGroupRow();
+    return i >= 0 && i < m_groups.size() ? qint64(m_groups.at(i)) : -1;
+}
+
+int BrowseModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : firstGroupRow() + m_groups.size();
+}
+
+int BrowseModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : ColCount;
+}
+
+QVariant BrowseModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= rowCount()) return QVariant();
+    const qint64 group = groupAt(index.row());
+    if (group < 0) {
+        if (role == Qt::DisplayRole && index.column() == ColName)
+            return allLabel();
+        if (role == GroupRole) return qint64(-1);
+        return QVariant();
+    }
+    const quint32 g = quint32(group);
+    const bool albums = m_category == BrowseIndex::Albums;
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case ColName: return name(g);
+        case ColArtist: return albums ? albumArtist(g) : QString();
+        case ColYear: {
+            const int year = albums ? albumYear(g) : 0;
+            return year ? QString::number(year) : QString();
+        }
+        default: break;
+        }
+        break;
+    case Qt::DecorationRole:
+        if (albums && index.column() == ColName) return m_albumIcon;
+        break;
+    case Qt::ToolTipRole:
+        return i18np("%1 track", "%1 tracks", m_tracks->browseIndex().trackCount(m_category, g));
+    case GroupRole:
+        return group;
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+QVariant BrowseModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+        switch (section) {
+        case ColName:
+            switch (m_category) {
+            case BrowseIndex::Artists: return i18n("Artist");
+            case BrowseIndex::Genres: return i18n("Genre");
+            case BrowseIndex::Composers: return i18n("Composer");
+            default: return i18n("Album");
+            }
+        case ColArtist: return i18n("Artist");
+        case ColYear: return i18n("Year");
+        }
+    }
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+void BrowseModel::sync()
+{
+    const BrowseIndex &browse = m_tracks->browseIndex();
+    const int limit = browse.groupLimit(m_category);
+    if (m_counts.size() < limit) m_counts.resize(limit);
+
+    // Group 0 holds the tracks without a value and is never listed.
+    QVector<quint32> added;
+    for (int g = 1; g < limit; ++g)
+        if (m_counts.at(g) == 0 && browse.trackCount(m_category, quint32(g)) > 0) added << quint32(g);
+    QVector<QPair<int, int>> removed; // ranges of m_groups
+    for (int i = 0; i < m_groups.size(); ++i) {
+        if (browse.trackCount(m_category, m_groups.at(i)) > 0) continue;
+        if (!removed.isEmpty() && removed.last().second == i - 1) removed.last().second = i;
+        else removed << qMakePair(i, i);
+    }
+    if (added.size() + removed.size() > kMaxRowSignals) {
+        beginResetModel();
+        rebuild();
+        endResetModel();
+        return;
+    }
+
+    for (int r = removed.size() - 1; r >= 0; --r) {
+        const QPair<int, int> range = removed.at(r);
+        beginRemoveRows(QModelIndex(), firstGroupRow() + range.first, firstGroupRow() + range.second);
+        for (int i = range.first; i <= range.second; ++i) m_counts[int(m_groups.at(i))] = 0;
+        m_groups.remove(range.first, range.second - range.first + 1);
+        endRemoveRows();
+    }
+    auto less = [this](quint32 a, quint32 b) { return lessThan(a, b); };
+    std::sort(added.begin(), added.end(), less);
+    for (const quint32 g : added) {
+        const int i = int(std::upper_bound(m_groups.constBegin(), m_groups.constEnd(), g, less) - m_groups.constBegin());
+        beginInsertRows(QModelIndex(), firstGroupRow() + i, firstGroupRow() + i);
+        m_groups.insert(i, g);
+        m_counts[int(g)] = browse.trackCount(m_category, g);
+        endInsertRows();
+    }
+
+    // Listed groups that gained or lost tracks.
+    int top = -1, bottom = -1;
+    for (int i = 0; i < m_groups.size(); ++i) {
+        const quint32 g = m_groups.at(i);
+        const int count = browse.trackCount(m_category, g);
+        if (count == m_counts.at(int(g))) continue;
+        m_counts[int(g)] = count;
+        if (top < 0) top = i;
+        bottom = i;
+    }
+    if (top >= 0) emit dataChanged(index(firstGroupRow() + top, 0), index(firstGroupRow() + bottom, ColCount - 1));
+    if (m_showAll && (top >= 0 || !added.isEmpty() || !removed.isEmpty()))
+        emit dataChanged(index(0, 0), index(0, ColCount - 1));
+}
+
+void BrowseModel::rebuild()
+{
+    const BrowseIndex &browse = m_tracks->browseIndex();
+    const int limit = browse.groupLimit(m_category);
+    QVector<quint32> groups;
+    m_counts.fill(0, limit);
+    for (int g = 1; g < limit; ++g) {
+        const int count = browse.trackCount(m_category, quint32(g));
+        if (count == 0) continue;
+        groups << quint32(g);
+        m_counts[g] = count;
+    }
+    // Sort keys: a library restore lists tens of thousands of albums at once.
+    std::vector<QCollatorSortKey> keys;
+    keys.reserve(size_t(groups.size()));
+    for (const quint32 g : groups) keys.push_back(m_collator.sortKey(name(g)));
+    QVector<int> order(groups.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        const int c = keys[size_t(a)].compare(keys[size_t(b)]);
+        return c != 0 ? c < 0 : groups.at(a) < groups.at(b);
+    });
+    m_groups.clear();
+    m_groups.reserve(groups.size());
+    for (const int i : order) m_groups << groups.at(i);
+}
+
+void BrowseModel::refreshAll()
+{
+    if (rowCount() > 0) emit dataChanged(index(0, 0), index(rowCount() - 1, ColCount - 1));
+}
+
+bool BrowseModel::lessThan(quint32 a, quint32 b) const
+{
+    const int c = m_collator.compare(name(a), name(b));
+    return c != 0 ? c < 0 : a < b;
+}
+
+QString BrowseModel::name(quint32 group) const
+{
+    return BrowseIndex::values(m_tracks->store(), m_category).at(group);
+}
+
+QString BrowseModel::allLabel() const
+{
+    const int count = m_groups.size();
+    switch (m_category) {
+    case BrowseIndex::Artists: return i18np("All (%1 Artist)", "All (%1 Artists)", count);
+    case BrowseIndex::Genres: return i18np("All (%1 Genre)", "All (%1 Genres)", count);
+    case BrowseIndex::Composers: return i18np("All (%1 Composer)", "All (%1 Composers)", count);
+    default: return i18np("All (%1 Album)", "All (%1 Albums)", count);
+    }
+}
+
+QString BrowseModel::albumArtist(quint32 group) const
+{
+    const TrackStore &store = m_tracks->store();
+    qint64 artist = -1;
+    for (const quint32 id : m_tracks->browseIndex().tracks(m_category, group)) {
+        const int row = store.rowOfId(id);
+        if (row < 0) continue;
+        if (artist < 0) artist = store.artistId(row);
+        else if (artist != qint64(store.artistId(row))) return i18n("Various Artists");
+    }
+    return artist < 0 ? QString() : store.artists().at(quint32(artist));
+}
+
+int BrowseModel::albumYear(quint32 group) const
+{
+    const TrackStore &store = m_tracks->store();
+    int year = 0;
+    for (const quint32 id : m_tracks->browseIndex().tracks(m_category, group)) {
+        const int row = store.rowOfId(id);
+        if (row >= 0) year = qMax(year, store.year(row));
+    }
+    return year;
+}
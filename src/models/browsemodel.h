@@ -0,0 +1,74 @@
+/*
+ * BrowseModel - the groups of one BrowseIndex category as a flat list, for
+ * the album view, Cover Flow and the column browser
+ *
+ * Rows are the non-empty groups in collated name order, optionally led by an
+ * "All" row. The model follows the TrackModel it browses: a group is inserted
+ * in place when it gets its first track and removed when it loses its last,
+ * and only groups whose track count changed are reported as changed.
+ */
+#ifndef MEDIASONIC_MODELS_BROWSEMODEL_H
+#define MEDIASONIC_MODELS_BROWSEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QCollator>
+#include <QIcon>
+#include <QVector>
+#include "models/browseindex.h"
+
+namespace MS {
+
+class TrackModel;
+
+class BrowseModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    // Flow reads the album from column 0 and the artist from column 1.
+    enum Columns {
+        ColName = 0,
+        ColArtist,
+        ColYear,
+        ColCount
+    };
+    // Group id of a row; -1 on the "All" row.
+    static constexpr int GroupRole = Qt::UserRole + 1;
+
+    BrowseModel(TrackModel *tracks, BrowseIndex::Category category, QObject *parent = nullptr);
+
+    BrowseIndex::Category category() const { return m_category; }
+    void setCategory(BrowseIndex::Category category);
+    // Leads the list with an "All (n Artists)" row.
+    void setShowAll(bool show);
+
+    // Group of a row, or -1 for the "All" row and rows out of range.
+    qint64 groupAt(int row) const;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
+
+private:
+    void sync();
+    void rebuild();
+    void refreshAll();
+    bool lessThan(quint32 a, quint32 b) const;
+    QString name(quint32 group) const;
+    QString allLabel() const;
+    QString albumArtist(quint32 group) const;
+    int albumYear(quint32 group) const;
+    int firstGroupRow() const { return m_showAll ? 1 : 0; }
+
+    TrackModel *m_tracks;
+    BrowseIndex::Category m_category;
+    bool m_showAll = false;
+    QCollator m_collator;
+    QIcon m_albumIcon;
+    QVector<quint32> m_groups; // listed groups, in row order after the "All" row
+    QVector<int> m_counts;     // track count per group id when last listed; 0 if not listed
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_BROWSEMODEL_H
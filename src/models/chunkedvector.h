@@ -0,0 +1,109 @@
+/*
+ * ChunkedVector - a vector stored as fixed-size, implicitly shared chunks
+ *
+ * Copying one copies a pointer per chunk, and a change to the original
+ * after that copies only the chunk it lands in, where a QVector would copy
+ * every element. The track store and its indexes keep their columns in
+ * these, so a snapshot handed to a worker thread costs the GUI thread one
+ * chunk per column it goes on to change, not the whole library.
+ *
+ * Elements are addressed by int like QVector's. A chunk grows like a
+ * QVector until it is full, so short vectors stay small.
+ */
+#ifndef MEDIASONIC_MODELS_CHUNKEDVECTOR_H
+#define MEDIASONIC_MODELS_CHUNKEDVECTOR_H
+
+#include <QVector>
+#include <algorithm>
+
+namespace MS {
+
+template <typename T, int Shift = 12>
+class ChunkedVector
+{
+public:
+    static constexpr int kChunkSize = 1 << Shift;
+
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    const T &at(int i) const { return m_chunks.at(i >> Shift).at(i & kMask); }
+    const T &operator[](int i) const { return at(i); }
+    // Copies the element's chunk first if a copy of the vector shares it.
+    T &operator[](int i) { return m_chunks[i >> Shift][i & kMask]; }
+    const T &last() const { return m_chunks.last().last(); }
+
+    void append(const T &value)
+    {
+        if ((m_size & kMask) == 0) {
+            m_chunks.append(QVector<T>());
+            // Past the first chunk the vector is evidently a large one.
+            if (m_size) m_chunks.last().reserve(kChunkSize);
+        }
+        m_chunks.last().append(value);
+        ++m_size;
+    }
+    ChunkedVector &operator<<(const T &value)
+    {
+        append(value);
+        return *this;
+    }
+
+    // Elements added by growing are value-initialised.
+    void resize(int size)
+    {
+        size = qMax(0, size);
+        const int chunks = (size + kMask) >> Shift;
+        m_chunks.resize(chunks);
+        // Only the chunks from the old last one to the new last one change length.
+        for (int c = qMax(0, qMin(m_size >> Shift, chunks) - 1); c < chunks; ++c) {
+            const int length = qMin(kChunkSize, size - (c << Shift));
+            if (m_chunks.at(c).size() != length) m_chunks[c].resize(length);
+        }
+        m_size = size;
+    }
+    void fill(const T &value, int size)
+    {
+        m_chunks.clear();
+        m_size = 0;
+        m_chunks.reserve((size + kMask) >> Shift);
+        for (int at = 0; at < size; at += kChunkSize) m_chunks.append(QVector<T>(qMin(kChunkSize, size - at), value));
+        m_size = qMax(0, size);
+    }
+    void remove(int i, int count)
+    {
+        if (count <= 0) return;
+        // Chunk by chunk, so each destination chunk is detached once.
+        for (int to = i, from = i + count; from < m_size;) {
+            T *dst = m_chunks[to >> Shift].data() + (to & kMask);
+            const T *src = m_chunks.at(from >> Shift).constData() + (from & kMask);
+            const int n = qMin(qMin(kChunkSize - (to & kMask), kChunkSize - (from & kMask)), m_size - from);
+            std::copy(src, src + n, dst);
+            to += n;
+            from += n;
+        }
+        resize(m_size - count);
+    }
+    void reserve(int size) { m_chunks.reserve((size + kMask) >> Shift); }
+    void clear()
+    {
+        m_chunks.clear();
+        m_size = 0;
+    }
+
+    qint64 memoryBytes() const
+    {
+        qint64 bytes = qint64(m_chunks.capacity()) * qint64(sizeof(QVector<T>));
+        for (const QVector<T> &chunk : m_chunks) bytes += qint64(chunk.capacity()) * qint64(sizeof(T));
+        return bytes;
+    }
+
+private:
+    static constexpr int kMask = kChunkSize - 1;
+
+    QVector<QVector<T>> m_chunks;
+    int m_size = 0;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_CHUNKEDVECTOR_H
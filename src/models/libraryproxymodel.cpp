@@ -0,0 +1,355 @@
+#include "models/libraryproxymodel.h"
+#include "models/trackmodel.h"
+#include <QBitArray>
+#include <QDebug>
+#include <numeric>
+
+using namespace MS;
+
+namespace {
+
+// Queries slower than this are logged.
+constexpr qint64 kSlowRebuildMs = 10;
+// A change that hides rows in more places than this resets the view instead:
+// every removed range is a signal the view answers with a relayout.
+constexpr int kMaxRemovedRanges = 32;
+
+}
+
+LibraryProxyModel::LibraryProxyModel(QObject *parent)
+    : QAbstractProxyModel(parent)
+    , m_engine(new QueryEngine(this))
+{
+    connect(m_engine, &QueryEngine::finished, this, &LibraryProxyModel::onQueryFinished);
+}
+
+void LibraryProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
+{
+    beginResetModel();
+    if (m_tracks) disconnect(m_tracks, nullptr, this, nullptr);
+    m_engine->cancel();
+    m_tracks = qobject_cast<TrackModel *>(sourceModel);
+    QAbstractProxyModel::setSourceModel(sourceModel);
+    if (m_tracks) {
+        connect(m_tracks, &QAbstractItemModel::rowsInserted, this, &LibraryProxyModel::onRowsInserted);
+        connect(m_tracks, &QAbstractItemModel::rowsAboutToBeRemoved, this, &LibraryProxyModel::onRowsAboutToBeRemoved);
+        connect(m_tracks, &QAbstractItemModel::rowsRemoved, this, &LibraryProxyModel::onRowsRemoved);
+        connect(m_tracks, &QAbstractItemModel::dataChanged, this, &LibraryProxyModel::onDataChanged);
+        connect(m_tracks, &QAbstractItemModel::modelAboutToBeReset, this, &LibraryProxyModel::onModelAboutToBeReset);
+        connect(m_tracks, &QAbstractItemModel::modelReset, this, &LibraryProxyModel::onModelReset);
+    }
+    m_proxyToSource.clear();
+    m_sourceToProxyValid = false;
+    endResetModel();
+    requery(true);
+}
+
+void LibraryProxyModel::setSearchText(const QString &text)
+{
+    if (text == m_text) return;
+    m_text = text;
+    m_query = SearchIndex::parse(text);
+    requery(true);
+}
+
+void LibraryProxyModel::setBrowseFilter(BrowseIndex::Category category, qint64 group)
+{
+    if (category == m_browseCategory && group == m_browseGroup) return;
+    m_browseCategory = category;
+    m_browseGroup = group;
+    requery(true);
+}
+
+void LibraryProxyModel::setSmartPlaylist(int playlist)
+{
+    if (playlist == m_playlist) return;
+    m_playlist = playlist;
+    requery(true);
+}
+
+void LibraryProxyModel::sort(int column, Qt::SortOrder order)
+{
+    m_sortColumn = column >= 0 && column < columnCount() ? column : -1;
+    m_sortOrder = order;
+    requery(true);
+}
+
+QModelIndex LibraryProxyModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (parent.isValid() || row < 0 || row >= m_proxyToSource.size() || column < 0 || column >= columnCount())
+        return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex LibraryProxyModel::parent(const QModelIndex &) const
+{
+    return QModelIndex();
+}
+
+int LibraryProxyModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : m_proxyToSource.size();
+}
+
+int LibraryProxyModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() || !m_tracks ? 0 : m_tracks->columnCount();
+}
+
+bool LibraryProxyModel::hasChildren(const QModelIndex &parent) const
+{
+    return !parent.isValid() && !m_proxyToSource.isEmpty();
+}
+
+QModelIndex LibraryProxyModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!m_tracks || !proxyIndex.isValid() || proxyIndex.row() >= m_proxyToSource.size()) return QModelIndex();
+    return m_tracks->index(m_proxyToSource.at(proxyIndex.row()), proxyIndex.column());
+}
+
+QModelIndex LibraryProxyModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceIndex.isValid()) return QModelIndex();
+    const int row = proxyRow(sourceIndex.row());
+    return row < 0 ? QModelIndex() : index(row, sourceIndex.column());
+}
+
+QVariant LibraryProxyModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    // Not mapped through a proxy index: the header must stay labelled while a
+    // search shows no rows at all.
+    return sourceModel() ? sourceModel()->headerData(section, orientation, role) : QVariant();
+}
+
+QModelIndexList LibraryProxyModel::match(const QModelIndex &start, int role, const QVariant &value, int hits,
+                                         Qt::MatchFlags flags) const
+{
+    using Term = SearchIndex::Term;
+    Term::Field field = Term::Any;
+    switch (start.column()) {
+    case TrackModel::ColName: field = Term::Title; break;
+    case TrackModel::ColArtist: field = Term::Artist; break;
+    case TrackModel::ColAlbum: field = Term::Album; break;
+    case TrackModel::ColGenre: field = Term::Genre; break;
+    default: break;
+    }
+    const int type = int(flags & Qt::MatchTypeMask);
+    const bool folded = type == Qt::MatchStartsWith || type == Qt::MatchContains || type == Qt::MatchEndsWith
+        || type == Qt::MatchFixedString;
+    if (!m_tracks || !start.isValid() || role != Qt::DisplayRole || field == Term::Any || !folded
+        || (flags & Qt::MatchCaseSensitive))
+        return QAbstractProxyModel::match(start, role, value, hits, flags);
+
+    const QString text = SearchIndex::fold(value.toString());
+    const SearchIndex &search = m_tracks->searchIndex();
+    const TrackStore &store = m_tracks->store();
+    QModelIndexList found;
+    const int n = m_proxyToSource.size();
+    const int span = (flags & Qt::MatchWrap) ? n : n - start.row();
+    for (int i = 0; i < span && (hits < 0 || found.size() < hits); ++i) {
+        const int row = (start.row() + i) % n;
+        const QString candidate = search.folded(store, m_proxyToSource.at(row), field);
+        bool hit = false;
+        switch (type) {
+        case Qt::MatchStartsWith: hit = candidate.startsWith(text); break;
+        case Qt::MatchContains: hit = candidate.contains(text); break;
+        case Qt::MatchEndsWith: hit = candidate.endsWith(text); break;
+        default: hit = candidate == text; break;
+        }
+        if (hit) found << index(row, start.column());
+    }
+    return found;
+}
+
+void LibraryProxyModel::requery(bool supersede)
+{
+    if (!m_tracks) return;
+    if (m_query.isEmpty() && m_sortColumn < 0 && m_browseGroup < 0 && m_playlist < 0) {
+        // Every track in store order: not worth a job, nor a snapshot the
+        // model would have to detach from on its next change.
+        m_engine->cancel();
+        m_requeryPending = false;
+        QVector<int> rows(m_tracks->rowCount());
+        std::iota(rows.begin(), rows.end(), 0);
+        applyRows(rows);
+        return;
+    }
+    if (!supersede && m_engine->isBusy()) {
+        m_requeryPending = true;
+        return;
+    }
+    m_requeryPending = false;
+
+    QueryEngine::Snapshot snapshot;
+    snapshot.revision = m_tracks->revision();
+    snapshot.store = m_tracks->store().snapshot();
+    if (!m_query.isEmpty()) snapshot.search = m_tracks->searchIndex();
+    if (m_sortColumn >= 0) snapshot.sort = m_tracks->sortIndex();
+    QueryEngine::Request request;
+    request.query = m_query;
+    request.sortColumn = m_sortColumn;
+    request.sortOrder = m_sortOrder;
+    request.browseCategory = m_browseCategory;
+    request.browseGroup = m_browseGroup;
+    if (m_playlist >= 0) {
+        request.playlist = true;
+        request.playlistRows = m_tracks->smartPlaylistRows(m_playlist);
+    }
+    m_engine->submit(snapshot, request);
+}
+
+void LibraryProxyModel::onQueryFinished(const QueryEngine::Result &result)
+{
+    if (!m_tracks) return;
+    // A permutation built for the job saves building it for the next one.
+    m_tracks->adoptSortIndex(result.sort, result.revision);
+    // Tracks removed since the snapshot are gone; tracks added since are
+    // picked up by the pending job.
+    const TrackStore &store = m_tracks->store();
+    QVector<int> rows;
+    rows.reserve(result.ids.size());
+    for (const quint32 id : result.ids) {
+        const int row = store.rowOfId(id);
+        if (row >= 0) rows << row;
+    }
+    applyRows(rows);
+    if (result.elapsedMs > kSlowRebuildMs)
+        qInfo() << "LibraryProxyModel: query" << m_text << "sorted by column" << m_sortColumn << "took"
+                << result.elapsedMs << "ms over" << store.size() << "tracks";
+    if (m_requeryPending) requery(false);
+}
+
+void LibraryProxyModel::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid()) return;
+    const int count = last - first + 1;
+    if (first < m_tracks->rowCount() - count) {
+        for (int &row : m_proxyToSource)
+            if (row >= first) row += count;
+        m_sourceToProxyValid = false;
+    }
+    requery(false);
+}
+
+void LibraryProxyModel::onRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid()) return;
+    QVector<int> rows;
+    rows.reserve(m_proxyToSource.size());
+    for (const int row : m_proxyToSource)
+        if (row < first || row > last) rows << row;
+    applyRows(rows);
+}
+
+void LibraryProxyModel::onRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid()) return;
+    const int count = last - first + 1;
+    for (int &row : m_proxyToSource)
+        if (row > last) row -= count;
+    m_sourceToProxyValid = false;
+}
+
+void LibraryProxyModel::onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
+{
+    if (!topLeft.isValid() || topLeft.parent().isValid()) return;
+    const int first = topLeft.row();
+    const int last = bottomRight.row();
+    int top = -1, bottom = -1;
+    for (int row = first; row <= last; ++row) {
+        const int at = proxyRow(row);
+        if (at < 0) continue;
+        top = top < 0 ? at : qMin(top, at);
+        bottom = qMax(bottom, at);
+    }
+    if (top >= 0) emit dataChanged(index(top, topLeft.column()), index(bottom, bottomRight.column()), roles);
+    // The edit may move rows under the sort or in or out of the search.
+    requery(false);
+}
+
+void LibraryProxyModel::onModelAboutToBeReset()
+{
+    beginResetModel();
+}
+
+void LibraryProxyModel::onModelReset()
+{
+    m_proxyToSource.clear();
+    m_sourceToProxyValid = false;
+    endResetModel();
+    requery(true);
+}
+
+void LibraryProxyModel::applyRows(const QVector<int> &rows)
+{
+    const int sourceRows = m_tracks ? m_tracks->rowCount() : 0;
+    QBitArray shown(sourceRows);
+    for (const int row : rows) shown.setBit(row);
+
+    // Proxy rows whose track is no longer shown, as [first, last] ranges.
+    QVector<QPair<int, int>> removed;
+    for (int i = 0; i < m_proxyToSource.size(); ++i) {
+        if (shown.testBit(m_proxyToSource.at(i))) continue;
+        if (!removed.isEmpty() && removed.last().second == i - 1) {
+            removed.last().second = i;
+        } else if (removed.size() < kMaxRemovedRanges) {
+            removed << qMakePair(i, i);
+        } else {
+            beginResetModel();
+            m_proxyToSource = rows;
+            m_sourceToProxyValid = false;
+            endResetModel();
+            return;
+        }
+    }
+    for (int r = removed.size() - 1; r >= 0; --r) {
+        const QPair<int, int> range = removed.at(r);
+        beginRemoveRows(QModelIndex(), range.first, range.second);
+        m_proxyToSource.remove(range.first, range.second - range.first + 1);
+        m_sourceToProxyValid = false;
+        endRemoveRows();
+    }
+
+    // Newly shown rows go in at the end first, then move into place below.
+    QBitArray present(sourceRows);
+    for (const int row : m_proxyToSource) present.setBit(row);
+    QVector<int> added;
+    for (const int row : rows)
+        if (!present.testBit(row)) added << row;
+    if (!added.isEmpty()) {
+        const int at = m_proxyToSource.size();
+        beginInsertRows(QModelIndex(), at, at + added.size() - 1);
+        m_proxyToSource += added;
+        m_sourceToProxyValid = false;
+        endInsertRows();
+    }
+
+    if (m_proxyToSource == rows) return;
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+    const QModelIndexList from = persistentIndexList();
+    QVector<int> sourceOf;
+    sourceOf.reserve(from.size());
+    for (const QModelIndex &idx : from) sourceOf << m_proxyToSource.at(idx.row());
+    m_proxyToSource = rows;
+    m_sourceToProxyValid = false;
+    QModelIndexList to;
+    to.reserve(from.size());
+    for (int i = 0; i < from.size(); ++i) to << index(proxyRow(sourceOf.at(i)), from.at(i).column());
+    changePersistentIndexList(from, to);
+    emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+int LibraryProxyModel::proxyRow(int sourceRow) const
+{
+    if (!m_sourceToProxyValid) {
+        m_sourceToProxy.fill(-1, m_tracks ? m_tracks->rowCount() : 0);
+        // Bounds-checked: between a source removal and onRowsRemoved() the
+        // map may still name rows past the source's end.
+        for (int i = 0; i < m_proxyToSource.size(); ++i) {
+            const int row = m_proxyToSource.at(i);
+            if (row < m_sourceToProxy.size()) m_sourceToProxy[row] = i;
+        }
+        m_sourceToProxyValid = true;
+    }
+    return sourceRow >= 0 && sourceRow < m_sourceToProxy.size() ? m_sourceToProxy.at(sourceRow) : -1;
+}
@@ -0,0 +1,108 @@
+/*
+ * LibraryProxyModel - sorted, searchable view of a TrackModel
+ *
+ * The visible rows are a walk over one of the model's precomputed sort
+ * permutations (see SortIndex), skipping tracks the current search rejects.
+ * The search is answered by the model's SearchIndex into a bitmap over the
+ * source rows; the column browser's selection is one BrowseIndex group,
+ * checked per row by id. An open smart playlist supplies its own rows, best
+ * first for a top N list.
+ *
+ * That walk runs in a QueryEngine job over a snapshot of the model, never on
+ * the GUI thread: the proxy keeps showing its current rows and swaps in the
+ * new ones when the job delivers them. A new search, sort or filter cancels
+ * the job in flight; model changes wait for it and then queue one more, so
+ * a scan running under a search never queues more than one job. Rows the
+ * model is about to remove leave the proxy at once.
+ *
+ * Type-ahead in the Name, Artist, Album and Genre columns compares the
+ * search index's folded text, so typing "bjork" finds "Björk".
+ *
+ * Changes reach the view as removals, one insertion at the end and a layout
+ * change that moves rows into place, so selections and the current index
+ * survive re-sorts and scanner imports. A change that would take many
+ * removal ranges resets the view instead.
+ */
+#ifndef MEDIASONIC_MODELS_LIBRARYPROXYMODEL_H
+#define MEDIASONIC_MODELS_LIBRARYPROXYMODEL_H
+
+#include <QAbstractProxyModel>
+#include <QVector>
+#include "models/browseindex.h"
+#include "models/queryengine.h"
+#include "models/searchindex.h"
+
+namespace MS {
+
+class TrackModel;
+
+class LibraryProxyModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+public:
+    explicit LibraryProxyModel(QObject *parent = nullptr);
+
+    // The source must be a TrackModel; any other model shows no rows.
+    void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+    void setSearchText(const QString &text);
+    QString searchText() const { return m_text; }
+
+    // Shows only the tracks of one group; a negative group shows them all.
+    void setBrowseFilter(BrowseIndex::Category category, qint64 group);
+    // Shows only the tracks of a smart playlist; -1 shows the library.
+    void setSmartPlaylist(int playlist);
+    int smartPlaylist() const { return m_playlist; }
+
+    // Source order while the column is -1.
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    int sortColumn() const { return m_sortColumn; }
+    Qt::SortOrder sortOrder() const { return m_sortOrder; }
+    // Source rows of the visible rows, top to bottom.
+    const QVector<int> &sourceRows() const { return m_proxyToSource; }
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    QModelIndexList match(const QModelIndex &start, int role, const QVariant &value, int hits = 1,
+                          Qt::MatchFlags flags = Qt::MatchFlags(Qt::MatchStartsWith | Qt::MatchWrap)) const override;
+
+private:
+    // Recomputes the visible rows off-thread. A changed query supersedes the
+    // job in flight; a changed model queues behind it.
+    void requery(bool supersede);
+    void onQueryFinished(const QueryEngine::Result &result);
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void onRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+    void onRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles);
+    void onModelAboutToBeReset();
+    void onModelReset();
+
+    // Moves the proxy from its current rows to these, with the fewest signals.
+    void applyRows(const QVector<int> &rows);
+    int proxyRow(int sourceRow) const;
+
+    TrackModel *m_tracks = nullptr;
+    QueryEngine *m_engine;
+    bool m_requeryPending = false;
+    QString m_text;
+    SearchIndex::Query m_query;
+    BrowseIndex::Category m_browseCategory = BrowseIndex::Albums;
+    qint64 m_browseGroup = -1;
+    int m_playlist = -1;
+    int m_sortColumn = -1;
+    Qt::SortOrder m_sortOrder = Qt::AscendingOrder;
+    QVector<int> m_proxyToSource;
+    mutable QVector<int> m_sourceToProxy; // rebuilt on demand; -1 if hidden
+    mutable bool m_sourceToProxyValid = false;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_LIBRARYPROXYMODEL_H
@@ -0,0 +1,214 @@
+#include "models/playqueue.h"
+#include <QBitArray>
+#include <QRandomGenerator>
+#include <QSet>
+
+using namespace MS;
+
+PlayQueue::PlayQueue(QObject *parent)
+    : QObject(parent)
+{
+}
+
+int PlayQueue::positionOf(quint32 id) const
+{
+    if (id >= quint32(m_positionOf.size())) return -1;
+    const int p = m_positionOf.at(int(id));
+    if (p < 0) return -1;
+    if (p < m_order.size() && m_order.at(p) == id) return p;
+    // Stale: everything from the first position that moved gets its entry back
+    for (int i = m_validUpTo; i < m_order.size(); ++i) m_positionOf[int(m_order.at(i))] = i;
+    m_validUpTo = m_order.size();
+    return m_positionOf.at(int(id));
+}
+
+void PlayQueue::place(quint32 id, int position)
+{
+    if (id >= quint32(m_positionOf.size())) {
+        const int old = m_positionOf.size();
+        m_positionOf.resize(int(id) + 1);
+        std::fill(m_positionOf.begin() + old, m_positionOf.end(), -1);
+    }
+    m_positionOf[int(id)] = position;
+}
+
+QUrl PlayQueue::urlAt(int position) const
+{
+    if (position < 0 || position >= m_order.size() || !m_resolver) return QUrl();
+    return m_resolver(m_order.at(position));
+}
+
+int PlayQueue::nextPosition() const
+{
+    const int current = currentPosition();
+    return current >= 0 && current + 1 < m_order.size() ? current + 1 : -1;
+}
+
+int PlayQueue::previousPosition() const
+{
+    const int current = currentPosition();
+    return current > 0 ? current - 1 : -1;
+}
+
+bool PlayQueue::setCurrent(quint32 id)
+{
+    if (!contains(id)) return false;
+    if (id == m_current) return true;
+    m_current = id;
+    emit currentChanged(id);
+    return true;
+}
+
+void PlayQueue::replace(const QVector<quint32> &ids, quint32 current)
+{
+    for (const quint32 id : qAsConst(m_order)) m_positionOf[int(id)] = -1;
+    m_order.clear();
+    m_order.reserve(ids.size());
+    for (const quint32 id : ids) {
+        if (id == kNoTrack || contains(id)) continue;
+        place(id, m_order.size());
+        m_order << id;
+    }
+    m_validUpTo = m_order.size();
+    m_unshuffled.clear();
+
+    const quint32 old = m_current;
+    m_current = contains(current) ? current : idAt(0);
+    if (m_shuffled) {
+        // Shuffle is a mode: the new tracks are shuffled too
+        m_shuffled = false;
+        setShuffle(true);
+    } else {
+        emit changed();
+    }
+    if (m_current != old) emit currentChanged(m_current);
+}
+
+void PlayQueue::append(const QVector<quint32> &ids)
+{
+    const int before = m_order.size();
+    for (const quint32 id : ids) {
+        if (id == kNoTrack || contains(id)) continue;
+        place(id, m_order.size());
+        m_order << id;
+    }
+    if (m_order.size() != before) emit changed();
+}
+
+void PlayQueue::insertNext(const QVector<quint32> &ids)
+{
+    // Tracks already queued move, so take them out first
+    QSet<quint32> moving;
+    for (const quint32 id : ids)
+        if (id != m_current && contains(id)) moving.insert(id);
+    if (!moving.isEmpty()) {
+        int first = m_order.size();
+        int kept = 0;
+        for (int i = 0; i < m_order.size(); ++i) {
+            const quint32 id = m_order.at(i);
+            if (moving.contains(id)) {
+                m_positionOf[int(id)] = -1;
+                first = qMin(first, i);
+            } else {
+                m_order[kept++] = id;
+            }
+        }
+        m_order.resize(kept);
+        invalidateFrom(first);
+    }
+
+    QVector<quint32> block;
+    block.reserve(ids.size());
+    QSet<quint32> seen;
+    for (const quint32 id : ids) {
+        if (id == kNoTrack || id == m_current || contains(id) || seen.contains(id)) continue;
+        seen.insert(id);
+        block << id;
+    }
+    if (block.isEmpty() && moving.isEmpty()) return;
+    const int at = currentPosition() + 1; // 0 with no current track
+    m_order.insert(at, block.size(), kNoTrack);
+    for (int i = 0; i < block.size(); ++i) {
+        m_order[at + i] = block.at(i);
+        place(block.at(i), at + i);
+    }
+    invalidateFrom(at);
+    emit changed();
+}
+
+void PlayQueue::move(int from, int to)
+{
+    if (from == to || from < 0 || to < 0 || from >= m_order.size() || to >= m_order.size()) return;
+    m_order.move(from, to);
+    invalidateFrom(qMin(from, to));
+    emit changed();
+}
+
+void PlayQueue::remove(const QVector<quint32> &ids)
+{
+    // Look every position up before marking any: a lookup may reindex
+    const int current = currentPosition();
+    QVector<int> positions;
+    positions.reserve(ids.size());
+    for (const quint32 id : ids) positions << positionOf(id);
+    int first = m_order.size();
+    for (const int p : qAsConst(positions)) {
+        if (p < 0) continue;
+        m_positionOf[int(m_order.at(p))] = -1;
+        first = qMin(first, p);
+    }
+    if (first == m_order.size()) return;
+
+    // One compaction pass; the current track's successor is the first survivor after it
+    int kept = 0;
+    int successor = -1;
+    for (int i = 0; i < m_order.size(); ++i) {
+        const quint32 id = m_order.at(i);
+        if (m_positionOf.at(int(id)) < 0) continue;
+        if (successor < 0 && current >= 0 && i >= current) successor = kept;
+        m_order[kept++] = id;
+    }
+    m_order.resize(kept);
+    invalidateFrom(first);
+
+    const bool currentRemoved = m_current != kNoTrack && current >= 0 && m_positionOf.at(int(m_current)) < 0;
+    if (currentRemoved) m_current = idAt(successor);
+    emit changed();
+    if (currentRemoved) emit currentChanged(m_current);
+}
+
+void PlayQueue::setShuffle(bool on)
+{
+    if (on == m_shuffled) return;
+    if (on) {
+        m_unshuffled = m_order;
+        int start = 0;
+        const int current = currentPosition();
+        if (current >= 0) {
+            std::swap(m_order[0], m_order[current]);
+            start = 1;
+        }
+        // Fisher-Yates over everything after the current track
+        QRandomGenerator *random = QRandomGenerator::global();
+        for (int i = m_order.size() - 1; i > start; --i)
+            std::swap(m_order[i], m_order[start + int(random->bounded(i - start + 1))]);
+    } else {
+        // The order from before, less what left; whatever arrived since goes last
+        QVector<quint32> order;
+        order.reserve(m_order.size());
+        QBitArray taken(m_order.size());
+        for (const quint32 id : qAsConst(m_unshuffled)) {
+            const int p = positionOf(id);
+            if (p < 0 || taken.testBit(p)) continue;
+            taken.setBit(p);
+            order << id;
+        }
+        for (int p = 0; p < m_order.size(); ++p)
+            if (!taken.testBit(p)) order << m_order.at(p);
+        m_order = order;
+        m_unshuffled.clear();
+    }
+    m_shuffled = on;
+    m_validUpTo = 0;
+    emit changed();
+}
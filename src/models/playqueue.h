@@ -0,0 +1,97 @@
+/*
+ * PlayQueue - what plays next, by stable track id
+ *
+ * The queue holds TrackStore ids, which survive removals, renames and
+ * re-sorts of the track list, so the entry being played never depends on
+ * model rows. Positions are a plain vector of ids; the way back, id to
+ * position, is a vector indexed by id that is only brought up to date when
+ * a lookup finds it stale, so inserting, moving and shuffling cost a
+ * memmove rather than a rebuild. A track is queued at most once.
+ *
+ * URLs are never stored: the resolver turns an id into one when playback
+ * asks, which keeps a 100k-entry queue at a few bytes per entry and follows
+ * renames for free.
+ */
+#ifndef MEDIASONIC_MODELS_PLAYQUEUE_H
+#define MEDIASONIC_MODELS_PLAYQUEUE_H
+
+#include <QObject>
+#include <QUrl>
+#include <QVector>
+#include <functional>
+
+namespace MS {
+
+class PlayQueue : public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr quint32 kNoTrack = 0xFFFFFFFFu;
+    using Resolver = std::function<QUrl(quint32 id)>;
+
+    explicit PlayQueue(QObject *parent = nullptr);
+
+    // Turns ids into URLs; an empty URL for tracks that no longer exist.
+    void setResolver(const Resolver &resolver) { m_resolver = resolver; }
+
+    int size() const { return m_order.size(); }
+    bool isEmpty() const { return m_order.isEmpty(); }
+    quint32 idAt(int position) const { return position >= 0 && position < m_order.size() ? m_order.at(position) : kNoTrack; }
+    // -1 if the track is not queued; amortised O(1).
+    int positionOf(quint32 id) const;
+    bool contains(quint32 id) const { return positionOf(id) >= 0; }
+    QUrl urlAt(int position) const;
+    const QVector<quint32> &ids() const { return m_order; }
+
+    quint32 currentId() const { return m_current; }
+    int currentPosition() const { return positionOf(m_current); }
+    QUrl currentUrl() const { return urlAt(currentPosition()); }
+    // -1 past either end.
+    int nextPosition() const;
+    int previousPosition() const;
+    // False, and nothing changes, if the track is not queued.
+    bool setCurrent(quint32 id);
+    bool setCurrentPosition(int position) { return setCurrent(idAt(position)); }
+    bool next() { return setCurrentPosition(nextPosition()); }
+    bool previous() { return setCurrentPosition(previousPosition()); }
+
+    // Queues ids in order, dropping repeats, and makes current the current
+    // track (the first one if it is not among them). Shuffled if the queue
+    // was.
+    void replace(const QVector<quint32> &ids, quint32 current = kNoTrack);
+    // Adds at the end; tracks already queued stay where they are.
+    void append(const QVector<quint32> &ids);
+    // Puts ids right after the current track, moving those already queued.
+    void insertNext(const QVector<quint32> &ids);
+    void move(int from, int to);
+    // A removed current track passes current on to the entry that followed it.
+    void remove(const QVector<quint32> &ids);
+    void clear() { replace(QVector<quint32>()); }
+
+    // Shuffling puts the current track first and the rest in random order;
+    // turning it off restores the order from before, with tracks queued in
+    // the meantime after it.
+    void setShuffle(bool on);
+    bool isShuffled() const { return m_shuffled; }
+
+signals:
+    void currentChanged(quint32 id);
+    // Entries were added, removed or reordered.
+    void changed();
+
+private:
+    void place(quint32 id, int position);
+    void invalidateFrom(int position) { m_validUpTo = qMin(m_validUpTo, position); }
+
+    QVector<quint32> m_order;
+    mutable QVector<int> m_positionOf; // by id: -1 if not queued, else possibly stale
+    mutable int m_validUpTo = 0;       // entries for positions below are exact
+    quint32 m_current = kNoTrack;
+    bool m_shuffled = false;
+    QVector<quint32> m_unshuffled;
+    Resolver m_resolver;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_PLAYQUEUE_H
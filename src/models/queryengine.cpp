@@ -0,0 +1,114 @@
+#include "models/queryengine.h"
+#include <QBitArray>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+
+using namespace MS;
+
+namespace {
+
+// Rows walked between two looks at the cancel flag.
+constexpr int kCheckRows = 64 * 1024;
+
+}
+
+QueryEngine::QueryEngine(QObject *parent)
+    : QObject(parent)
+{
+}
+
+QueryEngine::~QueryEngine()
+{
+    // The job owns its snapshot; it only has to be told to stop.
+    cancel();
+}
+
+void QueryEngine::cancel()
+{
+    if (m_cancel) m_cancel->storeRelease(1);
+    m_cancel.reset();
+    m_busy = false;
+    ++m_serial;
+}
+
+quint64 QueryEngine::submit(const Snapshot &snapshot, const Request &request)
+{
+    cancel();
+    const QSharedPointer<QAtomicInt> flag(new QAtomicInt(0));
+    m_cancel = flag;
+    m_busy = true;
+    const quint64 serial = ++m_serial;
+
+    auto *watcher = new QFutureWatcher<Result>(this);
+    connect(watcher, &QFutureWatcher<Result>::finished, this, [this, watcher]() {
+        Result result = watcher->result();
+        watcher->deleteLater();
+        if (result.serial != m_serial || !result.complete) return;
+        m_busy = false;
+        emit finished(result);
+    });
+    watcher->setFuture(QtConcurrent::run([snapshot, request, flag, serial]() {
+        Result result = run(snapshot, request, *flag);
+        result.serial = serial;
+        return result;
+    }));
+    return serial;
+}
+
+QueryEngine::Result QueryEngine::run(const Snapshot &snapshot, const Request &request, const QAtomicInt &cancel)
+{
+    QElapsedTimer timer;
+    timer.start();
+    Result result;
+    result.revision = snapshot.revision;
+    const TrackStore &store = snapshot.store;
+
+    const bool all = request.query.isEmpty();
+    QBitArray matches;
+    if (!all) matches = snapshot.search.match(store, request.query);
+    if (cancel.loadAcquire()) return result;
+
+    const QVector<int> *sorted = nullptr;
+    if (request.sortColumn >= 0) {
+        result.sort = snapshot.sort;
+        sorted = &result.sort.rows(store, SortIndex::Key(qBound(0, request.sortColumn, SortIndex::KeyCount - 1)));
+        if (cancel.loadAcquire()) return result;
+    }
+    const bool ascending = request.sortOrder == Qt::AscendingOrder;
+
+    const bool browsing = request.browseGroup >= 0;
+    QVector<quint32> &ids = result.ids;
+    ids.reserve(request.playlist ? request.playlistRows.size() : all ? store.size() : matches.count(true));
+    int walked = 0;
+    auto take = [&](int row) {
+        if (++walked % kCheckRows == 0 && cancel.loadAcquire()) return false;
+        if (browsing && qint64(BrowseIndex::groupOf(store, request.browseCategory, row)) != request.browseGroup) return true;
+        if (all || matches.testBit(row)) ids << store.id(row);
+        return true;
+    };
+
+    if (request.playlist && !sorted) {
+        // The playlist's own order (best first) until a column is sorted.
+        for (const int row : request.playlistRows)
+            if (!take(row)) return result;
+    } else if (sorted) {
+        QBitArray in;
+        if (request.playlist) {
+            in.resize(store.size());
+            for (const int row : request.playlistRows) in.setBit(row);
+        }
+        const int n = sorted->size();
+        for (int i = 0; i < n; ++i) {
+            const int row = sorted->at(ascending ? i : n - 1 - i);
+            if (request.playlist && !in.testBit(row)) continue;
+            if (!take(row)) return result;
+        }
+    } else {
+        for (int row = 0; row < store.size(); ++row)
+            if (!take(row)) return result;
+    }
+    result.elapsedMs = timer.elapsed();
+    result.complete = true;
+    return result;
+}
@@ -0,0 +1,88 @@
+/*
+ * QueryEngine - filters and sorts the track list on a worker thread
+ *
+ * A job works on a Snapshot: copies of the model's TrackStore, SearchIndex
+ * and SortIndex. The store and search index keep their columns in chunks the
+ * copies share, so taking a snapshot costs O(chunks) on the GUI thread and a
+ * change while a job still reads it copies only the chunks it touches; a
+ * sort permutation is copied by the next insert into it, which is O(rows)
+ * anyway. Jobs run on the global thread
+ * pool and name the tracks they keep by stable id, so a result still applies
+ * after rows were added or removed behind it.
+ *
+ * Only the latest submitted job is wanted: submitting cancels the one before,
+ * which gives up at its next checkpoint, and a result that is not the latest
+ * is dropped. Typing a search therefore finishes one query, not one per key.
+ */
+#ifndef MEDIASONIC_MODELS_QUERYENGINE_H
+#define MEDIASONIC_MODELS_QUERYENGINE_H
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QSharedPointer>
+#include <QVector>
+#include "models/browseindex.h"
+#include "models/searchindex.h"
+#include "models/sortindex.h"
+#include "models/trackstore.h"
+
+namespace MS {
+
+class QueryEngine : public QObject
+{
+    Q_OBJECT
+public:
+    struct Snapshot
+    {
+        quint64 revision = 0; // TrackModel::revision() when taken
+        TrackStore store; // TrackStore::snapshot()
+        SearchIndex search; // only needed for a search
+        SortIndex sort;     // only needed for a sorted list
+    };
+    // What the track list shows.
+    struct Request
+    {
+        SearchIndex::Query query;
+        int sortColumn = -1; // store order while -1
+        Qt::SortOrder sortOrder = Qt::AscendingOrder;
+        BrowseIndex::Category browseCategory = BrowseIndex::Albums;
+        qint64 browseGroup = -1; // all tracks while -1
+        bool playlist = false;
+        QVector<int> playlistRows; // snapshot rows, best first
+    };
+    struct Result
+    {
+        quint64 serial = 0;
+        quint64 revision = 0;  // of the snapshot
+        QVector<quint32> ids;  // stable ids of the tracks to show, in order
+        SortIndex sort;        // the snapshot's, with the permutation the job used
+        qint64 elapsedMs = 0;
+        bool complete = false; // false if the job was cancelled
+    };
+
+    explicit QueryEngine(QObject *parent = nullptr);
+    ~QueryEngine() override;
+
+    // Starts a job, cancelling the one still running; returns its serial.
+    quint64 submit(const Snapshot &snapshot, const Request &request);
+    // Drops the job in flight without starting another.
+    void cancel();
+    // True until the latest job delivered its result.
+    bool isBusy() const { return m_busy; }
+
+    // The work of one job; stops early once cancel is set.
+    static Result run(const Snapshot &snapshot, const Request &request, const QAtomicInt &cancel);
+
+signals:
+    // The result of the latest job, on the thread that owns the engine.
+    void finished(const MS::QueryEngine::Result &result);
+
+private:
+    quint64 m_serial = 0;
+    bool m_busy = false;
+    QSharedPointer<QAtomicInt> m_cancel;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_QUERYENGINE_H
@@ -0,0 +1,600 @@
+#include "models/searchindex.h"
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace MS;
+
+namespace {
+
+// Title posting lists are rebuilt once they hold this many stale entries and
+// stale entries outnumber live ones.
+constexpr qint64 kMinStaleEntries = 256 * 1024;
+// Slots a posting table starts with; it is kept at most half full.
+constexpr int kMinPostingSlots = 1024;
+// Rows per parallel match task; a multiple of 8, so tasks never share a byte
+// of the result bitmap.
+constexpr int kMatchChunkRows = 64 * 1024;
+// Titles per parallel folding task when a large batch is indexed.
+constexpr int kFoldChunkRows = 16 * 1024;
+
+using Term = SearchIndex::Term;
+
+struct FieldName
+{
+    const char *name;
+    Term::Field field;
+};
+
+constexpr FieldName kFieldNames[] = {
+    { "title", Term::Title },       { "name", Term::Title },         { "artist", Term::Artist },
+    { "album", Term::Album },       { "genre", Term::Genre },        { "composer", Term::Composer },
+    { "year", Term::Year },         { "rating", Term::Rating },      { "stars", Term::Rating },
+    { "plays", Term::Plays },       { "playcount", Term::Plays },    { "bitrate", Term::Bitrate },
+    { "duration", Term::Duration }, { "time", Term::Duration },      { "length", Term::Duration },
+    { "track", Term::TrackNumber }, { "disc", Term::DiscNumber },
+};
+
+// Folded letters that have no decomposition to strip marks from.
+const char *foldedExpansion(ushort c)
+{
+    switch (c) {
+    case 0x00df: return "ss"; // sharp s
+    case 0x00e6: return "ae";
+    case 0x00f0: return "d";  // eth
+    case 0x00f8: return "o";  // o with stroke
+    case 0x00fe: return "th"; // thorn
+    case 0x0111: return "d";  // d with stroke
+    case 0x0131: return "i";  // dotless i
+    case 0x0142: return "l";  // l with stroke
+    case 0x0153: return "oe";
+    default: return nullptr;
+    }
+}
+
+bool isMark(QChar c)
+{
+    const QChar::Category category = c.category();
+    return category == QChar::Mark_NonSpacing || category == QChar::Mark_SpacingCombining
+        || category == QChar::Mark_Enclosing;
+}
+
+quint64 trigramAt(const QChar *s)
+{
+    return (quint64(s[0].unicode()) << 32) | (quint64(s[1].unicode()) << 16) | quint64(s[2].unicode());
+}
+
+// Distinct trigrams of text that contain no whitespace. Quoted phrases are
+// split on whitespace here like any title, so a phrase is looked up by the
+// trigrams of its words and then matched as a whole against the candidates.
+QVector<quint64> trigramsOf(const QChar *text, int length)
+{
+    QVector<quint64> out;
+    if (length < 3) return out;
+    out.reserve(length - 2);
+    int run = 0; // non-space characters ending at i
+    for (int i = 0; i < length; ++i) {
+        run = text[i].isSpace() ? 0 : run + 1;
+        if (run >= 3) out << trigramAt(text + i - 2);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+QVector<quint64> trigramsOf(const QString &text)
+{
+    return trigramsOf(text.constData(), text.size());
+}
+
+bool contains(const QChar *text, int length, const QString &token)
+{
+    const int n = token.size();
+    if (n == 0) return true;
+    const QChar *needle = token.constData();
+    const QChar first = needle[0];
+    for (int i = 0; i + n <= length; ++i) {
+        if (text[i] != first) continue;
+        if (std::memcmp(text + i + 1, needle + 1, size_t(n - 1) * sizeof(QChar)) == 0) return true;
+    }
+    return false;
+}
+
+bool hasTrigram(const QString &token)
+{
+    return !trigramsOf(token).isEmpty();
+}
+
+bool has(const QBitArray &ids, quint32 id)
+{
+    return int(id) < ids.size() && ids.testBit(int(id));
+}
+
+bool fieldNamed(const QString &name, Term::Field &field)
+{
+    for (const FieldName &f : kFieldNames) {
+        if (name.compare(QLatin1String(f.name), Qt::CaseInsensitive) != 0) continue;
+        field = f.field;
+        return true;
+    }
+    return false;
+}
+
+bool readOp(const QString &text, int &i, Term::Op &op)
+{
+    const QChar c = i < text.size() ? text.at(i) : QChar();
+    const bool orEqual = i + 1 < text.size() && text.at(i + 1) == QLatin1Char('=');
+    if (c == QLatin1Char(':')) op = Term::Contains;
+    else if (c == QLatin1Char('=')) op = Term::Equal;
+    else if (c == QLatin1Char('!') && orEqual) op = Term::NotEqual;
+    else if (c == QLatin1Char('<')) op = orEqual ? Term::LessEqual : Term::Less;
+    else if (c == QLatin1Char('>')) op = orEqual ? Term::GreaterEqual : Term::Greater;
+    else return false;
+    i += orEqual ? 2 : 1;
+    return true;
+}
+
+// A double-quoted phrase (the closing quote may be left out) or everything
+// up to the next whitespace.
+QString readValue(const QString &text, int &i)
+{
+    const int n = text.size();
+    if (i < n && text.at(i) == QLatin1Char('"')) {
+        const int close = text.indexOf(QLatin1Char('"'), i + 1);
+        const int end = close < 0 ? n : close;
+        const QString value = text.mid(i + 1, end - i - 1);
+        i = close < 0 ? n : close + 1;
+        return value;
+    }
+    const int start = i;
+    while (i < n && !text.at(i).isSpace()) ++i;
+    return text.mid(start, i - start);
+}
+
+// Durations are written as seconds, m:ss or h:mm:ss.
+bool readNumber(Term::Field field, const QString &value, qint64 &out)
+{
+    bool ok = false;
+    if (field != Term::Duration) {
+        out = value.toLongLong(&ok);
+        return ok;
+    }
+    const QStringList parts = value.split(QLatin1Char(':'));
+    if (parts.size() > 3) return false;
+    qint64 secs = 0;
+    for (const QString &part : parts) {
+        const qint64 v = part.toLongLong(&ok);
+        if (!ok || v < 0) return false;
+        secs = secs * 60 + v;
+    }
+    out = secs * 1000;
+    return true;
+}
+
+// Raw column value of a numeric field; durations in whole seconds (as ms),
+// the way the track list shows them.
+qint64 numberAt(const TrackStore &store, Term::Field field, int row)
+{
+    switch (field) {
+    case Term::Year: return store.year(row);
+    case Term::Rating: return store.rating(row);
+    case Term::Plays: return store.playCount(row);
+    case Term::Bitrate: return store.bitrateKbps(row);
+    case Term::Duration: return store.durationMs(row) / 1000 * 1000;
+    case Term::TrackNumber: return store.trackNumber(row);
+    case Term::DiscNumber: return store.discNumber(row);
+    default: return 0;
+    }
+}
+
+bool holds(Term::Op op, qint64 value, qint64 bound)
+{
+    switch (op) {
+    case Term::Less: return value < bound;
+    case Term::LessEqual: return value <= bound;
+    case Term::Greater: return value > bound;
+    case Term::GreaterEqual: return value >= bound;
+    case Term::NotEqual: return value != bound;
+    default: return value == bound;
+    }
+}
+
+template <typename T>
+qint64 columnBytes(const ChunkedVector<T> &column)
+{
+    return column.memoryBytes();
+}
+
+}
+
+QString SearchIndex::fold(const QString &text)
+{
+    // Plain ASCII, most of any library, only needs lower-casing.
+    const QChar *chars = text.constData();
+    if (std::all_of(chars, chars + text.size(), [](QChar c) { return c.unicode() < 0x80; })) return text.toLower();
+    // Compatibility decomposition splits accented letters into letter and
+    // mark and maps full-width and other presentation forms to plain ones.
+    const QString decomposed = text.normalized(QString::NormalizationForm_KD).toCaseFolded();
+    QString out;
+    out.reserve(decomposed.size());
+    for (const QChar c : decomposed) {
+        if (isMark(c)) continue;
+        if (const char *expansion = foldedExpansion(c.unicode())) out += QLatin1String(expansion);
+        else out += c;
+    }
+    return out;
+}
+
+SearchIndex::Query SearchIndex::parse(const QString &text)
+{
+    Query q;
+    const int n = text.size();
+    int i = 0;
+    while (i < n) {
+        if (text.at(i).isSpace()) {
+            ++i;
+            continue;
+        }
+        Term term;
+        if (text.at(i) == QLatin1Char('-') && i + 1 < n && !text.at(i + 1).isSpace()) {
+            term.negate = true;
+            ++i;
+        }
+        int end = i;
+        while (end < n && text.at(end).isLetter()) ++end;
+        Term::Field field = Term::Any;
+        Term::Op op = Term::Contains;
+        int at = end;
+        bool compiled = false;
+        if (fieldNamed(text.mid(i, end - i), field) && readOp(text, at, op)) {
+            Term fielded = term;
+            fielded.field = field;
+            fielded.op = op;
+            const QString value = readValue(text, at);
+            if (fielded.isText()) {
+                // Text is only ever compared for containment or equality.
+                fielded.text = fold(value);
+                compiled = !fielded.text.isEmpty() && op <= Term::NotEqual;
+                if (op == Term::NotEqual) {
+                    fielded.op = Term::Equal;
+                    fielded.negate = !fielded.negate;
+                }
+            } else {
+                compiled = readNumber(field, value, fielded.number);
+                if (op == Term::Contains) fielded.op = Term::Equal;
+            }
+            if (compiled) {
+                q.terms << fielded;
+                i = at;
+            }
+        }
+        if (compiled) continue;
+        // Anything else is free text: a word or a quoted phrase, possibly negated.
+        term.text = fold(readValue(text, i));
+        if (!term.text.isEmpty()) q.terms << term;
+    }
+    return q;
+}
+
+const ChunkedVector<quint32> *SearchIndex::Postings::find(quint64 trigram) const
+{
+    if (m_slots.isEmpty()) return nullptr;
+    const Slot &slot = m_slots.at(slotOf(trigram));
+    return slot.trigram == trigram ? &slot.ids : nullptr;
+}
+
+const ChunkedVector<quint32> *SearchIndex::Postings::rarest(const QString &token) const
+{
+    const ChunkedVector<quint32> *best = nullptr;
+    for (const quint64 tri : trigramsOf(token)) {
+        const ChunkedVector<quint32> *list = find(tri);
+        if (!list) return nullptr;
+        if (!best || list->size() < best->size()) best = list;
+    }
+    return best;
+}
+
+void SearchIndex::Postings::append(quint64 trigram, quint32 id)
+{
+    if (2 * (m_used + 1) > m_slots.size()) {
+        // The lists move by reference, so doubling copies no ids.
+        const ChunkedVector<Slot, 10> old = m_slots;
+        m_slots.fill(Slot(), qMax(kMinPostingSlots, 2 * old.size()));
+        for (int i = 0; i < old.size(); ++i) {
+            const Slot &slot = old.at(i);
+            if (slot.trigram != kNoTrigram) m_slots[slotOf(slot.trigram)] = slot;
+        }
+    }
+    Slot &slot = m_slots[slotOf(trigram)];
+    if (slot.trigram == kNoTrigram) {
+        slot.trigram = trigram;
+        ++m_used;
+    }
+    slot.ids.append(id);
+}
+
+void SearchIndex::Postings::clear()
+{
+    m_slots.clear();
+    m_used = 0;
+}
+
+qint64 SearchIndex::Postings::memoryBytes() const
+{
+    qint64 bytes = m_slots.memoryBytes();
+    for (int i = 0; i < m_slots.size(); ++i) bytes += m_slots.at(i).ids.memoryBytes();
+    return bytes;
+}
+
+int SearchIndex::Postings::slotOf(quint64 trigram) const
+{
+    // The trigram's slot, or the free one it would take.
+    const int mask = m_slots.size() - 1;
+    for (int slot = int(qHash(trigram) & uint(mask));; slot = (slot + 1) & mask) {
+        const quint64 at = m_slots.at(slot).trigram;
+        if (at == trigram || at == kNoTrigram) return slot;
+    }
+}
+
+void SearchIndex::Dictionary::sync(const StringDictionary &values)
+{
+    for (int id = folded.size(); id < values.size(); ++id) {
+        const QString f = fold(values.at(quint32(id)));
+        folded << f;
+        for (const quint64 tri : trigramsOf(f)) postings.append(tri, quint32(id));
+    }
+}
+
+QBitArray SearchIndex::Dictionary::match(const QString &text, bool exact) const
+{
+    QBitArray ids(folded.size());
+    if (!hasTrigram(text)) {
+        for (int id = 1; id < folded.size(); ++id)
+            if (has(quint32(id), text, exact)) ids.setBit(id);
+    } else if (const ChunkedVector<quint32> *list = postings.rarest(text)) {
+        for (int i = 0; i < list->size(); ++i)
+            if (has(list->at(i), text, exact)) ids.setBit(int(list->at(i)));
+    }
+    return ids;
+}
+
+bool SearchIndex::Dictionary::has(quint32 id, const QString &text, bool exact) const
+{
+    if (int(id) >= folded.size()) return false;
+    const QString &value = folded.at(int(id));
+    return exact ? value == text : contains(value.constData(), value.size(), text);
+}
+
+void SearchIndex::addRows(const TrackStore &store, int first, int last)
+{
+    syncDictionaries(store);
+    const int count = last - first + 1;
+    if (count <= kFoldChunkRows) {
+        for (int row = first; row <= last; ++row) setTitle(store.id(row), fold(store.displayTitle(row)));
+        return;
+    }
+    // A library restore indexes every title at once: fold them in parallel.
+    QVector<QString> titles(count);
+    QString *out = titles.data();
+    QVector<int> chunks;
+    for (int start = 0; start < count; start += kFoldChunkRows) chunks << start;
+    QtConcurrent::blockingMap(chunks, [&](int start) {
+        const int end = qMin(count, start + kFoldChunkRows);
+        for (int i = start; i < end; ++i) out[i] = fold(store.displayTitle(first + i));
+    });
+    for (int i = 0; i < count; ++i) setTitle(store.id(first + i), titles.at(i));
+}
+
+void SearchIndex::updateRows(const TrackStore &store, const QVector<int> &rows)
+{
+    syncDictionaries(store);
+    for (const int row : rows) {
+        const quint32 id = store.id(row);
+        const QString title = fold(store.displayTitle(row));
+        if (titleAt(id) == title) continue;
+        dropTitle(id);
+        setTitle(id, title);
+    }
+    compact();
+}
+
+QString SearchIndex::folded(const TrackStore &store, int row, Term::Field field) const
+{
+    switch (field) {
+    case Term::Title: return titleAt(store.id(row));
+    case Term::Artist: return m_artists.at(store.artistId(row));
+    case Term::Album: return m_albums.at(store.albumId(row));
+    case Term::Genre: return m_genres.at(store.genreId(row));
+    case Term::Composer: return m_composers.at(store.composerId(row));
+    default: return QString();
+    }
+}
+
+void SearchIndex::removeRows(const TrackStore &store, int first, int last)
+{
+    for (int row = first; row <= last; ++row) dropTitle(store.id(row));
+    compact();
+}
+
+void SearchIndex::clear()
+{
+    *this = SearchIndex();
+}
+
+void SearchIndex::syncDictionaries(const TrackStore &store)
+{
+    m_artists.sync(store.artists());
+    m_albums.sync(store.albums());
+    m_genres.sync(store.genres());
+    m_composers.sync(store.composers());
+}
+
+void SearchIndex::setTitle(quint32 id, const QString &foldedTitle)
+{
+    const QString folded = foldedTitle.left(StringArena::kMaxLength);
+    if (int(id) >= m_titleOffset.size()) {
+        m_titleOffset.resize(int(id) + 1);
+        m_titleLength.resize(int(id) + 1);
+        m_live.resize(int(id) + 1);
+    }
+    const StringArena::Ref ref = m_titleChars.add(folded);
+    m_titleOffset[int(id)] = ref.offset;
+    m_titleLength[int(id)] = quint16(ref.length);
+    m_live[int(id)] = true;
+    const QVector<quint64> tris = trigramsOf(folded);
+    for (const quint64 tri : tris) m_titles.append(tri, id);
+    m_entries += tris.size();
+    m_liveEntries += tris.size();
+}
+
+void SearchIndex::dropTitle(quint32 id)
+{
+    if (int(id) >= m_live.size() || !m_live.at(int(id))) return;
+    m_liveEntries -= trigramsOf(m_titleChars.data(m_titleOffset.at(int(id))), m_titleLength.at(int(id))).size();
+    m_garbageChars += m_titleLength.at(int(id));
+    m_titleLength[int(id)] = 0;
+    m_live[int(id)] = false;
+}
+
+QString SearchIndex::titleAt(quint32 id) const
+{
+    if (int(id) >= m_live.size() || !m_live.at(int(id))) return QString();
+    return m_titleChars.at(m_titleOffset.at(int(id)), m_titleLength.at(int(id)));
+}
+
+bool SearchIndex::titleHas(quint32 id, const QString &text, bool exact) const
+{
+    if (int(id) >= m_live.size() || !m_live.at(int(id))) return false;
+    const QChar *title = m_titleChars.data(m_titleOffset.at(int(id)));
+    const int length = m_titleLength.at(int(id));
+    if (!exact) return contains(title, length, text);
+    return length == text.size() && std::memcmp(title, text.constData(), size_t(length) * sizeof(QChar)) == 0;
+}
+
+QBitArray SearchIndex::matchTitles(const QString &text, bool exact) const
+{
+    QBitArray ids(m_live.size());
+    if (!hasTrigram(text)) {
+        for (int id = 0; id < m_live.size(); ++id)
+            if (titleHas(quint32(id), text, exact)) ids.setBit(id);
+    } else if (const ChunkedVector<quint32> *list = m_titles.rarest(text)) {
+        for (int i = 0; i < list->size(); ++i)
+            if (titleHas(list->at(i), text, exact)) ids.setBit(int(list->at(i)));
+    }
+    return ids;
+}
+
+void SearchIndex::compact()
+{
+    if (m_entries - m_liveEntries < qMax(kMinStaleEntries, m_liveEntries)) return;
+    StringArena chars;
+    chars.reserve(int(m_titleChars.size() - m_garbageChars));
+    m_titles.clear();
+    m_entries = 0;
+    for (int id = 0; id < m_live.size(); ++id) {
+        if (!m_live.at(id)) continue;
+        const StringArena::Ref ref = chars.add(titleAt(quint32(id)));
+        m_titleOffset[id] = ref.offset;
+        const QVector<quint64> tris = trigramsOf(chars.data(ref.offset), int(ref.length));
+        for (const quint64 tri : tris) m_titles.append(tri, quint32(id));
+        m_entries += tris.size();
+    }
+    m_titleChars = chars;
+    m_liveEntries = m_entries;
+    m_garbageChars = 0;
+}
+
+QVector<SearchIndex::Bound> SearchIndex::bind(const Query &query) const
+{
+    QVector<Bound> program;
+    program.reserve(query.terms.size());
+    for (const Term &t : query.terms) {
+        Bound b;
+        b.term = t;
+        if (t.isText()) {
+            // Matched once per distinct title and tag value; the rows then
+            // only test the bits of their ids.
+            const bool exact = t.op == Term::Equal;
+            const bool any = t.field == Term::Any;
+            if (any || t.field == Term::Title) b.titles = matchTitles(t.text, exact);
+            if (any || t.field == Term::Artist) b.artists = m_artists.match(t.text, exact);
+            if (any || t.field == Term::Album) b.albums = m_albums.match(t.text, exact);
+            if (any || t.field == Term::Genre) b.genres = m_genres.match(t.text, exact);
+            if (any || t.field == Term::Composer) b.composers = m_composers.match(t.text, exact);
+        }
+        program << b;
+    }
+    return program;
+}
+
+void SearchIndex::evaluate(const TrackStore &store, const Bound &bound, int first, int last, uchar *pass)
+{
+    const Term &t = bound.term;
+    if (!t.isText()) {
+        for (int row = first; row <= last; ++row) {
+            uchar &p = pass[row - first];
+            if (p) p = uchar(holds(t.op, numberAt(store, t.field, row), t.number) != t.negate);
+        }
+        return;
+    }
+    for (int row = first; row <= last; ++row) {
+        uchar &p = pass[row - first];
+        if (!p) continue;
+        const bool hit = has(bound.titles, store.id(row)) || has(bound.artists, store.artistId(row))
+            || has(bound.albums, store.albumId(row)) || has(bound.genres, store.genreId(row))
+            || has(bound.composers, store.composerId(row));
+        p = uchar(hit != t.negate);
+    }
+}
+
+QBitArray SearchIndex::match(const TrackStore &store, const Query &query) const
+{
+    const int rows = store.size();
+    const QVector<Bound> program = bind(query);
+    QBitArray result(rows);
+    QVector<int> chunks;
+    for (int first = 0; first < rows; first += kMatchChunkRows) chunks << first;
+    auto run = [&](int first) {
+        const int last = qMin(rows, first + kMatchChunkRows) - 1;
+        // Term at a time over the chunk, so each pass reads one column.
+        std::vector<uchar> pass(size_t(last - first + 1), 1);
+        for (const Bound &b : program) evaluate(store, b, first, last, pass.data());
+        for (int row = first; row <= last; ++row)
+            if (pass[size_t(row - first)]) result.setBit(row);
+    };
+    if (chunks.size() > 1) QtConcurrent::blockingMap(chunks, run);
+    else if (!chunks.isEmpty()) run(0);
+    return result;
+}
+
+bool SearchIndex::textMatches(const TrackStore &store, int row, const Term &term) const
+{
+    const bool exact = term.op == Term::Equal;
+    const bool any = term.field == Term::Any;
+    return ((any || term.field == Term::Title) && titleHas(store.id(row), term.text, exact))
+        || ((any || term.field == Term::Artist) && m_artists.has(store.artistId(row), term.text, exact))
+        || ((any || term.field == Term::Album) && m_albums.has(store.albumId(row), term.text, exact))
+        || ((any || term.field == Term::Genre) && m_genres.has(store.genreId(row), term.text, exact))
+        || ((any || term.field == Term::Composer) && m_composers.has(store.composerId(row), term.text, exact));
+}
+
+bool SearchIndex::matchesRow(const TrackStore &store, int row, const Query &query) const
+{
+    for (const Term &t : query.terms) {
+        const bool hit = t.isText() ? textMatches(store, row, t) : holds(t.op, numberAt(store, t.field, row), t.number);
+        if (hit == t.negate) return false;
+    }
+    return true;
+}
+
+qint64 SearchIndex::memoryBytes() const
+{
+    qint64 bytes = m_titleChars.memoryBytes() + columnBytes(m_titleOffset) + columnBytes(m_titleLength)
+        + columnBytes(m_live) + m_titles.memoryBytes();
+    for (const Dictionary *d : { &m_artists, &m_albums, &m_genres, &m_composers }) {
+        bytes += columnBytes(d->folded) + d->postings.memoryBytes();
+        for (int i = 0; i < d->folded.size(); ++i) bytes += 32 + qint64(d->folded.at(i).size()) * qint64(sizeof(QChar));
+    }
+    return bytes;
+}
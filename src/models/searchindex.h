@@ -0,0 +1,179 @@
+/*
+ * SearchIndex - trigram inverted index over the track list's text columns
+ *
+ * Titles are indexed per track (by the store's stable id). Artist, album,
+ * genre and composer are indexed per dictionary value, so a library with 1M
+ * tracks by 20k artists indexes 20k artist names, and a match is turned into
+ * rows by one pass over the id column.
+ *
+ * A query is compiled into terms, e.g. `artist:"boards of canada"
+ * year>=1995 rating>=4 -genre:live`; words outside field syntax are free text
+ * matched against every text field. Text terms are first resolved to the set
+ * of matching title ids and dictionary values: a term with a trigram only
+ * verifies the entries of its rarest trigram, others scan the folded values.
+ * Then every term is checked per row in parallel chunks of the store's
+ * columns, numeric fields on their raw values.
+ *
+ * All text is compared in folded form (see fold()), computed once when a
+ * title or tag value is indexed: "Björk" is found by "bjork", "Æon" by
+ * "aeon" and full-width letters by their ASCII forms.
+ *
+ * Posting lists are append-only: a retitled or removed track leaves stale
+ * entries behind that verification rejects, and the lists are rebuilt once
+ * stale entries outnumber live ones. Lists, titles and folded values are kept
+ * in ChunkedVectors, so a copy taken for a query job shares them by chunk.
+ */
+#ifndef MEDIASONIC_MODELS_SEARCHINDEX_H
+#define MEDIASONIC_MODELS_SEARCHINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QBitArray>
+#include "models/chunkedvector.h"
+#include "models/trackstore.h"
+
+namespace MS {
+
+class SearchIndex
+{
+public:
+    // One condition of a query; a leading '-' negates it.
+    struct Term
+    {
+        enum Field {
+            Any = 0, // free text: title, artist, album, genre or composer
+            Title,
+            Artist,
+            Album,
+            Genre,
+            Composer,
+            Year,
+            Rating,
+            Plays,
+            Bitrate,
+            Duration,
+            TrackNumber,
+            DiscNumber
+        };
+        // ':' is Contains for text and Equal for numbers.
+        enum Op { Contains = 0, Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+        Field field = Any;
+        Op op = Contains;
+        bool negate = false;
+        QString text;      // folded; text fields
+        qint64 number = 0; // numeric fields, in the column's unit (ms for durations)
+        bool isText() const { return field <= Composer; }
+    };
+    // Terms that must all hold.
+    struct Query
+    {
+        QVector<Term> terms;
+        bool isEmpty() const { return terms.isEmpty(); }
+    };
+
+    // Comparison form of a string: compatibility-decomposed (NFKD), case
+    // folded and stripped of combining marks, with the few letters that do
+    // not decompose (ß, æ, ø, ł, ...) spelled out in ASCII.
+    static QString fold(const QString &text);
+    static Query parse(const QString &text);
+
+    // Keep the index in step with the store: call after rows were appended or
+    // retitled, and before rows are removed from it.
+    void addRows(const TrackStore &store, int first, int last);
+    void updateRows(const TrackStore &store, const QVector<int> &rows);
+    void removeRows(const TrackStore &store, int first, int last);
+    void clear();
+
+    // One bit per store row; large stores are matched on several threads.
+    QBitArray match(const TrackStore &store, const Query &query) const;
+    bool matchesRow(const TrackStore &store, int row, const Query &query) const;
+
+    // Folded text of a row's title, artist, album, genre or composer, as
+    // indexed; empty for other fields.
+    QString folded(const TrackStore &store, int row, Term::Field field) const;
+
+    qint64 memoryBytes() const;
+
+private:
+    // Posting lists by trigram, in an open-addressed table of chunked slots
+    // rather than a QHash, so that a copy shares the table by chunk too.
+    class Postings
+    {
+    public:
+        // The trigram's list, or null if it has none.
+        const ChunkedVector<quint32> *find(quint64 trigram) const;
+        // The shortest list among the token's trigrams, or null if one of
+        // them is not indexed at all (so nothing can match). Tokens without
+        // a trigram cannot use the postings; callers scan for those.
+        const ChunkedVector<quint32> *rarest(const QString &token) const;
+        void append(quint64 trigram, quint32 id);
+        void clear();
+        qint64 memoryBytes() const;
+
+    private:
+        // Trigrams pack three UTF-16 units into 48 bits, so this is none.
+        static constexpr quint64 kNoTrigram = ~quint64(0);
+        struct Slot
+        {
+            quint64 trigram = kNoTrigram;
+            ChunkedVector<quint32> ids;
+        };
+
+        int slotOf(quint64 trigram) const;
+
+        ChunkedVector<Slot, 10> m_slots;
+        int m_used = 0;
+    };
+
+    // Folded values of one StringDictionary, indexed as they get interned.
+    struct Dictionary
+    {
+        ChunkedVector<QString> folded;
+        Postings postings;
+        QString at(quint32 id) const { return int(id) < folded.size() ? folded.at(int(id)) : QString(); }
+        void sync(const StringDictionary &values);
+        // Bit per dictionary id that contains (or equals) the text.
+        QBitArray match(const QString &text, bool exact) const;
+        bool has(quint32 id, const QString &text, bool exact) const;
+    };
+    // A text term resolved to the title ids and dictionary values it matches.
+    struct Bound
+    {
+        Term term;
+        QBitArray titles, artists, albums, genres, composers;
+    };
+
+    QVector<Bound> bind(const Query &query) const;
+    static void evaluate(const TrackStore &store, const Bound &bound, int first, int last, uchar *pass);
+    bool textMatches(const TrackStore &store, int row, const Term &term) const;
+
+    void setTitle(quint32 id, const QString &foldedTitle);
+    void dropTitle(quint32 id);
+    QString titleAt(quint32 id) const;
+    bool titleHas(quint32 id, const QString &text, bool exact) const;
+    QBitArray matchTitles(const QString &text, bool exact) const;
+    void syncDictionaries(const TrackStore &store);
+    void compact();
+
+    Dictionary m_artists;
+    Dictionary m_albums;
+    Dictionary m_genres;
+    Dictionary m_composers;
+
+    // Folded display titles by stable id.
+    StringArena m_titleChars;
+    ChunkedVector<quint32> m_titleOffset;
+    ChunkedVector<quint16> m_titleLength;
+    ChunkedVector<bool> m_live;
+    Postings m_titles;
+    qint64 m_entries = 0;     // ids in all title posting lists
+    qint64 m_liveEntries = 0; // of those, belonging to a track's current title
+    qint64 m_garbageChars = 0;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_SEARCHINDEX_H
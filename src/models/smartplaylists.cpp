@@ -0,0 +1,218 @@
+#include "models/smartplaylists.h"
+#include <algorithm>
+
+using namespace MS;
+
+namespace {
+
+// Lingering ids an unordered playlist may collect before it is tidied anyway.
+constexpr int kMinUntidyIds = 64;
+
+}
+
+int SmartPlaylists::add(const TrackStore &store, const QString &name, const Rule &rule)
+{
+    View view;
+    view.name = name;
+    view.rule = rule;
+    fill(store, view);
+    m_views << view;
+    return m_views.size() - 1;
+}
+
+int SmartPlaylists::indexOf(const QString &name) const
+{
+    for (int i = 0; i < m_views.size(); ++i)
+        if (m_views.at(i).name == name) return i;
+    return -1;
+}
+
+void SmartPlaylists::addRows(const TrackStore &store, int first, int last)
+{
+    for (View &view : m_views) {
+        view.members.resize(int(store.idLimit()));
+        for (int row = first; row <= last; ++row) update(store, view, row);
+    }
+}
+
+void SmartPlaylists::updateRows(const TrackStore &store, const QVector<int> &rows)
+{
+    for (View &view : m_views)
+        for (const int row : rows) update(store, view, row);
+}
+
+void SmartPlaylists::removeRows(const TrackStore &store, int first, int last)
+{
+    for (View &view : m_views) {
+        for (int row = first; row <= last; ++row) {
+            const quint32 id = store.id(row);
+            if (int(id) >= view.members.size() || !view.members.testBit(int(id))) continue;
+            if (view.rule.order == Rule::Unordered) {
+                setMember(view, id, false);
+                continue;
+            }
+            demote(view);
+            drop(view, id);
+        }
+    }
+}
+
+QVector<int> SmartPlaylists::rows(const TrackStore &store, int playlist)
+{
+    QVector<int> out;
+    if (playlist < 0 || playlist >= m_views.size()) return out;
+    View &view = m_views[playlist];
+    if (view.rule.order != Rule::Unordered) {
+        if (!view.complete && view.exact < view.rule.limit) fill(store, view);
+        QVector<Entry> best = view.heap;
+        const int shown = qMin(best.size(), view.rule.limit);
+        std::partial_sort(best.begin(), best.begin() + shown, best.end());
+        out.reserve(shown);
+        for (int i = 0; i < shown; ++i) {
+            const int row = store.rowOfId(best.at(i).id);
+            if (row >= 0) out << row;
+        }
+        return out;
+    }
+    // Rows keep the order they were added in, so ascending ids are ascending rows.
+    tidy(view);
+    out.reserve(view.ids.size());
+    for (const quint32 id : qAsConst(view.ids)) {
+        const int row = store.rowOfId(id);
+        if (row >= 0) out << row;
+    }
+    return out;
+}
+
+bool SmartPlaylists::accepts(const Rule &rule, const TrackStore &store, int row)
+{
+    if (store.rating(row) < rule.minRating) return false;
+    const int year = store.year(row);
+    if (rule.minYear && year < rule.minYear) return false;
+    if (rule.maxYear && year > rule.maxYear) return false;
+    return rule.genre.isEmpty() || store.genre(row).compare(rule.genre, Qt::CaseInsensitive) == 0;
+}
+
+quint64 SmartPlaylists::rank(const Rule &rule, const TrackStore &store, int row)
+{
+    // The id breaks ties in favour of the newer track.
+    const quint64 id = store.id(row);
+    switch (rule.order) {
+    case Rule::MostPlayed: return store.playCount(row) ? quint64(store.playCount(row)) << 32 | id : 0;
+    case Rule::RecentlyAdded: return quint64(1) << 32 | id;
+    case Rule::RecentlyPlayed: return store.lastPlayed(row) ? quint64(store.lastPlayed(row)) << 32 | id : 0;
+    default: return 0;
+    }
+}
+
+void SmartPlaylists::fill(const TrackStore &store, View &view)
+{
+    view.members.fill(false, int(store.idLimit()));
+    view.ids.clear();
+    view.memberCount = 0;
+    view.sorted = true;
+    view.heap.clear();
+    view.complete = true;
+    view.exact = 0;
+    const bool ordered = view.rule.order != Rule::Unordered;
+    if (ordered) view.heap.reserve(2 * view.rule.limit);
+    for (int row = 0; row < store.size(); ++row) {
+        if (!accepts(view.rule, store, row)) continue;
+        if (!ordered) setMember(view, store.id(row), true);
+        else if (const quint64 r = rank(view.rule, store, row)) offer(view, r, store.id(row));
+    }
+}
+
+void SmartPlaylists::update(const TrackStore &store, View &view, int row)
+{
+    const quint32 id = store.id(row);
+    if (int(id) >= view.members.size()) view.members.resize(int(store.idLimit()));
+    const bool accepted = accepts(view.rule, store, row);
+    if (view.rule.order == Rule::Unordered) {
+        setMember(view, id, accepted);
+        return;
+    }
+    const quint64 r = accepted ? rank(view.rule, store, row) : 0;
+    if (!view.members.testBit(int(id))) {
+        if (r) offer(view, r, id);
+        return;
+    }
+    auto it = std::find_if(view.heap.begin(), view.heap.end(), [id](const Entry &e) { return e.id == id; });
+    if (it == view.heap.end()) return;
+    if (r < it->rank) demote(view);
+    if (r == 0) {
+        drop(view, id);
+        return;
+    }
+    it->rank = r;
+    std::make_heap(view.heap.begin(), view.heap.end());
+}
+
+void SmartPlaylists::setMember(View &view, quint32 id, bool member)
+{
+    if (view.members.testBit(int(id)) == member) return;
+    view.members.setBit(int(id), member);
+    if (!member) {
+        --view.memberCount;
+        return;
+    }
+    ++view.memberCount;
+    if (!view.ids.isEmpty() && id <= view.ids.last()) view.sorted = false;
+    view.ids << id;
+    if (view.ids.size() > 2 * view.memberCount + kMinUntidyIds) tidy(view);
+}
+
+void SmartPlaylists::tidy(View &view)
+{
+    if (view.sorted && view.ids.size() == view.memberCount) return;
+    if (!view.sorted) std::sort(view.ids.begin(), view.ids.end());
+    // Drops the ids that left, and the second copy of those that came back.
+    int kept = 0;
+    for (int i = 0; i < view.ids.size(); ++i) {
+        const quint32 id = view.ids.at(i);
+        if (!view.members.testBit(int(id)) || (kept && view.ids.at(kept - 1) == id)) continue;
+        view.ids[kept++] = id;
+    }
+    view.ids.resize(kept);
+    view.sorted = true;
+}
+
+void SmartPlaylists::offer(View &view, quint64 rank, quint32 id)
+{
+    if (view.heap.size() < 2 * view.rule.limit) {
+        view.heap << Entry{rank, id};
+        std::push_heap(view.heap.begin(), view.heap.end());
+        view.members.setBit(int(id));
+        return;
+    }
+    // Everything held outranks the track turned away.
+    if (view.complete) {
+        view.complete = false;
+        view.exact = view.heap.size();
+    }
+    if (!view.heap.isEmpty() && rank > view.heap.first().rank) {
+        std::pop_heap(view.heap.begin(), view.heap.end());
+        view.members.clearBit(int(view.heap.last().id));
+        view.heap.last() = Entry{rank, id};
+        std::push_heap(view.heap.begin(), view.heap.end());
+    } else {
+        return;
+    }
+    view.members.setBit(int(id));
+}
+
+void SmartPlaylists::demote(View &view)
+{
+    // A member leaving or sinking may fall below a track that was turned away.
+    if (!view.complete) --view.exact;
+}
+
+void SmartPlaylists::drop(View &view, quint32 id)
+{
+    view.members.clearBit(int(id));
+    auto it = std::find_if(view.heap.begin(), view.heap.end(), [id](const Entry &e) { return e.id == id; });
+    if (it == view.heap.end()) return;
+    *it = view.heap.last();
+    view.heap.removeLast();
+    std::make_heap(view.heap.begin(), view.heap.end());
+}
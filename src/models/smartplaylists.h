@@ -0,0 +1,106 @@
+/*
+ * SmartPlaylists - rule-based playlists kept as materialized views of a
+ * TrackStore
+ *
+ * A playlist is a rule (minimum rating, a year range, a genre) and, for
+ * "top N" playlists, an order (most played, most recently added or played)
+ * with a size limit. Members are recorded by stable track id and updated one
+ * row at a time as tracks are added, edited, played and removed, so opening a
+ * playlist reads its members instead of querying the library.
+ *
+ * A top N playlist holds its best N tracks and a reserve of up to N more in
+ * a min-heap: a track gets in by outranking the weakest one held. Once the
+ * heap has turned a track away, a member leaving or sinking may let an unseen
+ * track into the top N, so each such change uses up one track of the reserve;
+ * only when the reserve is spent is the playlist refilled from the store, the
+ * next time it is read. Other playlists keep their member ids in order, so
+ * reading one costs its size rather than the library's.
+ */
+#ifndef MEDIASONIC_MODELS_SMARTPLAYLISTS_H
+#define MEDIASONIC_MODELS_SMARTPLAYLISTS_H
+
+#include <QBitArray>
+#include <QString>
+#include <QVector>
+#include "models/trackstore.h"
+
+namespace MS {
+
+class SmartPlaylists
+{
+public:
+    struct Rule
+    {
+        enum Order {
+            Unordered = 0,
+            MostPlayed,    // by play count; tracks never played are left out
+            RecentlyAdded, // by stable id, which grows with every import
+            RecentlyPlayed // by last play; tracks never played are left out
+        };
+        int minRating = 0;
+        int minYear = 0; // 0: no lower bound
+        int maxYear = 0; // 0: no upper bound
+        QString genre;   // compared case-insensitively; empty matches any
+        Order order = Unordered;
+        int limit = 0;   // size of an ordered playlist
+    };
+
+    // Adds a playlist, fills it from the store and returns its index.
+    int add(const TrackStore &store, const QString &name, const Rule &rule);
+    int count() const { return m_views.size(); }
+    // Index of the playlist with this name, or -1.
+    int indexOf(const QString &name) const;
+    QString name(int playlist) const { return m_views.at(playlist).name; }
+    bool isOrdered(int playlist) const { return m_views.at(playlist).rule.order != Rule::Unordered; }
+
+    // Keep the playlists in step with the store: addRows() and updateRows()
+    // once the rows were appended or changed, removeRows() before they go.
+    void addRows(const TrackStore &store, int first, int last);
+    void updateRows(const TrackStore &store, const QVector<int> &rows);
+    void removeRows(const TrackStore &store, int first, int last);
+
+    // Store rows of a playlist; best first for ordered playlists, in store
+    // order otherwise. Refills a top N playlist whose reserve ran out first.
+    QVector<int> rows(const TrackStore &store, int playlist);
+
+private:
+    struct Entry
+    {
+        quint64 rank;
+        quint32 id;
+        // Inverted so that the std heap functions keep the weakest on top.
+        bool operator<(const Entry &other) const { return rank > other.rank; }
+    };
+    struct View
+    {
+        QString name;
+        Rule rule;
+        QBitArray members;    // by stable id
+        // Unordered playlists: member ids, ascending and one each once tidy();
+        // until then ids that left linger and ids that came back are appended.
+        QVector<quint32> ids;
+        int memberCount = 0;
+        bool sorted = true;
+        // Ordered playlists: the best tracks, up to twice the limit.
+        QVector<Entry> heap;
+        bool complete = true; // every track the rule ranks is in the heap
+        int exact = 0;        // if not, how many of the best held are the best overall
+    };
+
+    static bool accepts(const Rule &rule, const TrackStore &store, int row);
+    // Position of a row in an ordered playlist, higher is better; 0 keeps it out.
+    static quint64 rank(const Rule &rule, const TrackStore &store, int row);
+    void fill(const TrackStore &store, View &view);
+    void update(const TrackStore &store, View &view, int row);
+    void setMember(View &view, quint32 id, bool member);
+    void tidy(View &view);
+    void offer(View &view, quint64 rank, quint32 id);
+    void demote(View &view);
+    void drop(View &view, quint32 id);
+
+    QVector<View> m_views;
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_SMARTPLAYLISTS_H
@@ -0,0 +1,311 @@
+#include "models/sortindex.h"
+#include <QBitArray>
+#include <QtConcurrent>
+#include <QThread>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+using namespace MS;
+
+namespace {
+
+// Below this many rows a permutation is sorted on the calling thread.
+constexpr int kParallelSortRows = 64 * 1024;
+// Rows per task when collation keys are computed in parallel.
+constexpr int kKeyChunkRows = 16 * 1024;
+// Inserting more rows than this at once rebuilds the permutation instead:
+// collation sort keys beat a QCollator::compare per binary-search step.
+constexpr int kMaxInsertRows = 4096;
+
+QCollator makeCollator()
+{
+    QCollator collator;
+    collator.setCaseSensitivity(Qt::CaseInsensitive);
+    collator.setNumericMode(true);
+    return collator;
+}
+
+// Sorts rows in power-of-two chunks on the global pool, then merges the
+// chunks pairwise, each round's merges in parallel as well.
+template <typename T, typename Less>
+void parallelSort(QVector<T> &rows, Less less)
+{
+    const int n = rows.size();
+    int chunks = 1;
+    while (chunks * 2 <= QThread::idealThreadCount() && n / (chunks * 2) >= kParallelSortRows) chunks *= 2;
+    if (chunks == 1) {
+        std::sort(rows.begin(), rows.end(), less);
+        return;
+    }
+    QVector<int> bounds(chunks + 1);
+    for (int c = 0; c <= chunks; ++c) bounds[c] = int(qint64(n) * c / chunks);
+    T *src = rows.data();
+    QVector<T> buffer(n);
+    T *dst = buffer.data();
+
+    QVector<int> tasks(chunks);
+    std::iota(tasks.begin(), tasks.end(), 0);
+    QtConcurrent::blockingMap(tasks, [&](int c) {
+        std::sort(src + bounds.at(c), src + bounds.at(c + 1), less);
+    });
+    for (int width = 1; width < chunks; width *= 2) {
+        tasks.clear();
+        for (int c = 0; c < chunks; c += 2 * width) tasks << c;
+        QtConcurrent::blockingMap(tasks, [&](int c) {
+            const int lo = bounds.at(c);
+            const int mid = bounds.at(qMin(c + width, chunks));
+            const int hi = bounds.at(qMin(c + 2 * width, chunks));
+            std::merge(src + lo, src + mid, src + mid, src + hi, dst + lo, less);
+        });
+        std::swap(src, dst);
+    }
+    if (src != rows.data()) rows = buffer;
+}
+
+// Merges sorted items into a sorted list with a binary search per item and
+// one pass over the list, instead of a comparison per list element.
+template <typename T, typename Less>
+void mergeSorted(QVector<T> &list, const QVector<T> &items, Less less)
+{
+    if (items.isEmpty()) return;
+    QVector<T> out;
+    out.reserve(list.size() + items.size());
+    auto from = list.constBegin();
+    for (const T &item : items) {
+        const auto to = std::upper_bound(from, list.constEnd(), item, less);
+        for (; from != to; ++from) out << *from;
+        out << item;
+    }
+    for (; from != list.constEnd(); ++from) out << *from;
+    list = out;
+}
+
+// Collation sort keys for rows [0, count), computed in parallel; the key of
+// row r is keys[r / kKeyChunkRows][r % kKeyChunkRows]. QCollatorSortKey has
+// no default constructor, hence the vectors of vectors.
+template <typename Text>
+std::vector<std::vector<QCollatorSortKey>> sortKeys(int count, Text text)
+{
+    QVector<int> chunks;
+    for (int start = 0; start < count; start += kKeyChunkRows) chunks << start;
+    std::vector<std::vector<QCollatorSortKey>> keys(size_t(chunks.size()));
+    QtConcurrent::blockingMap(chunks, [&](int start) {
+        // One collator per task; QCollator is not documented as thread-safe.
+        const QCollator collator = makeCollator();
+        std::vector<QCollatorSortKey> &chunk = keys[size_t(start / kKeyChunkRows)];
+        const int end = qMin(count, start + kKeyChunkRows);
+        chunk.reserve(size_t(end - start));
+        for (int i = start; i < end; ++i) chunk.push_back(collator.sortKey(text(i)));
+    });
+    return keys;
+}
+
+const QCollatorSortKey &keyAt(const std::vector<std::vector<QCollatorSortKey>> &keys, int i)
+{
+    return keys[size_t(i / kKeyChunkRows)][size_t(i % kKeyChunkRows)];
+}
+
+}
+
+SortIndex::SortIndex()
+    : m_collator(makeCollator())
+{
+}
+
+SortIndex::SortIndex(const SortIndex &other)
+    : m_collator(makeCollator())
+{
+    *this = other;
+}
+
+SortIndex &SortIndex::operator=(const SortIndex &other)
+{
+    // The collator stays: copies of a QCollator share one ICU collator.
+    m_artists = other.m_artists;
+    m_albums = other.m_albums;
+    m_genres = other.m_genres;
+    std::copy(std::begin(other.m_rows), std::end(other.m_rows), std::begin(m_rows));
+    std::copy(std::begin(other.m_built), std::end(other.m_built), std::begin(m_built));
+    return *this;
+}
+
+void SortIndex::Ranks::sync(const StringDictionary &values, const QCollator &collator)
+{
+    if (rankOf.size() == values.size()) return;
+    const int first = rankOf.size();
+    const int count = values.size() - first;
+    const auto keys = sortKeys(count, [&](int i) { return values.at(quint32(first + i)); });
+    QVector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        const int c = keyAt(keys, a).compare(keyAt(keys, b));
+        return c != 0 ? c < 0 : a < b;
+    });
+    QVector<quint32> added;
+    added.reserve(count);
+    for (const int i : order) added << quint32(first + i);
+    mergeSorted(sortedIds, added, [&](quint32 a, quint32 b) {
+        const int c = collator.compare(values.at(a), values.at(b));
+        return c != 0 ? c < 0 : a < b;
+    });
+    rankOf.resize(values.size());
+    for (int i = 0; i < sortedIds.size(); ++i) rankOf[int(sortedIds.at(i))] = quint32(i);
+}
+
+const QVector<int> &SortIndex::rows(const TrackStore &store, Key key)
+{
+    if (!m_built[key]) build(store, key);
+    return m_rows[key];
+}
+
+void SortIndex::addRows(const TrackStore &store, int first, int last)
+{
+    if (!anyBuilt() || last < first) return;
+    syncRanks(store);
+    QVector<int> added(last - first + 1);
+    std::iota(added.begin(), added.end(), first);
+    for (int k = 0; k < KeyCount; ++k)
+        if (m_built[k]) insert(store, Key(k), added);
+}
+
+void SortIndex::updateRows(const TrackStore &store, const QVector<int> &rows)
+{
+    if (!anyBuilt() || rows.isEmpty()) return;
+    syncRanks(store);
+    QVector<int> changed = rows;
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    QBitArray isChanged(store.size());
+    for (const int row : changed) isChanged.setBit(row);
+    for (int k = 0; k < KeyCount; ++k) {
+        if (!m_built[k]) continue;
+        QVector<int> &order = m_rows[k];
+        order.erase(std::remove_if(order.begin(), order.end(), [&](int row) { return isChanged.testBit(row); }), order.end());
+        insert(store, Key(k), changed);
+    }
+}
+
+void SortIndex::removeRows(int first, int last)
+{
+    const int count = last - first + 1;
+    for (int k = 0; k < KeyCount; ++k) {
+        if (!m_built[k]) continue;
+        QVector<int> &order = m_rows[k];
+        int out = 0;
+        for (int i = 0; i < order.size(); ++i) {
+            const int row = order.at(i);
+            if (row >= first && row <= last) continue;
+            order[out++] = row > last ? row - count : row;
+        }
+        order.resize(out);
+    }
+}
+
+void SortIndex::clear()
+{
+    *this = SortIndex();
+}
+
+void SortIndex::adopt(const SortIndex &built, Key key, const TrackStore &store)
+{
+    if (m_built[key] || !built.m_built[key]) return;
+    // Dictionaries only grow, so the further synced ranks cover ours.
+    for (auto ranks : { qMakePair(&m_artists, &built.m_artists), qMakePair(&m_albums, &built.m_albums),
+                        qMakePair(&m_genres, &built.m_genres) }) {
+        if (ranks.second->rankOf.size() > ranks.first->rankOf.size()) *ranks.first = *ranks.second;
+    }
+    m_rows[key] = built.m_rows[key];
+    m_built[key] = true;
+    const int known = m_rows[key].size();
+    if (known < store.size()) {
+        syncRanks(store);
+        QVector<int> added(store.size() - known);
+        std::iota(added.begin(), added.end(), known);
+        insert(store, key, added);
+    }
+}
+
+qint64 SortIndex::memoryBytes() const
+{
+    qint64 bytes = 0;
+    for (const QVector<int> &order : m_rows) bytes += qint64(order.capacity()) * qint64(sizeof(int));
+    for (const Ranks *r : { &m_artists, &m_albums, &m_genres })
+        bytes += qint64(r->sortedIds.capacity() + r->rankOf.capacity()) * qint64(sizeof(quint32));
+    return bytes;
+}
+
+void SortIndex::build(const TrackStore &store, Key key)
+{
+    syncRanks(store);
+    // Keys are packed once per row up front, so the sort itself compares
+    // plain integers instead of chasing columns and ranks.
+    QVector<Item> items(store.size());
+    for (int row = 0; row < items.size(); ++row) items[row] = item(store, key, row);
+    if (key == ByTitle) {
+        const auto keys = sortKeys(store.size(), [&](int row) { return store.displayTitle(row); });
+        parallelSort(items, [&](const Item &a, const Item &b) {
+            const int c = keyAt(keys, a.row).compare(keyAt(keys, b.row));
+            return c != 0 ? c < 0 : a < b;
+        });
+    } else {
+        parallelSort(items, [](const Item &a, const Item &b) { return a < b; });
+    }
+    QVector<int> &order = m_rows[key];
+    order.resize(items.size());
+    for (int i = 0; i < items.size(); ++i) order[i] = items.at(i).row;
+    m_built[key] = true;
+}
+
+void SortIndex::insert(const TrackStore &store, Key key, QVector<int> added)
+{
+    if (added.size() > kMaxInsertRows) {
+        build(store, key);
+        return;
+    }
+    auto less = [&](int a, int b) { return lessThan(store, key, a, b); };
+    std::sort(added.begin(), added.end(), less);
+    mergeSorted(m_rows[key], added, less);
+}
+
+void SortIndex::syncRanks(const TrackStore &store)
+{
+    m_artists.sync(store.artists(), m_collator);
+    m_albums.sync(store.albums(), m_collator);
+    m_genres.sync(store.genres(), m_collator);
+}
+
+bool SortIndex::anyBuilt() const
+{
+    return std::any_of(std::begin(m_built), std::end(m_built), [](bool built) { return built; });
+}
+
+SortIndex::Item SortIndex::item(const TrackStore &store, Key key, int row) const
+{
+    Item it;
+    switch (key) {
+    case ByTime: it.primary = quint64(store.durationMs(row)); break;
+    // An album sorts by disc and track before artist, so compilations stay whole.
+    case ByAlbum:
+        it.primary = (quint64(m_albums.at(store.albumId(row))) << 32) | (quint64(store.discNumber(row)) << 16)
+            | quint64(store.trackNumber(row));
+        break;
+    case ByGenre: it.primary = m_genres.at(store.genreId(row)); break;
+    case ByRating: it.primary = quint64(store.rating(row)); break;
+    case ByPlays: it.primary = quint64(store.playCount(row)); break;
+    default: break;
+    }
+    it.artistAlbum = (quint64(m_artists.at(store.artistId(row))) << 32) | m_albums.at(store.albumId(row));
+    it.discTrack = (quint32(store.discNumber(row)) << 16) | quint32(store.trackNumber(row));
+    it.row = row;
+    return it;
+}
+
+bool SortIndex::lessThan(const TrackStore &store, Key key, int a, int b) const
+{
+    if (key == ByTitle) {
+        const int c = m_collator.compare(store.displayTitle(a), store.displayTitle(b));
+        if (c != 0) return c < 0;
+    }
+    return item(store, key, a) < item(store, key, b);
+}
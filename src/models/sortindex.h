@@ -0,0 +1,109 @@
+/*
+ * SortIndex - sorted permutations of a TrackStore, one per sort key
+ *
+ * A permutation is built the first time its key is sorted by and is kept in
+ * step with every insert, edit and removal after that, so sorting the track
+ * list by a column hands out an existing row order instead of running a
+ * comparison sort through the model.
+ *
+ * Strings collate with QCollator (locale order, case-insensitive, numbers by
+ * value). Artist, album and genre compare by their rank in the collated
+ * dictionary, which is integer work per row; titles compare through
+ * collation sort keys when a permutation is rebuilt, and through
+ * QCollator::compare for the handful of rows an edit or import inserts.
+ * Ties fall through to the iTunes order (artist, album, disc, track) and
+ * finally to the row, so every order is total.
+ *
+ * Copies share their permutations but collate with a QCollator of their
+ * own, so a copy can build a permutation on another thread; adopt() takes
+ * the result back.
+ */
+#ifndef MEDIASONIC_MODELS_SORTINDEX_H
+#define MEDIASONIC_MODELS_SORTINDEX_H
+
+#include <QCollator>
+#include <QVector>
+#include "models/trackstore.h"
+
+namespace MS {
+
+class SortIndex
+{
+public:
+    // In the order of TrackModel's columns.
+    enum Key {
+        ByTitle = 0,
+        ByTime,
+        ByArtist,
+        ByAlbum,
+        ByGenre,
+        ByRating,
+        ByPlays,
+        KeyCount
+    };
+
+    SortIndex();
+    SortIndex(const SortIndex &other);
+    SortIndex &operator=(const SortIndex &other);
+
+    // Rows of the store in ascending key order.
+    const QVector<int> &rows(const TrackStore &store, Key key);
+    bool isBuilt(Key key) const { return m_built[key]; }
+
+    // Keep built permutations in step with the store: call after rows were
+    // appended or edited, and when rows are removed.
+    void addRows(const TrackStore &store, int first, int last);
+    void updateRows(const TrackStore &store, const QVector<int> &rows);
+    void removeRows(int first, int last);
+    void clear();
+    // Takes a permutation from a copy that built it against the same store,
+    // or against one that store has only had rows appended to since.
+    void adopt(const SortIndex &built, Key key, const TrackStore &store);
+
+    qint64 memoryBytes() const;
+
+private:
+    // Collated order of one StringDictionary, extended as values get interned.
+    struct Ranks
+    {
+        QVector<quint32> sortedIds;
+        QVector<quint32> rankOf; // by id
+        void sync(const StringDictionary &values, const QCollator &collator);
+        quint32 at(quint32 id) const { return rankOf.at(int(id)); }
+    };
+
+    // A row's sort position under a key, short of the title: the key's own
+    // field, then the iTunes order, then the row.
+    struct Item
+    {
+        quint64 primary = 0;
+        quint64 artistAlbum = 0; // ranks
+        quint32 discTrack = 0;
+        int row = 0;
+        bool operator<(const Item &o) const
+        {
+            if (primary != o.primary) return primary < o.primary;
+            if (artistAlbum != o.artistAlbum) return artistAlbum < o.artistAlbum;
+            if (discTrack != o.discTrack) return discTrack < o.discTrack;
+            return row < o.row;
+        }
+    };
+
+    void build(const TrackStore &store, Key key);
+    void insert(const TrackStore &store, Key key, QVector<int> added);
+    void syncRanks(const TrackStore &store);
+    bool anyBuilt() const;
+    Item item(const TrackStore &store, Key key, int row) const;
+    bool lessThan(const TrackStore &store, Key key, int a, int b) const;
+
+    QCollator m_collator;
+    Ranks m_artists;
+    Ranks m_albums;
+    Ranks m_genres;
+    QVector<int> m_rows[KeyCount];
+    bool m_built[KeyCount] = {};
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_SORTINDEX_H
@@ -4,8 +4,11 @@
 #ifndef MEDIASONIC_MODELS_TRACK_H
 #define MEDIASONIC_MODELS_TRACK_H
 
+#include <QMap>
 #include <QString>
+#include <QStringList>
 #include <QUrl>
+#include <QVector>
 #include <QImage>
 #include <QMetaType>
 
@@ -13,11 +16,12 @@ namespace MS {
 
 struct Track
 {
-    QUrl url;
+    QString localPath; // '/'-separated, as QUrl::toLocalFile() gives it
     QString title;
     QString artist;
     QString album;
     QString genre;
+    QString composer;
     int year = 0;
     int trackNumber = 0;
     int discNumber = 0;
@@ -26,6 +30,48 @@ struct Track
     int sampleRate = 0;
     int rating = 0; // 0..5
     int playCount = 0;
+    qint64 lastPlayed = 0; // seconds since the epoch; 0 if never played
+    qint64 fileSize = 0; // bytes on disk when the tags were read
+    // Measured by LoudnessAnalyzer: ReplayGain 2.0 adjustments in dB and
+    // true peaks as linear sample values. A negative peak means the track
+    // was not analysed yet.
+    float trackGainDb = 0.0f;
+    float trackPeak = -1.0f;
+    float albumGainDb = 0.0f;
+    float albumPeak = -1.0f;
+
+    // Built on demand; only the path is kept.
+    QUrl url() const { return QUrl::fromLocalFile(localPath); }
+};
+
+// Tags that are only read when a track is inspected (see ColdTagCache), so
+// that the library keeps none of them per row.
+struct ColdTags
+{
+    struct Picture
+    {
+        QString type; // "Front Cover", "Back Cover", ...
+        QString mimeType;
+        int width = 0; // 0 if the file does not say
+        int height = 0;
+        qint64 bytes = 0;
+    };
+
+    QString comment;
+    QString lyrics;
+    // ReplayGain adjustments in dB and peaks as linear sample values.
+    bool hasTrackGain = false;
+    double trackGainDb = 0.0;
+    double trackPeak = 0.0;
+    bool hasAlbumGain = false;
+    double albumGainDb = 0.0;
+    double albumPeak = 0.0;
+    QString musicBrainzTrackId;
+    QString musicBrainzAlbumId;
+    QString musicBrainzArtistId;
+    QVector<Picture> pictures;
+    // Every other tag by its Vorbis comment / TagLib property name.
+    QMap<QString, QStringList> other;
 };
 
 }
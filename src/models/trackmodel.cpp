@@ -1,9 +1,14 @@
 #include "models/trackmodel.h"
+#include <QDateTime>
 #include <QLocale>
 #include <QTime>
+#include <QUrl>
 
 using namespace MS;
 
+static_assert(int(SortIndex::KeyCount) == int(TrackModel::ColCount) && int(SortIndex::ByPlays) == int(TrackModel::ColPlays),
+              "sort keys follow the track columns");
+
 TrackModel::TrackModel(QObject *parent)
     : QAbstractTableModel(parent)
 {
@@ -11,7 +16,7 @@ TrackModel::TrackModel(QObject *parent)
 
 int TrackModel::rowCount(const QModelIndex &parent) const
 {
-    return parent.isValid() ? 0 : m_tracks.size();
+    return parent.isValid() ? 0 : m_store.size();
 }
 
 int TrackModel::columnCount(const QModelIndex &parent) const
@@ -21,28 +26,28 @@ int TrackModel::columnCount(const QModelIndex &parent) const
 
 QVariant TrackModel::data(const QModelIndex &index, int role) const
 {
-    if (!index.isValid() || index.row() < 0 || index.row() >= m_tracks.size()) return QVariant();
-    const Track &t = m_tracks.at(index.row());
+    if (!index.isValid() || index.row() < 0 || index.row() >= m_store.size()) return QVariant();
+    const int row = index.row();
     if (role == Qt::DisplayRole) {
         switch (index.column()) {
-        case ColName: return t.title.isEmpty() ? t.url.fileName() : t.title;
+        case ColName: return m_store.displayTitle(row);
         case ColTime: {
-            int secs = int(t.durationMs / 1000);
+            int secs = int(m_store.durationMs(row) / 1000);
             return QString("%1:%2").arg(secs/60).arg(secs%60, 2, 10, QChar('0'));
         }
-        case ColArtist: return t.artist;
-        case ColAlbum: return t.album;
-        case ColGenre: return t.genre;
-        case ColRating: return t.rating;
-        case ColPlays: return t.playCount;
+        case ColArtist: return m_store.artist(row);
+        case ColAlbum: return m_store.album(row);
+        case ColGenre: return m_store.genre(row);
+        case ColRating: return m_store.rating(row);
+        case ColPlays: return m_store.playCount(row);
         default: return QVariant();
         }
     } else if (role == Qt::EditRole) {
-        if (index.column() == ColRating) return t.rating;
+        if (index.column() == ColRating) return m_store.rating(row);
     } else if (role == Qt::UserRole) {
         // Provide raw duration and URL
-        if (index.column() == ColTime) return t.durationMs;
-        if (index.column() == ColName) return t.url.toString();
+        if (index.column() == ColTime) return m_store.durationMs(row);
+        if (index.column() == ColName) return QUrl::fromLocalFile(m_store.localPath(row)).toString();
     }
     return QVariant();
 }
@@ -72,11 +77,13 @@ Qt::ItemFlags TrackModel::flags(const QModelIndex &index) const
 
 bool TrackModel::setData(const QModelIndex &index, const QVariant &value, int role)
 {
-    if (!index.isValid() || index.row() < 0 || index.row() >= m_tracks.size()) return false;
-    Track &t = m_tracks[index.row()];
+    if (!index.isValid() || index.row() < 0 || index.row() >= m_store.size()) return false;
     if (role == Qt::EditRole || role == Qt::DisplayRole) {
         if (index.column() == ColRating) {
-            t.rating = value.toInt();
+            m_store.setRating(index.row(), value.toInt());
+            m_edited = ++m_revision;
+            m_sort.updateRows(m_store, QVector<int>() << index.row());
+            m_smart.updateRows(m_store, QVector<int>() << index.row());
             emit dataChanged(index, index, {Qt::DisplayRole, Qt::EditRole});
             return true;
         }
@@ -86,21 +93,142 @@ bool TrackModel::setData(const QModelIndex &index, const QVariant &value, int ro
 
 void TrackModel::addTrack(const Track &t)
 {
-    const int row = m_tracks.size();
-    beginInsertRows(QModelIndex(), row, row);
-    m_tracks.push_back(t);
+    addTracks(QVector<Track>() << t);
+}
+
+void TrackModel::addTracks(const QVector<Track> &tracks)
+{
+    if (tracks.isEmpty()) return;
+    const int first = m_store.size();
+    const int last = first + tracks.size() - 1;
+    beginInsertRows(QModelIndex(), first, last);
+    // No exact reserve here: imports arrive in small batches and must keep the
+    // columns' geometric growth.
+    for (const Track &t : tracks) m_store.append(t);
+    ++m_revision;
+    for (int row = first; row <= last; ++row) {
+        m_browse.add(m_store, row);
+        updateUnmeasured(row);
+    }
+    m_search.addRows(m_store, first, last);
+    m_sort.addRows(m_store, first, last);
+    m_smart.addRows(m_store, first, last);
     endInsertRows();
-    emit trackAdded(t, row);
+    emit tracksAdded(first, last);
+}
+
+void TrackModel::updateTracks(const QVector<Track> &tracks)
+{
+    int top = -1, bottom = -1;
+    QVector<int> rows;
+    rows.reserve(tracks.size());
+    for (const Track &t : tracks) {
+        const int row = rowOf(t.localPath);
+        if (row < 0) continue;
+        // Library state is not part of the file's tags; keep it across re-parses.
+        m_browse.remove(m_store, row);
+        m_store.setTags(row, t);
+        m_browse.add(m_store, row);
+        updateUnmeasured(row);
+        rows << row;
+        m_edited = ++m_revision;
+        top = top < 0 ? row : qMin(top, row);
+        bottom = qMax(bottom, row);
+    }
+    m_search.updateRows(m_store, rows);
+    m_sort.updateRows(m_store, rows);
+    m_smart.updateRows(m_store, rows);
+    if (top >= 0) emit dataChanged(index(top, 0), index(bottom, ColCount - 1));
+}
+
+bool TrackModel::removeRows(int row, int count, const QModelIndex &parent)
+{
+    if (parent.isValid() || row < 0 || count <= 0 || row + count > m_store.size()) return false;
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    m_search.removeRows(m_store, row, row + count - 1);
+    for (int r = row; r < row + count; ++r) {
+        m_browse.remove(m_store, r);
+        m_unmeasured.remove(m_store.id(r));
+    }
+    m_smart.removeRows(m_store, row, row + count - 1);
+    m_store.remove(row, count);
+    m_edited = ++m_revision;
+    m_sort.removeRows(row, row + count - 1);
+    endRemoveRows();
+    return true;
+}
+
+bool TrackModel::renameTrack(const QString &oldPath, const QString &newPath)
+{
+    const int row = rowOf(oldPath);
+    if (row < 0) return false;
+    m_store.setLocalPath(row, newPath);
+    m_edited = ++m_revision;
+    // Untitled tracks are listed, and found, by file name.
+    m_search.updateRows(m_store, QVector<int>() << row);
+    m_sort.updateRows(m_store, QVector<int>() << row);
+    emit dataChanged(index(row, 0), index(row, ColCount - 1));
+    return true;
+}
+
+bool TrackModel::moveDirectory(const QString &from, const QString &to)
+{
+    // Nothing shown, sorted or searched depends on the directory.
+    if (!m_store.moveDirectory(from, to)) return false;
+    ++m_revision;
+    return true;
+}
+
+void TrackModel::recordPlay(int row)
+{
+    if (row < 0 || row >= m_store.size()) return;
+    m_store.setPlayCount(row, m_store.playCount(row) + 1);
+    m_store.setLastPlayed(row, QDateTime::currentSecsSinceEpoch());
+    m_edited = ++m_revision;
+    m_sort.updateRows(m_store, QVector<int>() << row);
+    m_smart.updateRows(m_store, QVector<int>() << row);
+    emit dataChanged(index(row, ColPlays), index(row, ColPlays), {Qt::DisplayRole});
+}
+
+void TrackModel::setLoudness(int row, float trackGainDb, float trackPeak, float albumGainDb, float albumPeak)
+{
+    if (row < 0 || row >= m_store.size()) return;
+    m_store.setLoudness(row, trackGainDb, trackPeak, albumGainDb, albumPeak);
+    updateUnmeasured(row);
+    ++m_revision;
+}
+
+void TrackModel::updateUnmeasured(int row)
+{
+    if (m_store.hasLoudness(row)) m_unmeasured.remove(m_store.id(row));
+    else m_unmeasured.insert(m_store.id(row));
+}
+
+int TrackModel::addSmartPlaylist(const QString &name, const SmartPlaylists::Rule &rule)
+{
+    return m_smart.add(m_store, name, rule);
+}
+
+QVector<int> TrackModel::smartPlaylistRows(int playlist)
+{
+    return m_smart.rows(m_store, playlist);
+}
+
+int TrackModel::rowOf(const QString &localPath) const
+{
+    return m_store.rowOf(localPath);
 }
 
-const Track &TrackModel::trackAt(int row) const
+Track TrackModel::trackAt(int row) const
 {
-    return m_tracks.at(row);
+    return m_store.track(row);
 }
 
-Track &TrackModel::trackAtMutable(int row)
+void TrackModel::adoptSortIndex(const SortIndex &built, quint64 revision)
 {
-    return m_tracks[row];
+    // Rows appended since are merged in; any other change may have moved rows.
+    if (revision < m_edited) return;
+    for (int key = 0; key < SortIndex::KeyCount; ++key) m_sort.adopt(built, SortIndex::Key(key), m_store);
 }
 
 QList<int> TrackModel::columnRoles() const
@@ -110,14 +238,11 @@ QList<int> TrackModel::columnRoles() const
 
 qint64 TrackModel::totalDurationMs() const
 {
-    qint64 sum = 0;
-    for (const auto &t : m_tracks) sum += t.durationMs;
-    return sum;
+    return m_store.totalDurationMs();
 }
 
 qint64 TrackModel::totalSizeBytes() const
 {
-    // Placeholder until file sizes are stored; assume 5MB per track
-    return qint64(m_tracks.size()) * 5 * 1024 * 1024;
+    return m_store.totalFileSize();
 }
 
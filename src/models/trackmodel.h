@@ -5,10 +5,14 @@
 #define MEDIASONIC_MODELS_TRACKMODEL_H
 
 #include <QAbstractTableModel>
+#include <QSet>
 #include <QVector>
-#include <QHash>
-#include <QByteArray>
 #include "models/track.h"
+#include "models/trackstore.h"
+#include "models/searchindex.h"
+#include "models/sortindex.h"
+#include "models/browseindex.h"
+#include "models/smartplaylists.h"
 
 namespace MS {
 
@@ -35,20 +39,73 @@ public:
     QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
     Qt::ItemFlags flags(const QModelIndex &index) const override;
     bool setData(const QModelIndex &index, const QVariant &value, int role) override;
+    bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
 
     void addTrack(const Track &t);
-    const Track &trackAt(int row) const;
-    Track &trackAtMutable(int row);
+    // Appends all tracks under a single rowsInserted notification.
+    void addTracks(const QVector<Track> &tracks);
+    // Replaces the metadata of rows with the same local path; unknown paths are ignored.
+    void updateTracks(const QVector<Track> &tracks);
+    // Points the row of oldPath at newPath, keeping all of its metadata.
+    bool renameTrack(const QString &oldPath, const QString &newPath);
+    // Moves every track under directory from to directory to in one step;
+    // false if the store has to take the tracks one by one instead.
+    bool moveDirectory(const QString &from, const QString &to);
+    // Counts a play of the row and stamps it as the last one.
+    void recordPlay(int row);
+    // Stores a row's measured ReplayGain (see Track); nothing shown, sorted
+    // or searched depends on it, so no view is notified.
+    void setLoudness(int row, float trackGainDb, float trackPeak, float albumGainDb, float albumPeak);
+    // Row holding the given local file path, or -1.
+    int rowOf(const QString &localPath) const;
+    Track trackAt(int row) const;
+    // All rows in order; implicitly shared, so copying is cheap.
+    const TrackStore &store() const { return m_store; }
+    // Kept in step with every insert, edit and removal.
+    const SearchIndex &searchIndex() const { return m_search; }
+    // Row orders by column; a permutation is built the first time a column
+    // is sorted by and maintained with the model from then on.
+    const SortIndex &sortIndex() const { return m_sort; }
+    // Takes permutations that a copy of sortIndex() built off the GUI thread,
+    // unless tracks were edited or removed since the copy was taken; tracks
+    // added since are merged into them.
+    void adoptSortIndex(const SortIndex &built, quint64 revision);
+    // Bumped by every change to the tracks.
+    quint64 revision() const { return m_revision; }
+    // Tracks by album, artist, genre and composer; kept in step like the search.
+    const BrowseIndex &browseIndex() const { return m_browse; }
+    // Smart playlists, maintained like the indexes; see SmartPlaylists.
+    int addSmartPlaylist(const QString &name, const SmartPlaylists::Rule &rule);
+    const SmartPlaylists &smartPlaylists() const { return m_smart; }
+    QVector<int> smartPlaylistRows(int playlist);
     QList<int> columnRoles() const;
 
+    // Maintained on every insert, edit and removal; O(1).
     qint64 totalDurationMs() const;
-    qint64 totalSizeBytes() const; // placeholder until we store file size
+    qint64 totalSizeBytes() const;
+    int albumCount() const { return m_store.albumTally().distinct(); }
+    int artistCount() const { return m_store.artistTally().distinct(); }
+    int genreCount() const { return m_store.genreTally().distinct(); }
+    // Stable ids of the tracks without loudness, kept in step like the
+    // indexes, so finding what to measure does not walk the library.
+    const QSet<quint32> &unmeasuredIds() const { return m_unmeasured; }
 
 signals:
-    void trackAdded(const MS::Track &track, int row);
+    // Emitted once per insertion, covering rows first..last inclusive.
+    void tracksAdded(int first, int last);
 
 private:
-    QVector<Track> m_tracks;
+    void updateUnmeasured(int row);
+
+    TrackStore m_store;
+    SearchIndex m_search;
+    SortIndex m_sort;
+    BrowseIndex m_browse;
+    SmartPlaylists m_smart;
+    QSet<quint32> m_unmeasured;
+    quint64 m_revision = 0;
+    // The revision of the last change other than adding tracks.
+    quint64 m_edited = 0;
 };
 
 }
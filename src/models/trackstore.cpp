@@ -0,0 +1,602 @@
+#include "models/trackstore.h"
+#include <QVarLengthArray>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace MS;
+
+namespace {
+
+// Rough heap cost of one QHash node plus its bucket pointer and malloc slack.
+constexpr qint64 kHashNodeBytes = 48;
+// Header and malloc slack of one QString allocation.
+constexpr qint64 kStringHeaderBytes = 32;
+// Arenas are rebuilt once this many characters are unreferenced and they make
+// up more than half of the arena.
+constexpr int kMinGarbageChars = 64 * 1024;
+constexpr int kMinIndexSlots = 16;
+// Path index slots: free, and left by a removed track (probes go on past it).
+constexpr qint32 kFreeSlot = -1;
+constexpr qint32 kTombstone = -2;
+
+template <typename T>
+qint64 columnBytes(const ChunkedVector<T> &column)
+{
+    return column.memoryBytes();
+}
+
+template <typename T>
+T narrow(qint64 value)
+{
+    return T(qBound<qint64>(0, value, qint64(std::numeric_limits<T>::max())));
+}
+
+qint16 centibels(double db)
+{
+    return qint16(qBound(-32767.0, std::round(db * 100.0), 32767.0));
+}
+
+// Index hash of a file: its directory node and its name, so that moving the
+// directory leaves it alone.
+uint pathHash(quint32 dir, const QChar *name, int length)
+{
+    return qHashBits(name, size_t(length) * sizeof(QChar), dir);
+}
+
+QString asDirectory(const QString &path)
+{
+    return path.endsWith(QLatin1Char('/')) ? path : path + QLatin1Char('/');
+}
+
+}
+
+StringDictionary::StringDictionary()
+{
+    m_values << QString();
+    m_ids.insert(QString(), 0);
+}
+
+quint32 StringDictionary::intern(const QString &value)
+{
+    if (value.isEmpty()) return 0;
+    const auto it = m_ids.constFind(value);
+    if (it != m_ids.constEnd()) return it.value();
+    const quint32 id = quint32(m_values.size());
+    m_values << value;
+    m_ids.insert(value, id);
+    return id;
+}
+
+qint64 StringDictionary::find(const QString &value) const
+{
+    if (value.isEmpty()) return 0;
+    const auto it = m_ids.constFind(value);
+    return it == m_ids.constEnd() ? -1 : qint64(it.value());
+}
+
+qint64 StringDictionary::memoryBytes() const
+{
+    qint64 bytes = columnBytes(m_values) + qint64(m_ids.size()) * kHashNodeBytes;
+    // The hash key shares its data with the value.
+    for (int i = 0; i < m_values.size(); ++i)
+        bytes += kStringHeaderBytes + qint64(m_values.at(i).capacity()) * qint64(sizeof(QChar));
+    return bytes;
+}
+
+PathTrie::PathTrie()
+{
+    m_parent << 0;
+    m_name << QString();
+}
+
+quint32 PathTrie::intern(const QString &dir)
+{
+    quint32 node = 0;
+    int start = 0;
+    for (int slash = dir.indexOf(QLatin1Char('/')); slash >= 0; slash = dir.indexOf(QLatin1Char('/'), start)) {
+        const Key key(node, dir.mid(start, slash - start));
+        const auto it = m_children.constFind(key);
+        if (it != m_children.constEnd()) {
+            node = it.value();
+        } else {
+            const quint32 child = quint32(m_parent.size());
+            m_parent << node;
+            m_name << key.second;
+            m_children.insert(key, child);
+            node = child;
+        }
+        start = slash + 1;
+    }
+    return node;
+}
+
+qint64 PathTrie::find(const QString &dir) const
+{
+    quint32 node = 0;
+    int start = 0;
+    for (int slash = dir.indexOf(QLatin1Char('/')); slash >= 0; slash = dir.indexOf(QLatin1Char('/'), start)) {
+        const auto it = m_children.constFind(Key(node, dir.mid(start, slash - start)));
+        if (it == m_children.constEnd()) return -1;
+        node = it.value();
+        start = slash + 1;
+    }
+    return node;
+}
+
+QString PathTrie::path(quint32 node) const
+{
+    QVarLengthArray<quint32, 16> chain;
+    int length = 0;
+    for (quint32 n = node; n != 0; n = m_parent.at(int(n))) {
+        chain.append(n);
+        length += m_name.at(int(n)).size() + 1;
+    }
+    QString out;
+    out.reserve(length);
+    for (int i = chain.size() - 1; i >= 0; --i) {
+        out += m_name.at(int(chain.at(i)));
+        out += QLatin1Char('/');
+    }
+    return out;
+}
+
+bool PathTrie::move(quint32 node, const QString &to)
+{
+    QString parentDir, name;
+    if (node == 0 || int(node) >= m_parent.size() || !split(to, &parentDir, &name)) return false;
+    if (to.startsWith(path(node)) || find(to) >= 0) return false;
+    const quint32 parent = intern(parentDir);
+    m_children.remove(Key(m_parent.at(int(node)), m_name.at(int(node))));
+    m_parent[int(node)] = parent;
+    m_name[int(node)] = name;
+    m_children.insert(Key(parent, name), node);
+    return true;
+}
+
+qint64 PathTrie::memoryBytes() const
+{
+    qint64 bytes = columnBytes(m_parent) + columnBytes(m_name) + qint64(m_children.size()) * kHashNodeBytes;
+    // The hash key shares its data with the name.
+    for (int i = 0; i < m_name.size(); ++i)
+        bytes += kStringHeaderBytes + qint64(m_name.at(i).capacity()) * qint64(sizeof(QChar));
+    return bytes;
+}
+
+bool PathTrie::split(const QString &dir, QString *parent, QString *name)
+{
+    if (!dir.endsWith(QLatin1Char('/'))) return false;
+    const int slash = dir.size() >= 2 ? dir.lastIndexOf(QLatin1Char('/'), dir.size() - 2) : -1;
+    *parent = dir.left(slash + 1);
+    *name = dir.mid(slash + 1, dir.size() - slash - 2);
+    return true;
+}
+
+void TrackTally::add(quint32 id)
+{
+    if (int(id) >= m_counts.size()) m_counts.resize(int(id) + 1);
+    if (m_counts[int(id)]++ == 0 && id != 0) ++m_distinct;
+}
+
+void TrackTally::remove(quint32 id)
+{
+    if (--m_counts[int(id)] == 0 && id != 0) --m_distinct;
+}
+
+StringArena::Ref StringArena::add(const QString &value)
+{
+    Ref ref;
+    ref.length = quint32(value.size());
+    if (value.isEmpty()) {
+        ref.offset = quint32(size());
+        return ref;
+    }
+    // A string that does not fit in what is left of the last chunk starts
+    // the next one.
+    if (m_chunks.isEmpty() || m_chunks.last().size() + value.size() > kChunkChars) {
+        m_chunks.append(QVector<QChar>());
+        if (m_chunks.size() > 1) m_chunks.last().reserve(kChunkChars);
+    }
+    QVector<QChar> &chunk = m_chunks.last();
+    const int at = chunk.size();
+    ref.offset = quint32(((m_chunks.size() - 1) << kShift) + at);
+    chunk.resize(at + value.size());
+    std::memcpy(chunk.data() + at, value.constData(), size_t(value.size()) * sizeof(QChar));
+    return ref;
+}
+
+const QChar *StringArena::data(quint32 offset) const
+{
+    // An empty string may sit at the very end, past the last chunk.
+    const int chunk = int(offset >> kShift);
+    return chunk < m_chunks.size() ? m_chunks.at(chunk).constData() + (offset & kMask) : nullptr;
+}
+
+qint64 StringArena::memoryBytes() const
+{
+    qint64 bytes = qint64(m_chunks.capacity()) * qint64(sizeof(QVector<QChar>));
+    for (const QVector<QChar> &chunk : m_chunks) bytes += qint64(chunk.capacity()) * qint64(sizeof(QChar));
+    return bytes;
+}
+
+QString TrackStore::MemoryUsage::toString() const
+{
+    return QStringLiteral("%1 tracks, %2 bytes/track (%3 bytes/track for tags, %4 MB in total)")
+        .arg(tracks)
+        .arg(QString::number(bytesPerTrack(), 'f', 1))
+        .arg(QString::number(hotBytesPerTrack(), 'f', 1))
+        .arg(QString::number(double(hotBytes + coldBytes) / (1024.0 * 1024.0), 'f', 1));
+}
+
+void TrackStore::reserve(int tracks)
+{
+    m_artist.reserve(tracks);
+    m_album.reserve(tracks);
+    m_genre.reserve(tracks);
+    m_composer.reserve(tracks);
+    m_titleOffset.reserve(tracks);
+    m_titleLength.reserve(tracks);
+    m_durationMs.reserve(tracks);
+    m_year.reserve(tracks);
+    m_trackNumber.reserve(tracks);
+    m_discNumber.reserve(tracks);
+    m_bitrateKbps.reserve(tracks);
+    m_sampleRate.reserve(tracks);
+    m_rating.reserve(tracks);
+    m_playCount.reserve(tracks);
+    m_lastPlayed.reserve(tracks);
+    m_dir.reserve(tracks);
+    m_nameOffset.reserve(tracks);
+    m_nameLength.reserve(tracks);
+    m_pathHash.reserve(tracks);
+    m_fileSize.reserve(tracks);
+    m_trackGain.reserve(tracks);
+    m_trackPeak.reserve(tracks);
+    m_albumGain.reserve(tracks);
+    m_albumPeak.reserve(tracks);
+    m_id.reserve(tracks);
+}
+
+void TrackStore::clear()
+{
+    *this = TrackStore();
+}
+
+void TrackStore::append(const Track &t)
+{
+    const int row = size();
+    m_artist.append(0);
+    m_album.append(0);
+    m_genre.append(0);
+    m_composer.append(0);
+    m_titleOffset.append(0);
+    m_titleLength.append(0);
+    m_durationMs.append(0);
+    m_year.append(0);
+    m_trackNumber.append(0);
+    m_discNumber.append(0);
+    m_bitrateKbps.append(0);
+    m_sampleRate.append(0);
+    m_rating.append(0);
+    m_playCount.append(0);
+    m_lastPlayed.append(0);
+    m_dir.append(0);
+    m_nameOffset.append(0);
+    m_nameLength.append(0);
+    m_pathHash.append(0);
+    m_fileSize.append(0);
+    m_trackGain.append(0);
+    m_trackPeak.append(kNoPeak);
+    m_albumGain.append(0);
+    m_albumPeak.append(kNoPeak);
+    m_id.append(quint32(m_rowById.size()));
+    m_rowById.append(row);
+    setTagColumns(row, t);
+    setTitle(row, t.title);
+    setRating(row, t.rating);
+    setPlayCount(row, t.playCount);
+    setLastPlayed(row, t.lastPlayed);
+    setLoudness(row, t.trackGainDb, t.trackPeak, t.albumGainDb, t.albumPeak);
+    setPathColumns(row, t.localPath);
+    countRow(row, 1);
+
+    // Keep the index, tombstones included, at most half full.
+    if (2 * (size() + m_tombstones) > m_index.size()) rebuildIndex();
+    else indexInsert(row);
+}
+
+void TrackStore::setTags(int row, const Track &t)
+{
+    if (t.durationMs != durationMs(row) || qMax<qint64>(0, t.fileSize) != fileSize(row))
+        setLoudness(row, 0.0f, -1.0f, 0.0f, -1.0f);
+    countRow(row, -1);
+    setTagColumns(row, t);
+    countRow(row, 1);
+    // Re-parses mostly leave the title alone; do not grow the arena for them.
+    if (t.title.size() != m_titleLength.at(row)
+        || (!t.title.isEmpty() && std::memcmp(t.title.constData(), m_titles.data(m_titleOffset.at(row)),
+                       size_t(t.title.size()) * sizeof(QChar)) != 0)) {
+        m_garbageChars += m_titleLength.at(row);
+        setTitle(row, t.title);
+        compactArenas();
+    }
+}
+
+void TrackStore::setLastPlayed(int row, qint64 secs)
+{
+    m_lastPlayed[row] = narrow<quint32>(secs);
+}
+
+void TrackStore::setLoudness(int row, float trackGainDb, float trackPeak, float albumGainDb, float albumPeak)
+{
+    if (trackPeak < 0.0f) {
+        m_trackGain[row] = 0;
+        m_trackPeak[row] = kNoPeak;
+        m_albumGain[row] = 0;
+        m_albumPeak[row] = kNoPeak;
+        return;
+    }
+    // Rounded up, so that a peak read back never lets a gain clip; digital
+    // silence has no peak in dB and is kept at the bottom of the range.
+    auto peakCentibels = [](float linear) {
+        if (linear <= 0.0f) return qint16(kNoPeak + 1);
+        return qint16(qBound(-32767.0, std::ceil(2000.0 * std::log10(double(linear))), 32767.0));
+    };
+    m_trackGain[row] = centibels(trackGainDb);
+    m_trackPeak[row] = peakCentibels(trackPeak);
+    m_albumGain[row] = centibels(albumGainDb);
+    m_albumPeak[row] = albumPeak < 0.0f ? m_trackPeak.at(row) : peakCentibels(albumPeak);
+}
+
+float TrackStore::peak(qint16 centibels)
+{
+    if (centibels == kNoPeak) return -1.0f;
+    return float(std::pow(10.0, centibels / 2000.0));
+}
+
+void TrackStore::setTitle(int row, const QString &title)
+{
+    const StringArena::Ref ref = m_titles.add(title.left(StringArena::kMaxLength));
+    m_titleOffset[row] = ref.offset;
+    m_titleLength[row] = quint16(ref.length);
+}
+
+void TrackStore::setTagColumns(int row, const Track &t)
+{
+    m_artist[row] = m_artists.intern(t.artist);
+    m_album[row] = m_albums.intern(t.album);
+    m_genre[row] = m_genres.intern(t.genre);
+    m_composer[row] = m_composers.intern(t.composer);
+    m_durationMs[row] = narrow<quint32>(t.durationMs);
+    m_year[row] = narrow<quint16>(t.year);
+    m_trackNumber[row] = narrow<quint16>(t.trackNumber);
+    m_discNumber[row] = narrow<quint16>(t.discNumber);
+    m_bitrateKbps[row] = narrow<quint16>(t.bitrateKbps);
+    m_sampleRate[row] = narrow<quint32>(t.sampleRate);
+    m_fileSize[row] = qMax<qint64>(0, t.fileSize);
+}
+
+void TrackStore::countRow(int row, int sign)
+{
+    m_totalDurationMs += sign * qint64(m_durationMs.at(row));
+    m_totalFileSize += sign * m_fileSize.at(row);
+    if (sign > 0) {
+        m_artistTally.add(m_artist.at(row));
+        m_albumTally.add(m_album.at(row));
+        m_genreTally.add(m_genre.at(row));
+        m_composerTally.add(m_composer.at(row));
+    } else {
+        m_artistTally.remove(m_artist.at(row));
+        m_albumTally.remove(m_album.at(row));
+        m_genreTally.remove(m_genre.at(row));
+        m_composerTally.remove(m_composer.at(row));
+    }
+}
+
+void TrackStore::setPathColumns(int row, const QString &localPath)
+{
+    // The directory keeps its trailing slash so that dir + name is the path.
+    const int slash = localPath.lastIndexOf(QLatin1Char('/'));
+    m_dir[row] = m_dirs.intern(localPath.left(slash + 1));
+    const StringArena::Ref name = m_names.add(localPath.mid(slash + 1).left(StringArena::kMaxLength));
+    m_nameOffset[row] = name.offset;
+    m_nameLength[row] = quint16(name.length);
+    m_pathHash[row] = pathHash(m_dir.at(row), m_names.data(name.offset), int(name.length));
+}
+
+void TrackStore::remove(int row, int count)
+{
+    if (row < 0 || count <= 0 || row + count > size()) return;
+    for (int r = row; r < row + count; ++r) {
+        countRow(r, -1);
+        indexErase(r);
+        m_rowById[int(m_id.at(r))] = -1;
+        m_garbageChars += m_titleLength.at(r) + m_nameLength.at(r);
+    }
+    m_artist.remove(row, count);
+    m_album.remove(row, count);
+    m_genre.remove(row, count);
+    m_composer.remove(row, count);
+    m_titleOffset.remove(row, count);
+    m_titleLength.remove(row, count);
+    m_durationMs.remove(row, count);
+    m_year.remove(row, count);
+    m_trackNumber.remove(row, count);
+    m_discNumber.remove(row, count);
+    m_bitrateKbps.remove(row, count);
+    m_sampleRate.remove(row, count);
+    m_rating.remove(row, count);
+    m_playCount.remove(row, count);
+    m_lastPlayed.remove(row, count);
+    m_dir.remove(row, count);
+    m_nameOffset.remove(row, count);
+    m_nameLength.remove(row, count);
+    m_pathHash.remove(row, count);
+    m_fileSize.remove(row, count);
+    m_trackGain.remove(row, count);
+    m_trackPeak.remove(row, count);
+    m_albumGain.remove(row, count);
+    m_albumPeak.remove(row, count);
+    m_id.remove(row, count);
+    for (int r = row; r < size(); ++r) m_rowById[int(m_id.at(r))] = r;
+    // The index holds ids, so the rows that moved keep their slots; it is
+    // only rebuilt once the library has shrunk well below its capacity.
+    if (m_index.size() > kMinIndexSlots && 8 * size() < m_index.size()) rebuildIndex();
+    compactArenas();
+}
+
+void TrackStore::setLocalPath(int row, const QString &localPath)
+{
+    indexErase(row);
+    m_garbageChars += m_nameLength.at(row);
+    setPathColumns(row, localPath);
+    // The erase left a tombstone, so the same bound as append() applies.
+    if (2 * (size() + m_tombstones) > m_index.size()) rebuildIndex();
+    else indexInsert(row);
+    compactArenas();
+}
+
+bool TrackStore::moveDirectory(const QString &from, const QString &to)
+{
+    const qint64 node = m_dirs.find(asDirectory(from));
+    return node > 0 && m_dirs.move(quint32(node), asDirectory(to));
+}
+
+int TrackStore::rowOf(const QString &localPath) const
+{
+    if (m_index.isEmpty()) return -1;
+    const int slash = localPath.lastIndexOf(QLatin1Char('/'));
+    const qint64 dir = m_dirs.find(localPath.left(slash + 1));
+    if (dir < 0) return -1;
+    const QChar *name = localPath.constData() + slash + 1;
+    const int length = localPath.size() - slash - 1;
+    const int mask = m_index.size() - 1;
+    const uint hash = pathHash(quint32(dir), name, length);
+    // Bounded, so that even a table with no free slot left ends the search.
+    for (int slot = int(hash) & mask, probes = 0; probes < m_index.size(); slot = (slot + 1) & mask, ++probes) {
+        const qint32 id = m_index.at(slot);
+        if (id == kFreeSlot) return -1;
+        if (id == kTombstone) continue;
+        const int row = m_rowById.at(id);
+        if (m_pathHash.at(row) == hash && m_dir.at(row) == quint32(dir) && nameEquals(row, name, length)) return row;
+    }
+    return -1;
+}
+
+bool TrackStore::nameEquals(int row, const QChar *name, int length) const
+{
+    return m_nameLength.at(row) == length
+        && (length == 0 || std::memcmp(m_names.data(m_nameOffset.at(row)), name, size_t(length) * sizeof(QChar)) == 0);
+}
+
+void TrackStore::indexInsert(int row)
+{
+    const int mask = m_index.size() - 1;
+    int slot = int(m_pathHash.at(row)) & mask;
+    while (m_index.at(slot) >= 0) slot = (slot + 1) & mask;
+    if (m_index.at(slot) == kTombstone) --m_tombstones;
+    m_index[slot] = qint32(m_id.at(row));
+}
+
+void TrackStore::indexErase(int row)
+{
+    // A tombstone rather than a backward shift, which would have to look up
+    // the row of every entry it moves.
+    const int mask = m_index.size() - 1;
+    const qint32 id = qint32(m_id.at(row));
+    int slot = int(m_pathHash.at(row)) & mask;
+    while (m_index.at(slot) != id) slot = (slot + 1) & mask;
+    m_index[slot] = kTombstone;
+    ++m_tombstones;
+}
+
+void TrackStore::rebuildIndex()
+{
+    int capacity = kMinIndexSlots;
+    while (capacity < 2 * size()) capacity *= 2;
+    m_index.fill(kFreeSlot, capacity);
+    m_tombstones = 0;
+    for (int row = 0; row < size(); ++row) indexInsert(row);
+}
+
+void TrackStore::compactArenas()
+{
+    if (m_garbageChars < kMinGarbageChars || 2 * m_garbageChars < m_titles.size() + m_names.size()) return;
+    StringArena titles;
+    StringArena names;
+    titles.reserve(m_titles.size());
+    names.reserve(m_names.size());
+    for (int row = 0; row < size(); ++row) {
+        m_titleOffset[row] = titles.add(title(row)).offset;
+        m_nameOffset[row] = names.add(fileName(row)).offset;
+    }
+    m_titles = titles;
+    m_names = names;
+    m_garbageChars = 0;
+}
+
+Track TrackStore::track(int row) const
+{
+    Track t;
+    t.localPath = localPath(row);
+    t.title = title(row);
+    t.artist = artist(row);
+    t.album = album(row);
+    t.genre = genre(row);
+    t.composer = composer(row);
+    t.year = year(row);
+    t.trackNumber = trackNumber(row);
+    t.discNumber = discNumber(row);
+    t.durationMs = durationMs(row);
+    t.bitrateKbps = bitrateKbps(row);
+    t.sampleRate = sampleRate(row);
+    t.rating = rating(row);
+    t.playCount = playCount(row);
+    t.lastPlayed = lastPlayed(row);
+    t.fileSize = fileSize(row);
+    t.trackGainDb = trackGainDb(row);
+    t.trackPeak = trackPeak(row);
+    t.albumGainDb = albumGainDb(row);
+    t.albumPeak = albumPeak(row);
+    return t;
+}
+
+QString TrackStore::displayTitle(int row) const
+{
+    return m_titleLength.at(row) ? title(row) : fileName(row);
+}
+
+QString TrackStore::localPath(int row) const
+{
+    return m_dirs.path(m_dir.at(row)) + fileName(row);
+}
+
+TrackStore::MemoryUsage TrackStore::memoryUsage() const
+{
+    MemoryUsage m;
+    m.tracks = size();
+    m.hotBytes = columnBytes(m_artist) + columnBytes(m_album) + columnBytes(m_genre) + columnBytes(m_composer)
+        + columnBytes(m_titleOffset) + columnBytes(m_titleLength) + columnBytes(m_durationMs) + columnBytes(m_year)
+        + columnBytes(m_trackNumber) + columnBytes(m_discNumber) + columnBytes(m_bitrateKbps)
+        + columnBytes(m_sampleRate) + columnBytes(m_rating) + columnBytes(m_playCount) + columnBytes(m_lastPlayed)
+        + m_artists.memoryBytes()
+        + m_albums.memoryBytes() + m_genres.memoryBytes() + m_composers.memoryBytes() + m_titles.memoryBytes()
+        + m_artistTally.memoryBytes() + m_albumTally.memoryBytes() + m_genreTally.memoryBytes()
+        + m_composerTally.memoryBytes();
+    m.coldBytes = columnBytes(m_dir) + columnBytes(m_nameOffset) + columnBytes(m_nameLength) + columnBytes(m_pathHash)
+        + columnBytes(m_fileSize) + columnBytes(m_trackGain) + columnBytes(m_trackPeak) + columnBytes(m_albumGain)
+        + columnBytes(m_albumPeak) + columnBytes(m_id) + columnBytes(m_rowById) + m_dirs.memoryBytes() + m_names.memoryBytes() + columnBytes(m_index);
+    return m;
+}
+
+TrackStore TrackStore::snapshot() const
+{
+    TrackStore copy(*this);
+    copy.m_artists.m_ids.clear();
+    copy.m_albums.m_ids.clear();
+    copy.m_genres.m_ids.clear();
+    copy.m_composers.m_ids.clear();
+    copy.m_dirs.m_children.clear();
+    copy.m_index.clear();
+    return copy;
+}
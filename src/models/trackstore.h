@@ -0,0 +1,306 @@
+/*
+ * TrackStore - columnar, string-interned storage behind TrackModel
+ *
+ * One dense array per field instead of one Track per row. Artist, album,
+ * genre and composer are dictionary-encoded (a library has far fewer distinct
+ * values than tracks), numeric fields are narrowed to what tags can hold,
+ * and titles and file names live in UTF-16 arenas addressed by (offset,
+ * length). Paths are split into a directory, a node of a shared PathTrie,
+ * and a file name, and are looked up through an open-addressing index over
+ * the stable ids keyed by (directory node, file name); the full path is only
+ * assembled when asked for. A directory moved on disk is one trie node
+ * re-parented: no row, and no index entry, changes.
+ *
+ * Every row also carries a stable id that survives the removal of other rows,
+ * for indexes that must not be renumbered on every removal.
+ *
+ * Library totals (duration, size, tracks per artist, album, genre and
+ * composer) are kept up to date by every mutation, so reading them is O(1).
+ *
+ * Columns are ChunkedVectors, so a copy shares them chunk by chunk and a
+ * change after it copies only the chunks it touches. snapshot() is the copy
+ * to hand to another thread: it leaves out the lookup tables, which only the
+ * store's own thread needs, so interning a new value never copies them either.
+ */
+#ifndef MEDIASONIC_MODELS_TRACKSTORE_H
+#define MEDIASONIC_MODELS_TRACKSTORE_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <limits>
+#include "models/chunkedvector.h"
+#include "models/track.h"
+
+namespace MS {
+
+// Distinct strings by id; id 0 is always the empty string.
+class StringDictionary
+{
+public:
+    StringDictionary();
+
+    quint32 intern(const QString &value);
+    const QString &at(quint32 id) const { return m_values.at(int(id)); }
+    // Id of value, or -1 if it was never interned.
+    qint64 find(const QString &value) const;
+    int size() const { return m_values.size(); }
+    qint64 memoryBytes() const;
+
+private:
+    friend class TrackStore;
+
+    ChunkedVector<QString> m_values;
+    QHash<QString, quint32> m_ids;
+};
+
+// Directories as a tree of path components by node id; node 0 is the empty
+// directory. A directory path keeps its trailing '/', so that directory plus
+// file name is the file's path.
+class PathTrie
+{
+public:
+    PathTrie();
+
+    // Node of a directory, added along with any missing ancestors.
+    quint32 intern(const QString &dir);
+    // Node of a directory, or -1 if it was never interned.
+    qint64 find(const QString &dir) const;
+    // Path of a node, built by walking up to the root.
+    QString path(quint32 node) const;
+    // Renames or re-parents a node, and with it everything beneath, in
+    // O(depth). Fails if the target is already a node or lies beneath the
+    // node itself; the caller then has to move paths one by one.
+    bool move(quint32 node, const QString &to);
+    int size() const { return m_parent.size(); }
+    qint64 memoryBytes() const;
+
+private:
+    using Key = QPair<quint32, QString>; // (parent, component)
+
+    // Parent and component of a directory path, or false for the empty one.
+    static bool split(const QString &dir, QString *parent, QString *name);
+
+    friend class TrackStore;
+
+    ChunkedVector<quint32> m_parent;
+    ChunkedVector<QString> m_name;
+    QHash<Key, quint32> m_children;
+};
+
+// Tracks per dictionary id, and how many non-empty ids have any.
+class TrackTally
+{
+public:
+    void add(quint32 id);
+    void remove(quint32 id);
+    int count(quint32 id) const { return int(id) < m_counts.size() ? m_counts.at(int(id)) : 0; }
+    int distinct() const { return m_distinct; }
+    qint64 memoryBytes() const { return m_counts.memoryBytes(); }
+
+private:
+    ChunkedVector<int> m_counts;
+    int m_distinct = 0;
+};
+
+// Append-only UTF-16 storage for strings that are rarely shared, in
+// implicitly shared chunks like a ChunkedVector's. A string never straddles
+// two chunks, so it can be read in place; strings are at most kMaxLength long.
+class StringArena
+{
+public:
+    static constexpr int kMaxLength = std::numeric_limits<quint16>::max();
+
+    struct Ref
+    {
+        quint32 offset = 0;
+        quint32 length = 0;
+    };
+
+    Ref add(const QString &value);
+    QString at(quint32 offset, quint32 length) const { return length ? QString(data(offset), int(length)) : QString(); }
+    const QChar *data(quint32 offset) const;
+    // Characters, counting the ends of chunks left unused.
+    int size() const { return m_chunks.isEmpty() ? 0 : ((m_chunks.size() - 1) << kShift) + m_chunks.last().size(); }
+    void clear() { m_chunks.clear(); }
+    void reserve(int chars) { m_chunks.reserve((chars >> kShift) + 1); }
+    qint64 memoryBytes() const;
+
+private:
+    static constexpr int kShift = 16;
+    static constexpr int kChunkChars = 1 << kShift;
+    static constexpr quint32 kMask = kChunkChars - 1;
+
+    QVector<QVector<QChar>> m_chunks;
+};
+
+class TrackStore
+{
+public:
+    struct MemoryUsage
+    {
+        int tracks = 0;
+        qint64 hotBytes = 0;  // fields shown, sorted and filtered in the track list
+        qint64 coldBytes = 0; // paths and the path index
+        double hotBytesPerTrack() const { return tracks ? double(hotBytes) / tracks : 0.0; }
+        double bytesPerTrack() const { return tracks ? double(hotBytes + coldBytes) / tracks : 0.0; }
+        QString toString() const;
+    };
+
+    int size() const { return m_artist.size(); }
+    bool isEmpty() const { return m_artist.isEmpty(); }
+    void reserve(int tracks);
+    void clear();
+
+    void append(const Track &t);
+    // Replaces the tags and file size of a row; its path, rating, play count
+    // and last play are kept, and so is its loudness unless the duration or
+    // file size changed, that is unless the audio may have.
+    void setTags(int row, const Track &t);
+    void remove(int row, int count);
+    void setLocalPath(int row, const QString &localPath);
+    // Moves every track under directory from to directory to, in O(depth)
+    // when to is not a directory the store knows already; false otherwise,
+    // and nothing changes.
+    bool moveDirectory(const QString &from, const QString &to);
+    void setRating(int row, int rating) { m_rating[row] = quint8(qBound(0, rating, 5)); }
+    void setPlayCount(int row, int playCount) { m_playCount[row] = quint32(qMax(0, playCount)); }
+    void setLastPlayed(int row, qint64 secs);
+    // ReplayGain values as in Track; a negative track peak clears them.
+    void setLoudness(int row, float trackGainDb, float trackPeak, float albumGainDb, float albumPeak);
+
+    // Row holding the given local file path, or -1.
+    int rowOf(const QString &localPath) const;
+    // Stable id of a row; ids are never reused within a store.
+    quint32 id(int row) const { return m_id.at(row); }
+    // Row of a stable id, or -1 once the track has been removed.
+    int rowOfId(quint32 id) const { return int(id) < m_rowById.size() ? m_rowById.at(int(id)) : -1; }
+    // One past the largest id handed out so far.
+    quint32 idLimit() const { return quint32(m_rowById.size()); }
+    // Materialises a row; for hand-off to code that works on Track values.
+    Track track(int row) const;
+
+    QString title(int row) const { return m_titles.at(m_titleOffset.at(row), m_titleLength.at(row)); }
+    // The title, or the file name for files without one.
+    QString displayTitle(int row) const;
+    const QString &artist(int row) const { return m_artists.at(m_artist.at(row)); }
+    const QString &album(int row) const { return m_albums.at(m_album.at(row)); }
+    const QString &genre(int row) const { return m_genres.at(m_genre.at(row)); }
+    const QString &composer(int row) const { return m_composers.at(m_composer.at(row)); }
+    quint32 artistId(int row) const { return m_artist.at(row); }
+    quint32 albumId(int row) const { return m_album.at(row); }
+    quint32 genreId(int row) const { return m_genre.at(row); }
+    quint32 composerId(int row) const { return m_composer.at(row); }
+    const StringDictionary &artists() const { return m_artists; }
+    const StringDictionary &albums() const { return m_albums; }
+    const StringDictionary &genres() const { return m_genres; }
+    const StringDictionary &composers() const { return m_composers; }
+    QString localPath(int row) const;
+    QString fileName(int row) const { return m_names.at(m_nameOffset.at(row), m_nameLength.at(row)); }
+    // Rows in the same directory have the same directory id.
+    quint32 directoryId(int row) const { return m_dir.at(row); }
+
+    qint64 durationMs(int row) const { return m_durationMs.at(row); }
+    int year(int row) const { return m_year.at(row); }
+    int trackNumber(int row) const { return m_trackNumber.at(row); }
+    int discNumber(int row) const { return m_discNumber.at(row); }
+    int bitrateKbps(int row) const { return m_bitrateKbps.at(row); }
+    int sampleRate(int row) const { return int(m_sampleRate.at(row)); }
+    int rating(int row) const { return m_rating.at(row); }
+    int playCount(int row) const { return int(m_playCount.at(row)); }
+    // Seconds since the epoch; 0 if never played.
+    qint64 lastPlayed(int row) const { return m_lastPlayed.at(row); }
+    qint64 fileSize(int row) const { return m_fileSize.at(row); }
+    bool hasLoudness(int row) const { return m_trackPeak.at(row) != kNoPeak; }
+    float trackGainDb(int row) const { return m_trackGain.at(row) / 100.0f; }
+    float albumGainDb(int row) const { return m_albumGain.at(row) / 100.0f; }
+    // Linear; -1 if not analysed.
+    float trackPeak(int row) const { return peak(m_trackPeak.at(row)); }
+    float albumPeak(int row) const { return peak(m_albumPeak.at(row)); }
+
+    qint64 totalDurationMs() const { return m_totalDurationMs; }
+    qint64 totalFileSize() const { return m_totalFileSize; }
+    // Tracks per artist, album, genre or composer id; distinct() leaves out
+    // the empty value.
+    const TrackTally &artistTally() const { return m_artistTally; }
+    const TrackTally &albumTally() const { return m_albumTally; }
+    const TrackTally &genreTally() const { return m_genreTally; }
+    const TrackTally &composerTally() const { return m_composerTally; }
+
+    MemoryUsage memoryUsage() const;
+
+    // A copy for reading on another thread: it shares every column, but has
+    // no lookup tables, so rowOf() and the dictionaries' and directories'
+    // find() fail on it. It must not be changed.
+    TrackStore snapshot() const;
+
+private:
+    static constexpr qint16 kNoPeak = std::numeric_limits<qint16>::min();
+    static float peak(qint16 centibels);
+
+    void setTagColumns(int row, const Track &t);
+    void setTitle(int row, const QString &title);
+    void countRow(int row, int sign);
+    void setPathColumns(int row, const QString &localPath);
+    bool nameEquals(int row, const QChar *name, int length) const;
+    void indexInsert(int row);
+    void indexErase(int row);
+    void rebuildIndex();
+    void compactArenas();
+
+    // Hot columns
+    ChunkedVector<quint32> m_artist;
+    ChunkedVector<quint32> m_album;
+    ChunkedVector<quint32> m_genre;
+    ChunkedVector<quint32> m_composer;
+    ChunkedVector<quint32> m_titleOffset;
+    ChunkedVector<quint16> m_titleLength;
+    ChunkedVector<quint32> m_durationMs;
+    ChunkedVector<quint16> m_year;
+    ChunkedVector<quint16> m_trackNumber;
+    ChunkedVector<quint16> m_discNumber;
+    ChunkedVector<quint16> m_bitrateKbps;
+    ChunkedVector<quint32> m_sampleRate;
+    ChunkedVector<quint8> m_rating;
+    ChunkedVector<quint32> m_playCount;
+    ChunkedVector<quint32> m_lastPlayed;
+    StringDictionary m_artists;
+    StringDictionary m_albums;
+    StringDictionary m_genres;
+    StringDictionary m_composers;
+    StringArena m_titles;
+
+    // Aggregates
+    qint64 m_totalDurationMs = 0;
+    qint64 m_totalFileSize = 0;
+    TrackTally m_artistTally;
+    TrackTally m_albumTally;
+    TrackTally m_genreTally;
+    TrackTally m_composerTally;
+
+    // Cold columns
+    ChunkedVector<quint32> m_dir;
+    ChunkedVector<quint32> m_nameOffset;
+    ChunkedVector<quint16> m_nameLength;
+    ChunkedVector<uint> m_pathHash;
+    ChunkedVector<qint64> m_fileSize;
+    // Loudness in hundredths of a dB; peaks relative to full scale.
+    ChunkedVector<qint16> m_trackGain;
+    ChunkedVector<qint16> m_trackPeak;
+    ChunkedVector<qint16> m_albumGain;
+    ChunkedVector<qint16> m_albumPeak;
+    ChunkedVector<quint32> m_id;
+    ChunkedVector<qint32> m_rowById;
+    PathTrie m_dirs;
+    StringArena m_names;
+    // Open addressing, linear probing, by stable id; -1 marks a free slot and
+    // -2 a removed track's.
+    ChunkedVector<qint32> m_index;
+    int m_tombstones = 0;
+    int m_garbageChars = 0; // arena characters no row refers to any more
+};
+
+}
+
+#endif // MEDIASONIC_MODELS_TRACKSTORE_H
@@ -0,0 +1,80 @@
+#include "services/coldtagcache.h"
+#include "services/tagreader.h"
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <climits>
+
+using namespace MS;
+
+namespace {
+
+constexpr int kDefaultMaxBytes = 4 * 1024 * 1024;
+// Per-string and per-entry bookkeeping on top of the characters.
+constexpr int kStringOverhead = 24;
+constexpr int kEntryOverhead = 256;
+
+int stringBytes(const QString &s) { return s.isEmpty() ? 0 : kStringOverhead + s.size() * 2; }
+
+}
+
+ColdTagCache::ColdTagCache(QObject *parent)
+    : QObject(parent)
+    , m_cache(kDefaultMaxBytes)
+{
+}
+
+int ColdTagCache::approximateBytes(const ColdTags &tags)
+{
+    qint64 bytes = kEntryOverhead + stringBytes(tags.comment) + stringBytes(tags.lyrics)
+                 + stringBytes(tags.musicBrainzTrackId) + stringBytes(tags.musicBrainzAlbumId)
+                 + stringBytes(tags.musicBrainzArtistId);
+    for (const ColdTags::Picture &p : tags.pictures)
+        bytes += int(sizeof(p)) + stringBytes(p.type) + stringBytes(p.mimeType);
+    for (auto it = tags.other.cbegin(); it != tags.other.cend(); ++it) {
+        bytes += kStringOverhead + stringBytes(it.key());
+        for (const QString &v : it.value()) bytes += stringBytes(v);
+    }
+    return int(qMin<qint64>(bytes, INT_MAX));
+}
+
+const ColdTags *ColdTagCache::tags(const QString &localPath)
+{
+    if (const ColdTags *cached = m_cache.object(localPath)) return cached;
+    if (localPath.isEmpty() || m_pending.contains(localPath)) return nullptr;
+    const quint64 serial = ++m_serial;
+    m_pending.insert(localPath, serial);
+
+    auto *watcher = new QFutureWatcher<ColdTags>(this);
+    connect(watcher, &QFutureWatcher<ColdTags>::finished, this, [this, watcher, localPath, serial]() {
+        watcher->deleteLater();
+        // Superseded by invalidate() or clear() while the file was read.
+        if (m_pending.value(localPath) != serial) return;
+        m_pending.remove(localPath);
+        auto *tags = new ColdTags(watcher->result());
+        // Capped so that an entry larger than the whole cache is still kept
+        // (alone) instead of being refused and read again on every lookup.
+        m_cache.insert(localPath, tags, qMin(approximateBytes(*tags), m_cache.maxCost()));
+        emit loaded(localPath);
+    });
+    watcher->setFuture(QtConcurrent::run([localPath]() {
+        ColdTags tags;
+        if (!TagReader::readColdTags(localPath, tags))
+            qWarning() << "ColdTagCache: could not read tags of" << localPath;
+        return tags;
+    }));
+    return nullptr;
+}
+
+void ColdTagCache::invalidate(const QString &localPath)
+{
+    m_cache.remove(localPath);
+    // A read in flight may have seen the old tags; the next lookup reads again.
+    m_pending.remove(localPath);
+}
+
+void ColdTagCache::clear()
+{
+    m_cache.clear();
+    m_pending.clear();
+}
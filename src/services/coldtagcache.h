@@ -0,0 +1,55 @@
+/*
+ * ColdTagCache - cold tags of recently inspected tracks
+ *
+ * The library keeps only the fields it lists, sorts and searches by (Track);
+ * comments, lyrics, ReplayGain, MusicBrainz ids, picture details and the
+ * remaining tags are read from the file when something asks for them. Reads
+ * run on the global thread pool and their results stay in an LRU bounded by
+ * their approximate size, so going back and forth between a few tracks
+ * reads each file once.
+ */
+#ifndef MEDIASONIC_SERVICES_COLDTAGCACHE_H
+#define MEDIASONIC_SERVICES_COLDTAGCACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include "models/track.h"
+
+namespace MS {
+
+class ColdTagCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ColdTagCache(QObject *parent = nullptr);
+
+    // The cached tags of a file, or nullptr while they are not known yet; a
+    // miss starts reading the file and loaded() follows. The pointer is only
+    // valid until the next call.
+    const ColdTags *tags(const QString &localPath);
+    // Forgets a file after its tags were rewritten or it was moved away.
+    void invalidate(const QString &localPath);
+    void clear();
+
+    int maxBytes() const { return m_cache.maxCost(); }
+    void setMaxBytes(int bytes) { m_cache.setMaxCost(bytes); }
+    int usedBytes() const { return m_cache.totalCost(); }
+
+    // Rough heap footprint, used as the entry's cost.
+    static int approximateBytes(const ColdTags &tags);
+
+signals:
+    // A read started by tags() finished; unreadable files are cached empty.
+    void loaded(const QString &localPath);
+
+private:
+    QCache<QString, ColdTags> m_cache;
+    QHash<QString, quint64> m_pending; // path -> serial of the read that counts
+    quint64 m_serial = 0;
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_COLDTAGCACHE_H
@@ -0,0 +1,360 @@
+#include "services/dirwalker.h"
+#include <QtConcurrent>
+#include <QByteArray>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstring>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace MS;
+
+namespace {
+
+constexpr int kMaxThreads = 16;
+// Idle polls of the other queues before a worker parks until work is pushed.
+constexpr int kSpinRounds = 64;
+
+#ifdef Q_OS_LINUX
+struct LinuxDirent64
+{
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+// Closed once the directory and every queued child that still needs it for
+// openat() are done.
+struct DirFd
+{
+    explicit DirFd(int fd) : fd(fd) {}
+    ~DirFd() { ::close(fd); }
+    const int fd;
+};
+#endif
+
+struct Task
+{
+    QByteArray path; // encoded with QFile::encodeName
+#ifdef Q_OS_LINUX
+    std::shared_ptr<DirFd> parent;
+    int nameOffset = 0; // start of the last component in path
+#endif
+};
+
+struct TaskQueue
+{
+    QMutex mutex;
+    std::deque<Task> tasks;
+};
+
+}
+
+struct DirWalker::Walk
+{
+    Walk(int threads, const FileFn &onFile, const CancelFn &cancelled, VisitedDirs *visited)
+        : onFile(onFile), cancelled(cancelled), visited(visited)
+    {
+        for (int i = 0; i < threads; ++i) queues.emplace_back(new TaskQueue);
+    }
+
+    bool isCancelled() const { return cancelled && cancelled(); }
+
+    void push(int worker, std::vector<Task> &tasks)
+    {
+        if (tasks.empty()) return;
+        pending.fetch_add(int(tasks.size()));
+        TaskQueue &q = *queues[size_t(worker)];
+        QMutexLocker lock(&q.mutex);
+        for (Task &t : tasks) q.tasks.push_back(std::move(t));
+        tasks.clear();
+        lock.unlock();
+        notify();
+    }
+
+    // A directory is done, children pushed first; the last one ends the walk.
+    void retire()
+    {
+        if (pending.fetch_sub(1) == 1) notify();
+    }
+
+    // Parks until a task turns up or the walk ends; false once it has ended.
+    bool waitForWork(int worker, Task &out)
+    {
+        QMutexLocker lock(&idleMutex);
+        for (;;) {
+            const quint64 seen = posted;
+            lock.unlock();
+            if (take(worker, out)) return true;
+            if (pending.load() == 0) return false;
+            lock.relock();
+            // A push or the end of the walk since the look bumped posted.
+            if (posted == seen) idle.wait(&idleMutex);
+        }
+    }
+
+    void notify()
+    {
+        QMutexLocker lock(&idleMutex);
+        ++posted;
+        idle.wakeAll();
+    }
+
+    bool take(int worker, Task &out)
+    {
+        {
+            TaskQueue &own = *queues[size_t(worker)];
+            QMutexLocker lock(&own.mutex);
+            if (!own.tasks.empty()) {
+                out = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        const int n = int(queues.size());
+        for (int i = 1; i < n; ++i) {
+            TaskQueue &victim = *queues[size_t((worker + i) % n)];
+            QMutexLocker lock(&victim.mutex);
+            if (!victim.tasks.empty()) {
+                out = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const FileFn &onFile;
+    const CancelFn &cancelled;
+    VisitedDirs *const visited;
+    QMutex aliasedMutex;
+    QStringList aliased;
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::atomic<int> pending { 0 }; // queued plus in progress
+    std::atomic<int> directories { 0 };
+    std::atomic<int> files { 0 };
+    std::atomic<bool> incomplete { false };
+    // Idle workers wait on this rather than polling while others read
+    // directories that may still produce work.
+    QMutex idleMutex;
+    QWaitCondition idle;
+    quint64 posted = 0; // pushes and the end of the walk, under idleMutex
+};
+
+DirWalker::DirWalker(int threads)
+{
+    setThreadCount(threads);
+}
+
+DirWalker::~DirWalker()
+{
+    m_pool.waitForDone();
+}
+
+void DirWalker::setThreadCount(int threads)
+{
+    m_threads = threads > 0 ? threads : qBound(1, 2 * QThread::idealThreadCount(), kMaxThreads);
+    m_pool.setMaxThreadCount(qMax(1, m_threads - 1));
+}
+
+bool DirWalker::isAudioName(const char *name, int length)
+{
+    static const char *const exts[] = { "mp3", "flac", "m4a", "wav", "ogg", "aac", "opus", "aiff", "wma" };
+    int dot = length - 1;
+    while (dot >= 0 && name[dot] != '.') --dot;
+    const int extLen = length - dot - 1;
+    if (dot < 0 || extLen < 3 || extLen > 4) return false;
+    char ext[5] = {};
+    for (int i = 0; i < extLen; ++i) {
+        const char c = name[dot + 1 + i];
+        ext[i] = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+    }
+    for (const char *e : exts)
+        if (std::strcmp(ext, e) == 0) return true;
+    return false;
+}
+
+bool DirWalker::VisitedDirs::insert(quint64 device, quint64 inode)
+{
+    const QPair<quint64, quint64> key(device, inode);
+    QMutexLocker lock(&m_mutex);
+    if (m_dirs.contains(key)) return false;
+    m_dirs.insert(key);
+    return true;
+}
+
+DirWalker::Result DirWalker::walk(const QString &root, const FileFn &onFile, const CancelFn &cancelled,
+                                  VisitedDirs *visited)
+{
+    const int threads = m_threads;
+    Walk w(threads, onFile, cancelled, visited);
+    Task first;
+    first.path = QFile::encodeName(QDir::cleanPath(root));
+    std::vector<Task> seed;
+    seed.push_back(std::move(first));
+    w.push(0, seed);
+
+    QVector<QFuture<void>> helpers;
+    for (int i = 1; i < threads; ++i)
+        helpers << QtConcurrent::run(&m_pool, [this, &w, i]() { work(w, i); });
+    work(w, 0);
+    for (QFuture<void> &f : helpers) f.waitForFinished();
+
+    Result r;
+    r.complete = !w.incomplete.load() && !w.isCancelled();
+    r.directories = w.directories.load();
+    r.files = w.files.load();
+    r.aliased = w.aliased;
+    return r;
+}
+
+void DirWalker::work(Walk &w, int worker)
+{
+    std::vector<Task> children;
+#ifdef Q_OS_LINUX
+    alignas(LinuxDirent64) char buf[32 * 1024];
+#endif
+    int idle = 0;
+    for (;;) {
+        Task task;
+        if (!w.take(worker, task)) {
+            if (w.pending.load() == 0) return;
+            // Someone is still reading a directory that may produce work.
+            if (++idle < kSpinRounds) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+            if (!w.waitForWork(worker, task)) return;
+        }
+        idle = 0;
+
+        if (w.isCancelled()) {
+            w.incomplete = true;
+            w.retire();
+            continue;
+        }
+
+#ifdef Q_OS_LINUX
+        // Symlinked subdirectories are not followed, but a root may well be
+        // one (~/Music pointing at another disk).
+        const bool root = !task.parent;
+        const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (root ? 0 : O_NOFOLLOW);
+        int fd = -1;
+        if (!root) fd = ::openat(task.parent->fd, task.path.constData() + task.nameOffset, flags);
+        // Without a parent, or when holding parents open exhausted the fd limit,
+        // resolve the full path instead.
+        if (fd < 0 && (root || errno == EMFILE || errno == ENFILE))
+            fd = ::open(task.path.constData(), flags);
+        task.parent.reset();
+        if (fd < 0) {
+            // A directory deleted under us is not an error; anything else means
+            // the walk cannot prove files are gone.
+            if (errno != ENOENT && errno != ENOTDIR) w.incomplete = true;
+            w.retire();
+            continue;
+        }
+        const auto self = std::make_shared<DirFd>(fd);
+        if (w.visited) {
+            struct ::stat st;
+            if (::fstat(fd, &st) == 0 && !w.visited->insert(quint64(st.st_dev), quint64(st.st_ino))) {
+                QMutexLocker lock(&w.aliasedMutex);
+                w.aliased << QFile::decodeName(task.path);
+                w.retire();
+                continue;
+            }
+        }
+        w.directories.fetch_add(1);
+
+        for (;;) {
+            const long n = ::syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n < 0) w.incomplete = true;
+            if (n <= 0) break;
+            for (long pos = 0; pos < n;) {
+                const auto *d = reinterpret_cast<const LinuxDirent64 *>(buf + pos);
+                pos += d->d_reclen;
+                const char *name = d->d_name;
+                if (name[0] == '.') continue; // ".", ".." and hidden entries
+                const int nameLen = int(std::strlen(name));
+                unsigned char type = d->d_type;
+
+                if (type == DT_UNKNOWN) {
+                    struct ::stat st;
+                    if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+                }
+                if (type == DT_DIR) {
+                    Task child;
+                    child.path.reserve(task.path.size() + 1 + nameLen);
+                    child.path.append(task.path).append('/');
+                    child.nameOffset = child.path.size();
+                    child.path.append(name, nameLen);
+                    child.parent = self;
+                    children.push_back(std::move(child));
+                    continue;
+                }
+                if (!isAudioName(name, nameLen)) continue;
+                if (type == DT_LNK) {
+                    // Symlinked files count, symlinked directories are not followed.
+                    struct ::stat st;
+                    if (::fstatat(fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+                } else if (type != DT_REG) {
+                    continue;
+                }
+                QByteArray filePath;
+                filePath.reserve(task.path.size() + 1 + nameLen);
+                filePath.append(task.path).append('/').append(name, nameLen);
+                w.files.fetch_add(1);
+                w.onFile(worker, QFile::decodeName(filePath));
+            }
+        }
+#else
+        const QString dir = QFile::decodeName(task.path);
+        if (!QFileInfo(dir).isReadable()) {
+            if (QFileInfo::exists(dir)) w.incomplete = true;
+            w.retire();
+            continue;
+        }
+        w.directories.fetch_add(1);
+        QDirIterator it(dir, QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot);
+        while (it.hasNext()) {
+            const QString path = it.next();
+            const QFileInfo fi = it.fileInfo();
+            if (fi.isDir()) {
+                if (fi.isSymLink()) continue;
+                Task child;
+                child.path = QFile::encodeName(path);
+                children.push_back(std::move(child));
+            } else if (fi.isFile()) {
+                const QByteArray name = QFile::encodeName(fi.fileName());
+                if (!isAudioName(name.constData(), name.size())) continue;
+                w.files.fetch_add(1);
+                w.onFile(worker, path);
+            }
+        }
+#endif
+        w.push(worker, children);
+        // Children are counted before this task retires, so pending cannot
+        // touch zero while work remains.
+        w.retire();
+    }
+}
@@ -0,0 +1,85 @@
+/*
+ * DirWalker - parallel directory tree enumeration
+ *
+ * Each directory is one task. Workers pop tasks from the back of their own
+ * queue (depth-first, warm dentry cache) and steal from the front of other
+ * workers' queues (shallow directories, i.e. large subtrees) when they run
+ * dry, so wide layouts with thousands of sibling album folders spread over
+ * all threads. On Linux directories are read with openat()/getdents64() and
+ * classified by d_type, so only symlinks and filesystems that do not fill in
+ * d_type cost a stat().
+ *
+ * Matches QDirIterator(QDir::Files, Subdirectories) as the scanner used it:
+ * hidden entries are skipped, symlinked files are reported, symlinked
+ * directories are not followed.
+ */
+#ifndef MEDIASONIC_SERVICES_DIRWALKER_H
+#define MEDIASONIC_SERVICES_DIRWALKER_H
+
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QMutex>
+#include <QSet>
+#include <QPair>
+#include <functional>
+
+namespace MS {
+
+class DirWalker
+{
+public:
+    // Called concurrently; worker is in [0, threadCount()) and unique per thread.
+    using FileFn = std::function<void(int worker, const QString &path)>;
+    // Polled once per directory; may block, e.g. to pause the walk.
+    using CancelFn = std::function<bool()>;
+
+    struct Result
+    {
+        bool complete = false; // every directory was read and nothing was cancelled
+        int directories = 0;
+        int files = 0;         // files passed to the callback
+        // Directories skipped because they had already been read under
+        // another path (bind mounts, overlapping roots).
+        QStringList aliased;
+    };
+
+    // Directories already read, by (device, inode). Share one between the
+    // walk() calls of a scan so every directory is read once.
+    class VisitedDirs
+    {
+    public:
+        // False if the directory was already there.
+        bool insert(quint64 device, quint64 inode);
+
+    private:
+        QMutex m_mutex;
+        QSet<QPair<quint64, quint64>> m_dirs;
+    };
+
+    explicit DirWalker(int threads = 0);
+    ~DirWalker();
+
+    // 0 selects twice QThread::idealThreadCount(), capped at 16; enumeration
+    // mostly waits on the disk or the network.
+    void setThreadCount(int threads);
+    int threadCount() const { return m_threads; }
+
+    // Blocks until root has been enumerated; the calling thread is worker 0.
+    Result walk(const QString &root, const FileFn &onFile, const CancelFn &cancelled = CancelFn(),
+                VisitedDirs *visited = nullptr);
+
+    // Case-insensitive match against the scanner's audio extensions.
+    static bool isAudioName(const char *name, int length);
+
+private:
+    struct Walk;
+    void work(Walk &walk, int worker);
+
+    int m_threads = 1;
+    QThreadPool m_pool;
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_DIRWALKER_H
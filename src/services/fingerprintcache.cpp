@@ -0,0 +1,150 @@
+#include "services/fingerprintcache.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+using namespace MS;
+
+bool FingerprintCache::stat(const QString &path, FileFingerprint &out)
+{
+#ifdef Q_OS_UNIX
+    struct ::stat st;
+    if (::stat(QFile::encodeName(path).constData(), &st) != 0) return false;
+    out.size = qint64(st.st_size);
+#if defined(Q_OS_MACOS)
+    out.mtimeNs = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    out.mtimeNs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    out.inode = quint64(st.st_ino);
+    out.device = quint64(st.st_dev);
+    return true;
+#else
+    QFileInfo fi(path);
+    if (!fi.exists()) return false;
+    out.size = fi.size();
+    out.mtimeNs = fi.lastModified().toMSecsSinceEpoch() * 1000000;
+    out.inode = 0;
+    out.device = 0;
+    return true;
+#endif
+}
+
+FingerprintCache::Status FingerprintCache::classify(const QString &path, const FileFingerprint &fp) const
+{
+    QReadLocker lock(&m_lock);
+    auto it = m_entries.constFind(path);
+    if (it == m_entries.constEnd()) return Unknown;
+    return it.value() == fp ? Unchanged : Changed;
+}
+
+void FingerprintCache::indexLocked(const QString &path, const FileFingerprint &fp)
+{
+    if (fp.inode != 0) m_pathByFile.insert(qMakePair(fp.device, fp.inode), path);
+}
+
+void FingerprintCache::unindexLocked(const QString &path)
+{
+    auto it = m_entries.constFind(path);
+    if (it == m_entries.constEnd() || it->inode == 0) return;
+    const QPair<quint64, quint64> key(it->device, it->inode);
+    if (m_pathByFile.value(key) == path) m_pathByFile.remove(key);
+}
+
+void FingerprintCache::insert(const QString &path, const FileFingerprint &fp)
+{
+    QWriteLocker lock(&m_lock);
+    unindexLocked(path);
+    m_entries.insert(path, fp);
+    indexLocked(path, fp);
+}
+
+void FingerprintCache::insert(const QHash<QString, FileFingerprint> &entries)
+{
+    QWriteLocker lock(&m_lock);
+    if (m_entries.isEmpty()) {
+        m_entries = entries;
+    } else {
+        for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+            unindexLocked(it.key());
+            m_entries.insert(it.key(), it.value());
+        }
+    }
+    m_pathByFile.reserve(m_pathByFile.size() + entries.size());
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) indexLocked(it.key(), it.value());
+}
+
+void FingerprintCache::remove(const QStringList &paths)
+{
+    QWriteLocker lock(&m_lock);
+    for (const QString &p : paths) {
+        unindexLocked(p);
+        m_entries.remove(p);
+    }
+}
+
+QVector<QPair<QString, QString>> FingerprintCache::rename(const QString &from, const QString &to)
+{
+    const QString prefix = from + QLatin1Char('/');
+    QVector<QPair<QString, QString>> moved;
+    QWriteLocker lock(&m_lock);
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (it.key() == from) moved << qMakePair(it.key(), to);
+        else if (it.key().startsWith(prefix)) moved << qMakePair(it.key(), to + it.key().mid(from.size()));
+    }
+    for (const auto &m : moved) {
+        unindexLocked(m.first);
+        const FileFingerprint fp = m_entries.take(m.first);
+        m_entries.insert(m.second, fp);
+        indexLocked(m.second, fp);
+    }
+    return moved;
+}
+
+bool FingerprintCache::contains(const QString &path) const
+{
+    QReadLocker lock(&m_lock);
+    return m_entries.contains(path);
+}
+
+QString FingerprintCache::aliasOf(const QString &path, const FileFingerprint &fp) const
+{
+    if (fp.inode == 0) return QString();
+    QReadLocker lock(&m_lock);
+    const QString other = m_pathByFile.value(qMakePair(fp.device, fp.inode));
+    return other == path ? QString() : other;
+}
+
+QStringList FingerprintCache::pathsUnder(const QString &root) const
+{
+    const QString prefix = root.endsWith(QLatin1Char('/')) ? root : root + QLatin1Char('/');
+    QStringList out;
+    QReadLocker lock(&m_lock);
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (it.key() == root || it.key().startsWith(prefix)) out << it.key();
+    }
+    return out;
+}
+
+QHash<QString, FileFingerprint> FingerprintCache::entries() const
+{
+    QReadLocker lock(&m_lock);
+    return m_entries;
+}
+
+int FingerprintCache::size() const
+{
+    QReadLocker lock(&m_lock);
+    return m_entries.size();
+}
+
+void FingerprintCache::clear()
+{
+    QWriteLocker lock(&m_lock);
+    m_entries.clear();
+    m_pathByFile.clear();
+}
@@ -0,0 +1,69 @@
+/*
+ * FingerprintCache - per-path (size, mtime, inode, device) fingerprints used
+ * to decide which files a rescan has to re-parse
+ */
+#ifndef MEDIASONIC_SERVICES_FINGERPRINTCACHE_H
+#define MEDIASONIC_SERVICES_FINGERPRINTCACHE_H
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QReadWriteLock>
+
+namespace MS {
+
+struct FileFingerprint
+{
+    qint64 size = 0;
+    qint64 mtimeNs = 0;
+    quint64 inode = 0;
+    quint64 device = 0;
+
+    bool operator==(const FileFingerprint &o) const {
+        return size == o.size && mtimeNs == o.mtimeNs && inode == o.inode && device == o.device;
+    }
+    bool operator!=(const FileFingerprint &o) const { return !(*this == o); }
+};
+
+// Thread-safe: the scanner's walker reads while parse workers insert.
+class FingerprintCache
+{
+public:
+    enum Status { Unknown, Unchanged, Changed };
+
+    // One stat() call, no open(). Returns false if the path does not exist.
+    static bool stat(const QString &path, FileFingerprint &out);
+
+    Status classify(const QString &path, const FileFingerprint &fp) const;
+    void insert(const QString &path, const FileFingerprint &fp);
+    void insert(const QHash<QString, FileFingerprint> &entries);
+    void remove(const QStringList &paths);
+    // Moves the entry for a file, or every entry below a directory, to a new
+    // location. Returns the (from, to) file paths that were moved.
+    QVector<QPair<QString, QString>> rename(const QString &from, const QString &to);
+    bool contains(const QString &path) const;
+    // Another cached path for the same (device, inode), i.e. a hard link or
+    // the same file seen through a bind mount; empty if there is none.
+    QString aliasOf(const QString &path, const FileFingerprint &fp) const;
+    // Every cached path equal to root or below it.
+    QStringList pathsUnder(const QString &root) const;
+
+    // Copy of every entry (implicitly shared, so cheap until the next insert).
+    QHash<QString, FileFingerprint> entries() const;
+    int size() const;
+    void clear();
+
+private:
+    void indexLocked(const QString &path, const FileFingerprint &fp);
+    void unindexLocked(const QString &path);
+
+    mutable QReadWriteLock m_lock;
+    QHash<QString, FileFingerprint> m_entries;
+    QHash<QPair<quint64, quint64>, QString> m_pathByFile; // (device, inode) -> path
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_FINGERPRINTCACHE_H
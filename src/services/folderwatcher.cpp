@@ -0,0 +1,316 @@
+#include "services/folderwatcher.h"
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QDebug>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace MS;
+
+namespace {
+
+constexpr int kDefaultSettleMs = 1000;
+constexpr int kDefaultSweepMs = 10 * 60 * 1000;
+// Conservative kernel default on older systems when /proc is unavailable.
+constexpr int kFallbackWatchLimit = 8192;
+
+#ifdef Q_OS_LINUX
+// Files are reported once fully written (IN_CLOSE_WRITE); IN_CREATE is still
+// needed for new directories and hard links.
+constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                              | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+#endif
+
+bool isAudioFile(const QString &name)
+{
+    static const QStringList exts = QStringList() << "mp3" << "flac" << "m4a" << "wav" << "ogg"
+                                                  << "aac" << "opus" << "aiff" << "wma";
+    const int dot = name.lastIndexOf(QLatin1Char('.'));
+    if (dot < 0) return false;
+    const QStringRef ext = name.midRef(dot + 1);
+    for (const QString &e : exts)
+        if (ext.compare(e, Qt::CaseInsensitive) == 0) return true;
+    return false;
+}
+
+int systemWatchLimit()
+{
+    QFile f(QStringLiteral("/proc/sys/fs/inotify/max_user_watches"));
+    if (!f.open(QIODevice::ReadOnly)) return kFallbackWatchLimit;
+    bool ok = false;
+    const int limit = f.readAll().trimmed().toInt(&ok);
+    return ok && limit > 0 ? limit : kFallbackWatchLimit;
+}
+
+}
+
+FolderWatcher::FolderWatcher(QObject *parent)
+    : QObject(parent)
+    , m_systemLimit(systemWatchLimit())
+{
+    m_settleTimer = new QTimer(this);
+    m_settleTimer->setSingleShot(true);
+    m_settleTimer->setInterval(kDefaultSettleMs);
+    connect(m_settleTimer, &QTimer::timeout, this, &FolderWatcher::flushChanges);
+
+    m_sweepTimer = new QTimer(this);
+    m_sweepTimer->setInterval(kDefaultSweepMs);
+    connect(m_sweepTimer, &QTimer::timeout, this, &FolderWatcher::sweep);
+
+    m_treeWatcher = new QFutureWatcher<TreeWatches>(this);
+    connect(m_treeWatcher, &QFutureWatcher<TreeWatches>::finished, this, [this]() {
+        adoptTree(m_treeWatcher->result());
+        m_treeQueue.removeFirst();
+        startNextTree();
+    });
+
+#ifdef Q_OS_LINUX
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd >= 0) {
+        m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &FolderWatcher::readEvents);
+    } else {
+        qWarning() << "FolderWatcher: inotify unavailable, using periodic sweeps";
+    }
+#endif
+}
+
+FolderWatcher::~FolderWatcher()
+{
+    // The worker adds watches through m_fd, so it has to stop before the close.
+    m_closing = true;
+    m_treeWatcher->waitForFinished();
+#ifdef Q_OS_LINUX
+    if (m_fd >= 0) ::close(m_fd);
+#endif
+}
+
+void FolderWatcher::setWatchBudget(int watches)
+{
+    m_budget = qMax(0, watches);
+}
+
+int FolderWatcher::watchBudget() const
+{
+    return m_budget > 0 ? m_budget : m_systemLimit / 2;
+}
+
+void FolderWatcher::setSettleInterval(int ms)
+{
+    m_settleTimer->setInterval(ms);
+}
+
+void FolderWatcher::setSweepInterval(int ms)
+{
+    m_sweepTimer->setInterval(ms);
+}
+
+void FolderWatcher::addRoot(const QString &path)
+{
+    const QString root = QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+    for (const QString &r : m_roots)
+        if (root == r || root.startsWith(r + QLatin1Char('/'))) return; // already covered
+    m_roots << root;
+    if (m_fd < 0) fallBackToSweep(root);
+    else watchTree(root);
+}
+
+void FolderWatcher::watchTree(const QString &dir)
+{
+    if (m_sweptRoots.contains(rootOf(dir)) || m_treeQueue.contains(dir)) return;
+    m_treeQueue << dir;
+    if (m_treeQueue.size() == 1) startNextTree();
+}
+
+void FolderWatcher::startNextTree()
+{
+    // Events wait in the kernel's queue until the tree's watches are known
+    // here; one for a watch we have no path for yet would be lost.
+    if (m_notifier) m_notifier->setEnabled(m_treeQueue.isEmpty());
+    if (m_treeQueue.isEmpty()) return;
+    const QString dir = m_treeQueue.first();
+    const int fd = m_fd;
+    const int available = watchBudget() - watchCount();
+    const std::atomic<bool> *closing = &m_closing;
+    m_treeWatcher->setFuture(QtConcurrent::run([fd, dir, available, closing]() {
+        return addTreeWatches(fd, dir, available, *closing);
+    }));
+}
+
+FolderWatcher::TreeWatches FolderWatcher::addTreeWatches(int fd, const QString &dir, int available,
+                                                         const std::atomic<bool> &closing)
+{
+    TreeWatches tree;
+    tree.dir = dir;
+#ifdef Q_OS_LINUX
+    const auto addWatch = [&](const QString &path) {
+        // Stop at our own budget rather than at the kernel's ENOSPC, which would
+        // also starve every other inotify user of this account.
+        if (tree.watches.size() >= available || closing.load(std::memory_order_relaxed)) return false;
+        const int wd = inotify_add_watch(fd, QFile::encodeName(path).constData(), kWatchMask);
+        if (wd >= 0) tree.watches << qMakePair(wd, path);
+        // Vanished or unreadable directories are simply not watched.
+        return wd >= 0 || errno == ENOENT || errno == EACCES || errno == ENOTDIR;
+    };
+    tree.complete = addWatch(dir);
+    QDirIterator it(dir, QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (tree.complete && it.hasNext()) tree.complete = addWatch(it.next());
+#else
+    Q_UNUSED(fd)
+    Q_UNUSED(available)
+    Q_UNUSED(closing)
+    tree.complete = false;
+#endif
+    return tree;
+}
+
+void FolderWatcher::adoptTree(const TreeWatches &tree)
+{
+    for (const auto &watch : tree.watches) {
+        m_pathByWatch.insert(watch.first, watch.second);
+        m_watchByPath.insert(watch.second, watch.first);
+    }
+    const QString root = rootOf(tree.dir);
+    if (m_sweptRoots.contains(root)) {
+        // The root fell back to sweeps while this tree was walked.
+        unwatchTree(tree.dir);
+    } else if (!tree.complete) {
+        fallBackToSweep(root);
+    } else if (tree.dir == root) {
+        qInfo() << "FolderWatcher: watching" << root << "-" << watchCount() << "of" << watchBudget() << "watches in use";
+    }
+}
+
+void FolderWatcher::unwatchTree(const QString &dir)
+{
+    const QString prefix = dir + QLatin1Char('/');
+    for (auto it = m_watchByPath.begin(); it != m_watchByPath.end();) {
+        if (it.key() == dir || it.key().startsWith(prefix)) {
+#ifdef Q_OS_LINUX
+            inotify_rm_watch(m_fd, it.value());
+#endif
+            m_pathByWatch.remove(it.value());
+            it = m_watchByPath.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FolderWatcher::fallBackToSweep(const QString &root)
+{
+    if (root.isEmpty() || m_sweptRoots.contains(root)) return;
+    unwatchTree(root);
+    m_sweptRoots.insert(root);
+    if (!m_sweepTimer->isActive()) m_sweepTimer->start();
+    qInfo() << "FolderWatcher:" << root << "exceeds the watch budget or cannot be watched; sweeping every"
+            << m_sweepTimer->interval() / 1000 << "s instead";
+}
+
+QString FolderWatcher::rootOf(const QString &path) const
+{
+    for (const QString &r : m_roots)
+        if (path == r || path.startsWith(r + QLatin1Char('/'))) return r;
+    return QString();
+}
+
+void FolderWatcher::queueChanged(const QString &path)
+{
+    if (m_pendingSet.contains(path)) return;
+    m_pendingSet.insert(path);
+    m_pending.changed << path;
+}
+
+void FolderWatcher::readEvents()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buf[64 * 1024];
+    for (;;) {
+        const ssize_t len = ::read(m_fd, buf, sizeof(buf));
+        if (len <= 0) break;
+        for (char *p = buf; p < buf + len;) {
+            const auto *ev = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were dropped; only a sweep can tell what changed.
+                emit sweepRequested(m_roots);
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                m_watchByPath.remove(m_pathByWatch.take(ev->wd));
+                continue;
+            }
+            const QString dir = m_pathByWatch.value(ev->wd);
+            if (dir.isEmpty()) continue;
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // Non-root directories are reported through their parent.
+                if (m_roots.contains(dir)) {
+                    unwatchTree(dir);
+                    queueChanged(dir);
+                }
+                continue;
+            }
+
+            const QString name = ev->len ? QFile::decodeName(ev->name) : QString();
+            const QString path = dir + QLatin1Char('/') + name;
+            const bool isDir = ev->mask & IN_ISDIR;
+
+            if (ev->mask & IN_MOVED_FROM) {
+                if (isDir) unwatchTree(path);
+                m_moveSources.insert(ev->cookie, path);
+            } else if (ev->mask & IN_MOVED_TO) {
+                if (isDir) watchTree(path);
+                const QString from = m_moveSources.take(ev->cookie);
+                if (from.isEmpty()) {
+                    // Moved in from outside the library
+                    if (isDir || isAudioFile(name)) queueChanged(path);
+                } else if (!isDir && !isAudioFile(name)) {
+                    // Renamed away from an audio name: gone as far as the library is concerned
+                    if (isAudioFile(from)) queueChanged(from);
+                } else if (!isDir && !isAudioFile(from)) {
+                    // Temporary file renamed into place (rsync, downloaders)
+                    queueChanged(path);
+                } else {
+                    m_pending.renamed << qMakePair(from, path);
+                }
+            } else if (isDir) {
+                if (ev->mask & IN_CREATE) watchTree(path);
+                queueChanged(path);
+            } else if (isAudioFile(name)) {
+                queueChanged(path);
+            }
+        }
+    }
+    if (!m_settleTimer->isActive() && (!m_pending.changed.isEmpty() || !m_pending.renamed.isEmpty()
+                                       || !m_moveSources.isEmpty()))
+        m_settleTimer->start();
+#endif
+}
+
+void FolderWatcher::flushChanges()
+{
+    // A move whose destination never showed up left the watched tree.
+    for (const QString &from : qAsConst(m_moveSources)) queueChanged(from);
+    m_moveSources.clear();
+    if (m_pending.changed.isEmpty() && m_pending.renamed.isEmpty()) return;
+    const FolderChanges changes = m_pending;
+    m_pending = FolderChanges();
+    m_pendingSet.clear();
+    emit changesReady(changes);
+}
+
+void FolderWatcher::sweep()
+{
+    if (!m_sweptRoots.isEmpty()) emit sweepRequested(sweptRoots());
+}
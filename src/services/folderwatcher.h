@@ -0,0 +1,107 @@
+/*
+ * FolderWatcher - keeps library roots in sync with the disk
+ *
+ * On Linux each directory below a root gets an inotify watch, added on a
+ * worker so that listing a large tree never holds up the GUI. Events are
+ * coalesced over a short window so a large copy or rsync turns into a few
+ * batches of affected paths rather than thousands of rescans. Roots that do
+ * not fit into the watch budget (or any root on other platforms) fall back to
+ * periodic fingerprint sweeps, which cost one stat() per file.
+ */
+#ifndef MEDIASONIC_SERVICES_FOLDERWATCHER_H
+#define MEDIASONIC_SERVICES_FOLDERWATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QVector>
+#include <atomic>
+
+class QSocketNotifier;
+class QTimer;
+template<typename T> class QFutureWatcher;
+
+namespace MS {
+
+struct FolderChanges
+{
+    // Created, rewritten or deleted files and directories; the scanner decides which by fingerprint.
+    QStringList changed;
+    // (from, to) moves within watched roots; either side may be a directory.
+    QVector<QPair<QString, QString>> renamed;
+};
+
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FolderWatcher(QObject *parent = nullptr);
+    ~FolderWatcher() override;
+
+    void addRoot(const QString &path);
+    QStringList roots() const { return m_roots; }
+    // Roots currently verified by periodic sweeps instead of inotify.
+    QStringList sweptRoots() const { return m_sweptRoots.values(); }
+
+    // Maximum inotify watches to register; 0 (default) uses half of
+    // /proc/sys/fs/inotify/max_user_watches so other applications keep theirs.
+    void setWatchBudget(int watches);
+    int watchBudget() const;
+    int watchCount() const { return m_pathByWatch.size(); }
+
+    void setSettleInterval(int ms);
+    void setSweepInterval(int ms);
+
+signals:
+    void changesReady(const MS::FolderChanges &changes);
+    void sweepRequested(const QStringList &roots);
+
+private slots:
+    void readEvents();
+    void flushChanges();
+    void sweep();
+
+private:
+    // Watches added on a worker for one directory and everything below it.
+    struct TreeWatches
+    {
+        QString dir;
+        QVector<QPair<int, QString>> watches;
+        bool complete = true; // false when the budget ran out
+    };
+    static TreeWatches addTreeWatches(int fd, const QString &dir, int available, const std::atomic<bool> &closing);
+
+    void watchTree(const QString &dir);
+    void startNextTree();
+    void adoptTree(const TreeWatches &tree);
+    void unwatchTree(const QString &dir);
+    void fallBackToSweep(const QString &root);
+    QString rootOf(const QString &path) const;
+    void queueChanged(const QString &path);
+
+    int m_fd = -1;
+    int m_budget = 0;
+    int m_systemLimit = 0;
+    QSocketNotifier *m_notifier = nullptr;
+    QTimer *m_settleTimer = nullptr;
+    QTimer *m_sweepTimer = nullptr;
+    QStringList m_roots;
+    QSet<QString> m_sweptRoots;
+    QHash<int, QString> m_pathByWatch;
+    QHash<QString, int> m_watchByPath;
+    // Trees waiting for their watches; the first is being walked on a worker.
+    QStringList m_treeQueue;
+    QFutureWatcher<TreeWatches> *m_treeWatcher = nullptr;
+    std::atomic<bool> m_closing{false};
+    // Unpaired IN_MOVED_FROM events by cookie until the matching IN_MOVED_TO arrives.
+    QHash<quint32, QString> m_moveSources;
+    FolderChanges m_pending;
+    QSet<QString> m_pendingSet;
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_FOLDERWATCHER_H
@@ -0,0 +1,290 @@
+#include "services/librarysnapshot.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <cstddef>
+#include <cstring>
+
+using namespace MS;
+
+namespace {
+
+const char kMagic[8] = { 'M', 'S', 'L', 'I', 'B', 'S', 'N', 'P' };
+
+// Tracks decoded per parallel task when loading.
+constexpr int kDecodeChunk = 4096;
+
+struct Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 headerSize;
+    quint32 trackCount;
+    quint32 recordSize;
+    quint64 stringsOffset;
+    quint64 stringsBytes;
+    quint64 recordsChecksum;
+    quint64 stringsChecksum;
+    quint64 headerChecksum; // over every field above
+};
+static_assert(sizeof(Header) == 64, "snapshot header layout changed");
+
+struct StringRef
+{
+    quint32 offset; // in UTF-16 code units into the string pool
+    quint32 length;
+};
+
+struct Record
+{
+    StringRef path;
+    StringRef title;
+    StringRef artist;
+    StringRef album;
+    StringRef genre;
+    StringRef composer;
+    qint32 year;
+    qint32 trackNumber;
+    qint32 discNumber;
+    qint32 bitrateKbps;
+    qint32 sampleRate;
+    qint32 rating;
+    qint32 playCount;
+    quint32 lastPlayed; // seconds since the epoch; written as zero before it was kept
+    qint64 durationMs;
+    qint64 fileSize;
+    qint64 mtimeNs;
+    quint64 inode;
+    quint64 device;
+    float trackGainDb;
+    float trackPeak; // negative if not analysed
+    float albumGainDb;
+    float albumPeak;
+};
+static_assert(sizeof(Record) == 136, "snapshot record layout changed");
+
+// Four independent multiply-xor lanes over 32-byte strides; fast enough to
+// verify a few hundred MB well inside the startup budget.
+quint64 checksum64(const uchar *data, quint64 len)
+{
+    const quint64 k = 0x9E3779B97F4A7C15ULL;
+    quint64 h[4] = { k ^ len, k * 3, k * 5, k * 7 };
+    quint64 i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int lane = 0; lane < 4; ++lane) {
+            quint64 w;
+            std::memcpy(&w, data + i + lane * 8, 8);
+            h[lane] = (h[lane] ^ w) * 0xFF51AFD7ED558CCDULL;
+            h[lane] ^= h[lane] >> 29;
+        }
+    }
+    quint64 tail = 0;
+    for (int shift = 0; i < len; ++i, shift += 8) tail |= quint64(data[i]) << (shift % 64);
+    quint64 out = h[0] ^ (h[1] << 1 | h[1] >> 63) ^ (h[2] << 2 | h[2] >> 62) ^ (h[3] << 3 | h[3] >> 61) ^ tail;
+    out ^= out >> 33;
+    out *= 0xC4CEB9FE1A85EC53ULL;
+    out ^= out >> 33;
+    return out;
+}
+
+class StringPool
+{
+public:
+    StringRef add(const QString &s, bool shared)
+    {
+        if (shared) {
+            auto it = m_shared.constFind(s);
+            if (it != m_shared.constEnd()) return it.value();
+        }
+        StringRef ref { quint32(m_units.size()), quint32(s.size()) };
+        m_units.append(reinterpret_cast<const ushort *>(s.constData()), s.size());
+        if (shared) m_shared.insert(s, ref);
+        return ref;
+    }
+    const QVector<ushort> &units() const { return m_units; }
+
+private:
+    QVector<ushort> m_units;
+    QHash<QString, StringRef> m_shared;
+};
+
+}
+
+QString LibrarySnapshot::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QStringLiteral("/library.mssnap");
+}
+
+bool LibrarySnapshot::write(const QString &path, const TrackStore &tracks,
+                            const QHash<QString, FileFingerprint> &fingerprints, QString *error)
+{
+    StringPool strings;
+    QByteArray records(int(sizeof(Record)) * tracks.size(), Qt::Uninitialized);
+    Record *rec = reinterpret_cast<Record *>(records.data());
+    for (int row = 0; row < tracks.size(); ++row) {
+        const QString local = tracks.localPath(row);
+        const FileFingerprint fp = fingerprints.value(local);
+        Record r;
+        std::memset(&r, 0, sizeof(r));
+        r.path = strings.add(local, false);
+        r.title = strings.add(tracks.title(row), false);
+        r.artist = strings.add(tracks.artist(row), true);
+        r.album = strings.add(tracks.album(row), true);
+        r.genre = strings.add(tracks.genre(row), true);
+        r.composer = strings.add(tracks.composer(row), true);
+        r.year = tracks.year(row);
+        r.trackNumber = tracks.trackNumber(row);
+        r.discNumber = tracks.discNumber(row);
+        r.bitrateKbps = tracks.bitrateKbps(row);
+        r.sampleRate = tracks.sampleRate(row);
+        r.rating = tracks.rating(row);
+        r.playCount = tracks.playCount(row);
+        r.lastPlayed = quint32(tracks.lastPlayed(row));
+        r.durationMs = tracks.durationMs(row);
+        r.fileSize = fp.size ? fp.size : tracks.fileSize(row);
+        r.mtimeNs = fp.mtimeNs;
+        r.inode = fp.inode;
+        r.device = fp.device;
+        r.trackGainDb = tracks.trackGainDb(row);
+        r.trackPeak = tracks.trackPeak(row);
+        r.albumGainDb = tracks.albumGainDb(row);
+        r.albumPeak = tracks.albumPeak(row);
+        *rec++ = r;
+    }
+
+    const uchar *stringBytes = reinterpret_cast<const uchar *>(strings.units().constData());
+    const quint64 stringsBytes = quint64(strings.units().size()) * sizeof(ushort);
+
+    Header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = Version;
+    h.headerSize = sizeof(Header);
+    h.trackCount = quint32(tracks.size());
+    h.recordSize = sizeof(Record);
+    h.stringsOffset = sizeof(Header) + quint64(records.size());
+    h.stringsBytes = stringsBytes;
+    h.recordsChecksum = checksum64(reinterpret_cast<const uchar *>(records.constData()), quint64(records.size()));
+    h.stringsChecksum = checksum64(stringBytes, stringsBytes);
+    h.headerChecksum = checksum64(reinterpret_cast<const uchar *>(&h), offsetof(Header, headerChecksum));
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        if (error) *error = out.errorString();
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    out.write(records);
+    out.write(reinterpret_cast<const char *>(stringBytes), qint64(stringsBytes));
+    if (!out.commit()) {
+        if (error) *error = out.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool LibrarySnapshot::read(const QString &path, Contents &out, QString *error)
+{
+    auto fail = [error](const QString &why) {
+        if (error) *error = why;
+        return false;
+    };
+
+    QFile f(path);
+    if (!f.exists()) return false;
+    if (!f.open(QIODevice::ReadOnly)) return fail(f.errorString());
+    const qint64 size = f.size();
+    if (size < qint64(sizeof(Header))) return fail(QStringLiteral("truncated header"));
+    const uchar *base = f.map(0, size);
+    if (!base) return fail(QStringLiteral("mmap failed: %1").arg(f.errorString()));
+
+    Header h;
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) return fail(QStringLiteral("bad magic"));
+    if (h.version != Version) return fail(QStringLiteral("unsupported version %1").arg(h.version));
+    if (h.headerChecksum != checksum64(reinterpret_cast<const uchar *>(&h), offsetof(Header, headerChecksum)))
+        return fail(QStringLiteral("header checksum mismatch"));
+    if (h.headerSize != sizeof(Header) || h.recordSize != sizeof(Record))
+        return fail(QStringLiteral("unexpected layout"));
+    const quint64 recordsBytes = quint64(h.trackCount) * sizeof(Record);
+    if (h.stringsOffset != sizeof(Header) + recordsBytes || h.stringsOffset + h.stringsBytes > quint64(size)
+        || h.stringsBytes % sizeof(ushort) != 0)
+        return fail(QStringLiteral("truncated body"));
+
+    const uchar *recordBytes = base + sizeof(Header);
+    const uchar *stringBytes = base + h.stringsOffset;
+    if (checksum64(recordBytes, recordsBytes) != h.recordsChecksum)
+        return fail(QStringLiteral("record checksum mismatch"));
+    if (checksum64(stringBytes, h.stringsBytes) != h.stringsChecksum)
+        return fail(QStringLiteral("string checksum mismatch"));
+
+    const quint64 poolUnits = h.stringsBytes / sizeof(ushort);
+    const int count = int(h.trackCount);
+    QVector<Track> tracks(count);
+    QVector<QString> paths(count);
+    QVector<FileFingerprint> fps(count);
+    QVector<int> chunks;
+    for (int start = 0; start < count; start += kDecodeChunk) chunks << start;
+
+    QAtomicInt corrupt(0);
+    QtConcurrent::blockingMap(chunks, [&](int start) {
+        // Shared strings decode once per chunk and are implicitly shared after that.
+        QHash<quint32, QString> sharedStrings;
+        auto str = [&](const StringRef &ref, bool shared) -> QString {
+            if (quint64(ref.offset) + ref.length > poolUnits) { corrupt.fetchAndStoreRelaxed(1); return QString(); }
+            if (shared) {
+                auto it = sharedStrings.constFind(ref.offset);
+                if (it != sharedStrings.constEnd()) return it.value();
+            }
+            const QString s = QString::fromUtf16(reinterpret_cast<const ushort *>(stringBytes) + ref.offset, int(ref.length));
+            if (shared) sharedStrings.insert(ref.offset, s);
+            return s;
+        };
+        const int end = qMin(count, start + kDecodeChunk);
+        for (int i = start; i < end; ++i) {
+            Record r;
+            std::memcpy(&r, recordBytes + quint64(i) * sizeof(Record), sizeof(Record));
+            Track &t = tracks[i];
+            paths[i] = str(r.path, false);
+            t.localPath = paths.at(i);
+            t.title = str(r.title, false);
+            t.artist = str(r.artist, true);
+            t.album = str(r.album, true);
+            t.genre = str(r.genre, true);
+            t.composer = str(r.composer, true);
+            t.year = r.year;
+            t.trackNumber = r.trackNumber;
+            t.discNumber = r.discNumber;
+            t.bitrateKbps = r.bitrateKbps;
+            t.sampleRate = r.sampleRate;
+            t.rating = r.rating;
+            t.playCount = r.playCount;
+            t.lastPlayed = r.lastPlayed;
+            t.durationMs = r.durationMs;
+            t.fileSize = r.fileSize;
+            t.trackGainDb = r.trackGainDb;
+            t.trackPeak = r.trackPeak;
+            t.albumGainDb = r.albumGainDb;
+            t.albumPeak = r.albumPeak;
+            FileFingerprint &fp = fps[i];
+            fp.size = r.fileSize;
+            fp.mtimeNs = r.mtimeNs;
+            fp.inode = r.inode;
+            fp.device = r.device;
+        }
+    });
+    if (corrupt.loadAcquire()) return fail(QStringLiteral("string reference out of range"));
+
+    out.fingerprints.clear();
+    out.fingerprints.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        if (fps.at(i).inode == 0 && fps.at(i).size == 0) continue; // never fingerprinted
+        out.fingerprints.insert(paths.at(i), fps.at(i));
+    }
+    out.tracks = tracks;
+    return true;
+}
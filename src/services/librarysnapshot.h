@@ -0,0 +1,50 @@
+/*
+ * LibrarySnapshot - versioned, checksummed binary image of the library that is
+ * memory-mapped at startup instead of re-parsing every file's tags
+ *
+ * Layout (host byte order, all offsets in bytes from the start of the file):
+ *   Header   64 bytes: magic, version, counts, section checksums
+ *   Records  trackCount fixed-size records (tags, stats, loudness, file
+ *            fingerprint)
+ *   Strings  UTF-16 pool referenced by (offset, length) pairs; artist, album,
+ *            genre and composer are stored once and shared by every record
+ *            using them
+ */
+#ifndef MEDIASONIC_SERVICES_LIBRARYSNAPSHOT_H
+#define MEDIASONIC_SERVICES_LIBRARYSNAPSHOT_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include "models/track.h"
+#include "models/trackstore.h"
+#include "services/fingerprintcache.h"
+
+namespace MS {
+
+class LibrarySnapshot
+{
+public:
+    // Bump whenever Header or Record change; older files are ignored and the
+    // library is rebuilt by a rescan.
+    static constexpr quint32 Version = 3;
+
+    struct Contents
+    {
+        QVector<Track> tracks;
+        QHash<QString, FileFingerprint> fingerprints; // keyed by local path
+    };
+
+    static QString defaultPath();
+
+    // Writes atomically (temporary file + rename).
+    static bool write(const QString &path, const TrackStore &tracks,
+                      const QHash<QString, FileFingerprint> &fingerprints, QString *error = nullptr);
+    // Returns false without touching out if the file is missing, from another
+    // version, truncated or fails a checksum.
+    static bool read(const QString &path, Contents &out, QString *error = nullptr);
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_LIBRARYSNAPSHOT_H
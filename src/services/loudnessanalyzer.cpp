@@ -0,0 +1,194 @@
+#include "services/loudnessanalyzer.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMetaObject>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QTimer>
+#include <QUrl>
+#include "audio/loudness.h"
+#include "audio/trackdecoder.h"
+#include "services/tagreader.h"
+
+using namespace MS;
+
+namespace {
+
+// Work done between rests.
+constexpr int kSliceMs = 50;
+// Fraction of the time the analysis may be active.
+constexpr double kDutyCycle = 0.25;
+// How soon to look again when the decoder has nothing buffered.
+constexpr int kWaitMs = 20;
+// Frames taken from the decoder at a time.
+constexpr int kReadFrames = 4096;
+// For files whose rate neither the scan nor the stream headers give.
+constexpr int kFallbackRate = 44100;
+
+}
+
+class LoudnessAnalyzer::Worker : public QObject
+{
+public:
+    explicit Worker(LoudnessAnalyzer *owner)
+        : m_owner(owner), m_timer(new QTimer(this)), m_buffer(2 * kReadFrames)
+    {
+        m_timer->setSingleShot(true);
+        connect(m_timer, &QTimer::timeout, this, [this]() { step(); });
+    }
+
+    void add(const QVector<Job> &jobs)
+    {
+        for (const Job &job : jobs) m_jobs.enqueue(job);
+        if (!m_inSlice && !m_timer->isActive()) m_timer->start(0);
+    }
+
+    void stop()
+    {
+        m_timer->stop();
+        m_decoder.reset();
+        m_meter.reset();
+        m_jobs.clear();
+    }
+
+private:
+    void step()
+    {
+        if (!m_inSlice) {
+            m_slice.start();
+            m_inSlice = true;
+        }
+        while (m_slice.elapsed() < kSliceMs) {
+            if (!m_decoder && !openNext()) {
+                m_inSlice = false;
+                return; // idle until add()
+            }
+            const int frames = m_decoder->read(m_buffer.data(), kReadFrames);
+            if (frames > 0) {
+                m_meter->process(m_buffer.constData(), frames);
+                continue;
+            }
+            if (m_decoder->atEnd()) {
+                finishTrack();
+                continue;
+            }
+            // Decoding is behind; ready() resumes the slice, or the timer does
+            m_timer->start(kWaitMs);
+            return;
+        }
+        const qint64 busy = m_slice.elapsed();
+        m_inSlice = false;
+        m_timer->start(int(busy * (1.0 - kDutyCycle) / kDutyCycle));
+    }
+
+    bool openNext()
+    {
+        if (m_next >= m_job.paths.size()) {
+            if (m_jobs.isEmpty()) return false;
+            m_job = m_jobs.dequeue();
+            m_next = 0;
+            m_albumPeak = 0.0f;
+        }
+        const QString &path = m_job.paths.at(m_next);
+        GaplessInfo gapless;
+        TagReader::readGapless(path, gapless);
+        // Measured at the file's own rate: resampling would move the true peak
+        int rate = gapless.sampleRate > 0 ? gapless.sampleRate : m_job.sampleRates.value(m_next);
+        if (rate <= 0) rate = kFallbackRate;
+        m_decoder.reset(new TrackDecoder(QUrl::fromLocalFile(path), gapless, rate));
+        connect(m_decoder.data(), &TrackDecoder::ready, this, [this]() {
+            if (m_inSlice && m_timer->isActive()) m_timer->start(0);
+        });
+        m_meter.reset(new LoudnessMeter(rate));
+        return true;
+    }
+
+    void finishTrack()
+    {
+        Result r;
+        r.localPath = m_job.paths.at(m_next);
+        if (!m_decoder->failed() && m_decoder->position() > 0) {
+            r.trackGainDb = float(LoudnessMeter::gainDb(m_meter->integratedLoudness()));
+            r.trackPeak = float(m_meter->truePeak());
+            m_albumBlocks += m_meter->blocks();
+            m_albumPeak = qMax(m_albumPeak, r.trackPeak);
+            m_results << r;
+        } else {
+            qWarning() << "LoudnessAnalyzer: could not decode" << r.localPath;
+            m_failed << r;
+        }
+        m_decoder.reset();
+        m_meter.reset();
+        if (++m_next < m_job.paths.size()) return;
+
+        const float albumGain = float(LoudnessMeter::gainDb(LoudnessMeter::integratedLoudness(m_albumBlocks)));
+        for (Result &result : m_results) {
+            result.albumGainDb = albumGain;
+            result.albumPeak = m_albumPeak;
+        }
+        LoudnessAnalyzer *owner = m_owner;
+        const QVector<QString> paths = m_job.paths;
+        const QVector<Result> results = m_results + m_failed;
+        QMetaObject::invokeMethod(owner, [owner, paths, results]() { owner->albumDone(paths, results); },
+                                  Qt::QueuedConnection);
+        m_results.clear();
+        m_failed.clear();
+        m_albumBlocks.clear();
+    }
+
+    LoudnessAnalyzer *m_owner;
+    QTimer *m_timer;
+    QQueue<Job> m_jobs;
+    Job m_job;
+    int m_next = 0; // track of m_job open or opened next
+    QScopedPointer<TrackDecoder> m_decoder;
+    QScopedPointer<LoudnessMeter> m_meter;
+    QVector<float> m_buffer;
+    QVector<Result> m_results;
+    QVector<Result> m_failed; // at 0 dB, and left out of the album
+    QVector<float> m_albumBlocks;
+    float m_albumPeak = 0.0f;
+    QElapsedTimer m_slice;
+    bool m_inSlice = false;
+};
+
+LoudnessAnalyzer::LoudnessAnalyzer(QObject *parent)
+    : QObject(parent)
+    , m_worker(new Worker(this))
+{
+    m_thread.setObjectName(QStringLiteral("LoudnessAnalyzer"));
+    m_worker->moveToThread(&m_thread);
+    m_thread.start(QThread::IdlePriority);
+}
+
+LoudnessAnalyzer::~LoudnessAnalyzer()
+{
+    QMetaObject::invokeMethod(m_worker, [this]() { m_worker->stop(); }, Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+    delete m_worker;
+}
+
+void LoudnessAnalyzer::enqueue(const QVector<Job> &jobs)
+{
+    QVector<Job> fresh;
+    for (const Job &job : jobs) {
+        Job kept;
+        for (int i = 0; i < job.paths.size(); ++i) {
+            if (m_queued.contains(job.paths.at(i))) continue;
+            m_queued.insert(job.paths.at(i));
+            kept.paths << job.paths.at(i);
+            kept.sampleRates << job.sampleRates.value(i);
+        }
+        if (!kept.paths.isEmpty()) fresh << kept;
+    }
+    if (fresh.isEmpty()) return;
+    qInfo() << "LoudnessAnalyzer: queued" << fresh.size() << "albums," << m_queued.size() << "tracks pending";
+    QMetaObject::invokeMethod(m_worker, [this, fresh]() { m_worker->add(fresh); }, Qt::QueuedConnection);
+}
+
+void LoudnessAnalyzer::albumDone(const QVector<QString> &paths, const QVector<Result> &results)
+{
+    for (const QString &path : paths) m_queued.remove(path);
+    if (!results.isEmpty()) emit analyzed(results);
+}
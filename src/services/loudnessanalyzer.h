@@ -0,0 +1,73 @@
+/*
+ * LoudnessAnalyzer - ReplayGain for the library, measured in the background
+ *
+ * Tracks are decoded at their own sample rate on one idle-priority thread and
+ * measured by a LoudnessMeter; an album's tracks are queued as one job, so
+ * that its album gain comes from the gating blocks of all of them. The work
+ * is cut into slices of kSliceMs, and after each slice the thread rests long
+ * enough that the analysis, the decoder it waits on included, is active for
+ * at most a quarter of the time. The decoder only runs a bounded distance
+ * ahead of the meter, so the rests hold it back as well, and on Linux the
+ * threads it starts inherit the idle scheduling class.
+ */
+#ifndef MEDIASONIC_SERVICES_LOUDNESSANALYZER_H
+#define MEDIASONIC_SERVICES_LOUDNESSANALYZER_H
+
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+namespace MS {
+
+class LoudnessAnalyzer : public QObject
+{
+    Q_OBJECT
+public:
+    // One album, or one track that has none.
+    struct Job
+    {
+        QVector<QString> paths;
+        QVector<int> sampleRates; // as scanned, per path; 0 if unknown
+    };
+
+    // As stored in Track.
+    struct Result
+    {
+        QString localPath;
+        float trackGainDb = 0.0f;
+        float trackPeak = 0.0f;
+        float albumGainDb = 0.0f;
+        float albumPeak = 0.0f;
+    };
+
+    explicit LoudnessAnalyzer(QObject *parent = nullptr);
+    ~LoudnessAnalyzer() override;
+
+    // Queues albums behind those already queued; a path that is queued or
+    // being analysed is not queued again.
+    void enqueue(const QVector<Job> &jobs);
+    // Tracks queued or being analysed.
+    int pendingTracks() const { return m_queued.size(); }
+    bool isQueued(const QString &localPath) const { return m_queued.contains(localPath); }
+
+signals:
+    // An album was measured. Files that could not be decoded come back at
+    // 0 dB with a zero peak, so that they are not queued again until they
+    // change.
+    void analyzed(const QVector<MS::LoudnessAnalyzer::Result> &results);
+
+private:
+    class Worker;
+
+    void albumDone(const QVector<QString> &paths, const QVector<Result> &results);
+
+    QThread m_thread;
+    Worker *m_worker;
+    QSet<QString> m_queued;
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_LOUDNESSANALYZER_H
@@ -1,137 +1,493 @@
 #include "services/scanner.h"
-#include <QtConcurrent>
+#include "services/scanstats.h"
+#include "services/tagreader.h"
+#include <QDir>
 #include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QRunnable>
+#include <QMap>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QThread>
 #include <QDebug>
-
-#ifdef HAVE_TAGLIB
-#include <taglib/fileref.h>
-#include <taglib/tag.h>
-#include <taglib/audioproperties.h>
-#endif
+#include <algorithm>
+#include <atomic>
+#include <functional>
 
 using namespace MS;
 
+namespace {
+
+// Parse jobs allowed in flight per worker before the walker blocks.
+constexpr int kInFlightPerWorker = 16;
+// Jobs walking at once; a job that outranks all of them still starts at once.
+constexpr int kMaxConcurrentJobs = 2;
+
+bool isUnder(const QString &path, const QString &root)
+{
+    if (!path.startsWith(root)) return false;
+    return path.size() == root.size() || root.endsWith(QLatin1Char('/')) || path.at(root.size()) == QLatin1Char('/');
+}
+
+bool isUnderAny(const QString &path, const QStringList &roots)
+{
+    for (const QString &r : roots)
+        if (isUnder(path, r)) return true;
+    return false;
+}
+
+// Drops duplicates and paths below another path of the list.
+QStringList withoutNested(QStringList paths)
+{
+    std::sort(paths.begin(), paths.end());
+    QStringList out;
+    for (const QString &p : qAsConst(paths))
+        if (out.isEmpty() || !isUnder(p, out.last())) out << p;
+    return out;
+}
+
+}
+
+const QStringList &Scanner::audioNameFilters()
+{
+    // Keep in step with DirWalker::isAudioName().
+    static const QStringList filters = QStringList() << "*.mp3" << "*.flac" << "*.m4a" << "*.wav" << "*.ogg"
+                                                     << "*.aac" << "*.opus" << "*.aiff" << "*.wma";
+    return filters;
+}
+
+struct Scanner::Job
+{
+    quint64 id = 0;
+    QStringList roots;
+    Priority priority = Normal;
+    std::atomic<bool> cancelled { false };
+    bool walking = false; // guarded by m_jobsMutex
+};
+
+class Scanner::PoolTask : public QRunnable
+{
+public:
+    explicit PoolTask(std::function<void()> fn) : m_fn(std::move(fn)) {}
+    void run() override { m_fn(); }
+
+private:
+    std::function<void()> m_fn;
+};
+
+// Per-scan state shared between the walker and the parse workers.
+struct Scanner::Pipeline
+{
+    Pipeline(int capacity, bool ordered) : capacity(capacity), ordered(ordered), freeSlots(capacity) {}
+
+    const int capacity;
+    const bool ordered;
+    QSemaphore freeSlots;       // bounds parse jobs in flight (and the reorder buffer)
+    QMutex mutex;
+    struct Result { Track track; bool modified = false; };
+    QMap<quint64, Result> pending; // finished out of order, waiting for their turn
+    quint64 nextToEmit = 0;
+    QVector<Track> added;          // ready for hand-off to the GUI thread
+    QVector<Track> modified;
+    QElapsedTimer sinceFlush;
+    ScanStatsCollector stats;
+};
+
 Scanner::Scanner(QObject *parent)
     : QObject(parent)
 {
+    setWorkerCount(0);
+    // Room for one job of each higher priority on top of the regular slots.
+    m_jobPool.setMaxThreadCount(kMaxConcurrentJobs + Interactive);
+}
+
+Scanner::~Scanner()
+{
+    cancel();
+    m_jobPool.waitForDone();
+    m_parsePool.waitForDone();
+}
+
+void Scanner::setWorkerCount(int count)
+{
+    m_parsePool.setMaxThreadCount(count > 0 ? count : qMax(1, QThread::idealThreadCount()));
+}
+
+int Scanner::workerCount() const
+{
+    return m_parsePool.maxThreadCount();
+}
+
+void Scanner::setOrderedOutput(bool ordered)
+{
+    m_ordered = ordered;
+}
+
+void Scanner::setWalkerThreadCount(int count)
+{
+    m_walkerThreads = qMax(0, count);
+}
+
+void Scanner::setTagBackend(TagReader::Backend backend)
+{
+    m_tagBackend = backend;
+}
+
+quint64 Scanner::scanDirectory(const QString &path, Priority priority)
+{
+    return scanPaths(QStringList() << path, priority);
+}
+
+quint64 Scanner::scanPaths(const QStringList &paths, Priority priority)
+{
+    QStringList cleaned;
+    for (const QString &p : paths) cleaned << QDir::cleanPath(QFileInfo(p).absoluteFilePath());
+    cleaned = withoutNested(cleaned);
+
+    QMutexLocker lock(&m_jobsMutex);
+    for (int i = 0; i < m_queued.size(); ++i) {
+        const std::shared_ptr<Job> job = m_queued.at(i);
+        bool covered = true;
+        for (const QString &p : qAsConst(cleaned))
+            if (!isUnderAny(p, job->roots)) { covered = false; break; }
+        if (!covered) continue;
+        if (priority > job->priority) {
+            job->priority = priority;
+            m_queued.removeAt(i);
+            int at = 0;
+            while (at < m_queued.size() && m_queued.at(at)->priority >= priority) ++at;
+            m_queued.insert(at, job);
+            schedule();
+        }
+        return job->id;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->id = m_nextJobId++;
+    job->roots = cleaned;
+    job->priority = priority;
+    int at = 0;
+    while (at < m_queued.size() && m_queued.at(at)->priority >= priority) ++at;
+    m_queued.insert(at, job);
+    schedule();
+    return job->id;
+}
+
+// Called with m_jobsMutex held.
+void Scanner::schedule()
+{
+    while (!m_queued.isEmpty()) {
+        int top = -1;
+        for (const auto &r : qAsConst(m_running)) top = qMax(top, int(r->priority));
+        if (m_running.size() >= kMaxConcurrentJobs && int(m_queued.first()->priority) <= top) break;
+        const std::shared_ptr<Job> job = m_queued.takeFirst();
+        job->walking = true;
+        m_running << job;
+        m_jobPool.start(new PoolTask([this, job]() { runJob(job); }));
+    }
+    updateGate();
+}
+
+// Called with m_jobsMutex held whenever the set of walking jobs changes.
+void Scanner::updateGate()
+{
+    int top = -1;
+    for (const auto &r : qAsConst(m_running))
+        if (r->walking) top = qMax(top, int(r->priority));
+    m_topWalking = top;
+    m_jobsChanged.wakeAll();
 }
 
 void Scanner::cancel()
 {
-    m_cancelled = true;
-}
-
-void Scanner::scanDirectory(const QString &path)
-{
-    m_cancelled = false;
-    // Run on a background thread to avoid blocking UI
-    QtConcurrent::run([this, path]() {
-        qInfo() << "Scanner: scanning directory" << path;
-        QDirIterator it(path, QStringList() << "*.mp3" << "*.flac" << "*.m4a" << "*.wav" << "*.ogg" << "*.aac" << "*.opus" << "*.aiff" << "*.wma",
-                         QDir::Files, QDirIterator::Subdirectories);
-        while (it.hasNext() && !m_cancelled) {
-            const QString filePath = it.next();
-            Track t; t.url = QUrl::fromLocalFile(filePath);
-#ifdef HAVE_TAGLIB
-            try {
-                TagLib::FileRef f(filePath.toUtf8().constData());
-                if (!f.isNull()) {
-                    if (f.tag()) {
-                        t.title = QString::fromUtf8(f.tag()->title().toCString(true));
-                        t.artist = QString::fromUtf8(f.tag()->artist().toCString(true));
-                        t.album = QString::fromUtf8(f.tag()->album().toCString(true));
-                        t.genre = QString::fromUtf8(f.tag()->genre().toCString(true));
-                        t.year = int(f.tag()->year());
-                        t.trackNumber = int(f.tag()->track());
-                    }
-                    if (f.audioProperties()) {
-                        t.durationMs = qint64(f.audioProperties()->length()) * 1000;
-                        t.bitrateKbps = f.audioProperties()->bitrate();
-                        t.sampleRate = f.audioProperties()->sampleRate();
-                    }
-                }
-            } catch (...) {
-                // Fallbacks below
+    QList<std::shared_ptr<Job>> dropped;
+    bool idle = false;
+    {
+        QMutexLocker lock(&m_jobsMutex);
+        dropped = m_queued;
+        m_queued.clear();
+        for (const auto &job : qAsConst(dropped)) job->cancelled = true;
+        for (const auto &job : qAsConst(m_running)) job->cancelled = true;
+        idle = m_running.isEmpty();
+        m_jobsChanged.wakeAll();
+    }
+    for (const auto &job : qAsConst(dropped)) emit jobFinished(job->id, true);
+    if (idle && !dropped.isEmpty()) emit finished();
+}
+
+void Scanner::cancel(quint64 id)
+{
+    std::shared_ptr<Job> dropped;
+    bool idle = false;
+    {
+        QMutexLocker lock(&m_jobsMutex);
+        for (const auto &job : qAsConst(m_running))
+            if (job->id == id) job->cancelled = true;
+        for (int i = 0; i < m_queued.size(); ++i) {
+            if (m_queued.at(i)->id != id) continue;
+            dropped = m_queued.takeAt(i);
+            dropped->cancelled = true;
+            break;
+        }
+        idle = m_running.isEmpty() && m_queued.isEmpty();
+        m_jobsChanged.wakeAll();
+    }
+    if (!dropped) return;
+    emit jobFinished(dropped->id, true);
+    if (idle) emit finished();
+}
+
+void Scanner::pause()
+{
+    QMutexLocker lock(&m_jobsMutex);
+    m_paused = true;
+}
+
+void Scanner::resume()
+{
+    QMutexLocker lock(&m_jobsMutex);
+    m_paused = false;
+    m_jobsChanged.wakeAll();
+}
+
+bool Scanner::isPaused() const
+{
+    QMutexLocker lock(&m_jobsMutex);
+    return m_paused;
+}
+
+bool Scanner::isIdle() const
+{
+    QMutexLocker lock(&m_jobsMutex);
+    return m_running.isEmpty() && m_queued.isEmpty();
+}
+
+bool Scanner::checkpoint(Job &job, bool walking)
+{
+    // Lock-free when nothing is paused and no walk outranks this one, which is
+    // the case for nearly every file and directory.
+    if (!m_paused && (!walking || int(job.priority) >= m_topWalking)) return job.cancelled;
+    QMutexLocker lock(&m_jobsMutex);
+    auto outranked = [&]() {
+        if (!walking) return false; // parse order is already settled by pool priority
+        for (const auto &r : qAsConst(m_running))
+            if (r->walking && r->priority > job.priority) return true;
+        return false;
+    };
+    while (!job.cancelled && (m_paused || outranked())) m_jobsChanged.wait(&m_jobsMutex);
+    return job.cancelled;
+}
+
+void Scanner::retire(const std::shared_ptr<Job> &job)
+{
+    bool idle = false;
+    {
+        QMutexLocker lock(&m_jobsMutex);
+        m_running.removeOne(job);
+        schedule();
+        idle = m_running.isEmpty() && m_queued.isEmpty();
+    }
+    emit jobFinished(job->id, job->cancelled);
+    if (idle) emit finished();
+}
+
+bool Scanner::claim(const FileFingerprint &fp)
+{
+    if (fp.inode == 0) return true; // no identity to go by
+    QMutexLocker lock(&m_inFlightMutex);
+    const QPair<quint64, quint64> key(fp.device, fp.inode);
+    if (m_inFlight.contains(key)) return false;
+    m_inFlight.insert(key);
+    return true;
+}
+
+void Scanner::release(const FileFingerprint &fp)
+{
+    if (fp.inode == 0) return;
+    QMutexLocker lock(&m_inFlightMutex);
+    m_inFlight.remove(qMakePair(fp.device, fp.inode));
+}
+
+void Scanner::runJob(const std::shared_ptr<Job> &jobPtr)
+{
+    Job &job = *jobPtr;
+    const QStringList &roots = job.roots;
+    qInfo() << "Scanner: job" << job.id << "scanning" << roots << "with" << workerCount() << "workers";
+    ScanStats stats;
+    stats.job = job.id;
+    stats.roots = roots;
+    stats.workers = workerCount();
+    const qint64 bytesReadBefore = processBytesRead();
+    QElapsedTimer wall;
+    wall.start();
+    DirWalker walker(m_walkerThreads);
+    DirWalker::VisitedDirs visitedDirs;
+    // Walker threads waiting for a free parse slot, summed.
+    std::atomic<qint64> blockedNs { 0 };
+    std::atomic<int> filesSeen { 0 };
+    std::atomic<int> filesUnchanged { 0 };
+    std::atomic<int> filesDuplicate { 0 };
+
+    Pipeline pipe(workerCount() * kInFlightPerWorker, m_ordered);
+    pipe.sinceFlush.start();
+    std::atomic<quint64> seq { 0 };
+    QStringList removed;
+
+    // One stat per file decides whether it needs a parse at all. Called from
+    // every walker thread at once.
+    auto visit = [&](const QString &filePath) {
+        filesSeen.fetch_add(1, std::memory_order_relaxed);
+        FileFingerprint fp;
+        if (!FingerprintCache::stat(filePath, fp)) return;
+        const FingerprintCache::Status status = m_fingerprints.classify(filePath, fp);
+        if (status == FingerprintCache::Unchanged) {
+            filesUnchanged.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (status == FingerprintCache::Unknown) {
+            // Known under another path that still points at this very file:
+            // a bind mount or hard link, not a new track.
+            const QString alias = m_fingerprints.aliasOf(filePath, fp);
+            FileFingerprint other;
+            if (!alias.isEmpty() && FingerprintCache::stat(alias, other) && other.device == fp.device
+                && other.inode == fp.inode) {
+                filesDuplicate.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // Another job is parsing the same file right now.
+        if (!claim(fp)) {
+            filesDuplicate.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        QElapsedTimer blocked;
+        blocked.start();
+        pipe.freeSlots.acquire();
+        blockedNs.fetch_add(blocked.nsecsElapsed(), std::memory_order_relaxed);
+        // Walker threads race for these, so only a single walker keeps the
+        // numbering, and with it the emitted order, the same between scans.
+        const quint64 n = seq.fetch_add(1);
+        const bool modified = status == FingerprintCache::Changed;
+        m_parsePool.start(new PoolTask([this, &job, &pipe, n, filePath, fp, modified]() {
+            if (checkpoint(job, false)) {
+                release(fp);
+                deliver(pipe, n, Track(), modified);
+                return;
             }
-#endif
-            if (t.title.isEmpty()) {
-                QFileInfo fi(filePath);
-                t.title = fi.completeBaseName();
+            QElapsedTimer parse;
+            parse.start();
+            bool viaTagLib = false;
+            Track t = TagReader::read(filePath, m_tagBackend, &viaTagLib);
+            t.fileSize = fp.size;
+            pipe.stats.recordParse(filePath, parse.nsecsElapsed(), fp.size, viaTagLib);
+            m_fingerprints.insert(filePath, fp);
+            release(fp);
+            deliver(pipe, n, t, modified);
+        }), int(job.priority));
+    };
+
+    for (const QString &p : roots) {
+        if (checkpoint(job, true)) break;
+        QFileInfo fi(p);
+        if (!fi.exists()) {
+            removed << m_fingerprints.pathsUnder(p);
+            continue;
+        }
+        if (fi.isDir()) {
+            // Per walker thread, so recording what was seen needs no lock.
+            QVector<QStringList> seen(walker.threadCount());
+            const DirWalker::Result walked = walker.walk(p, [&](int worker, const QString &filePath) {
+                seen[worker] << filePath;
+                visit(filePath);
+            }, [&]() { return checkpoint(job, true); }, &visitedDirs);
+            stats.directories += walked.directories;
+            // Only a complete walk can prove that a file has gone. Directories
+            // skipped as aliases of one already read prove nothing.
+            if (walked.complete && !job.cancelled) {
+                QSet<QString> all;
+                all.reserve(walked.files);
+                for (const QStringList &list : qAsConst(seen))
+                    for (const QString &path : list) all.insert(path);
+                for (const QString &known : m_fingerprints.pathsUnder(p))
+                    if (!all.contains(known) && !isUnderAny(known, walked.aliased)) removed << known;
             }
-            emit trackDiscovered(t);
+        } else if (fi.isFile()) {
+            visit(p);
         }
-        qInfo() << "Scanner: finished" << path;
-        emit finished();
-    });
-}
-
-void Scanner::scanPaths(const QStringList &paths)
-{
-    m_cancelled = false;
-    const QStringList items = paths; // copy for lambda capture
-    QtConcurrent::run([this, items]() {
-        qInfo() << "Scanner: scanning paths" << items;
-        for (const QString &p : items) {
-            if (m_cancelled) break;
-            QFileInfo fi(p);
-            if (!fi.exists()) continue;
-            if (fi.isDir()) {
-                QDirIterator it(p, QStringList() << "*.mp3" << "*.flac" << "*.m4a" << "*.wav" << "*.ogg" << "*.aac" << "*.opus" << "*.aiff" << "*.wma",
-                                QDir::Files, QDirIterator::Subdirectories);
-                while (it.hasNext() && !m_cancelled) {
-                    const QString filePath = it.next();
-                    Track t; t.url = QUrl::fromLocalFile(filePath);
-#ifdef HAVE_TAGLIB
-                    try {
-                        TagLib::FileRef f(filePath.toUtf8().constData());
-                        if (!f.isNull()) {
-                            if (f.tag()) {
-                                t.title = QString::fromUtf8(f.tag()->title().toCString(true));
-                                t.artist = QString::fromUtf8(f.tag()->artist().toCString(true));
-                                t.album = QString::fromUtf8(f.tag()->album().toCString(true));
-                                t.genre = QString::fromUtf8(f.tag()->genre().toCString(true));
-                                t.year = int(f.tag()->year());
-                                t.trackNumber = int(f.tag()->track());
-                            }
-                            if (f.audioProperties()) {
-                                t.durationMs = qint64(f.audioProperties()->length()) * 1000;
-                                t.bitrateKbps = f.audioProperties()->bitrate();
-                                t.sampleRate = f.audioProperties()->sampleRate();
-                            }
-                        }
-                    } catch (...) {}
-#endif
-                    if (t.title.isEmpty()) t.title = QFileInfo(filePath).completeBaseName();
-                    emit trackDiscovered(t);
-                }
-            } else if (fi.isFile()) {
-                const QString filePath = fi.absoluteFilePath();
-                Track t; t.url = QUrl::fromLocalFile(filePath);
-#ifdef HAVE_TAGLIB
-                try {
-                    TagLib::FileRef f(filePath.toUtf8().constData());
-                    if (!f.isNull()) {
-                        if (f.tag()) {
-                            t.title = QString::fromUtf8(f.tag()->title().toCString(true));
-                            t.artist = QString::fromUtf8(f.tag()->artist().toCString(true));
-                            t.album = QString::fromUtf8(f.tag()->album().toCString(true));
-                            t.genre = QString::fromUtf8(f.tag()->genre().toCString(true));
-                            t.year = int(f.tag()->year());
-                            t.trackNumber = int(f.tag()->track());
-                        }
-                        if (f.audioProperties()) {
-                            t.durationMs = qint64(f.audioProperties()->length()) * 1000;
-                            t.bitrateKbps = f.audioProperties()->bitrate();
-                            t.sampleRate = f.audioProperties()->sampleRate();
-                        }
-                    }
-                } catch (...) {}
-#endif
-                if (t.title.isEmpty()) t.title = fi.completeBaseName();
-                emit trackDiscovered(t);
+    }
+
+    stats.filesSeen = filesSeen.load();
+    stats.filesUnchanged = filesUnchanged.load();
+    stats.filesDuplicate = filesDuplicate.load();
+    stats.walkNs = wall.nsecsElapsed() - blockedNs.load() / walker.threadCount();
+    {
+        // Lower-priority walks may go on while this job's parses finish.
+        QMutexLocker lock(&m_jobsMutex);
+        job.walking = false;
+        updateGate();
+    }
+
+    // Drain: once every slot is back, all submitted jobs have been delivered.
+    pipe.freeSlots.acquire(pipe.capacity);
+    flushBatch(pipe);
+    if (!removed.isEmpty()) {
+        m_fingerprints.remove(removed);
+        emit tracksRemoved(removed);
+    }
+
+    stats.wallNs = wall.nsecsElapsed();
+    stats.filesRemoved = removed.size();
+    const qint64 bytesReadAfter = processBytesRead();
+    if (bytesReadBefore >= 0 && bytesReadAfter >= 0) stats.bytesRead = bytesReadAfter - bytesReadBefore;
+    pipe.stats.finish(stats);
+    qInfo().noquote() << "Scanner: finished\n" + stats.toString();
+    emit statsReady(stats);
+    retire(jobPtr);
+}
+
+void Scanner::deliver(Pipeline &pipe, quint64 seq, const Track &track, bool modified)
+{
+    // A default-constructed track marks a job skipped by cancellation; it still
+    // occupies its sequence number so ordered output does not stall.
+    int done = 0;
+    {
+        QMutexLocker lock(&pipe.mutex);
+        auto take = [&pipe](const Track &t, bool isModified) {
+            if (t.localPath.isEmpty()) return;
+            (isModified ? pipe.modified : pipe.added).push_back(t);
+        };
+        if (!pipe.ordered) {
+            take(track, modified);
+            done = 1;
+        } else {
+            pipe.pending.insert(seq, Pipeline::Result{track, modified});
+            while (!pipe.pending.isEmpty() && pipe.pending.firstKey() == pipe.nextToEmit) {
+                const Pipeline::Result next = pipe.pending.take(pipe.nextToEmit++);
+                take(next.track, next.modified);
+                ++done;
             }
         }
-        qInfo() << "Scanner: finished paths";
-        emit finished();
-    });
+        if (pipe.added.size() + pipe.modified.size() >= BatchSize || pipe.sinceFlush.elapsed() >= BatchIntervalMs)
+            flushBatch(pipe);
+    }
+    // Release only after unlocking: the walker may tear the pipeline down as
+    // soon as the last slot comes back.
+    if (done) pipe.freeSlots.release(done);
+}
+
+// Called with pipe.mutex held (or after the workers have drained), which keeps
+// batches in order on the receiving side.
+void Scanner::flushBatch(Pipeline &pipe)
+{
+    pipe.sinceFlush.restart();
+    if (!pipe.added.isEmpty()) {
+        emit tracksDiscovered(pipe.added);
+        pipe.added.clear();
+    }
+    if (!pipe.modified.isEmpty()) {
+        emit tracksModified(pipe.modified);
+        pipe.modified.clear();
+    }
 }
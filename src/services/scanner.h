@@ -1,14 +1,42 @@
 /*
- * Scanner - asynchronous library scanner with optional TagLib metadata
+ * Scanner - asynchronous library scanner
+ *
+ * Scanning is pipelined: a parallel walker stage (DirWalker) enumerates files
+ * while a bounded pool of workers parses tags in parallel. Results are handed
+ * to the GUI thread in batches rather than one queued signal per file.
+ *
+ * Every scan is incremental: files whose fingerprint (size, mtime, inode,
+ * device) is unchanged since they were last parsed cost one stat() and are
+ * skipped; changed files are re-parsed and reported as modified, and files
+ * that vanished from a fully walked directory root are reported as removed.
+ *
+ * Each scanPaths() call becomes a job with its own cancellation token. Jobs
+ * are scheduled by priority: a higher-priority job gets its parse work ahead
+ * of everyone else's and holds lower-priority walks at their next directory
+ * until it has finished walking. A file is never parsed by two jobs at once,
+ * and a directory or file reached through a bind mount or hard link that the
+ * library already knows under another path is skipped.
  */
 #ifndef MEDIASONIC_SERVICES_SCANNER_H
 #define MEDIASONIC_SERVICES_SCANNER_H
 
 #include <QObject>
 #include <QString>
-#include <QFutureWatcher>
-#include <QDirIterator>
+#include <QStringList>
+#include <QList>
+#include <QVector>
+#include <QSet>
+#include <QPair>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
 #include "models/track.h"
+#include "services/dirwalker.h"
+#include "services/fingerprintcache.h"
+#include "services/scanstats.h"
+#include "services/tagreader.h"
 
 namespace MS {
 
@@ -16,18 +44,106 @@ class Scanner : public QObject
 {
     Q_OBJECT
 public:
+    enum Priority {
+        Background,  // periodic sweeps, startup verification
+        Normal,      // file system change notifications
+        Interactive  // something the user just added
+    };
+
     explicit Scanner(QObject *parent = nullptr);
+    ~Scanner() override;
 
-    void scanDirectory(const QString &path);
-    void scanPaths(const QStringList &paths);
+    // Queue a scan and return its job id. Paths under another path of the same
+    // call are dropped; a call whose paths are all covered by a job that has
+    // not started yet is folded into that job, which is returned instead.
+    quint64 scanDirectory(const QString &path, Priority priority = Normal);
+    quint64 scanPaths(const QStringList &paths, Priority priority = Normal);
+    // Cancel every job, or one job.
     void cancel();
+    void cancel(quint64 job);
+    // Stops walkers at their next directory and workers before their next file.
+    void pause();
+    void resume();
+    bool isPaused() const;
+    bool isIdle() const;
+
+    // Number of tag-parsing workers; 0 selects QThread::idealThreadCount().
+    void setWorkerCount(int count);
+    int workerCount() const;
+
+    // Directory enumeration threads per job; 0 selects DirWalker's default.
+    void setWalkerThreadCount(int count);
+    int walkerThreadCount() const { return m_walkerThreads; }
+
+    // When enabled (default), tracks are emitted in the order the walker handed
+    // them over even though workers finish out of order. With more than one
+    // walker thread that order depends on thread timing and differs from scan
+    // to scan; one walker thread makes it the stable depth-first walk order.
+    void setOrderedOutput(bool ordered);
+    bool orderedOutput() const { return m_ordered; }
+
+    // Which tag reader the workers use; Auto by default. Only for benchmarks
+    // and comparisons; set it before starting a scan.
+    void setTagBackend(TagReader::Backend backend);
+    TagReader::Backend tagBackend() const { return m_tagBackend; }
+
+    FingerprintCache &fingerprints() { return m_fingerprints; }
+
+    // Glob patterns of the files the walker picks up.
+    static const QStringList &audioNameFilters();
+
+    // Largest batch delivered through tracksDiscovered().
+    static constexpr int BatchSize = 512;
+    // A partial batch is flushed once it has waited this long.
+    static constexpr int BatchIntervalMs = 100;
 
 signals:
-    void trackDiscovered(const MS::Track &track);
+    void tracksDiscovered(const QVector<MS::Track> &tracks);
+    // Known files whose fingerprint changed; re-parsed.
+    void tracksModified(const QVector<MS::Track> &tracks);
+    // Local paths of known files that no longer exist.
+    void tracksRemoved(const QStringList &paths);
+    // Emitted at the end of every job, just before jobFinished().
+    void statsReady(const MS::ScanStats &stats);
+    void jobFinished(quint64 job, bool cancelled);
+    // No job is running or queued any more.
     void finished();
 
 private:
-    bool m_cancelled = false;
+    struct Job;
+    struct Pipeline;
+    class PoolTask;
+
+    void schedule();
+    void updateGate();
+    void runJob(const std::shared_ptr<Job> &job);
+    void retire(const std::shared_ptr<Job> &job);
+    // Blocks while paused or outranked; returns whether the job was cancelled.
+    bool checkpoint(Job &job, bool walking);
+    bool claim(const FileFingerprint &fp);
+    void release(const FileFingerprint &fp);
+    void deliver(Pipeline &pipe, quint64 seq, const Track &track, bool modified);
+    void flushBatch(Pipeline &pipe);
+
+    bool m_ordered = true;
+    int m_walkerThreads = 0;
+    TagReader::Backend m_tagBackend = TagReader::Auto;
+    QThreadPool m_parsePool;
+    QThreadPool m_jobPool;
+    FingerprintCache m_fingerprints;
+
+    mutable QMutex m_jobsMutex;
+    QWaitCondition m_jobsChanged;
+    QList<std::shared_ptr<Job>> m_queued;  // by descending priority, then FIFO
+    QList<std::shared_ptr<Job>> m_running;
+    quint64 m_nextJobId = 1;
+    // Written under m_jobsMutex, read without it by checkpoint().
+    std::atomic<bool> m_paused { false };
+    std::atomic<int> m_topWalking { -1 }; // highest priority still walking
+
+    // Files being parsed right now, by (device, inode).
+    QMutex m_inFlightMutex;
+    QSet<QPair<quint64, quint64>> m_inFlight;
 };
 
 }
@@ -0,0 +1,120 @@
+#include "services/scanstats.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QMutexLocker>
+#include <algorithm>
+
+using namespace MS;
+
+namespace {
+
+int bucketFor(qint64 ns)
+{
+    qint64 us = ns / 1000;
+    int b = 0;
+    while (us > 1 && b < ScanStats::HistogramBuckets - 1) { us >>= 1; ++b; }
+    return b;
+}
+
+QString formatMs(qint64 ns)
+{
+    return QString::number(double(ns) / 1e6, 'f', 1) + QStringLiteral(" ms");
+}
+
+}
+
+qint64 ScanStats::Extension::quantileUs(double q) const
+{
+    if (count == 0) return 0;
+    const int target = qMax(1, int(q * count + 0.5));
+    int seen = 0;
+    for (int b = 0; b < histogram.size(); ++b) {
+        seen += histogram.at(b);
+        if (seen >= target) return qint64(1) << (b + 1);
+    }
+    return qint64(1) << histogram.size();
+}
+
+double ScanStats::filesPerSecond() const
+{
+    return wallNs > 0 ? double(filesSeen) * 1e9 / double(wallNs) : 0.0;
+}
+
+QString ScanStats::toString() const
+{
+    QString out;
+    QTextStream ts(&out);
+    ts << "Scan job " << job << " of " << roots.join(QStringLiteral(", ")) << " with " << workers << " workers\n";
+    ts << "  files: " << filesSeen << " seen in " << directories << " directories, " << filesParsed << " parsed ("
+       << filesViaTagLib << " via TagLib), " << filesUnchanged << " unchanged, " << filesDuplicate << " duplicate, "
+       << filesRemoved << " removed\n";
+    ts << "  throughput: " << QString::number(filesPerSecond(), 'f', 0) << " files/s over " << formatMs(wallNs) << "\n";
+    ts << "  walk: " << formatMs(walkNs) << ", parse: " << formatMs(parseNs) << " (summed over workers)\n";
+    ts << "  bytes: " << bytesInParsedFiles << " in parsed files, "
+       << (bytesRead >= 0 ? QString::number(bytesRead) : QStringLiteral("unknown")) << " read\n";
+    for (auto it = perExtension.constBegin(); it != perExtension.constEnd(); ++it) {
+        const Extension &e = it.value();
+        ts << "  ." << it.key() << ": " << e.count << " files (" << e.viaTagLib << " via TagLib), mean "
+           << QString::number(e.count ? double(e.totalNs) / e.count / 1e6 : 0.0, 'f', 2) << " ms, p50 <"
+           << e.quantileUs(0.5) << " us, p95 <" << e.quantileUs(0.95) << " us, p99 <" << e.quantileUs(0.99) << " us\n";
+    }
+    if (!slowest.isEmpty()) {
+        ts << "  slowest:\n";
+        for (const SlowFile &f : slowest) ts << "    " << formatMs(f.ns) << "  " << f.path << "\n";
+    }
+    return out;
+}
+
+void ScanStatsCollector::recordParse(const QString &path, qint64 ns, qint64 fileSize, bool viaTagLib)
+{
+    const QString ext = QFileInfo(path).suffix().toLower();
+    QMutexLocker lock(&m_mutex);
+    ++m_stats.filesParsed;
+    if (viaTagLib) ++m_stats.filesViaTagLib;
+    m_stats.parseNs += ns;
+    m_stats.bytesInParsedFiles += fileSize;
+    ScanStats::Extension &e = m_stats.perExtension[ext];
+    ++e.count;
+    if (viaTagLib) ++e.viaTagLib;
+    e.totalNs += ns;
+    ++e.histogram[bucketFor(ns)];
+
+    // Min-heap on ns keeps the N slowest without sorting every file.
+    auto faster = [](const ScanStats::SlowFile &a, const ScanStats::SlowFile &b) { return a.ns > b.ns; };
+    QVector<ScanStats::SlowFile> &heap = m_stats.slowest;
+    if (heap.size() < ScanStats::SlowestCount) {
+        heap.push_back({path, ns});
+        std::push_heap(heap.begin(), heap.end(), faster);
+    } else if (ns > heap.front().ns) {
+        std::pop_heap(heap.begin(), heap.end(), faster);
+        heap.back() = {path, ns};
+        std::push_heap(heap.begin(), heap.end(), faster);
+    }
+}
+
+void ScanStatsCollector::finish(ScanStats &stats)
+{
+    QMutexLocker lock(&m_mutex);
+    stats.filesParsed = m_stats.filesParsed;
+    stats.filesViaTagLib = m_stats.filesViaTagLib;
+    stats.parseNs = m_stats.parseNs;
+    stats.bytesInParsedFiles = m_stats.bytesInParsedFiles;
+    stats.perExtension = m_stats.perExtension;
+    stats.slowest = m_stats.slowest;
+    std::sort(stats.slowest.begin(), stats.slowest.end(),
+              [](const ScanStats::SlowFile &a, const ScanStats::SlowFile &b) { return a.ns > b.ns; });
+    m_stats = ScanStats();
+}
+
+qint64 MS::processBytesRead()
+{
+    QFile f(QStringLiteral("/proc/self/io"));
+    if (!f.open(QIODevice::ReadOnly)) return -1;
+    // Reading a procfs file adds to rchar itself, which is negligible here.
+    const QList<QByteArray> lines = f.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith("rchar:")) return line.mid(6).trimmed().toLongLong();
+    }
+    return -1;
+}
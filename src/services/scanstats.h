@@ -0,0 +1,83 @@
+/*
+ * ScanStats - throughput figures for one scanner run
+ */
+#ifndef MEDIASONIC_SERVICES_SCANSTATS_H
+#define MEDIASONIC_SERVICES_SCANSTATS_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QVector>
+#include <QMutex>
+#include <QMetaType>
+
+namespace MS {
+
+struct ScanStats
+{
+    // Parse latency buckets per extension: bucket b counts parses that took
+    // [2^b, 2^(b+1)) microseconds; the last bucket is open-ended.
+    static constexpr int HistogramBuckets = 24;
+    static constexpr int SlowestCount = 10;
+
+    struct Extension
+    {
+        int count = 0;
+        int viaTagLib = 0;
+        qint64 totalNs = 0;
+        QVector<int> histogram = QVector<int>(HistogramBuckets, 0);
+
+        // Upper bound of the bucket holding the given quantile, in microseconds.
+        qint64 quantileUs(double q) const;
+    };
+
+    struct SlowFile
+    {
+        QString path;
+        qint64 ns = 0;
+    };
+
+    quint64 job = 0;
+    QStringList roots;
+    int workers = 0;
+    int directories = 0;
+    int filesSeen = 0;      // audio files found by the walk
+    int filesParsed = 0;    // opened and parsed
+    int filesViaTagLib = 0; // of those, declined by the native reader
+    int filesUnchanged = 0; // skipped by fingerprint
+    int filesRemoved = 0;
+    int filesDuplicate = 0; // aliases of known files, or being parsed by another job
+    qint64 bytesInParsedFiles = 0;
+    qint64 bytesRead = -1;  // process read() volume during the scan; -1 if unknown
+    qint64 wallNs = 0;
+    qint64 walkNs = 0;      // walker stage busy enumerating and stat()ing
+    qint64 parseNs = 0;     // summed over all workers
+    QMap<QString, Extension> perExtension;
+    QVector<SlowFile> slowest; // slowest first
+
+    double filesPerSecond() const;
+    QString toString() const;
+};
+
+// Thread-safe accumulator the scanner's workers report into.
+class ScanStatsCollector
+{
+public:
+    void recordParse(const QString &path, qint64 ns, qint64 fileSize, bool viaTagLib);
+    // Moves the accumulated figures into stats.
+    void finish(ScanStats &stats);
+
+private:
+    QMutex m_mutex;
+    ScanStats m_stats;
+};
+
+// Bytes the process has read via read()-style calls so far, or -1 where
+// /proc/self/io is unavailable.
+qint64 processBytesRead();
+
+}
+
+Q_DECLARE_METATYPE(MS::ScanStats)
+
+#endif // MEDIASONIC_SERVICES_SCANSTATS_H
@@ -0,0 +1,1326 @@
+#include "services/tagreader.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+#include <QVector>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_TAGLIB
+#include <taglib/fileref.h>
+#include <taglib/tag.h>
+#include <taglib/audioproperties.h>
+#include <taglib/tpropertymap.h>
+#include <taglib/taglib.h>
+#if TAGLIB_MAJOR_VERSION >= 2
+#include <taglib/tvariant.h>
+#endif
+#endif
+
+using namespace MS;
+
+namespace {
+
+// Largest text field or tag item read into memory; bigger ones are skipped
+// (usually embedded pictures) or make the reader decline if they matter.
+constexpr qint64 kMaxFieldBytes = 64 * 1024;
+// How far past the ID3v2 tag to look for the first MPEG frame.
+constexpr qint64 kMpegSyncWindow = 64 * 1024;
+// Tail read to find the last Ogg page and trailing ID3v1/APE tags.
+constexpr qint64 kOggTailBytes = 64 * 1024;
+constexpr int kMaxOggPages = 1024;
+
+inline quint32 be16(const uchar *p) { return (quint32(p[0]) << 8) | p[1]; }
+inline quint32 be24(const uchar *p) { return (quint32(p[0]) << 16) | (quint32(p[1]) << 8) | p[2]; }
+inline quint32 be32(const uchar *p) { return (quint32(p[0]) << 24) | be24(p + 1); }
+inline quint64 be64(const uchar *p) { return (quint64(be32(p)) << 32) | be32(p + 4); }
+inline quint32 le16(const uchar *p) { return quint32(p[0]) | (quint32(p[1]) << 8); }
+inline quint32 le32(const uchar *p) { return le16(p) | (quint32(le16(p + 2)) << 16); }
+inline quint64 le64(const uchar *p) { return quint64(le32(p)) | (quint64(le32(p + 4)) << 32); }
+inline const uchar *bytes(const QByteArray &b) { return reinterpret_cast<const uchar *>(b.constData()); }
+
+// Leading integer like TagLib's String::toInt(): "3/12" -> 3, "2004-05-01" -> 2004.
+int leadingInt(const QString &s)
+{
+    int i = 0;
+    while (i < s.size() && s.at(i).isSpace()) ++i;
+    int value = 0;
+    bool any = false;
+    for (; i < s.size() && s.at(i).isDigit() && value < 100000000; ++i) {
+        value = value * 10 + s.at(i).digitValue();
+        any = true;
+    }
+    return any ? value : 0;
+}
+
+// Read-only file accessed by absolute offset; no shared file position, so
+// nothing is read that the parsers did not ask for.
+class Source
+{
+public:
+    explicit Source(const QString &path)
+    {
+#ifdef Q_OS_UNIX
+        m_fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+        if (m_fd < 0) return;
+        struct ::stat st;
+        if (::fstat(m_fd, &st) != 0) return;
+        m_size = qint64(st.st_size);
+#if defined(POSIX_FADV_RANDOM)
+        // Kernel readahead would fetch the audio data we are trying to avoid.
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+#else
+        m_file.setFileName(path);
+        if (m_file.open(QIODevice::ReadOnly)) m_size = m_file.size();
+#endif
+    }
+
+    ~Source()
+    {
+#ifdef Q_OS_UNIX
+        if (m_fd >= 0) ::close(m_fd);
+#endif
+    }
+
+    bool isOpen() const { return m_size >= 0; }
+    qint64 size() const { return m_size; }
+
+    // Short (or empty) at end of file or on error.
+    QByteArray read(qint64 offset, qint64 length) const
+    {
+        if (offset < 0 || length <= 0 || offset >= m_size) return QByteArray();
+        length = qMin(length, m_size - offset);
+        QByteArray out(int(length), Qt::Uninitialized);
+        return readInto(offset, out.data(), length) ? out : QByteArray();
+    }
+
+    bool readInto(qint64 offset, char *out, qint64 length) const
+    {
+        if (offset < 0 || offset + length > m_size) return false;
+#ifdef Q_OS_UNIX
+        while (length > 0) {
+            const ssize_t n = ::pread(m_fd, out, size_t(length), off_t(offset));
+            if (n <= 0) return false;
+            out += n;
+            offset += n;
+            length -= n;
+        }
+        return true;
+#else
+        return m_file.seek(offset) && m_file.read(out, length) == length;
+#endif
+    }
+
+private:
+#ifdef Q_OS_UNIX
+    int m_fd = -1;
+#else
+    mutable QFile m_file;
+#endif
+    qint64 m_size = -1;
+};
+
+// Sequential access to a byte stream that may be scattered over the file.
+class Cursor
+{
+public:
+    virtual ~Cursor() = default;
+    virtual bool read(char *out, qint64 n) = 0;
+    virtual bool skip(qint64 n) = 0;
+
+    bool readU32LE(quint32 &v)
+    {
+        uchar b[4];
+        if (!read(reinterpret_cast<char *>(b), 4)) return false;
+        v = le32(b);
+        return true;
+    }
+};
+
+class RangeCursor : public Cursor
+{
+public:
+    RangeCursor(const Source &src, qint64 begin, qint64 end) : m_src(src), m_pos(begin), m_end(end) {}
+
+    bool read(char *out, qint64 n) override
+    {
+        if (n > m_end - m_pos || !m_src.readInto(m_pos, out, n)) return false;
+        m_pos += n;
+        return true;
+    }
+
+    bool skip(qint64 n) override
+    {
+        if (n > m_end - m_pos) return false;
+        m_pos += n;
+        return true;
+    }
+
+private:
+    const Source &m_src;
+    qint64 m_pos;
+    const qint64 m_end;
+};
+
+// Walks the packets of a single logical Ogg stream. Only page headers and the
+// bytes actually consumed are read, so a comment packet carrying a large
+// METADATA_BLOCK_PICTURE costs a few page headers rather than the picture.
+class OggPacketCursor : public Cursor
+{
+public:
+    explicit OggPacketCursor(const Source &src) : m_src(src) {}
+
+    quint32 serial() const { return m_serial; }
+
+    // Moves to the first byte of the next packet.
+    bool nextPacket()
+    {
+        while (m_curLen == 255)
+            if (!advance()) return false;
+        return advance();
+    }
+
+    bool read(char *out, qint64 n) override { return consume(out, n); }
+    bool skip(qint64 n) override { return consume(nullptr, n); }
+
+private:
+    bool loadPage()
+    {
+        if (++m_pages > kMaxOggPages) return false;
+        const QByteArray h = m_src.read(m_nextPage, 27);
+        if (h.size() < 27 || !h.startsWith("OggS") || h.at(4) != 0) return false;
+        const quint32 serial = le32(bytes(h) + 14);
+        // Multiplexed streams are left to TagLib.
+        if (m_pages > 1 && serial != m_serial) return false;
+        m_serial = serial;
+        const int segments = uchar(h.at(26));
+        m_lacing = m_src.read(m_nextPage + 27, segments);
+        if (m_lacing.size() != segments) return false;
+        m_segPos = m_nextPage + 27 + segments;
+        m_segLeft = 0;
+        qint64 body = 0;
+        for (char c : qAsConst(m_lacing)) body += uchar(c);
+        m_nextPage = m_segPos + body;
+        m_seg = -1;
+        return true;
+    }
+
+    bool advance()
+    {
+        m_segPos += m_segLeft;
+        if (m_seg + 1 >= m_lacing.size() && !loadPage()) return false;
+        if (m_lacing.isEmpty()) return false;
+        ++m_seg;
+        m_curLen = uchar(m_lacing.at(m_seg));
+        m_segLeft = m_curLen;
+        return true;
+    }
+
+    bool consume(char *out, qint64 n)
+    {
+        while (n > 0) {
+            if (m_segLeft == 0) {
+                if (m_curLen < 255 || !advance()) return false; // packet ended
+                continue;
+            }
+            const qint64 take = qMin<qint64>(n, m_segLeft);
+            if (out) {
+                if (!m_src.readInto(m_segPos, out, take)) return false;
+                out += take;
+            }
+            m_segPos += take;
+            m_segLeft -= int(take);
+            n -= take;
+        }
+        return true;
+    }
+
+    const Source &m_src;
+    qint64 m_nextPage = 0;
+    QByteArray m_lacing;
+    int m_seg = -1;
+    int m_curLen = -1;  // lacing value of the current segment; < 255 ends a packet
+    int m_segLeft = 0;
+    qint64 m_segPos = 0;
+    quint32 m_serial = 0;
+    int m_pages = 0;
+};
+
+// Trailing tags TagLib would merge into the result; the native reader
+// declines rather than reimplementing that merge (and the ID3v1 genre table).
+bool hasTrailingTags(const Source &src)
+{
+    const QByteArray tail = src.read(qMax<qint64>(0, src.size() - 160), 160);
+    if (tail.size() >= 128 && tail.mid(tail.size() - 128, 3) == "TAG") return true;
+    if (tail.size() >= 32 && tail.mid(tail.size() - 32, 8) == "APETAGEX") return true;
+    return tail.size() >= 160 && tail.startsWith("APETAGEX");
+}
+
+// ---- Vorbis comments (FLAC, Ogg Vorbis, Opus) ----
+
+bool readVorbisComment(Cursor &c, Track &t)
+{
+    quint32 vendorLen = 0, count = 0;
+    if (!c.readU32LE(vendorLen) || !c.skip(vendorLen) || !c.readU32LE(count)) return false;
+    QStringList titles, artists, albums, genres, composers;
+    QString date, trackNo, discNo;
+    for (quint32 i = 0; i < count; ++i) {
+        quint32 len = 0;
+        if (!c.readU32LE(len)) return false;
+        // Look at the key first so pictures can be skipped unread.
+        const qint64 head = qMin<qint64>(len, 32);
+        QByteArray field(int(head), Qt::Uninitialized);
+        if (!c.read(field.data(), head)) return false;
+        const int eq = field.indexOf('=');
+        const QByteArray key = eq > 0 ? field.left(eq).toUpper() : QByteArray();
+        const bool wanted = key == "TITLE" || key == "ARTIST" || key == "ALBUM" || key == "GENRE"
+                         || key == "COMPOSER" || key == "DATE" || key == "TRACKNUMBER" || key == "DISCNUMBER";
+        if (!wanted) {
+            if (!c.skip(len - head)) return false;
+            continue;
+        }
+        if (len > kMaxFieldBytes) return false;
+        field.resize(int(len));
+        if (!c.read(field.data() + head, len - head)) return false;
+        const QString value = QString::fromUtf8(field.constData() + eq + 1, field.size() - eq - 1);
+        if (key == "TITLE") titles << value;
+        else if (key == "ARTIST") artists << value;
+        else if (key == "ALBUM") albums << value;
+        else if (key == "GENRE") genres << value;
+        else if (key == "COMPOSER") composers << value;
+        else if (key == "DATE" && date.isEmpty()) date = value;
+        else if (key == "TRACKNUMBER" && trackNo.isEmpty()) trackNo = value;
+        else if (key == "DISCNUMBER" && discNo.isEmpty()) discNo = value;
+    }
+    // Multiple values are joined the way TagLib's XiphComment does.
+    const QString sep = QStringLiteral(" ");
+    t.title = titles.join(sep);
+    t.artist = artists.join(sep);
+    t.album = albums.join(sep);
+    t.genre = genres.join(sep);
+    t.composer = composers.join(sep);
+    t.year = leadingInt(date);
+    t.trackNumber = leadingInt(trackNo);
+    t.discNumber = leadingInt(discNo);
+    return true;
+}
+
+// ---- FLAC ----
+
+bool readFlac(const Source &src, Track &t)
+{
+    const QByteArray magic = src.read(0, 4);
+    if (magic != "fLaC") return false; // includes FLAC behind an ID3v2 tag
+    qint64 pos = 4;
+    bool haveInfo = false, haveComment = false;
+    quint64 totalSamples = 0;
+    for (;;) {
+        const QByteArray h = src.read(pos, 4);
+        if (h.size() < 4) return false;
+        const int type = uchar(h.at(0)) & 0x7F;
+        const bool last = uchar(h.at(0)) & 0x80;
+        const qint64 len = be24(bytes(h) + 1);
+        const qint64 body = pos + 4;
+        if (type == 127) return false;
+        if (type == 0 && !haveInfo) {
+            const QByteArray si = src.read(body, 34);
+            if (si.size() < 34 || len < 34) return false;
+            const uchar *p = bytes(si);
+            t.sampleRate = int((quint32(p[10]) << 12) | (quint32(p[11]) << 4) | (p[12] >> 4));
+            totalSamples = (quint64(p[13] & 0x0F) << 32) | be32(p + 14);
+            haveInfo = true;
+        } else if (type == 4 && !haveComment) {
+            RangeCursor c(src, body, body + len);
+            if (!readVorbisComment(c, t)) return false;
+            haveComment = true;
+        }
+        pos = body + len;
+        if (last) break;
+    }
+    if (!haveInfo || t.sampleRate <= 0 || hasTrailingTags(src)) return false;
+    t.durationMs = qint64(totalSamples * 1000 / quint64(t.sampleRate));
+    if (t.durationMs > 0) t.bitrateKbps = int((src.size() - pos) * 8 / t.durationMs);
+    return true;
+}
+
+// ---- Ogg Vorbis / Opus ----
+
+// Granule position of the stream's last page, -1 if none is found.
+qint64 lastGranule(const Source &src, quint32 serial)
+{
+    const qint64 tailStart = qMax<qint64>(0, src.size() - kOggTailBytes);
+    const QByteArray tail = src.read(tailStart, src.size() - tailStart);
+    for (int i = tail.lastIndexOf("OggS"); i >= 0; i = i > 0 ? tail.lastIndexOf("OggS", i - 1) : -1) {
+        if (i + 27 > tail.size()) continue;
+        const uchar *p = bytes(tail) + i;
+        if (le32(p + 14) != serial) continue;
+        const qint64 g = qint64(le64(p + 6));
+        if (g >= 0) return g;
+    }
+    return -1;
+}
+
+bool readOgg(const Source &src, Track &t)
+{
+    OggPacketCursor c(src);
+    if (!c.nextPacket()) return false;
+    char id[30];
+    bool opus = false;
+    quint32 preSkip = 0;
+    if (!c.read(id, 8)) return false;
+    if (std::memcmp(id, "OpusHead", 8) == 0) {
+        if (!c.read(id + 8, 11)) return false;
+        const uchar *p = reinterpret_cast<const uchar *>(id);
+        preSkip = le16(p + 10);
+        t.sampleRate = 48000; // Opus always decodes at 48 kHz
+        opus = true;
+    } else if (std::memcmp(id, "\x01vorbis", 7) == 0) {
+        if (!c.read(id + 8, 22)) return false;
+        const uchar *p = reinterpret_cast<const uchar *>(id);
+        t.sampleRate = int(le32(p + 12));
+        t.bitrateKbps = int(le32(p + 20)) / 1000; // nominal, refined below
+    } else {
+        return false; // Ogg FLAC, Speex, ... are left to TagLib
+    }
+    if (t.sampleRate <= 0 || !c.nextPacket()) return false;
+
+    char tagId[8];
+    if (opus) {
+        if (!c.read(tagId, 8) || std::memcmp(tagId, "OpusTags", 8) != 0) return false;
+    } else {
+        if (!c.read(tagId, 7) || std::memcmp(tagId, "\x03vorbis", 7) != 0) return false;
+    }
+    if (!readVorbisComment(c, t)) return false;
+
+    // The granule position of the last page gives the length in samples.
+    const qint64 granule = lastGranule(src, c.serial());
+    if (granule < 0) return false;
+    const qint64 samples = opus ? qMax<qint64>(0, granule - preSkip) : granule;
+    t.durationMs = samples * 1000 / t.sampleRate;
+    if (t.durationMs > 0) t.bitrateKbps = int(src.size() * 8 / t.durationMs);
+    return true;
+}
+
+// ---- MP3 ----
+
+enum class Id3Field { None, Title, Artist, Album, Genre, Composer, Year, TrackNo, DiscNo, Count };
+
+Id3Field id3Field(const QByteArray &id)
+{
+    if (id == "TIT2" || id == "TT2") return Id3Field::Title;
+    if (id == "TPE1" || id == "TP1") return Id3Field::Artist;
+    if (id == "TALB" || id == "TAL") return Id3Field::Album;
+    if (id == "TCON" || id == "TCO") return Id3Field::Genre;
+    if (id == "TCOM" || id == "TCM") return Id3Field::Composer;
+    if (id == "TDRC" || id == "TYER" || id == "TYE") return Id3Field::Year;
+    if (id == "TRCK" || id == "TRK") return Id3Field::TrackNo;
+    if (id == "TPOS" || id == "TPA") return Id3Field::DiscNo;
+    return Id3Field::None;
+}
+
+QString decodeUtf16(const uchar *p, int units, bool &littleEndian)
+{
+    if (units > 0 && ((p[0] == 0xFF && p[1] == 0xFE) || (p[0] == 0xFE && p[1] == 0xFF))) {
+        littleEndian = p[0] == 0xFF;
+        p += 2;
+        --units;
+    }
+    QVector<ushort> u(units);
+    for (int i = 0; i < units; ++i) u[i] = ushort(littleEndian ? le16(p + 2 * i) : be16(p + 2 * i));
+    return QString::fromUtf16(u.constData(), units);
+}
+
+// Text frame payload -> its NUL-separated values.
+QStringList decodeId3Text(const QByteArray &payload)
+{
+    QStringList values;
+    if (payload.isEmpty()) return values;
+    const int encoding = uchar(payload.at(0));
+    const uchar *p = bytes(payload) + 1;
+    const int n = payload.size() - 1;
+    if (encoding == 1 || encoding == 2) {
+        bool littleEndian = encoding == 1; // BOM-less UTF-16 is almost always LE
+        int start = 0;
+        for (int i = 0; i + 1 < n; i += 2) {
+            if (p[i] == 0 && p[i + 1] == 0) {
+                values << decodeUtf16(p + start, (i - start) / 2, littleEndian);
+                start = i + 2;
+            }
+        }
+        if (start + 1 < n) values << decodeUtf16(p + start, (n - start) / 2, littleEndian);
+    } else {
+        const char *s = reinterpret_cast<const char *>(p);
+        int start = 0;
+        for (int i = 0; i <= n; ++i) {
+            if (i == n || s[i] == 0) {
+                values << (encoding == 3 ? QString::fromUtf8(s + start, i - start)
+                                         : QString::fromLatin1(s + start, i - start));
+                start = i + 1;
+            }
+        }
+    }
+    while (!values.isEmpty() && values.last().isEmpty()) values.removeLast();
+    return values;
+}
+
+bool syncsafe(const uchar *p, qint64 &out)
+{
+    if ((p[0] | p[1] | p[2] | p[3]) & 0x80) return false;
+    out = (qint64(p[0]) << 21) | (qint64(p[1]) << 14) | (qint64(p[2]) << 7) | p[3];
+    return true;
+}
+
+// Reads the leading ID3v2 tag, if any; audioStart is set past it.
+bool readId3v2(const Source &src, Track &t, qint64 &audioStart)
+{
+    audioStart = 0;
+    const QByteArray hb = src.read(0, 10);
+    if (hb.size() < 10 || !hb.startsWith("ID3")) return true;
+    const uchar *h = bytes(hb);
+    const int major = h[3];
+    const int flags = h[5];
+    qint64 tagSize = 0;
+    // Whole-tag unsynchronisation (and v2.2 compression) are TagLib's job.
+    if (major < 2 || major > 4 || (flags & 0x80) || !syncsafe(h + 6, tagSize)) return false;
+    const qint64 end = 10 + tagSize;
+    audioStart = end + ((major == 4 && (flags & 0x10)) ? 10 : 0);
+
+    qint64 pos = 10;
+    if (major >= 3 && (flags & 0x40)) {
+        const QByteArray ext = src.read(pos, 4);
+        if (ext.size() < 4) return false;
+        qint64 extSize = 0;
+        if (major == 3) extSize = be32(bytes(ext)) + 4;
+        else if (!syncsafe(bytes(ext), extSize)) return false;
+        pos += extSize;
+    }
+
+    const int headerLen = major == 2 ? 6 : 10;
+    const int idLen = major == 2 ? 3 : 4;
+    QStringList values[int(Id3Field::Count)];
+    while (pos + headerLen <= end) {
+        const QByteArray fb = src.read(pos, headerLen);
+        if (fb.size() < headerLen || fb.at(0) == 0) break; // padding
+        const uchar *f = bytes(fb);
+        qint64 size = 0;
+        int frameFlags = 0;
+        if (major == 2) {
+            size = be24(f + 3);
+        } else if (major == 3) {
+            size = be32(f + 4);
+            frameFlags = int(be16(f + 8));
+        } else {
+            if (!syncsafe(f + 4, size)) return false; // non-syncsafe v2.4 sizes need TagLib's heuristics
+            frameFlags = int(be16(f + 8));
+        }
+        if (pos + headerLen + size > end) return false;
+        const Id3Field field = id3Field(fb.left(idLen));
+        if (field != Id3Field::None && size > 0) {
+            // v2.3: compression, encryption, grouping; v2.4: grouping, compression,
+            // encryption, unsynchronisation, data length indicator.
+            const int unusual = major == 3 ? 0x00E0 : major == 4 ? 0x004F : 0;
+            if ((frameFlags & unusual) || size > kMaxFieldBytes) return false;
+            values[int(field)] = decodeId3Text(src.read(pos + headerLen, size));
+        }
+        pos += headerLen + size;
+    }
+
+    const QString sep = QStringLiteral(" ");
+    for (const QString &g : qAsConst(values[int(Id3Field::Genre)])) {
+        // Numeric and "(n)" genres refer to the ID3v1 table.
+        bool numeric = false;
+        g.toInt(&numeric);
+        if (numeric || g.startsWith(QLatin1Char('('))) return false;
+    }
+    t.title = values[int(Id3Field::Title)].join(sep);
+    t.artist = values[int(Id3Field::Artist)].join(sep);
+    t.album = values[int(Id3Field::Album)].join(sep);
+    t.genre = values[int(Id3Field::Genre)].join(sep);
+    t.composer = values[int(Id3Field::Composer)].join(sep);
+    t.year = leadingInt(values[int(Id3Field::Year)].value(0));
+    t.trackNumber = leadingInt(values[int(Id3Field::TrackNo)].value(0));
+    t.discNumber = leadingInt(values[int(Id3Field::DiscNo)].value(0));
+    return true;
+}
+
+struct MpegHeader
+{
+    int version = 0;  // 1, 2, or 25 for MPEG 2.5
+    int layer = 0;
+    int bitrateKbps = 0;
+    int sampleRate = 0;
+    bool mono = false;
+    int frameLength = 0;
+    int samplesPerFrame = 0;
+
+    bool parse(const uchar *p)
+    {
+        if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0) return false;
+        const int v = (p[1] >> 3) & 3;
+        const int l = (p[1] >> 1) & 3;
+        const int br = p[2] >> 4;
+        const int sr = (p[2] >> 2) & 3;
+        if (v == 1 || l == 0 || br == 0 || br == 15 || sr == 3) return false;
+        version = v == 3 ? 1 : v == 2 ? 2 : 25;
+        layer = 4 - l;
+        static const int kBitrates[2][3][15] = {
+            { { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+              { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+              { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 } },
+            { { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+              { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+              { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } }
+        };
+        static const int kRates[3] = { 44100, 48000, 32000 };
+        bitrateKbps = kBitrates[version == 1 ? 0 : 1][layer - 1][br];
+        sampleRate = kRates[sr] / (version == 1 ? 1 : version == 2 ? 2 : 4);
+        mono = (p[3] >> 6) == 3;
+        const int padding = (p[2] >> 1) & 1;
+        if (layer == 1) {
+            samplesPerFrame = 384;
+            frameLength = (12 * bitrateKbps * 1000 / sampleRate + padding) * 4;
+        } else {
+            samplesPerFrame = (layer == 3 && version != 1) ? 576 : 1152;
+            frameLength = samplesPerFrame / 8 * bitrateKbps * 1000 / sampleRate + padding;
+        }
+        return frameLength > 4;
+    }
+};
+
+// The first MPEG frame of a stream and what its Xing/Info/LAME or VBRI
+// header says about the rest.
+struct MpegStream
+{
+    MpegHeader header;
+    qint64 firstFrame = 0;  // file offset
+    qint64 frames = 0;      // 0 without a Xing or VBRI header
+    qint64 streamBytes = 0;
+    bool lame = false;      // delay and padding are known
+    qint64 delay = 0;       // encoder delay and padding, in samples
+    qint64 padding = 0;
+};
+
+bool readMpegStream(const Source &src, qint64 audioStart, MpegStream &s)
+{
+    // First frame header that is followed by another valid one.
+    const QByteArray win = src.read(audioStart, kMpegSyncWindow);
+    const uchar *w = bytes(win);
+    MpegHeader &hdr = s.header;
+    int at = -1;
+    for (int i = 0; i + 4 <= win.size(); ++i) {
+        if (w[i] != 0xFF || !hdr.parse(w + i)) continue;
+        MpegHeader next;
+        const int j = i + hdr.frameLength;
+        if (j + 4 <= win.size() && (!next.parse(w + j) || next.sampleRate != hdr.sampleRate)) continue;
+        at = i;
+        break;
+    }
+    if (at < 0) return false;
+    s.firstFrame = audioStart + at;
+
+    const int sideInfo = hdr.version == 1 ? (hdr.mono ? 17 : 32) : (hdr.mono ? 9 : 17);
+    const int xing = at + 4 + sideInfo;
+    const int vbri = at + 4 + 32;
+    if (xing + 8 <= win.size() && (std::memcmp(w + xing, "Xing", 4) == 0 || std::memcmp(w + xing, "Info", 4) == 0)) {
+        const quint32 xflags = be32(w + xing + 4);
+        int p = xing + 8;
+        if ((xflags & 1) && p + 4 <= win.size()) { s.frames = be32(w + p); p += 4; }
+        if ((xflags & 2) && p + 4 <= win.size()) { s.streamBytes = be32(w + p); p += 4; }
+        if (xflags & 4) p += 100;
+        if (xflags & 8) p += 4;
+        // LAME extension: encoder delay and padding, 12 bits each
+        if (p + 24 <= win.size() && (std::memcmp(w + p, "LAME", 4) == 0 || std::memcmp(w + p, "Lavc", 4) == 0
+                                     || std::memcmp(w + p, "Lavf", 4) == 0)) {
+            s.delay = (qint64(w[p + 21]) << 4) | (w[p + 22] >> 4);
+            s.padding = (qint64(w[p + 22] & 0x0F) << 8) | w[p + 23];
+            s.lame = true;
+        }
+    } else if (vbri + 18 <= win.size() && std::memcmp(w + vbri, "VBRI", 4) == 0) {
+        s.streamBytes = be32(w + vbri + 10);
+        s.frames = be32(w + vbri + 14);
+    }
+    return true;
+}
+
+bool readMp3(const Source &src, Track &t)
+{
+    qint64 audioStart = 0;
+    if (!readId3v2(src, t, audioStart) || hasTrailingTags(src)) return false;
+    MpegStream s;
+    if (!readMpegStream(src, audioStart, s)) return false;
+    const MpegHeader &hdr = s.header;
+    t.sampleRate = hdr.sampleRate;
+
+    if (s.frames > 0) {
+        const qint64 samples = qMax<qint64>(0, s.frames * hdr.samplesPerFrame - s.delay - s.padding);
+        t.durationMs = samples * 1000 / hdr.sampleRate;
+        const qint64 streamBytes = s.streamBytes > 0 ? s.streamBytes : src.size() - s.firstFrame;
+        if (t.durationMs > 0) t.bitrateKbps = int(streamBytes * 8 / t.durationMs);
+    } else {
+        // Constant bitrate: length follows from the stream size.
+        t.bitrateKbps = hdr.bitrateKbps;
+        t.durationMs = (src.size() - s.firstFrame) * 8 / hdr.bitrateKbps;
+    }
+    return true;
+}
+
+// ---- MP4 / M4A ----
+
+struct Atom
+{
+    qint64 offset = 0;  // of the header
+    qint64 body = 0;    // first byte after the header
+    qint64 end = 0;
+    QByteArray type;
+};
+
+bool readAtom(const Source &src, qint64 offset, qint64 limit, Atom &a)
+{
+    if (offset + 8 > limit) return false;
+    const QByteArray h = src.read(offset, 16);
+    if (h.size() < 8) return false;
+    qint64 size = be32(bytes(h));
+    qint64 header = 8;
+    if (size == 1) {
+        if (h.size() < 16) return false;
+        size = qint64(be64(bytes(h) + 8));
+        header = 16;
+    } else if (size == 0) {
+        size = limit - offset;
+    }
+    if (size < header || offset + size > limit) return false;
+    a.offset = offset;
+    a.body = offset + header;
+    a.end = offset + size;
+    a.type = h.mid(4, 4);
+    return true;
+}
+
+bool findChild(const Source &src, const Atom &parent, qint64 from, const char *type, Atom &out)
+{
+    for (qint64 pos = from; readAtom(src, pos, parent.end, out); pos = out.end)
+        if (out.type == type) return true;
+    return false;
+}
+
+// Average bitrate from an esds DecoderConfigDescriptor, in bit/s.
+quint32 esdsAverageBitrate(const QByteArray &esds)
+{
+    const uchar *p = bytes(esds);
+    const int n = esds.size();
+    int i = 4; // version/flags
+    auto descriptor = [&](int tag) -> bool {
+        if (i >= n || p[i] != tag) return false;
+        ++i;
+        for (int k = 0; k < 4 && i < n; ++k)
+            if (!(p[i++] & 0x80)) break;
+        return true;
+    };
+    if (!descriptor(0x03) || i + 3 > n) return 0;
+    const int esFlags = p[i + 2];
+    i += 3;
+    if (esFlags & 0x80) i += 2;
+    if ((esFlags & 0x40) && i < n) i += 1 + p[i];
+    if (esFlags & 0x20) i += 2;
+    if (!descriptor(0x04) || i + 13 > n) return 0;
+    return be32(p + i + 9);
+}
+
+// The first audio track and its media atom.
+bool findSoundTrak(const Source &src, const Atom &moov, Atom &trak, Atom &mdia)
+{
+    for (qint64 pos = moov.body; findChild(src, moov, pos, "trak", trak); pos = trak.end) {
+        Atom hdlr;
+        if (findChild(src, trak, trak.body, "mdia", mdia) && findChild(src, mdia, mdia.body, "hdlr", hdlr)
+            && src.read(hdlr.body + 8, 4) == "soun")
+            return true;
+    }
+    return false;
+}
+
+bool readMp4Audio(const Source &src, const Atom &moov, Track &t)
+{
+    Atom trak, mdia;
+    if (!findSoundTrak(src, moov, trak, mdia)) return false;
+    Atom mdhd, minf, stbl, stsd;
+    if (!findChild(src, mdia, mdia.body, "mdhd", mdhd)) return false;
+    const QByteArray md = src.read(mdhd.body, 32);
+    if (md.size() < 24) return false;
+    qint64 timescale = 0, duration = 0;
+    if (md.at(0) == 1) {
+        if (md.size() < 32) return false;
+        timescale = be32(bytes(md) + 20);
+        duration = qint64(be64(bytes(md) + 24));
+    } else {
+        timescale = be32(bytes(md) + 12);
+        duration = be32(bytes(md) + 16);
+    }
+    if (timescale <= 0) return false;
+    t.durationMs = duration * 1000 / timescale;
+
+    if (!findChild(src, mdia, mdia.body, "minf", minf) || !findChild(src, minf, minf.body, "stbl", stbl)
+        || !findChild(src, stbl, stbl.body, "stsd", stsd))
+        return false;
+    Atom entry;
+    if (!readAtom(src, stsd.body + 8, stsd.end, entry)) return false;
+    const QByteArray se = src.read(entry.body, 28);
+    if (se.size() < 28) return false;
+    t.sampleRate = int(be32(bytes(se) + 24) >> 16);
+    if (t.sampleRate <= 0) t.sampleRate = int(timescale);
+    // QuickTime sound description versions 1 and 2 carry extra fields.
+    const int version = int(be16(bytes(se) + 8));
+    const qint64 children = entry.body + (version == 1 ? 44 : version == 2 ? 64 : 28);
+
+    Atom child;
+    if (entry.type == "mp4a" && findChild(src, entry, children, "esds", child)) {
+        t.bitrateKbps = int((esdsAverageBitrate(src.read(child.body, qMin<qint64>(child.end - child.body, 256))) + 500) / 1000);
+    } else if (entry.type == "alac" && findChild(src, entry, children, "alac", child)) {
+        const QByteArray a = src.read(child.body, 28);
+        if (a.size() >= 28) {
+            t.bitrateKbps = int((be32(bytes(a) + 20) + 500) / 1000);
+            t.sampleRate = int(be32(bytes(a) + 24));
+        }
+    } else if (entry.type != "mp4a" && entry.type != "alac") {
+        return false;
+    }
+    return true;
+}
+
+bool readIlst(const Source &src, const Atom &ilst, Track &t)
+{
+    Atom item;
+    for (qint64 pos = ilst.body; readAtom(src, pos, ilst.end, item); pos = item.end) {
+        const QByteArray &k = item.type;
+        const bool text = k == "\xa9nam" || k == "\xa9" "ART" || k == "\xa9" "alb" || k == "\xa9gen" || k == "\xa9wrt"
+                       || k == "\xa9" "day";
+        const bool pair = k == "trkn" || k == "disk";
+        if (k == "gnre") return false; // ID3v1 genre index
+        if (!text && !pair) continue;   // covr and friends are never read
+        if (item.end - item.body > kMaxFieldBytes) return false;
+
+        QStringList values;
+        Atom data;
+        for (qint64 dpos = item.body; findChild(src, item, dpos, "data", data); dpos = data.end) {
+            const QByteArray d = src.read(data.body, data.end - data.body);
+            if (d.size() < 8) continue;
+            const quint32 cls = be32(bytes(d)) & 0xFFFFFF;
+            if (pair) {
+                if (d.size() >= 12) {
+                    const int n = int(be16(bytes(d) + 10));
+                    if (k == "trkn") t.trackNumber = n;
+                    else t.discNumber = n;
+                }
+                break;
+            }
+            if (cls == 1) values << QString::fromUtf8(d.constData() + 8, d.size() - 8);
+            else if (cls == 2) {
+                bool littleEndian = false;
+                values << decodeUtf16(bytes(d) + 8, (d.size() - 8) / 2, littleEndian);
+            }
+        }
+        if (!text) continue;
+        // TagLib's MP4::Tag joins multiple values with ", ".
+        const QString v = values.join(QStringLiteral(", "));
+        if (k == "\xa9nam") t.title = v;
+        else if (k == "\xa9" "ART") t.artist = v;
+        else if (k == "\xa9" "alb") t.album = v;
+        else if (k == "\xa9gen") t.genre = v;
+        else if (k == "\xa9wrt") t.composer = v;
+        else t.year = leadingInt(v);
+    }
+    return true;
+}
+
+bool readMp4(const Source &src, Track &t)
+{
+    Atom root;
+    root.end = src.size();
+    Atom ftyp, moov;
+    if (!readAtom(src, 0, root.end, ftyp) || ftyp.type != "ftyp") return false;
+    if (!findChild(src, root, 0, "moov", moov) || !readMp4Audio(src, moov, t)) return false;
+
+    Atom udta, meta, ilst;
+    if (findChild(src, moov, moov.body, "udta", udta) && findChild(src, udta, udta.body, "meta", meta)) {
+        // meta is a full atom in MP4 but a plain container in QuickTime files.
+        const QByteArray peek = src.read(meta.body, 8);
+        const qint64 first = peek.mid(4, 4) == "hdlr" ? meta.body : meta.body + 4;
+        if (findChild(src, meta, first, "ilst", ilst) && !readIlst(src, ilst, t)) return false;
+    }
+    if (t.bitrateKbps <= 0 && t.durationMs > 0) {
+        Atom mdat;
+        if (findChild(src, root, 0, "mdat", mdat)) t.bitrateKbps = int((mdat.end - mdat.body) * 8 / t.durationMs);
+    }
+    return true;
+}
+
+// ---- Gapless playback ----
+
+// MP3 decoders add 529 samples of their own delay to the encoder's.
+constexpr qint64 kMp3DecoderDelay = 529;
+
+// Offset of the first byte after a leading ID3v2 tag; -1 if it is malformed.
+qint64 id3v2End(const Source &src)
+{
+    const QByteArray hb = src.read(0, 10);
+    if (hb.size() < 10 || !hb.startsWith("ID3")) return 0;
+    qint64 size = 0;
+    if (!syncsafe(bytes(hb) + 6, size)) return -1;
+    return 10 + size + ((uchar(hb.at(5)) & 0x10) ? 10 : 0);
+}
+
+bool gaplessMp3(const Source &src, GaplessInfo &g)
+{
+    const qint64 audioStart = id3v2End(src);
+    MpegStream s;
+    if (audioStart < 0 || !readMpegStream(src, audioStart, s)) return false;
+    g.sampleRate = s.header.sampleRate;
+    if (s.lame && s.frames > 0) {
+        g.delayFrames = s.delay + kMp3DecoderDelay;
+        g.validFrames = qMax<qint64>(0, s.frames * s.header.samplesPerFrame - s.delay - s.padding);
+    }
+    return true;
+}
+
+// iTunSMPB: " 00000000 <delay> <padding> <valid samples> ..." in hex.
+bool parseItunSmpb(const QString &value, GaplessInfo &g)
+{
+    const QStringList f = value.simplified().split(QLatin1Char(' '));
+    if (f.size() < 4) return false;
+    bool delayOk = false, validOk = false;
+    const qint64 delay = f.at(1).toLongLong(&delayOk, 16);
+    const qint64 valid = f.at(3).toLongLong(&validOk, 16);
+    if (!delayOk || !validOk || valid <= 0) return false;
+    g.delayFrames = delay;
+    g.validFrames = valid;
+    return true;
+}
+
+bool gaplessMp4(const Source &src, GaplessInfo &g)
+{
+    Atom root;
+    root.end = src.size();
+    Atom ftyp, moov, trak, mdia, mdhd;
+    if (!readAtom(src, 0, root.end, ftyp) || ftyp.type != "ftyp" || !findChild(src, root, 0, "moov", moov)
+        || !findSoundTrak(src, moov, trak, mdia) || !findChild(src, mdia, mdia.body, "mdhd", mdhd))
+        return false;
+    const QByteArray md = src.read(mdhd.body, 24);
+    if (md.size() < 24) return false;
+    // AAC tracks count time in samples, so the media timescale is the rate.
+    const qint64 mediaScale = be32(bytes(md) + (md.at(0) == 1 ? 20 : 12));
+    if (mediaScale <= 0) return false;
+    g.sampleRate = int(mediaScale);
+
+    // iTunes writes the counts as a freeform tag.
+    Atom udta, meta, ilst, item;
+    if (findChild(src, moov, moov.body, "udta", udta) && findChild(src, udta, udta.body, "meta", meta)) {
+        const QByteArray peek = src.read(meta.body, 8);
+        const qint64 first = peek.mid(4, 4) == "hdlr" ? meta.body : meta.body + 4;
+        if (findChild(src, meta, first, "ilst", ilst)) {
+            for (qint64 pos = ilst.body; findChild(src, ilst, pos, "----", item); pos = item.end) {
+                Atom name, data;
+                if (!findChild(src, item, item.body, "name", name)
+                    || src.read(name.body + 4, name.end - name.body - 4) != "iTunSMPB")
+                    continue;
+                if (findChild(src, item, item.body, "data", data) && data.end - data.body <= 256
+                    && parseItunSmpb(QString::fromLatin1(src.read(data.body + 8, data.end - data.body - 8)), g))
+                    return true;
+            }
+        }
+    }
+
+    // Otherwise a single edit that skips the priming samples and lasts as
+    // long as the music.
+    Atom edts, elst, mvhd;
+    if (!findChild(src, trak, trak.body, "edts", edts) || !findChild(src, edts, edts.body, "elst", elst)
+        || !findChild(src, moov, moov.body, "mvhd", mvhd))
+        return true;
+    const QByteArray mv = src.read(mvhd.body, 24);
+    const QByteArray el = src.read(elst.body, 28);
+    if (mv.size() < 24 || el.size() < 8) return true;
+    const qint64 movieScale = be32(bytes(mv) + (mv.at(0) == 1 ? 20 : 12));
+    const bool wide = el.at(0) == 1;
+    if (movieScale <= 0 || be32(bytes(el) + 4) != 1 || el.size() < (wide ? 28 : 20)) return true;
+    const uchar *e = bytes(el) + 8;
+    const qint64 segment = wide ? qint64(be64(e)) : qint64(be32(e));
+    const qint64 mediaTime = wide ? qint64(be64(e + 8)) : qint64(qint32(be32(e + 4)));
+    if (segment <= 0 || mediaTime < 0) return true; // an empty edit delays rather than trims
+    g.delayFrames = mediaTime;
+    g.validFrames = segment * mediaScale / movieScale;
+    return true;
+}
+
+bool gaplessOgg(const Source &src, GaplessInfo &g)
+{
+    OggPacketCursor c(src);
+    char id[16];
+    if (!c.nextPacket() || !c.read(id, 8)) return false;
+    const uchar *p = reinterpret_cast<const uchar *>(id);
+    if (std::memcmp(id, "OpusHead", 8) == 0) {
+        if (!c.read(id + 8, 4)) return false;
+        const qint64 preSkip = le16(p + 10);
+        const qint64 granule = lastGranule(src, c.serial());
+        g.sampleRate = 48000;
+        g.delayFrames = preSkip;
+        if (granule >= preSkip) g.validFrames = granule - preSkip;
+        return true;
+    }
+    if (std::memcmp(id, "\x01vorbis", 7) == 0) {
+        if (!c.read(id + 8, 8)) return false;
+        g.sampleRate = int(le32(p + 12));
+        return true; // Vorbis decodes sample exact
+    }
+    return false;
+}
+
+bool gaplessFlac(const Source &src, GaplessInfo &g)
+{
+    const QByteArray h = src.read(0, 4 + 4 + 34);
+    if (h.size() < 42 || !h.startsWith("fLaC") || (uchar(h.at(4)) & 0x7F) != 0) return false;
+    const uchar *p = bytes(h) + 8;
+    g.sampleRate = int((quint32(p[10]) << 12) | (quint32(p[11]) << 4) | (p[12] >> 4));
+    return true; // lossless: nothing to trim
+}
+
+// ---- Cold tags ----
+
+// Cold text fields (lyrics, long comments) are cut at this size.
+constexpr qint64 kMaxColdFieldBytes = 256 * 1024;
+// Enough of a picture block for its type, MIME type and dimensions unless
+// the description is unusually long.
+constexpr int kPictureHeadBytes = 4096;
+
+// APIC / FLAC picture types, named the way TagLib 2 names them.
+const char *const kPictureTypes[] = {
+    "Other", "File Icon", "Other File Icon", "Front Cover", "Back Cover", "Leaflet Page",
+    "Media", "Lead Artist", "Artist", "Conductor", "Band", "Composer", "Lyricist",
+    "Recording Location", "During Recording", "During Performance", "Movie Screen Capture",
+    "Coloured Fish", "Illustration", "Band Logo", "Publisher Logo"
+};
+
+// Keys that already live in Track.
+bool isHotKey(const QString &key)
+{
+    static const QStringList hot = {
+        QStringLiteral("TITLE"), QStringLiteral("ARTIST"), QStringLiteral("ALBUM"),
+        QStringLiteral("GENRE"), QStringLiteral("COMPOSER"), QStringLiteral("DATE"),
+        QStringLiteral("TRACKNUMBER"), QStringLiteral("DISCNUMBER")
+    };
+    return hot.contains(key);
+}
+
+// Leading decimal number: "-6.52 dB" -> -6.52.
+double leadingDouble(const QString &s)
+{
+    const QString t = s.trimmed();
+    int end = 0;
+    if (end < t.size() && (t.at(end) == QLatin1Char('-') || t.at(end) == QLatin1Char('+'))) ++end;
+    while (end < t.size() && (t.at(end).isDigit() || t.at(end) == QLatin1Char('.'))) ++end;
+    return t.left(end).toDouble();
+}
+
+void addColdProperty(ColdTags &tags, const QString &key, const QStringList &values)
+{
+    const QString k = key.toUpper();
+    if (values.isEmpty() || isHotKey(k)) return;
+    auto append = [&](QString &text) {
+        for (const QString &v : values) {
+            if (!text.isEmpty()) text += QLatin1Char('\n');
+            text += v;
+        }
+    };
+    if (k == QLatin1String("COMMENT") || k == QLatin1String("DESCRIPTION")) append(tags.comment);
+    else if (k == QLatin1String("LYRICS") || k == QLatin1String("UNSYNCEDLYRICS")) append(tags.lyrics);
+    else if (k == QLatin1String("REPLAYGAIN_TRACK_GAIN")) {
+        tags.hasTrackGain = true;
+        tags.trackGainDb = leadingDouble(values.front());
+    } else if (k == QLatin1String("REPLAYGAIN_TRACK_PEAK")) tags.trackPeak = leadingDouble(values.front());
+    else if (k == QLatin1String("REPLAYGAIN_ALBUM_GAIN")) {
+        tags.hasAlbumGain = true;
+        tags.albumGainDb = leadingDouble(values.front());
+    } else if (k == QLatin1String("REPLAYGAIN_ALBUM_PEAK")) tags.albumPeak = leadingDouble(values.front());
+    else if (k == QLatin1String("MUSICBRAINZ_TRACKID")) tags.musicBrainzTrackId = values.front();
+    else if (k == QLatin1String("MUSICBRAINZ_ALBUMID")) tags.musicBrainzAlbumId = values.front();
+    else if (k == QLatin1String("MUSICBRAINZ_ARTISTID")) tags.musicBrainzArtistId = values.front();
+    else tags.other[k] << values;
+}
+
+// The header of a FLAC PICTURE block (also the payload of an Ogg
+// METADATA_BLOCK_PICTURE comment); the image data itself is not needed.
+bool parsePictureHeader(const QByteArray &b, ColdTags::Picture &pic)
+{
+    const uchar *p = bytes(b);
+    qint64 pos = 0;
+    auto u32 = [&](quint32 &v) {
+        if (pos + 4 > b.size()) return false;
+        v = be32(p + pos);
+        pos += 4;
+        return true;
+    };
+    quint32 type = 0, mimeLen = 0, descLen = 0, width = 0, height = 0, depth = 0, colours = 0, dataLen = 0;
+    if (!u32(type) || !u32(mimeLen) || mimeLen > quint32(b.size() - pos)) return false;
+    pic.type = QLatin1String(type < sizeof(kPictureTypes) / sizeof(*kPictureTypes) ? kPictureTypes[type] : kPictureTypes[0]);
+    pic.mimeType = QString::fromLatin1(b.constData() + pos, int(mimeLen));
+    pos += mimeLen;
+    if (!u32(descLen) || descLen > quint32(b.size() - pos)) return true; // type and MIME type are known
+    pos += descLen;
+    if (!u32(width) || !u32(height) || !u32(depth) || !u32(colours) || !u32(dataLen)) return true;
+    pic.width = int(width);
+    pic.height = int(height);
+    pic.bytes = dataLen;
+    return true;
+}
+
+bool readColdVorbisComment(Cursor &c, ColdTags &tags)
+{
+    quint32 vendorLen = 0, count = 0;
+    if (!c.readU32LE(vendorLen) || !c.skip(vendorLen) || !c.readU32LE(count)) return false;
+    for (quint32 i = 0; i < count; ++i) {
+        quint32 len = 0;
+        if (!c.readU32LE(len)) return false;
+        const qint64 head = qMin<qint64>(len, 32);
+        QByteArray field(int(head), Qt::Uninitialized);
+        if (!c.read(field.data(), head)) return false;
+        const int eq = field.indexOf('=');
+        const QString key = eq > 0 ? QString::fromLatin1(field.left(eq)).toUpper() : QString();
+        qint64 keep = 0;
+        if (key == QLatin1String("METADATA_BLOCK_PICTURE"))
+            keep = qMin<qint64>(len, eq + 1 + (kPictureHeadBytes / 3) * 4);
+        else if (!key.isEmpty() && !isHotKey(key))
+            keep = qMin<qint64>(len, kMaxColdFieldBytes);
+        if (keep <= head) {
+            if (!c.skip(len - head)) return false;
+            if (keep == 0) continue;
+        } else {
+            field.resize(int(keep));
+            if (!c.read(field.data() + head, keep - head) || !c.skip(len - keep)) return false;
+        }
+        const QByteArray value = field.mid(eq + 1);
+        if (key == QLatin1String("METADATA_BLOCK_PICTURE")) {
+            ColdTags::Picture pic;
+            if (parsePictureHeader(QByteArray::fromBase64(value.left(value.size() & ~3)), pic)) tags.pictures << pic;
+        } else {
+            addColdProperty(tags, key, QStringList(QString::fromUtf8(value)));
+        }
+    }
+    return true;
+}
+
+bool readColdFlac(const Source &src, ColdTags &tags)
+{
+    if (src.read(0, 4) != "fLaC") return false;
+    qint64 pos = 4;
+    for (;;) {
+        const QByteArray h = src.read(pos, 4);
+        if (h.size() < 4) return false;
+        const int type = uchar(h.at(0)) & 0x7F;
+        const bool last = uchar(h.at(0)) & 0x80;
+        const qint64 len = be24(bytes(h) + 1);
+        const qint64 body = pos + 4;
+        if (type == 127) return false;
+        if (type == 4) {
+            RangeCursor c(src, body, body + len);
+            if (!readColdVorbisComment(c, tags)) return false;
+        } else if (type == 6) {
+            ColdTags::Picture pic;
+            if (parsePictureHeader(src.read(body, qMin<qint64>(len, kPictureHeadBytes)), pic)) tags.pictures << pic;
+        }
+        pos = body + len;
+        if (last) break;
+    }
+    return !hasTrailingTags(src);
+}
+
+bool readColdOgg(const Source &src, ColdTags &tags)
+{
+    OggPacketCursor c(src);
+    char id[8];
+    if (!c.nextPacket() || !c.read(id, 8)) return false;
+    const bool opus = std::memcmp(id, "OpusHead", 8) == 0;
+    if (!opus && std::memcmp(id, "\x01vorbis", 7) != 0) return false;
+    if (!c.nextPacket()) return false;
+    if (opus) {
+        if (!c.read(id, 8) || std::memcmp(id, "OpusTags", 8) != 0) return false;
+    } else {
+        if (!c.read(id, 7) || std::memcmp(id, "\x03vorbis", 7) != 0) return false;
+    }
+    return readColdVorbisComment(c, tags);
+}
+
+bool readColdTagLib(const QString &filePath, ColdTags &tags)
+{
+#ifdef HAVE_TAGLIB
+    try {
+        TagLib::FileRef f(QFile::encodeName(filePath).constData());
+        if (f.isNull() || !f.file()) return false;
+        auto text = [](const TagLib::String &s) { return QString::fromUtf8(s.toCString(true)); };
+        const TagLib::PropertyMap props = f.file()->properties();
+        for (auto it = props.begin(); it != props.end(); ++it) {
+            QStringList values;
+            for (const TagLib::String &v : it->second) values << text(v);
+            addColdProperty(tags, text(it->first), values);
+        }
+#if TAGLIB_MAJOR_VERSION >= 2
+        // TagLib 1.x has no format-independent picture API; pictures are
+        // only listed for FLAC and Ogg there, by the native reader.
+        for (const TagLib::VariantMap &p : f.file()->complexProperties("PICTURE")) {
+            ColdTags::Picture pic;
+            pic.type = text(p.value("pictureType").toString());
+            pic.mimeType = text(p.value("mimeType").toString());
+            pic.bytes = p.value("data").toByteVector().size();
+            tags.pictures << pic;
+        }
+#endif
+        return true;
+    } catch (...) {
+        return false;
+    }
+#else
+    Q_UNUSED(filePath)
+    Q_UNUSED(tags)
+    return false;
+#endif
+}
+
+}
+
+Track TagReader::read(const QString &filePath, Backend backend, bool *usedTagLib)
+{
+    Track t;
+    bool ok = false;
+    bool tagLib = false;
+    if (backend != TagLibOnly) ok = readNative(filePath, t);
+    if (!ok && backend != NativeOnly) {
+        t = Track();
+        ok = readTagLib(filePath, t);
+        tagLib = true;
+    }
+    if (usedTagLib) *usedTagLib = tagLib;
+    t.localPath = filePath;
+    if (t.title.isEmpty()) t.title = QFileInfo(filePath).completeBaseName();
+    return t;
+}
+
+bool TagReader::readNative(const QString &filePath, Track &track)
+{
+    const int dot = filePath.lastIndexOf(QLatin1Char('.'));
+    const QString ext = dot < 0 ? QString() : filePath.mid(dot + 1).toLower();
+    const Source src(filePath);
+    if (!src.isOpen()) return false;
+    Track t;
+    bool ok = false;
+    if (ext == QLatin1String("mp3")) ok = readMp3(src, t);
+    else if (ext == QLatin1String("flac")) ok = readFlac(src, t);
+    else if (ext == QLatin1String("m4a")) ok = readMp4(src, t);
+    else if (ext == QLatin1String("ogg") || ext == QLatin1String("opus")) ok = readOgg(src, t);
+    if (ok) track = t;
+    return ok;
+}
+
+bool TagReader::hasTagLib()
+{
+#ifdef HAVE_TAGLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool TagReader::readTagLib(const QString &filePath, Track &t)
+{
+#ifdef HAVE_TAGLIB
+    try {
+        TagLib::FileRef f(QFile::encodeName(filePath).constData());
+        if (f.isNull()) return false;
+        if (f.tag()) {
+            t.title = QString::fromUtf8(f.tag()->title().toCString(true));
+            t.artist = QString::fromUtf8(f.tag()->artist().toCString(true));
+            t.album = QString::fromUtf8(f.tag()->album().toCString(true));
+            t.genre = QString::fromUtf8(f.tag()->genre().toCString(true));
+            t.year = int(f.tag()->year());
+            t.trackNumber = int(f.tag()->track());
+            const TagLib::PropertyMap props = f.file()->properties();
+            const auto disc = props.find("DISCNUMBER");
+            if (disc != props.end() && !disc->second.isEmpty()) t.discNumber = disc->second.front().toInt();
+            const auto composer = props.find("COMPOSER");
+            if (composer != props.end()) t.composer = QString::fromUtf8(composer->second.toString(" ").toCString(true));
+        }
+        if (f.audioProperties()) {
+            t.durationMs = qint64(f.audioProperties()->length()) * 1000;
+            t.bitrateKbps = f.audioProperties()->bitrate();
+            t.sampleRate = f.audioProperties()->sampleRate();
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+#else
+    Q_UNUSED(filePath)
+    Q_UNUSED(t)
+    return false;
+#endif
+}
+
+bool TagReader::readGapless(const QString &filePath, GaplessInfo &info)
+{
+    const int dot = filePath.lastIndexOf(QLatin1Char('.'));
+    const QString ext = dot < 0 ? QString() : filePath.mid(dot + 1).toLower();
+    const Source src(filePath);
+    if (!src.isOpen()) return false;
+    GaplessInfo g;
+    bool ok = false;
+    if (ext == QLatin1String("mp3")) ok = gaplessMp3(src, g);
+    else if (ext == QLatin1String("m4a")) ok = gaplessMp4(src, g);
+    else if (ext == QLatin1String("ogg") || ext == QLatin1String("opus")) ok = gaplessOgg(src, g);
+    else if (ext == QLatin1String("flac")) ok = gaplessFlac(src, g);
+    if (ok) info = g;
+    return ok;
+}
+
+bool TagReader::readColdTags(const QString &filePath, ColdTags &tags)
+{
+    const int dot = filePath.lastIndexOf(QLatin1Char('.'));
+    const QString ext = dot < 0 ? QString() : filePath.mid(dot + 1).toLower();
+    const Source src(filePath);
+    ColdTags t;
+    bool ok = false;
+    if (src.isOpen()) {
+        if (ext == QLatin1String("flac")) ok = readColdFlac(src, t);
+        else if (ext == QLatin1String("ogg") || ext == QLatin1String("opus")) ok = readColdOgg(src, t);
+    }
+    if (!ok) {
+        t = ColdTags();
+        ok = readColdTagLib(filePath, t);
+    }
+    if (ok) tags = t;
+    return ok;
+}
+
+QStringList TagReader::differences(const Track &native, const Track &taglib)
+{
+    QStringList out;
+    auto text = [&](const char *name, const QString &a, const QString &b) {
+        if (a != b) out << QStringLiteral("%1: \"%2\" | \"%3\"").arg(QLatin1String(name), a, b);
+    };
+    auto number = [&](const char *name, qint64 a, qint64 b, qint64 tolerance) {
+        if (qAbs(a - b) > tolerance) out << QStringLiteral("%1: %2 | %3").arg(QLatin1String(name)).arg(a).arg(b);
+    };
+    text("title", native.title, taglib.title);
+    text("artist", native.artist, taglib.artist);
+    text("album", native.album, taglib.album);
+    text("genre", native.genre, taglib.genre);
+    text("composer", native.composer, taglib.composer);
+    number("year", native.year, taglib.year, 0);
+    number("track", native.trackNumber, taglib.trackNumber, 0);
+    number("disc", native.discNumber, taglib.discNumber, 0);
+    number("sampleRate", native.sampleRate, taglib.sampleRate, 0);
+    // TagLib truncates to whole seconds and does not remove encoder delay.
+    number("durationMs", native.durationMs, taglib.durationMs, 1999);
+    number("bitrateKbps", native.bitrateKbps, taglib.bitrateKbps, qMax(2, taglib.bitrateKbps / 20));
+    return out;
+}
@@ -0,0 +1,71 @@
+/*
+ * TagReader - fills MS::Track from an audio file
+ *
+ * The native path fetches only the regions that hold tags and stream headers
+ * with pread(): ID3v2 plus the Xing/Info/LAME or VBRI frame for MP3,
+ * STREAMINFO and VORBIS_COMMENT for FLAC, moov/udta/ilst for MP4, and the
+ * identification and comment packets for Ogg Vorbis/Opus. Cover art, seek
+ * tables and audio data are skipped without being read. Anything unusual
+ * (ID3v1/APE tags, unsynchronised or compressed frames, numeric genres,
+ * multiplexed streams, ...) makes the native reader decline, and the file is
+ * handed to TagLib instead.
+ */
+#ifndef MEDIASONIC_SERVICES_TAGREADER_H
+#define MEDIASONIC_SERVICES_TAGREADER_H
+
+#include <QString>
+#include <QStringList>
+#include "models/track.h"
+
+namespace MS {
+
+// Where the music starts and ends in a decoded lossy stream. Encoders put
+// delay before the first sample and pad the last frame; both have to go for
+// the tracks of a live album to join without a click.
+struct GaplessInfo
+{
+    int sampleRate = 0;      // of the stream; 0 if unknown
+    qint64 delayFrames = 0;  // decoded frames to drop at the start
+    qint64 validFrames = -1; // frames to play after them; -1 plays to the end
+};
+
+class TagReader
+{
+public:
+    enum Backend {
+        Auto,       // native fast path, TagLib when it declines
+        NativeOnly,
+        TagLibOnly
+    };
+
+    // Never fails: on unreadable files only url and a title derived from the
+    // file name are set. usedTagLib reports which path produced the result.
+    static Track read(const QString &filePath, Backend backend = Auto, bool *usedTagLib = nullptr);
+
+    // Both return false when they could not read the file; track is then untouched.
+    static bool readNative(const QString &filePath, Track &track);
+    static bool readTagLib(const QString &filePath, Track &track);
+    static bool hasTagLib();
+
+    // The tags Track leaves out, read when a track is inspected. FLAC and Ogg
+    // comments and picture headers are read natively (never the image data);
+    // other formats, and files the native reader declines, go to TagLib.
+    // Returns false, leaving tags untouched, if neither could read the file.
+    static bool readColdTags(const QString &filePath, ColdTags &tags);
+
+    // Sample rate, encoder delay and length of the stream: LAME header for
+    // MP3, iTunSMPB or the edit list for MP4, pre-skip and the last granule
+    // for Opus. FLAC and Vorbis only report their rate. False if the format
+    // is not one of those or the headers are unreadable.
+    static bool readGapless(const QString &filePath, GaplessInfo &info);
+
+    // Field-by-field differences between a native and a TagLib result, as
+    // "field: native | taglib" lines. Duration and bitrate are compared with
+    // a tolerance, because TagLib rounds to whole seconds and estimates
+    // bitrates differently per format.
+    static QStringList differences(const Track &native, const Track &taglib);
+};
+
+}
+
+#endif // MEDIASONIC_SERVICES_TAGREADER_H
@@ -0,0 +1,140 @@
+/*
+ * mediasonic-dspbench - times the engine's processing per block
+ *
+ * Usage: mediasonic-dspbench [--blocks N] [--rate Hz] [--bands N]
+ *
+ * Every stage is run over blocks of 1024 stereo frames of noise, as the sink
+ * hands them out, and its cost is printed in nanoseconds per block together
+ * with how many times faster than real time that is. The equalizer has every
+ * band in use; the limiter is fed noise that peaks well above its ceiling, so
+ * that it works throughout; the crossfade is mixed the way the feeder mixes
+ * it. "chain" is equalizer and limiter back to back, as the sink runs them.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QVector>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include "audio/dspchain.h"
+#include "audio/dspkernels.h"
+
+using namespace MS;
+
+namespace {
+
+constexpr int kBlockFrames = 1024;
+// Distinct blocks of input, cycled through so that the caches see a stream.
+constexpr int kSourceBlocks = 64;
+// As in the engine's feeder.
+constexpr int kFadeSegment = 256;
+constexpr double kHalfPi = 1.57079632679489661923;
+
+QVector<float> noise(float amplitude)
+{
+    QVector<float> v(2 * kBlockFrames * kSourceBlocks);
+    QRandomGenerator random(1);
+    for (float &s : v) s = float((random.generateDouble() * 2.0 - 1.0) * amplitude);
+    return v;
+}
+
+// Nanoseconds per block of process, over blocks blocks after a warm-up;
+// process gets the block and which of the source blocks it is a copy of.
+double timeBlocks(const QVector<float> &source, int blocks, const std::function<void(float *, int)> &process)
+{
+    QVector<float> work(2 * kBlockFrames);
+    QElapsedTimer timer;
+    qint64 total = 0;
+    const int warmUp = blocks / 10;
+    for (int i = 0; i < warmUp + blocks; ++i) {
+        const int at = i % kSourceBlocks;
+        std::memcpy(work.data(), source.constData() + 2 * kBlockFrames * at, sizeof(float) * 2 * kBlockFrames);
+        timer.start();
+        process(work.data(), at);
+        if (i >= warmUp) total += timer.nsecsElapsed();
+    }
+    return double(total) / blocks;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("mediasonic-dspbench"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Time the audio engine's DSP stages per 1024-frame block."));
+    parser.addHelpOption();
+    QCommandLineOption blocksOpt(QStringLiteral("blocks"), QStringLiteral("Blocks timed per stage."),
+                                 QStringLiteral("N"), QStringLiteral("20000"));
+    QCommandLineOption rateOpt(QStringLiteral("rate"), QStringLiteral("Sample rate the stages are prepared for."),
+                               QStringLiteral("Hz"), QStringLiteral("44100"));
+    QCommandLineOption bandsOpt(QStringLiteral("bands"), QStringLiteral("Equalizer bands in use (1-10)."),
+                                QStringLiteral("N"), QStringLiteral("10"));
+    parser.addOption(blocksOpt);
+    parser.addOption(rateOpt);
+    parser.addOption(bandsOpt);
+    parser.process(app);
+
+    const int blocks = qMax(1, parser.value(blocksOpt).toInt());
+    const int rate = qBound(8000, parser.value(rateOpt).toInt(), 384000);
+    const int bands = qBound(1, parser.value(bandsOpt).toInt(), int(ParametricEq::kMaxBands));
+    QTextStream out(stdout);
+    out << "mediasonic-dspbench: " << DspKernels::instructionSet() << ", " << rate << " Hz, " << blocks
+        << " blocks of " << kBlockFrames << " frames\n";
+
+    const float gains[ParametricEq::kMaxBands] = { 4, 3, 2, 1, -1, -2, 1, 2, 3, 4 };
+    ParametricEq::Settings settings = ParametricEq::graphic(gains, -2.0f);
+    settings.bandCount = bands;
+    ParametricEq eq;
+    eq.prepare(rate);
+    eq.setSettings(settings);
+    Limiter limiter;
+    limiter.prepare(rate);
+
+    const QVector<float> quiet = noise(0.25f);
+    const QVector<float> loud = noise(1.5f);
+    const QVector<float> fading = noise(0.25f);
+    const qint64 fadeFrames = qint64(kSourceBlocks) * kBlockFrames;
+
+    struct Row
+    {
+        QString name;
+        double ns;
+    };
+    QVector<Row> rows;
+    rows << Row{ QStringLiteral("equalizer (%1 bands)").arg(bands),
+                 timeBlocks(quiet, blocks, [&](float *frames, int) { eq.process(frames, kBlockFrames); }) };
+    rows << Row{ QStringLiteral("crossfade"), timeBlocks(quiet, blocks, [&](float *frames, int block) {
+        // Equal power, exact at segment ends and linear in between
+        const float *under = fading.constData() + 2 * kBlockFrames * block;
+        for (int done = 0; done < kBlockFrames; done += kFadeSegment) {
+            const qint64 from = qint64(block) * kBlockFrames + done;
+            const double p0 = kHalfPi * from / fadeFrames;
+            const double p1 = kHalfPi * (from + kFadeSegment) / fadeFrames;
+            DspKernels::crossfade(frames + 2 * done, under + 2 * done, kFadeSegment, float(std::sin(p0)),
+                                  float((std::sin(p1) - std::sin(p0)) / kFadeSegment), float(std::cos(p0)),
+                                  float((std::cos(p1) - std::cos(p0)) / kFadeSegment));
+        }
+    }) };
+    rows << Row{ QStringLiteral("limiter"),
+                 timeBlocks(loud, blocks, [&](float *frames, int) { limiter.process(frames, kBlockFrames); }) };
+    rows << Row{ QStringLiteral("chain (equalizer, limiter)"), timeBlocks(loud, blocks, [&](float *frames, int) {
+        eq.process(frames, kBlockFrames);
+        limiter.process(frames, kBlockFrames);
+    }) };
+
+    const double blockNs = 1e9 * kBlockFrames / rate;
+    for (const Row &row : rows) {
+        out << QStringLiteral("  %1 %2 ns/block  %3x real time\n")
+                   .arg(row.name, -28)
+                   .arg(row.ns, 10, 'f', 1)
+                   .arg(blockNs / qMax(1.0, row.ns), 8, 'f', 0);
+    }
+    return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * mediasonic-scanbench - runs MS::Scanner headless and prints scan statistics
+ *
+ * Usage: mediasonic-scanbench [--workers N] [--walkers N] [--unordered] [--repeat N]
+ *                             [--backend auto|native|taglib] [--search text]... <path>...
+ *        mediasonic-scanbench --compare <path>...
+ *        mediasonic-scanbench --check-walker
+ *
+ * The first pass is a cold scan; with --repeat every further pass reuses the
+ * fingerprint cache and so measures the incremental re-verify. --compare reads
+ * every file with both the native tag reader and TagLib and lists the fields
+ * where they disagree; the exit status is 1 if any file differs. After the last
+ * pass the tracks of the first are loaded into a TrackStore and its memory per
+ * track is printed; every --search is then timed against a SearchIndex built
+ * over that store. --check-walker walks a small tree it builds in a temporary
+ * directory, reached through a symlinked root, and exits with 1 unless the
+ * walker found exactly the files outside its symlinked subdirectory.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMap>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtConcurrent>
+#include "models/searchindex.h"
+#include "models/trackstore.h"
+#include "services/dirwalker.h"
+#include "services/scanner.h"
+#include "services/scanstats.h"
+#include "services/tagreader.h"
+
+using namespace MS;
+
+namespace {
+
+struct Comparison
+{
+    QString path;
+    bool native = false;
+    bool taglib = false;
+    QStringList differences;
+};
+
+Comparison compareFile(const QString &path)
+{
+    Comparison c;
+    c.path = path;
+    Track native, taglib;
+    c.native = TagReader::readNative(path, native);
+    c.taglib = TagReader::readTagLib(path, taglib);
+    if (c.native && c.taglib) c.differences = TagReader::differences(native, taglib);
+    return c;
+}
+
+int compareReaders(const QStringList &paths, QTextStream &out)
+{
+    if (!TagReader::hasTagLib()) {
+        out << "mediasonic-scanbench: built without TagLib, nothing to compare against\n";
+        return 2;
+    }
+    QStringList files;
+    for (const QString &p : paths) {
+        if (QFileInfo(p).isFile()) {
+            files << p;
+            continue;
+        }
+        QDirIterator it(p, Scanner::audioNameFilters(), QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) files << it.next();
+    }
+    const QList<Comparison> results = QtConcurrent::blockingMapped<QList<Comparison>>(files, compareFile);
+
+    int declined = 0, unreadable = 0, differing = 0;
+    QMap<QString, int> perField;
+    for (const Comparison &c : results) {
+        if (!c.native) ++declined;
+        if (!c.taglib) ++unreadable;
+        if (c.differences.isEmpty()) continue;
+        ++differing;
+        out << c.path << "\n";
+        for (const QString &d : c.differences) {
+            out << "    " << d << "\n";
+            ++perField[d.section(QLatin1Char(':'), 0, 0)];
+        }
+    }
+    out << files.size() << " files: " << declined << " declined by the native reader, " << unreadable
+        << " unreadable by TagLib, " << differing << " differing\n";
+    for (auto it = perField.constBegin(); it != perField.constEnd(); ++it)
+        out << "  " << it.key() << ": " << it.value() << "\n";
+    out.flush();
+    return differing ? 1 : 0;
+}
+
+// real/a.mp3, real/disc/b.flac and real/linked -> elsewhere/c.mp3, walked
+// through root -> real: the root is followed, the subdirectory is not.
+int checkWalker(QTextStream &out)
+{
+    QTemporaryDir temp;
+    const QDir dir(temp.path());
+    bool built = temp.isValid() && dir.mkpath(QStringLiteral("real/disc")) && dir.mkpath(QStringLiteral("elsewhere"));
+    for (const QString &name : { QStringLiteral("real/a.mp3"), QStringLiteral("real/disc/b.flac"),
+                                 QStringLiteral("elsewhere/c.mp3") }) {
+        QFile f(dir.filePath(name));
+        built = built && f.open(QIODevice::WriteOnly);
+    }
+    built = built && QFile::link(dir.filePath(QStringLiteral("elsewhere")), dir.filePath(QStringLiteral("real/linked")))
+            && QFile::link(dir.filePath(QStringLiteral("real")), dir.filePath(QStringLiteral("root")));
+    if (!built) {
+        out << "mediasonic-scanbench: could not build the test tree in " << temp.path() << "\n";
+        return 2;
+    }
+
+    QMutex mutex;
+    QStringList found;
+    DirWalker walker;
+    const DirWalker::Result result = walker.walk(dir.filePath(QStringLiteral("root")), [&](int, const QString &path) {
+        QMutexLocker lock(&mutex);
+        found << QDir(dir.filePath(QStringLiteral("root"))).relativeFilePath(path);
+    });
+    found.sort();
+    const QStringList expected = { QStringLiteral("a.mp3"), QStringLiteral("disc/b.flac") };
+    const bool ok = result.complete && found == expected;
+    out << "Walker through a symlinked root: " << (result.complete ? "complete" : "incomplete") << ", found "
+        << (found.isEmpty() ? QStringLiteral("nothing") : found.join(QStringLiteral(", "))) << " - "
+        << (ok ? "ok" : "FAILED") << "\n";
+    out.flush();
+    return ok ? 0 : 1;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("mediasonic-scanbench"));
+    qRegisterMetaType<QVector<MS::Track>>("QVector<MS::Track>");
+    qRegisterMetaType<MS::ScanStats>("MS::ScanStats");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Scan directories with the MediaSonic scanner and report throughput."));
+    parser.addHelpOption();
+    QCommandLineOption workersOpt(QStringLiteral("workers"), QStringLiteral("Tag-parse workers (0 = one per core)."),
+                                  QStringLiteral("N"), QStringLiteral("0"));
+    QCommandLineOption walkersOpt(QStringLiteral("walkers"), QStringLiteral("Directory enumeration threads (0 = default)."),
+                                  QStringLiteral("N"), QStringLiteral("0"));
+    QCommandLineOption unorderedOpt(QStringLiteral("unordered"), QStringLiteral("Deliver tracks in completion order."));
+    QCommandLineOption repeatOpt(QStringLiteral("repeat"), QStringLiteral("Number of passes over the same paths."),
+                                 QStringLiteral("N"), QStringLiteral("1"));
+    QCommandLineOption backendOpt(QStringLiteral("backend"), QStringLiteral("Tag reader: auto, native or taglib."),
+                                  QStringLiteral("name"), QStringLiteral("auto"));
+    QCommandLineOption compareOpt(QStringLiteral("compare"),
+                                  QStringLiteral("Compare the native tag reader against TagLib instead of scanning."));
+    parser.addOption(workersOpt);
+    parser.addOption(walkersOpt);
+    parser.addOption(unorderedOpt);
+    parser.addOption(repeatOpt);
+    parser.addOption(backendOpt);
+    QCommandLineOption checkWalkerOpt(QStringLiteral("check-walker"),
+                                      QStringLiteral("Check the directory walker on a symlinked root and exit."));
+    parser.addOption(checkWalkerOpt);
+    QCommandLineOption searchOpt(QStringLiteral("search"), QStringLiteral("Time a library search after the scan (repeatable)."),
+                                 QStringLiteral("text"));
+    parser.addOption(compareOpt);
+    parser.addOption(searchOpt);
+    parser.addPositionalArgument(QStringLiteral("path"), QStringLiteral("Directories to scan."), QStringLiteral("<path>..."));
+    parser.process(app);
+
+    QTextStream out(stdout);
+    if (parser.isSet(checkWalkerOpt)) return checkWalker(out);
+    const QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty()) parser.showHelp(1);
+    if (parser.isSet(compareOpt)) return compareReaders(paths, out);
+
+    const int passes = qMax(1, parser.value(repeatOpt).toInt());
+    const QString backend = parser.value(backendOpt);
+    if (backend != QLatin1String("auto") && backend != QLatin1String("native") && backend != QLatin1String("taglib")) {
+        out << "mediasonic-scanbench: unknown backend " << backend << "\n";
+        return 2;
+    }
+
+    Scanner scanner;
+    scanner.setWorkerCount(parser.value(workersOpt).toInt());
+    scanner.setWalkerThreadCount(parser.value(walkersOpt).toInt());
+    scanner.setOrderedOutput(!parser.isSet(unorderedOpt));
+    scanner.setTagBackend(backend == QLatin1String("native") ? TagReader::NativeOnly
+                          : backend == QLatin1String("taglib") ? TagReader::TagLibOnly : TagReader::Auto);
+
+    int pass = 0;
+    int tracks = 0;
+    TrackStore store;
+    QObject::connect(&scanner, &Scanner::tracksDiscovered, &app, [&](const QVector<Track> &batch) {
+        tracks += batch.size();
+        if (pass == 0)
+            for (const Track &t : batch) store.append(t);
+    });
+    QObject::connect(&scanner, &Scanner::tracksModified, &app, [&](const QVector<Track> &batch) { tracks += batch.size(); });
+    QObject::connect(&scanner, &Scanner::statsReady, &app, [&](const ScanStats &stats) {
+        out << "Pass " << pass + 1 << "/" << passes << " - " << tracks << " tracks delivered\n"
+            << stats.toString();
+        out.flush();
+    });
+    // Everything is delivered to the main thread in emission order, so the
+    // next pass only starts once the previous one has been reported.
+    QObject::connect(&scanner, &Scanner::finished, &app, [&]() {
+        tracks = 0;
+        if (++pass < passes) {
+            scanner.scanPaths(paths);
+            return;
+        }
+        out << "Track store: " << store.memoryUsage().toString() << "\n";
+        const QStringList searches = parser.values(searchOpt);
+        if (!searches.isEmpty()) {
+            QElapsedTimer timer;
+            timer.start();
+            SearchIndex index;
+            if (!store.isEmpty()) index.addRows(store, 0, store.size() - 1);
+            out << "Search index: built in " << timer.elapsed() << " ms, "
+                << index.memoryBytes() / (1024 * 1024) << " MB\n";
+            for (const QString &text : searches) {
+                timer.restart();
+                const QBitArray hits = index.match(store, SearchIndex::parse(text));
+                out << "Search \"" << text << "\": " << hits.count(true) << " tracks in "
+                    << QString::number(timer.nsecsElapsed() / 1e6, 'f', 2) << " ms\n";
+            }
+        }
+        out.flush();
+        app.quit();
+    }, Qt::QueuedConnection);
+
+    scanner.scanPaths(paths);
+    return app.exec();
+}
@@ -9,6 +9,10 @@
 using namespace MS;
 
 namespace {
+// Mono samples the FFT runs over, and how many the tap may queue for it.
+constexpr int kTapFrames = 1024;
+constexpr int kTapRingSize = 8 * kTapFrames;
+
 template<typename T>
 inline float sampleToFloat(T v) { return 0.0f; }
 
@@ -24,16 +28,26 @@ inline float sampleToFloat<float>(float v) { return v; }
 
 VisualizerBridge::VisualizerBridge(MediaPlayer *player, QObject *parent)
     : QObject(parent)
+    , m_player(player)
+    , m_tapRing(kTapRingSize)
+    , m_tapBlock(kTapFrames)
 {
     if (player && player->backend()) {
         m_probeOk = m_probe.setSource(player->backend());
     }
+    if (player && player->audioEngine() && player->audioEngine()->addTap(this)) {
+        m_engine = player->audioEngine();
+        m_tapTimer = new QTimer(this);
+        connect(m_tapTimer, &QTimer::timeout, this, &VisualizerBridge::drainTap);
+        m_tapTimer->start(33);
+    }
     connect(&m_probe, &QAudioProbe::audioBufferProbed, this, &VisualizerBridge::processBuffer);
 
     if (!m_probeOk) {
         // Fallback animated levels to avoid blank visualizer on backends without probe support
         m_fallbackTimer = new QTimer(this);
         connect(m_fallbackTimer, &QTimer::timeout, this, [this]() {
+            if (m_engine && m_player && m_player->isGapless()) return; // the tap has real data
             QVector<float> bins(m_bins);
             static float phase = 0.0f; phase += 0.08f;
             for (int i = 0; i < m_bins; ++i) {
@@ -46,6 +60,44 @@ VisualizerBridge::VisualizerBridge(MediaPlayer *player, QObject *parent)
     }
 }
 
+VisualizerBridge::~VisualizerBridge()
+{
+    if (m_engine) m_engine->removeTap(this);
+}
+
+// Sink thread: mono into the ring, dropping what does not fit
+void VisualizerBridge::process(const float *frames, int count, int)
+{
+    int written = 0;
+    while (written < count) {
+        int n = 0;
+        float *span = m_tapRing.writeSpan(n);
+        n = qMin(n, count - written);
+        if (n == 0) return;
+        for (int i = 0; i < n; ++i, ++written)
+            span[i] = 0.5f * (frames[2 * written] + frames[2 * written + 1]);
+        m_tapRing.commitWrite(n);
+    }
+}
+
+void VisualizerBridge::drainTap()
+{
+    const int queued = m_tapRing.readable();
+    if (queued < kTapFrames) return;
+    // Only the newest block matters
+    m_tapRing.commitRead(queued - kTapFrames);
+    int n = 0;
+    for (int done = 0; done < kTapFrames; done += n) {
+        const float *span = m_tapRing.readSpan(n);
+        n = qMin(n, kTapFrames - done);
+        std::copy(span, span + n, m_tapBlock.begin() + done);
+        m_tapRing.commitRead(n);
+    }
+    QVector<float> bins(m_bins);
+    computeFFT(m_tapBlock.constData(), kTapFrames, bins);
+    emit levelsUpdated(bins);
+}
+
 void VisualizerBridge::processBuffer(const QAudioBuffer &buffer)
 {
     if (!buffer.isValid()) return;
@@ -1,5 +1,9 @@
 /*
  * VisualizerBridge - feeds audio probe data into visualizer bars for LCD
+ *
+ * QMediaPlayer's audio comes through a QAudioProbe. The gapless engine's
+ * comes through a PcmTap: the sink thread mixes it down to mono into a
+ * small ring, and a GUI timer runs the FFT over the newest block.
  */
 #ifndef MEDIASONIC_VISUALIZER_BRIDGE_H
 #define MEDIASONIC_VISUALIZER_BRIDGE_H
@@ -9,16 +13,20 @@
 #include <QAudioBuffer>
 #include <QVector>
 #include <QTimer>
+#include <QPointer>
+#include "audio/audioengine.h"
+#include "audio/spscring.h"
 
 class MediaPlayer;
 
 namespace MS {
 
-class VisualizerBridge : public QObject
+class VisualizerBridge : public QObject, private PcmTap
 {
     Q_OBJECT
 public:
     explicit VisualizerBridge(MediaPlayer *player, QObject *parent = nullptr);
+    ~VisualizerBridge() override;
 
 signals:
     void levelsUpdated(const QVector<float> &levels);
@@ -32,6 +40,14 @@ private:
     int m_bins = 32;
     void computeFFT(const float *samples, int count, QVector<float> &out);
     QTimer *m_fallbackTimer = nullptr;
+
+    void process(const float *frames, int count, int sampleRate) override;
+    void drainTap();
+    QPointer<MediaPlayer> m_player;
+    QPointer<AudioEngine> m_engine;
+    SpscRing<float> m_tapRing;
+    QVector<float> m_tapBlock;
+    QTimer *m_tapTimer = nullptr;
 };
 
 }